@@ -0,0 +1,272 @@
+// accept_pool.c — warm pre-forked instances for Accept=yes sockets
+//
+// A worker is a fresh coreinitd image (/proc/self/exe --accept-worker), spawned
+// like any service with its end of a SOCK_SEQPACKET pair as fd 3, sleeping in
+// recvmsg(). Dispatching a connection is one sendmsg(); the worker dup2()s it
+// into place and execs the service, so process creation and dynamic loading
+// are off the accept path. Being a small image rather than a fork() of the
+// daemon keeps its own exec cheap too.
+// Refilling happens a little later, so the fork() does not compete with the
+// worker that was just woken up.
+#define _GNU_SOURCE
+#include "accept_pool.h"
+#include "log.h"
+#include "spawn.h"
+#include "service_log.h"
+#include "cgroup.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <limits.h>
+
+#define REFILL_DELAY_USEC 5000
+
+typedef struct PoolWorker {
+    AcceptPool *pool;
+    int ctl_fd;
+    ServiceEntry *entry;
+} PoolWorker;
+
+struct AcceptPool {
+    Unit *service;
+    ExecCommand worker;     // coreinitd --accept-worker <service argv>, strings borrowed
+    unsigned min, max;
+    unsigned target;        // idle workers wanted, grows from min to max on misses
+    PoolWorker **idle;
+    size_t n_idle;
+    sd_event_source *refill_source;
+};
+
+int accept_pool_worker(char **argv) {
+    // Everything but the fd shuffle is done before we block
+    char pid[32];
+    snprintf(pid, sizeof(pid), "%d", (int)getpid());
+    if (setenv("LISTEN_PID", pid, 1) < 0 || setenv("LISTEN_FDS", "1", 1) < 0 ||
+        setenv("LISTEN_FDNAMES", "connection", 1) < 0)
+        return 1;
+
+    char dummy;
+    struct iovec iov = { &dummy, 1 };
+    union {
+        struct cmsghdr h;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct msghdr msg = {
+        .msg_iov = &iov, .msg_iovlen = 1,
+        .msg_control = control.buf, .msg_controllen = sizeof(control.buf),
+    };
+
+    ssize_t n;
+    do n = recvmsg(3, &msg, MSG_CMSG_CLOEXEC);
+    while (n < 0 && errno == EINTR);
+
+    struct cmsghdr *c = n > 0 ? CMSG_FIRSTHDR(&msg) : NULL;
+    if (!c || c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS)
+        return 0;   // pool shut down before we were needed
+
+    // conn is above 3 (0-2 are open, 3 is the control socket, which this replaces)
+    int conn;
+    memcpy(&conn, CMSG_DATA(c), sizeof(conn));
+    if (dup2(conn, STDIN_FILENO) < 0 || dup2(conn, STDOUT_FILENO) < 0 || dup2(conn, 3) < 0)
+        return 1;
+
+    execv(argv[0], argv);
+    log_error("[accept_pool] Failed to exec %s: %s", argv[0], strerror(errno));
+    return 127;
+}
+
+static void schedule_refill(AcceptPool *p) {
+    int enabled = SD_EVENT_OFF;
+    sd_event_source_get_enabled(p->refill_source, &enabled);
+    if (enabled == SD_EVENT_OFF &&
+        sd_event_source_set_time_relative(p->refill_source, REFILL_DELAY_USEC) >= 0)
+        sd_event_source_set_enabled(p->refill_source, SD_EVENT_ONESHOT);
+}
+
+static void worker_remove(AcceptPool *p, PoolWorker *w) {
+    for (size_t i = 0; i < p->n_idle; i++) {
+        if (p->idle[i] == w) {
+            p->idle[i] = p->idle[--p->n_idle];
+            break;
+        }
+    }
+}
+
+// An idle worker died (killed, OOM): forget it and top the pool back up
+static void on_idle_worker_exit(ServiceEntry *e, void *userdata) {
+    (void)e;
+    PoolWorker *w = userdata;
+    AcceptPool *p = w->pool;
+    worker_remove(p, w);
+    close(w->ctl_fd);
+    free(w);
+    schedule_refill(p);
+}
+
+static int worker_spawn(AcceptPool *p) {
+    PoolWorker **idle = realloc(p->idle, (p->n_idle + 1) * sizeof(*idle));
+    if (!idle) return -ENOMEM;
+    p->idle = idle;
+
+    PoolWorker *w = calloc(1, sizeof(*w));
+    if (!w) return -ENOMEM;
+
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0) {
+        free(w);
+        return -errno;
+    }
+
+    SpawnFds fds = { .fds = &sv[1], .n_fds = 1, .stdio_fd = -1, .output_fd = service_log_fd(p->service),
+                     .cgroup_fd = cgroup_unit_fd(p->service), .placement = p->service->placement };
+    pid_t pid;
+    int pidfd = -1;
+    int r = spawn_command_fds(&p->worker, &fds, &pid, &pidfd);
+    close(sv[1]);
+    if (r < 0) {
+        close(sv[0]);
+        free(w);
+        return r;
+    }
+
+    w->pool = p;
+    w->ctl_fd = sv[0];
+    w->entry = service_manager_adopt_instance(p->service, pid, pidfd, on_idle_worker_exit, w);
+    if (!w->entry) {
+        kill(pid, SIGKILL);     // the orphan reaper collects it
+        close(sv[0]);
+        free(w);
+        return -ENOMEM;
+    }
+    p->idle[p->n_idle++] = w;
+    return 0;
+}
+
+static int on_refill(sd_event_source *s, uint64_t usec, void *userdata) {
+    (void)s;
+    (void)usec;
+    AcceptPool *p = userdata;
+    // The next connection refills it, once the service is no longer stopping
+    if (service_manager_state(p->service) == SERVICE_STOPPING)
+        return 0;
+    while (p->n_idle < p->target) {
+        int r = worker_spawn(p);
+        if (r < 0) {
+            log_error("[accept_pool] Failed to pre-fork %s: %s", p->service->name, strerror(-r));
+            break;
+        }
+    }
+    return 0;
+}
+
+// Resolved once: /proc/self/exe itself would name the worker's parent
+static char self_exe[PATH_MAX];
+
+AcceptPool *accept_pool_new(sd_event *event, Unit *service, unsigned min, unsigned max) {
+    if (!self_exe[0]) {
+        ssize_t n = readlink("/proc/self/exe", self_exe, sizeof(self_exe) - 1);
+        if (n <= 0) {
+            log_error("[accept_pool] Cannot find our own binary: %s", strerror(errno));
+            return NULL;
+        }
+        self_exe[n] = '\0';
+    }
+
+    AcceptPool *p = calloc(1, sizeof(*p));
+    if (!p) return NULL;
+    p->service = service;
+    p->min = p->target = min;
+
+    size_t argc = 0;
+    while (service->exec.argv[argc]) argc++;
+    p->worker.argv = calloc(argc + 3, sizeof(char *));
+    if (!p->worker.argv) {
+        free(p);
+        return NULL;
+    }
+    p->worker.argv[0] = self_exe;
+    p->worker.argv[1] = ACCEPT_WORKER_ARG;
+    memcpy(p->worker.argv + 2, service->exec.argv, argc * sizeof(char *));
+    p->worker.envp = service->exec.envp;
+    p->max = max > min ? max : min;
+
+    // Fires right away the first time, to warm the pool at startup
+    int r = sd_event_add_time_relative(event, &p->refill_source, CLOCK_MONOTONIC, 0, 1, on_refill, p);
+    if (r < 0) {
+        log_error("[accept_pool] Failed to add refill source: %s", strerror(-r));
+        free(p->worker.argv);
+        free(p);
+        return NULL;
+    }
+    sd_event_source_set_priority(p->refill_source, SD_EVENT_PRIORITY_IDLE);
+    return p;
+}
+
+int accept_pool_dispatch(AcceptPool *p, int conn_fd, ServiceExitFn on_exit, void *userdata, ServiceEntry **ret) {
+    schedule_refill(p);
+
+    while (p->n_idle > 0) {
+        PoolWorker *w = p->idle[--p->n_idle];
+
+        char dummy = 0;
+        struct iovec iov = { &dummy, 1 };
+        union {
+            struct cmsghdr h;
+            char buf[CMSG_SPACE(sizeof(int))];
+        } control;
+        memset(&control, 0, sizeof(control));
+        struct msghdr msg = {
+            .msg_iov = &iov, .msg_iovlen = 1,
+            .msg_control = control.buf, .msg_controllen = sizeof(control.buf),
+        };
+        struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+        c->cmsg_level = SOL_SOCKET;
+        c->cmsg_type = SCM_RIGHTS;
+        c->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(c), &conn_fd, sizeof(int));
+
+        ssize_t n;
+        do n = sendmsg(w->ctl_fd, &msg, MSG_NOSIGNAL);
+        while (n < 0 && errno == EINTR);
+
+        ServiceEntry *e = w->entry;
+        close(w->ctl_fd);
+        free(w);
+        if (n < 0) {
+            // Worker is gone; its exit is still reported, but not to the pool
+            e->on_exit = NULL;
+            continue;
+        }
+
+        e->on_exit = on_exit;
+        e->userdata = userdata;
+        log_debug("[accept_pool] Started %s (PID %d, pre-forked)", e->name, e->pid);
+        *ret = e;
+        return 0;
+    }
+
+    // Ran dry: keep one more warm next time, up to max
+    if (p->target < p->max)
+        p->target++;
+    return -EAGAIN;
+}
+
+void accept_pool_free(AcceptPool *p) {
+    if (!p) return;
+    for (size_t i = 0; i < p->n_idle; i++) {
+        PoolWorker *w = p->idle[i];
+        w->entry->on_exit = NULL;
+        kill(w->entry->pid, SIGTERM);
+        close(w->ctl_fd);
+        free(w);
+    }
+    free(p->idle);
+    free(p->worker.argv);
+    sd_event_source_unref(p->refill_source);
+    free(p);
+}
@@ -0,0 +1,28 @@
+// accept_pool.h — warm pre-forked instances for Accept=yes sockets
+#ifndef COREINITD_ACCEPT_POOL_H
+#define COREINITD_ACCEPT_POOL_H
+
+#include <systemd/sd-event.h>
+#include "unit_loader.h"
+#include "service_manager.h"
+
+typedef struct AcceptPool AcceptPool;
+
+#define ACCEPT_WORKER_ARG "--accept-worker"
+
+// Keep min idle workers for service, growing towards max while connections
+// find the pool empty. Workers are spawned ahead of time and block until
+// handed a connection over SCM_RIGHTS, then exec the service.
+AcceptPool *accept_pool_new(sd_event *event, Unit *service, unsigned min, unsigned max);
+
+// Hand conn_fd to an idle worker, which becomes an instance reporting to
+// on_exit. -EAGAIN if no worker is warm; the caller spawns one cold.
+int accept_pool_dispatch(AcceptPool *p, int conn_fd, ServiceExitFn on_exit, void *userdata, ServiceEntry **ret);
+
+// Idle workers are terminated; dispatched ones keep running
+void accept_pool_free(AcceptPool *p);
+
+// main() of `coreinitd --accept-worker <argv...>`: wait on fd 3, exec argv
+int accept_pool_worker(char **argv);
+
+#endif
@@ -0,0 +1,312 @@
+// cgroup.c — a cgroup v2 directory per service
+//
+// Services live in <our cgroup>/system.slice/<unit name>. The directory is
+// created (with the unit's limits written) before the first spawn and the
+// spawner starts the child inside it, so even a service that forks right
+// away cannot leave a process behind: cgroup.kill takes down everything the
+// unit ever started in one write. We move ourselves into init.scope first,
+// since cgroup v2 only delegates controllers to children of a cgroup that
+// holds no processes itself.
+#define _GNU_SOURCE
+#include "cgroup.h"
+#include "log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+
+#ifndef CGROUP2_SUPER_MAGIC
+#define CGROUP2_SUPER_MAGIC 0x63677270
+#endif
+
+#define CGROUP_SLICE "system.slice"
+
+static const char *const mounts[] = { "/sys/fs/cgroup", "/sys/fs/cgroup/unified" };
+static const char *const controllers[] = { "cpu", "io", "memory", "pids" };
+enum { CTRL_CPU = 1, CTRL_IO = 2, CTRL_MEMORY = 4, CTRL_PIDS = 8 };
+
+static int slice_fd = -1;
+static unsigned enabled;        // CTRL_* delegated to the unit cgroups
+
+// Indexed by Unit.id; fd 0 is never a cgroup of ours, so 0 = not created
+static int *unit_fds = NULL;
+static const Unit **unit_of = NULL;
+static char *killed = NULL;     // cgroup.kill was written: replace the directory before reuse
+static size_t unit_cap = 0;
+
+static int write_at(int dir_fd, const char *file, const char *val) {
+    int fd = openat(dir_fd, file, O_WRONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -errno;
+    ssize_t n = write(fd, val, strlen(val));
+    int r = n < 0 ? -errno : 0;
+    close(fd);
+    return r;
+}
+
+// Enable what we want of dir's available controllers for its children; returns CTRL_*
+static unsigned delegate(int dir_fd, const char *path) {
+    char avail[256] = "";
+    int fd = openat(dir_fd, "cgroup.controllers", O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        ssize_t n = read(fd, avail, sizeof(avail) - 1);
+        avail[n > 0 ? n : 0] = '\0';
+        close(fd);
+    }
+
+    unsigned mask = 0;
+    for (size_t i = 0; i < sizeof(controllers) / sizeof(controllers[0]); i++) {
+        char word[16];
+        size_t len = strlen(controllers[i]);
+        int found = 0;
+        for (const char *p = avail; (p = strstr(p, controllers[i])); p += len)
+            if ((p == avail || p[-1] == ' ') && (p[len] == ' ' || p[len] == '\n' || p[len] == '\0'))
+                found = 1;
+        if (!found)
+            continue;
+        snprintf(word, sizeof(word), "+%s", controllers[i]);
+        int r = write_at(dir_fd, "cgroup.subtree_control", word);
+        if (r < 0)
+            log_warning("[cgroup] Cannot enable %s controller in %s: %s", controllers[i], path, strerror(-r));
+        else
+            mask |= 1u << i;
+    }
+    return mask;
+}
+
+// "/sys/fs/cgroup" + the 0:: line of /proc/self/cgroup
+static int own_cgroup(char *buf, size_t size, const char **ret_mount) {
+    const char *mount = NULL;
+    for (size_t i = 0; i < sizeof(mounts) / sizeof(mounts[0]) && !mount; i++) {
+        struct statfs fs;
+        if (statfs(mounts[i], &fs) == 0 && fs.f_type == CGROUP2_SUPER_MAGIC)
+            mount = mounts[i];
+    }
+    if (!mount)
+        return -ENOENT;
+
+    FILE *f = fopen("/proc/self/cgroup", "re");
+    if (!f)
+        return -errno;
+    char line[512];
+    int r = -ENOENT;
+    while (fgets(line, sizeof(line), f))
+        if (strncmp(line, "0::", 3) == 0) {
+            line[strcspn(line, "\n")] = '\0';
+            // The root shows as "/"; never end up with a trailing slash
+            snprintf(buf, size, "%s%s", mount, strcmp(line + 3, "/") == 0 ? "" : line + 3);
+            r = 0;
+            break;
+        }
+    fclose(f);
+    *ret_mount = mount;
+    return r;
+}
+
+int cgroup_start(void) {
+    char base[PATH_MAX], path[PATH_MAX + 32];
+    const char *mount = NULL;
+    int r = own_cgroup(base, sizeof(base), &mount);
+    if (r < 0) {
+        log_info("[cgroup] No cgroup v2 hierarchy, services run without resource control");
+        return -1;
+    }
+    int base_fd = open(base, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (base_fd < 0) {
+        log_warning("[cgroup] Cannot open %s: %s", base, strerror(errno));
+        return -1;
+    }
+
+    // Nothing may stay in base itself once it delegates (the root is exempt)
+    if (strcmp(base, mount) != 0) {
+        if (mkdirat(base_fd, "init.scope", 0755) < 0 && errno != EEXIST)
+            log_warning("[cgroup] Cannot create %s/init.scope: %s", base, strerror(errno));
+        else if ((r = write_at(base_fd, "init.scope/cgroup.procs", "0")) < 0)
+            log_warning("[cgroup] Cannot move into %s/init.scope: %s", base, strerror(-r));
+    }
+    unsigned mask = delegate(base_fd, base);
+
+    if (mkdirat(base_fd, CGROUP_SLICE, 0755) < 0 && errno != EEXIST) {
+        log_warning("[cgroup] Cannot create %s/" CGROUP_SLICE ": %s, services run without resource control",
+                    base, strerror(errno));
+        close(base_fd);
+        return -1;
+    }
+    slice_fd = openat(base_fd, CGROUP_SLICE, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    close(base_fd);
+    if (slice_fd < 0) {
+        log_warning("[cgroup] Cannot open %s/" CGROUP_SLICE ": %s", base, strerror(errno));
+        return -1;
+    }
+    snprintf(path, sizeof(path), "%s/" CGROUP_SLICE, base);
+    enabled = mask ? delegate(slice_fd, path) & mask : 0;
+
+    char names[64] = "";
+    for (size_t i = 0; i < sizeof(controllers) / sizeof(controllers[0]); i++)
+        if (enabled & (1u << i))
+            snprintf(names + strlen(names), sizeof(names) - strlen(names), " %s", controllers[i]);
+    log_info("[cgroup] Services run in %s (controllers:%s)", path, enabled ? names : " none");
+    return 0;
+}
+
+static const char *limit(char *buf, size_t size, uint64_t v) {
+    if (v == 0 || v == UINT64_MAX)
+        return "max";
+    snprintf(buf, size, "%llu", (unsigned long long)v);
+    return buf;
+}
+
+static void set(const Unit *unit, int fd, unsigned ctrl, const char *key, const char *file,
+                int configured, const char *val) {
+    if (!(enabled & ctrl)) {
+        if (configured)
+            log_warning("[cgroup] %s: %s= needs the %s controller, which is not available; ignoring",
+                        unit->name, key, controllers[__builtin_ctz(ctrl)]);
+        return;
+    }
+    int r = write_at(fd, file, val);
+    if (r < 0)
+        log_warning("[cgroup] %s: cannot set %s=%s: %s", unit->name, key, val, strerror(-r));
+}
+
+// Unset values are written too, so a reload that drops a key restores the default
+static void apply(const Unit *u, int fd) {
+    char cpu[16], io[24], mem[24], tasks[24];
+    snprintf(cpu, sizeof(cpu), "%u", u->cpu_weight ? u->cpu_weight : 100);
+    snprintf(io, sizeof(io), "default %u", u->io_weight ? u->io_weight : 100);
+    set(u, fd, CTRL_CPU, "CPUWeight", "cpu.weight", u->cpu_weight != 0, cpu);
+    set(u, fd, CTRL_IO, "IOWeight", "io.weight", u->io_weight != 0, io);
+    set(u, fd, CTRL_MEMORY, "MemoryMax", "memory.max", u->memory_max != 0,
+        limit(mem, sizeof(mem), u->memory_max));
+    set(u, fd, CTRL_PIDS, "TasksMax", "pids.max", u->tasks_max != 0, limit(tasks, sizeof(tasks), u->tasks_max));
+}
+
+// Kernels that compare the forking process's cgroup.kill count with the
+// target's SIGKILL every clone3(CLONE_INTO_CGROUP) child of a cgroup that was
+// ever killed, so such a cgroup is not used again. Once its last process is
+// gone it is replaced by a fresh one; until then spawns keep the old one.
+static void replace_killed(const Unit *unit) {
+    int fd = unit_fds[unit->id];
+    if (unlinkat(slice_fd, unit->name, AT_REMOVEDIR) < 0) {
+        log_warning("[cgroup] Cannot replace the cgroup of %s: %s", unit->name, strerror(errno));
+        return;
+    }
+    close(fd);
+    unit_fds[unit->id] = 0;
+    killed[unit->id] = 0;
+}
+
+int cgroup_unit_fd(const Unit *unit) {
+    if (slice_fd < 0)
+        return -1;
+    if (unit->id >= unit_cap) {
+        size_t cap = unit_cap ? unit_cap : 64;
+        while (cap <= unit->id) cap *= 2;
+        int *t = realloc(unit_fds, cap * sizeof(*t));
+        if (!t) return -1;
+        unit_fds = t;
+        const Unit **o = realloc(unit_of, cap * sizeof(*o));
+        if (!o) return -1;
+        unit_of = o;
+        char *k = realloc(killed, cap);
+        if (!k) return -1;
+        killed = k;
+        memset(unit_fds + unit_cap, 0, (cap - unit_cap) * sizeof(*unit_fds));
+        memset(killed + unit_cap, 0, cap - unit_cap);
+        unit_cap = cap;
+    }
+    if (unit_fds[unit->id] > 0 && killed[unit->id])
+        replace_killed(unit);
+    if (unit_fds[unit->id] > 0)
+        return unit_fds[unit->id];
+
+    if (mkdirat(slice_fd, unit->name, 0755) < 0 && errno != EEXIST) {
+        log_error("[cgroup] Cannot create cgroup for %s: %s", unit->name, strerror(errno));
+        return -1;
+    }
+    int fd = openat(slice_fd, unit->name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        log_error("[cgroup] Cannot open cgroup of %s: %s", unit->name, strerror(errno));
+        return -1;
+    }
+    apply(unit, fd);
+    unit_fds[unit->id] = fd;
+    unit_of[unit->id] = unit;
+    return fd;
+}
+
+void cgroup_apply(const Unit *unit) {
+    if (unit->id < unit_cap && unit_fds[unit->id] > 0)
+        apply(unit, unit_fds[unit->id]);
+}
+
+// Kernels before 5.14 have no cgroup.kill: signal what cgroup.procs lists
+static int kill_procs(int fd) {
+    int procs = openat(fd, "cgroup.procs", O_RDONLY | O_CLOEXEC);
+    FILE *f = procs >= 0 ? fdopen(procs, "r") : NULL;
+    if (!f) {
+        int r = -errno;
+        if (procs >= 0) close(procs);
+        return r;
+    }
+    int pid;
+    while (fscanf(f, "%d", &pid) == 1)
+        kill(pid, SIGKILL);
+    fclose(f);
+    return 0;
+}
+
+// "populated 0" in cgroup.events: nothing left to kill
+static int populated(int fd) {
+    char buf[128];
+    int events = openat(fd, "cgroup.events", O_RDONLY | O_CLOEXEC);
+    if (events < 0)
+        return 1;
+    ssize_t n = read(events, buf, sizeof(buf) - 1);
+    close(events);
+    if (n <= 0)
+        return 1;
+    buf[n] = '\0';
+    return strstr(buf, "populated 0") == NULL;
+}
+
+int cgroup_kill(const Unit *unit) {
+    if (unit->id >= unit_cap || unit_fds[unit->id] <= 0)
+        return -ENOENT;
+    // The usual case, a main process that exited on its own, kills nothing
+    if (!populated(unit_fds[unit->id]))
+        return 0;
+    killed[unit->id] = 1;
+    int r = write_at(unit_fds[unit->id], "cgroup.kill", "1");
+    if (r == -ENOENT)
+        r = kill_procs(unit_fds[unit->id]);
+    if (r < 0)
+        log_error("[cgroup] Cannot kill processes of %s: %s", unit->name, strerror(-r));
+    return r;
+}
+
+void cgroup_stop(void) {
+    for (size_t i = 0; i < unit_cap; i++) {
+        if (unit_fds[i] <= 0) continue;
+        close(unit_fds[i]);
+        // EBUSY while processes remain: they keep their cgroup
+        unlinkat(slice_fd, unit_of[i]->name, AT_REMOVEDIR);
+    }
+    free(unit_fds);
+    free(unit_of);
+    free(killed);
+    unit_fds = NULL;
+    unit_of = NULL;
+    killed = NULL;
+    unit_cap = 0;
+    if (slice_fd >= 0)
+        close(slice_fd);
+    slice_fd = -1;
+    enabled = 0;
+}
@@ -0,0 +1,22 @@
+// cgroup.h — a cgroup v2 directory per service: placement, limits, cgroup.kill
+#ifndef COREINITD_CGROUP_H
+#define COREINITD_CGROUP_H
+
+#include "unit_loader.h"
+
+// Find our cgroup v2 hierarchy and prepare <our cgroup>/system.slice for
+// services. -1 (services then share our cgroup) without cgroup v2.
+int cgroup_start(void);
+// Close the directories; empty ones are removed, running services keep theirs
+void cgroup_stop(void);
+
+// Directory fd of unit's cgroup, created with its limits applied on first
+// use; what spawn_command_fds() places the child into. -1 if unavailable.
+int cgroup_unit_fd(const Unit *unit);
+// Write CPUWeight=, MemoryMax=, IOWeight=, TasksMax= again (after a reload)
+void cgroup_apply(const Unit *unit);
+// SIGKILL every process in unit's cgroup with one write to cgroup.kill.
+// -ENOENT if the unit has no cgroup.
+int cgroup_kill(const Unit *unit);
+
+#endif
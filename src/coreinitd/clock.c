@@ -0,0 +1,192 @@
+// clock.c — monotonic time and one-shot timers, on sd-event or simulated
+//
+// The daemon's timers are sd-event time sources on the main loop. Under
+// clock_virtual() they sit in a binary heap instead and fire only when the
+// simulation harness says so, in a fixed order, so hours of timer and restart
+// traffic replay in moments and the same way every run.
+#include "clock.h"
+#include "event_loop.h"
+#include "util.h"
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+struct ClockTimer {
+    sd_event_source *source;    // real clock, created on first arm
+    size_t heap_index;          // virtual clock, SIZE_MAX when disarmed
+    uint64_t usec;
+    uint64_t seq;               // arming order, breaks ties
+    int64_t priority;
+    ClockTimerFn fn;
+    void *userdata;
+};
+
+static int virtual_clock = 0;
+static uint64_t virtual_now = 0;
+static uint64_t arm_seq = 0;
+static ClockTimer **heap = NULL;
+static size_t heap_count = 0, heap_cap = 0;
+static uint64_t rng_state = 0;
+
+uint64_t clock_now(void) {
+    if (virtual_clock)
+        return virtual_now;
+    uint64_t now;
+    if (event && sd_event_now(event, CLOCK_MONOTONIC, &now) >= 0)
+        return now;
+    return now_usec();
+}
+
+// xorshift64*: only used to spread wakeups, not for anything secret
+uint64_t clock_random(uint64_t max) {
+    if (!rng_state) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        rng_state = ((uint64_t)ts.tv_nsec << 20) ^ (uint64_t)ts.tv_sec ^ (uint64_t)getpid() ^ 0x9e3779b97f4a7c15ULL;
+    }
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    uint64_t r = rng_state * 2685821657736338717ULL;
+    return max == UINT64_MAX ? r : r % (max + 1);
+}
+
+// ──────────────
+// Virtual timers
+// ──────────────
+static int before(const ClockTimer *a, const ClockTimer *b) {
+    if (a->usec != b->usec) return a->usec < b->usec;
+    if (a->priority != b->priority) return a->priority < b->priority;
+    return a->seq < b->seq;
+}
+
+static void heap_place(size_t i, ClockTimer *t) {
+    heap[i] = t;
+    t->heap_index = i;
+}
+
+static void sift_up(size_t i) {
+    ClockTimer *t = heap[i];
+    while (i > 0 && before(t, heap[(i - 1) / 2])) {
+        heap_place(i, heap[(i - 1) / 2]);
+        i = (i - 1) / 2;
+    }
+    heap_place(i, t);
+}
+
+static void sift_down(size_t i) {
+    ClockTimer *t = heap[i];
+    for (;;) {
+        size_t c = 2 * i + 1;
+        if (c >= heap_count) break;
+        if (c + 1 < heap_count && before(heap[c + 1], heap[c])) c++;
+        if (!before(heap[c], t)) break;
+        heap_place(i, heap[c]);
+        i = c;
+    }
+    heap_place(i, t);
+}
+
+static void heap_remove(ClockTimer *t) {
+    size_t i = t->heap_index;
+    if (i == SIZE_MAX) return;
+    t->heap_index = SIZE_MAX;
+    ClockTimer *last = heap[--heap_count];
+    if (i == heap_count) return;
+    heap_place(i, last);
+    sift_up(i);
+    sift_down(last->heap_index);
+}
+
+static int heap_insert(ClockTimer *t) {
+    if (heap_count == heap_cap) {
+        size_t cap = heap_cap ? heap_cap * 2 : 64;
+        ClockTimer **h = realloc(heap, cap * sizeof(*h));
+        if (!h) return -ENOMEM;
+        heap = h;
+        heap_cap = cap;
+    }
+    heap_place(heap_count++, t);
+    sift_up(t->heap_index);
+    return 0;
+}
+
+void clock_virtual(uint64_t start, uint64_t seed) {
+    virtual_clock = 1;
+    virtual_now = start;
+    rng_state = seed ? seed : 1;
+}
+
+uint64_t clock_next(void) {
+    return heap_count ? heap[0]->usec : UINT64_MAX;
+}
+
+void clock_advance(uint64_t usec) {
+    if (usec > virtual_now)
+        virtual_now = usec;
+}
+
+int clock_run_next(void) {
+    if (!heap_count)
+        return 0;
+    ClockTimer *t = heap[0];
+    heap_remove(t);
+    clock_advance(t->usec);
+    t->fn(t, t->usec, t->userdata);
+    return 1;
+}
+
+// ──────────────
+// Timers
+// ──────────────
+static int on_time(sd_event_source *s, uint64_t usec, void *userdata) {
+    (void)s;
+    ClockTimer *t = userdata;
+    t->fn(t, usec, t->userdata);
+    return 0;
+}
+
+ClockTimer *clock_timer_new(int64_t priority, ClockTimerFn fn, void *userdata) {
+    ClockTimer *t = calloc(1, sizeof(*t));
+    if (!t) return NULL;
+    t->heap_index = SIZE_MAX;
+    t->priority = priority;
+    t->fn = fn;
+    t->userdata = userdata;
+    return t;
+}
+
+int clock_timer_set(ClockTimer *t, uint64_t usec, uint64_t accuracy) {
+    t->usec = usec;
+    if (virtual_clock) {
+        heap_remove(t);
+        t->seq = arm_seq++;
+        return heap_insert(t);
+    }
+
+    // accuracy 0 would mean sd-event's 250ms default, not "exact"
+    if (!accuracy)
+        accuracy = 1;
+    if (t->source) {
+        sd_event_source_set_time(t->source, usec);
+        sd_event_source_set_time_accuracy(t->source, accuracy);
+        return sd_event_source_set_enabled(t->source, SD_EVENT_ONESHOT);
+    }
+    int r = sd_event_add_time(event, &t->source, CLOCK_MONOTONIC, usec, accuracy, on_time, t);
+    if (r < 0)
+        return r;
+    if (t->priority)
+        sd_event_source_set_priority(t->source, t->priority);
+    return 0;
+}
+
+ClockTimer *clock_timer_free(ClockTimer *t) {
+    if (!t)
+        return NULL;
+    heap_remove(t);
+    // Safe from inside the source's own callback: sd-event defers the free
+    sd_event_source_unref(t->source);
+    free(t);
+    return NULL;
+}
@@ -0,0 +1,33 @@
+// clock.h — monotonic time and one-shot timers, on sd-event or simulated
+#ifndef COREINITD_CLOCK_H
+#define COREINITD_CLOCK_H
+
+#include <stdint.h>
+
+typedef struct ClockTimer ClockTimer;
+typedef void (*ClockTimerFn)(ClockTimer *t, uint64_t usec, void *userdata);
+
+// CLOCK_MONOTONIC as of this event loop iteration, or the virtual time
+uint64_t clock_now(void);
+// Uniform in [0, max], to spread wakeups; a virtual clock replays the same
+// sequence for the same seed
+uint64_t clock_random(uint64_t max);
+
+// Disarmed until clock_timer_set(); priority as for sd-event sources. NULL if out of memory.
+ClockTimer *clock_timer_new(int64_t priority, ClockTimerFn fn, void *userdata);
+// Fire once at usec (absolute), up to accuracy late; re-arms an armed timer
+int clock_timer_set(ClockTimer *t, uint64_t usec, uint64_t accuracy);
+// Disarm and free; fine from t's own callback. Returns NULL.
+ClockTimer *clock_timer_free(ClockTimer *t);
+
+// Simulation: time starts at start and only moves when told to. Timers fire
+// exactly at their time, ties in priority and then arming order.
+void clock_virtual(uint64_t start, uint64_t seed);
+// Time of the earliest armed timer, UINT64_MAX if none
+uint64_t clock_next(void);
+// Move time forward to usec, which must not be past clock_next()
+void clock_advance(uint64_t usec);
+// Advance to the earliest timer and fire it; 0 if none was armed
+int clock_run_next(void);
+
+#endif
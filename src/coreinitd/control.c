@@ -0,0 +1,459 @@
+// control.c — control socket: framed requests answered from in-memory state
+//
+// status/list/show read the registry and the service table; start/stop/
+// restart go through the job queue and reply from its completion callback.
+// Each wakeup processes every complete request that has arrived and sends
+// all resulting replies with one write, so a client pipelining a thousand
+// status queries costs a handful of syscalls, not a thousand round trips.
+#define _GNU_SOURCE
+#include "control.h"
+#include "log.h"
+#include "job_queue.h"
+#include "reload.h"
+#include "service_log.h"
+#include "service_manager.h"
+#include "spawn.h"
+#include "unit_registry.h"
+#include "util.h"
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#define CONTROL_CONN_MAX 64
+#define CONTROL_BACKLOG 16
+#define CONTROL_OUTPUT_MAX (1024 * 1024)    // unsent bytes at which we stop reading requests
+#define CONTROL_LOG_LINES 10                // recent output lines in a status reply
+#define CONTROL_LOG_MAX 4096
+
+typedef struct {
+    sd_event_source *source;    // owns the connection fd
+    char in[CONTROL_REQUEST_MAX];
+    size_t in_len;
+    char *out;
+    size_t out_len, out_off, out_cap;
+    unsigned jobs;      // replies still owed by job callbacks
+    int busy;           // inside on_conn_io: callbacks must not free or flush
+    int dead;           // closed; freed once jobs == 0
+} ControlConn;
+
+typedef struct {
+    ControlConn *conn;
+    uint32_t id;
+    uint16_t op;
+} ControlJob;
+
+static int listen_fd = -1;
+static sd_event_source *listen_source = NULL;
+static ControlConn *conns[CONTROL_CONN_MAX];
+static size_t n_conns = 0;
+
+static const uint8_t state_map[] = {
+    [SERVICE_INACTIVE] = CONTROL_STATE_INACTIVE,
+    [SERVICE_STARTING] = CONTROL_STATE_STARTING,
+    [SERVICE_ACTIVE] = CONTROL_STATE_ACTIVE,
+    [SERVICE_AUTO_RESTART] = CONTROL_STATE_AUTO_RESTART,
+    [SERVICE_STOPPING] = CONTROL_STATE_STOPPING,
+    [SERVICE_FAILED] = CONTROL_STATE_FAILED,
+};
+
+static void conn_close(ControlConn *c) {
+    if (!c->dead) {
+        c->dead = 1;
+        c->source = sd_event_source_unref(c->source);
+        for (size_t i = 0; i < n_conns; i++)
+            if (conns[i] == c) {
+                conns[i] = conns[--n_conns];
+                break;
+            }
+    }
+    if (c->jobs == 0 && !c->busy) {
+        free(c->out);
+        free(c);
+    }
+}
+
+// ─────────────────
+// Reply buffer
+// ─────────────────
+static void *out_reserve(ControlConn *c, size_t n) {
+    if (c->out_len + n > c->out_cap) {
+        size_t cap = c->out_cap ? c->out_cap : 4096;
+        while (cap < c->out_len + n) cap *= 2;
+        char *t = realloc(c->out, cap);
+        if (!t) return NULL;
+        c->out = t;
+        c->out_cap = cap;
+    }
+    void *p = c->out + c->out_len;
+    c->out_len += n;
+    return p;
+}
+
+static void out_append(ControlConn *c, const void *data, size_t n) {
+    void *p = out_reserve(c, n);
+    if (p)
+        memcpy(p, data, n);
+}
+
+// Measured first and formatted in place, so no line is ever cut short
+static void out_printf(ControlConn *c, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+    char *p = n > 0 ? out_reserve(c, (size_t)n + 1) : NULL;
+    if (!p)
+        return;
+    va_start(ap, fmt);
+    vsnprintf(p, (size_t)n + 1, fmt, ap);
+    va_end(ap);
+    c->out_len--;   // the NUL
+}
+
+// Offset of the header, whose len reply_end() fills in
+static size_t reply_begin(ControlConn *c, const ControlHeader *req, int result) {
+    ControlHeader h = { .id = req->id, .op = req->op, .result = result };
+    size_t off = c->out_len;
+    out_append(c, &h, sizeof(h));
+    return off;
+}
+
+static void reply_end(ControlConn *c, size_t off) {
+    if (c->out_len < off + sizeof(ControlHeader))
+        return;
+    uint32_t len = (uint32_t)(c->out_len - off - sizeof(ControlHeader));
+    memcpy(c->out + off + offsetof(ControlHeader, len), &len, sizeof(len));
+}
+
+static void reply(ControlConn *c, const ControlHeader *req, int result) {
+    reply_end(c, reply_begin(c, req, result));
+}
+
+static void conn_flush(ControlConn *c) {
+    while (c->out_off < c->out_len) {
+        ssize_t n = send(sd_event_source_get_io_fd(c->source), c->out + c->out_off,
+                         c->out_len - c->out_off, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN) break;
+            conn_close(c);
+            return;
+        }
+        c->out_off += (size_t)n;
+    }
+    if (c->out_off == c->out_len)
+        c->out_off = c->out_len = 0;
+    // Backpressure: a client that does not read its replies stops being read
+    size_t pending = c->out_len - c->out_off;
+    sd_event_source_set_io_events(c->source, (pending < CONTROL_OUTPUT_MAX ? EPOLLIN : 0) |
+                                             (pending ? EPOLLOUT : 0));
+}
+
+// ─────────────────
+// Requests
+// ─────────────────
+static void put_status(ControlConn *c, const Unit *u, int with_log, int with_placement) {
+    const ServiceEntry *e = u->type == UNIT_SERVICE ? service_manager_entry(u) : NULL;
+    const char *status = e ? e->status_text : "";
+    ControlUnitStatus st = {
+        .type = (uint8_t)u->type,
+        .state = u->type != UNIT_SERVICE ? CONTROL_STATE_LOADED : e ? state_map[e->state] : CONTROL_STATE_INACTIVE,
+        .job_pending = (uint8_t)job_pending(u),
+        .not_found = (uint8_t)u->not_found,
+        .name_len = (uint16_t)strlen(u->name),
+        .status_len = (uint16_t)strlen(status),
+    };
+    if (e) {
+        st.pid = e->pid;
+        st.exit_code = e->exit_code;
+        st.exit_status = e->exit_status;
+        st.restarts = e->restarts;
+        st.active_since = e->active_since;
+    }
+    char log[CONTROL_LOG_MAX];
+    char placement[SPAWN_PLACEMENT_TEXT_MAX];
+    SpawnPlacement p;
+    if (with_log)
+        st.log_len = (uint32_t)service_log_tail(u, log, sizeof(log), CONTROL_LOG_LINES);
+    // What the process really got, not what the unit asked for; a handful of
+    // syscalls and a /proc read, so only when asked
+    if (with_placement && e && e->pid > 0 && (e->state == SERVICE_STARTING || e->state == SERVICE_ACTIVE ||
+                                        e->state == SERVICE_STOPPING) && spawn_placement_of(e->pid, &p) == 0)
+        st.placement_len = (uint32_t)spawn_placement_format(&p, '\n', placement, sizeof(placement));
+    out_append(c, &st, sizeof(st));
+    out_append(c, u->name, st.name_len);
+    out_append(c, status, st.status_len);
+    out_append(c, log, st.log_len);
+    out_append(c, placement, st.placement_len);
+}
+
+static void put_show(ControlConn *c, const Unit *u) {
+    static const char *const types[] = { "service", "socket", "timer", "unknown" };
+    out_printf(c, "Id=%s\nUnitType=%s\nPath=%s\n", u->name, types[u->type], u->path);
+    if (u->description[0]) out_printf(c, "Description=%s\n", u->description);
+    if (u->requires[0]) out_printf(c, "Requires=%s\n", u->requires);
+    if (u->wants[0]) out_printf(c, "Wants=%s\n", u->wants);
+    if (u->after[0]) out_printf(c, "After=%s\n", u->after);
+    if (u->before[0]) out_printf(c, "Before=%s\n", u->before);
+
+    switch (u->type) {
+        case UNIT_SERVICE: {
+            static const char *const service_types[] = { "simple", "exec", "notify" };
+            static const char *const restarts[] = { "no", "on-failure", "always" };
+            static const char *const access[] = { "default", "none", "main", "exec", "all" };
+            out_printf(c, "ExecStart=%s\nType=%s\nRestart=%s\nNotifyAccess=%s\n", u->exec_start,
+                       service_types[u->service_type], restarts[u->restart], access[u->notify_access]);
+            if (u->environment[0]) out_printf(c, "Environment=%s\n", u->environment);
+            if (u->socket_unit[0]) out_printf(c, "Sockets=%s\n", u->socket_unit);
+            out_printf(c, "RestartUSec=%llu\nRestartMaxDelayUSec=%llu\nTimeoutStartUSec=%llu\nWatchdogUSec=%llu\n",
+                       (unsigned long long)u->restart_usec, (unsigned long long)u->restart_max_delay_usec,
+                       (unsigned long long)u->timeout_start_usec, (unsigned long long)u->watchdog_usec);
+            out_printf(c, "TimeoutStopUSec=%llu\nKillSignal=%d\n",
+                       (unsigned long long)u->timeout_stop_usec, u->kill_signal);
+            out_printf(c, "StartLimitIntervalUSec=%llu\nStartLimitBurst=%u\n",
+                       (unsigned long long)u->start_limit_interval_usec, u->start_limit_burst);
+            out_printf(c, "LogRateLimitIntervalUSec=%llu\nLogRateLimitBurst=%llu\n",
+                       (unsigned long long)u->log_rate_limit_interval_usec,
+                       (unsigned long long)u->log_rate_limit_burst);
+            if (u->cpu_weight) out_printf(c, "CPUWeight=%u\n", u->cpu_weight);
+            if (u->io_weight) out_printf(c, "IOWeight=%u\n", u->io_weight);
+            if (u->memory_max == UINT64_MAX) out_printf(c, "MemoryMax=infinity\n");
+            else if (u->memory_max) out_printf(c, "MemoryMax=%llu\n", (unsigned long long)u->memory_max);
+            if (u->tasks_max == UINT64_MAX) out_printf(c, "TasksMax=infinity\n");
+            else if (u->tasks_max) out_printf(c, "TasksMax=%llu\n", (unsigned long long)u->tasks_max);
+            if (u->placement) {
+                char placement[SPAWN_PLACEMENT_TEXT_MAX];
+                out_append(c, placement, spawn_placement_format(u->placement, '\n', placement, sizeof(placement)));
+            }
+            break;
+        }
+        case UNIT_SOCKET:
+            if (u->listen_stream[0]) out_printf(c, "ListenStream=%s\n", u->listen_stream);
+            if (u->listen_datagram[0]) out_printf(c, "ListenDatagram=%s\n", u->listen_datagram);
+            if (u->listen_seqpacket[0]) out_printf(c, "ListenSequentialPacket=%s\n", u->listen_seqpacket);
+            out_printf(c, "Backlog=%u\nReusePort=%s\nAccept=%s\n", u->backlog,
+                       u->reuse_port ? "yes" : "no", u->accept ? "yes" : "no");
+            if (u->shards > 1)
+                out_printf(c, "Shards=%u\n", u->shards);
+            if (u->accept)
+                out_printf(c, "MaxConnections=%u\n", u->max_connections);
+            break;
+        case UNIT_TIMER:
+            out_printf(c, "Unit=%s\nOnBootUSec=%llu\nOnUnitActiveUSec=%llu\nAccuracyUSec=%llu\nRandomizedDelayUSec=%llu\n",
+                       u->timer_unit, (unsigned long long)u->on_boot_usec, (unsigned long long)u->on_active_usec,
+                       (unsigned long long)u->accuracy_usec, (unsigned long long)u->randomized_delay_usec);
+            break;
+        default:
+            break;
+    }
+}
+
+static void on_job_done(Unit *unit, JobType type, int result, void *userdata) {
+    (void)unit;
+    (void)type;
+    ControlJob *cj = userdata;
+    ControlConn *c = cj->conn;
+    ControlHeader req = { .id = cj->id, .op = cj->op };
+    free(cj);
+
+    c->jobs--;
+    if (c->dead) {
+        conn_close(c);      // frees it once this was the last job
+        return;
+    }
+    // service_manager reports plain -1 for a failed start
+    reply(c, &req, result == -1 ? -EIO : result);
+    if (!c->busy)
+        conn_flush(c);
+}
+
+static void handle_request(ControlConn *c, const ControlHeader *h, const char *payload) {
+    Unit *u = NULL;
+    if (h->op != CONTROL_OP_LIST && h->op != CONTROL_OP_RELOAD) {
+        char name[UNIT_NAME_MAX + 1];
+        if (h->len == 0 || h->len >= sizeof(name)) {
+            reply(c, h, -EINVAL);
+            return;
+        }
+        memcpy(name, payload, h->len);
+        name[h->len] = '\0';
+        if (!(u = unit_registry_find(name))) {
+            reply(c, h, -ENOENT);
+            return;
+        }
+    }
+
+    size_t off;
+    switch (h->op) {
+        case CONTROL_OP_START:
+        case CONTROL_OP_STOP:
+        case CONTROL_OP_RESTART: {
+            if (u->type != UNIT_SERVICE) {
+                reply(c, h, -EOPNOTSUPP);
+                return;
+            }
+            JobType type = h->op == CONTROL_OP_START ? JOB_START : h->op == CONTROL_OP_STOP ? JOB_STOP : JOB_RESTART;
+            if (h->flags & CONTROL_NO_BLOCK) {
+                reply(c, h, job_enqueue(u, type, NULL, NULL));
+                return;
+            }
+            ControlJob *cj = malloc(sizeof(*cj));
+            if (!cj) {
+                reply(c, h, -ENOMEM);
+                return;
+            }
+            *cj = (ControlJob){ c, h->id, h->op };
+            c->jobs++;
+            int r = job_enqueue(u, type, on_job_done, cj);
+            if (r < 0) {
+                c->jobs--;
+                free(cj);
+                reply(c, h, r);
+            }
+            return;
+        }
+        case CONTROL_OP_STATUS:
+            off = reply_begin(c, h, 0);
+            put_status(c, u, 1, h->flags & CONTROL_PLACEMENT);
+            reply_end(c, off);
+            return;
+        case CONTROL_OP_LIST:
+            off = reply_begin(c, h, 0);
+            for (size_t id = 0; id < unit_registry_count(); id++)
+                put_status(c, unit_registry_get(id), 0, 0);
+            reply_end(c, off);
+            return;
+        case CONTROL_OP_SHOW:
+            off = reply_begin(c, h, 0);
+            put_show(c, u);
+            reply_end(c, off);
+            return;
+        case CONTROL_OP_RELOAD: {
+            int r = reload_all();
+            reply(c, h, r < 0 ? r : 0);
+            return;
+        }
+        default:
+            reply(c, h, -EOPNOTSUPP);
+            return;
+    }
+}
+
+static int on_conn_io(sd_event_source *s, int fd, uint32_t revents, void *userdata) {
+    (void)s;
+    ControlConn *c = userdata;
+    c->busy = 1;
+
+    if (revents & EPOLLIN) {
+        ssize_t n = read(fd, c->in + c->in_len, sizeof(c->in) - c->in_len);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR))
+            conn_close(c);
+        else if (n > 0)
+            c->in_len += (size_t)n;
+
+        size_t off = 0;
+        while (!c->dead && c->in_len - off >= sizeof(ControlHeader)) {
+            ControlHeader h;
+            memcpy(&h, c->in + off, sizeof(h));
+            if (h.len > CONTROL_REQUEST_MAX - sizeof(h)) {
+                log_warning("[control] Dropping client: %u byte request", h.len);
+                conn_close(c);
+                break;
+            }
+            if (c->in_len - off < sizeof(h) + h.len)
+                break;
+            handle_request(c, &h, c->in + off + sizeof(h));
+            off += sizeof(h) + h.len;
+        }
+        memmove(c->in, c->in + off, c->in_len - off);
+        c->in_len -= off;
+    } else if (revents & (EPOLLHUP | EPOLLERR)) {
+        conn_close(c);
+    }
+
+    c->busy = 0;
+    if (c->dead)
+        conn_close(c);
+    else
+        conn_flush(c);
+    return 0;
+}
+
+static int on_accept(sd_event_source *s, int fd, uint32_t revents, void *userdata) {
+    (void)s;
+    (void)revents;
+    (void)userdata;
+
+    for (;;) {
+        int cfd = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (cfd < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN)
+                log_error("[control] accept failed: %s", strerror(errno));
+            return 0;
+        }
+        if (n_conns >= CONTROL_CONN_MAX) {
+            log_warning("[control] Too many clients, refusing connection");
+            close(cfd);
+            continue;
+        }
+        ControlConn *c = calloc(1, sizeof(*c));
+        if (!c || sd_event_add_io(sd_event_source_get_event(listen_source), &c->source, cfd, EPOLLIN, on_conn_io, c) < 0) {
+            free(c);
+            close(cfd);
+            continue;
+        }
+        sd_event_source_set_io_fd_own(c->source, 1);
+        conns[n_conns++] = c;
+    }
+}
+
+int control_start(sd_event *event) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(CONTROL_SOCKET_PATH) >= sizeof(addr.sun_path))
+        return -ENAMETOOLONG;
+    strcpy(addr.sun_path, CONTROL_SOCKET_PATH);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd < 0)
+        return -errno;
+    mkdir_parents(CONTROL_SOCKET_PATH);
+    unlink(CONTROL_SOCKET_PATH);
+    // Nobody can connect before listen(), so tightening the mode in between is race-free
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        chmod(CONTROL_SOCKET_PATH, 0600) < 0 ||
+        listen(fd, CONTROL_BACKLOG) < 0) {
+        int r = -errno;
+        log_error("[control] Cannot listen on %s: %s", CONTROL_SOCKET_PATH, strerror(errno));
+        close(fd);
+        return r;
+    }
+
+    int r = sd_event_add_io(event, &listen_source, fd, EPOLLIN, on_accept, NULL);
+    if (r < 0) {
+        log_error("[control] Failed to watch %s: %s", CONTROL_SOCKET_PATH, strerror(-r));
+        close(fd);
+        return r;
+    }
+    sd_event_source_set_io_fd_own(listen_source, 1);
+    listen_fd = fd;
+    log_info("[control] Listening on %s", CONTROL_SOCKET_PATH);
+    return 0;
+}
+
+void control_stop(void) {
+    // Connections with jobs outstanding are freed by job_queue_free()'s callbacks
+    while (n_conns)
+        conn_close(conns[n_conns - 1]);
+    if (listen_fd >= 0)
+        unlink(CONTROL_SOCKET_PATH);
+    listen_source = sd_event_source_unref(listen_source);   // closes listen_fd
+    listen_fd = -1;
+}
@@ -0,0 +1,12 @@
+// control.h — control socket: start/stop/restart/status/list for coreinitctl
+#ifndef COREINITD_CONTROL_H
+#define COREINITD_CONTROL_H
+
+#include <systemd/sd-event.h>
+#include "control_protocol.h"
+
+// Listen on CONTROL_SOCKET_PATH (mode 0600) and serve clients from the loop
+int control_start(sd_event *event);
+void control_stop(void);
+
+#endif
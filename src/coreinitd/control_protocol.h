@@ -0,0 +1,72 @@
+// control_protocol.h — framing shared by the control socket and coreinitctl
+#ifndef COREINITD_CONTROL_PROTOCOL_H
+#define COREINITD_CONTROL_PROTOCOL_H
+
+#include <stdint.h>
+
+#ifndef CONTROL_SOCKET_PATH
+#define CONTROL_SOCKET_PATH "./run/coreinitd/control"
+#endif
+
+#define CONTROL_REQUEST_MAX 1024    // header + unit name; anything longer drops the connection
+
+// Every frame in either direction is a header followed by len payload bytes,
+// in host byte order (AF_UNIX: both ends are on this machine). Clients may
+// write any number of requests without waiting for replies. Each reply
+// carries its request's id; status/list/show are answered in order, but
+// start/stop/restart reply when their job finishes and may overtake them.
+typedef struct {
+    uint32_t len;       // payload bytes after the header
+    uint32_t id;        // chosen by the client, echoed in the reply
+    uint16_t op;        // ControlOp, echoed in the reply
+    uint16_t flags;     // requests: ControlFlags
+    int32_t result;     // replies: 0 or -errno; 0 in requests
+} ControlHeader;
+
+typedef enum {
+    CONTROL_OP_START = 1,   // payload: unit name
+    CONTROL_OP_STOP,
+    CONTROL_OP_RESTART,
+    CONTROL_OP_STATUS,      // reply: one ControlUnitStatus record
+    CONTROL_OP_LIST,        // no payload; reply: a record for every loaded unit
+    CONTROL_OP_SHOW,        // reply: "Key=value\n" lines of the loaded unit
+    CONTROL_OP_RELOAD,      // no payload; re-check all unit files, like SIGHUP
+} ControlOp;
+
+typedef enum {
+    CONTROL_NO_BLOCK = 1 << 0,  // start/stop/restart: reply once queued, not when done
+    CONTROL_PLACEMENT = 1 << 1, // status: also read the main process's placement back from /proc
+} ControlFlags;
+
+typedef enum {
+    CONTROL_STATE_INACTIVE,
+    CONTROL_STATE_STARTING,
+    CONTROL_STATE_ACTIVE,
+    CONTROL_STATE_AUTO_RESTART,
+    CONTROL_STATE_STOPPING,
+    CONTROL_STATE_FAILED,
+    CONTROL_STATE_LOADED,       // sockets and timers: no process of their own
+} ControlState;
+
+// Followed by name_len bytes of unit name, status_len bytes of the last
+// STATUS=, log_len bytes of recent output and placement_len bytes of the
+// running main process's CPUAffinity=, Nice=, ... as "Key=value\n" lines,
+// none NUL-terminated. Only status replies carry output, and placement
+// only with CONTROL_PLACEMENT. Records in a list reply are back to back, so only the first one is aligned.
+typedef struct {
+    uint8_t type;           // 0 service, 1 socket, 2 timer
+    uint8_t state;          // ControlState
+    uint8_t job_pending;
+    uint8_t not_found;      // unit file removed since it was loaded
+    int32_t pid;            // main PID, 0 if it never ran
+    int32_t exit_code;      // CLD_EXITED/KILLED/DUMPED of the last exit, 0 if none
+    int32_t exit_status;
+    uint32_t restarts;      // consecutive automatic restarts
+    uint16_t name_len;
+    uint16_t status_len;
+    uint32_t log_len;
+    uint32_t placement_len;
+    uint64_t active_since;  // CLOCK_MONOTONIC usec of the last start, 0 if never
+} ControlUnitStatus;
+
+#endif
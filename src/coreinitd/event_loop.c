@@ -1,5 +1,7 @@
 // event_loop.c — sd_event loop wrapper for coreinitd
 #include "event_loop.h"
+#include "log.h"
+#include "service_manager.h"
 #include <systemd/sd-event.h>
 #include <errno.h>
 #include <signal.h>
@@ -8,56 +10,105 @@
 #include <string.h>
 #include <sys/wait.h>
 
-// Basic SIGCHLD handler: reaps children
-static int on_sigchld(sd_event_source *s, const struct signalfd_siginfo *si, void *userdata) {
-    pid_t pid;
-    int status;
+sd_event *event = NULL;
+
+static sd_event_source *sigchld_src = NULL;
+static sd_event_source *orphan_src = NULL;
 
-    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
-        fprintf(stderr, "[coreinitd-event] Reaped child PID %d\n", pid);
+// Reap exited children that no service owns (re-parented orphans, helpers).
+// Supervised PIDs are left alone: their pidfd child source collects them.
+static void reap_orphans(void) {
+    for (;;) {
+        siginfo_t si;
+        memset(&si, 0, sizeof(si));
+        if (waitid(P_ALL, 0, &si, WEXITED | WNOHANG | WNOWAIT) < 0 || si.si_pid == 0)
+            break;
+        if (service_manager_lookup(si.si_pid))
+            break;  // next sweep runs once that service is collected
+        if (waitid(P_PID, si.si_pid, &si, WEXITED | WNOHANG) < 0)
+            break;
+        log_debug("[coreinitd-event] Reaped orphan PID %d", si.si_pid);
     }
+}
 
+// SIGCHLD: signals coalesce, so this is only a hint to sweep orphans
+static int on_sigchld(sd_event_source *s, const struct signalfd_siginfo *si, void *userdata) {
+    (void)s;
+    (void)si;
+    (void)userdata;
+    reap_orphans();
     return 0;
 }
 
-// Register SIGCHLD Handler
+static int on_orphan_sweep(sd_event_source *s, void *userdata) {
+    (void)s;
+    (void)userdata;
+    reap_orphans();
+    return 0;
+}
+
+// Called after a supervised child is collected, in case an orphan was queued behind it
+void event_loop_reap_orphans(void) {
+    if (orphan_src)
+        sd_event_source_set_enabled(orphan_src, SD_EVENT_ONESHOT);
+}
+
+// Create the loop and register SIGCHLD handling
 int event_loop_init(void) {
-    sd_event_source *sigchld_src = NULL;
-	int r = -1;
-	if (!event)
-	    r = sd_event_default(&event);
+    int r = 0;
+    if (!event)
+        r = sd_event_default(&event);
     if (r < 0) {
-        fprintf(stderr, "[coreinitd-event] Failed to create event loop: %s\n", strerror(-r));
+        log_error("[coreinitd-event] Failed to create event loop: %s", strerror(-r));
         return -1;
     }
-    if (event && sigchld_src == NULL) {
+
+    // sd-event child and signal sources both require SIGCHLD to be blocked;
+    // spawned services get an empty mask back before exec
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0) {
+        log_error("[coreinitd-event] Failed to block SIGCHLD: %s", strerror(errno));
+        return -1;
+    }
+
+    if (sigchld_src == NULL) {
         r = sd_event_add_signal(event, &sigchld_src, SIGCHLD, on_sigchld, NULL);
         if (r < 0) {
-            if (r == -EBUSY)
-                fprintf(stderr, "[coreinitd-event] SIGCHLD already has a handler!\n");
-            else
-                fprintf(stderr, "[coreinitd-event] Failed to add SIGCHLD handler: %s (%d)\n", strerror(-r), -r);
+            log_error("[coreinitd-event] Failed to add SIGCHLD handler: %s (%d)", strerror(-r), -r);
+            return r;
+        }
+        // Let the per-service child sources run first in an exit burst
+        sd_event_source_set_priority(sigchld_src, SD_EVENT_PRIORITY_IDLE);
+
+        r = sd_event_add_defer(event, &orphan_src, on_orphan_sweep, NULL);
+        if (r < 0) {
+            log_error("[coreinitd-event] Failed to add orphan sweep: %s", strerror(-r));
             return r;
         }
-        sd_event_source_set_priority(sigchld_src, SD_EVENT_PRIORITY_NORMAL);
+        sd_event_source_set_priority(orphan_src, SD_EVENT_PRIORITY_IDLE);
+        sd_event_source_set_enabled(orphan_src, SD_EVENT_OFF);
     } else {
-        fprintf(stderr, "[coreinitd-event] SIGCHLD handler already registered.\n");
+        log_debug("[coreinitd-event] SIGCHLD handler already registered.");
     }
 
     return 0;
 }
 
 int event_loop_run(void) {
-    fprintf(stderr, "[coreinitd-event] Starting event loop...\n");
+    log_info("[coreinitd-event] Starting event loop...");
     int r = sd_event_loop(event);
     if (r < 0) {
-        fprintf(stderr, "[coreinitd-event] Event loop error: %s\n", strerror(-r));
+        log_error("[coreinitd-event] Event loop error: %s", strerror(-r));
         return -1;
     }
     return 0;
 }
 
 void event_loop_shutdown(void) {
+    sigchld_src = sd_event_source_unref(sigchld_src);
+    orphan_src = sd_event_source_unref(orphan_src);
     if (event) {
         sd_event_unref(event);
         event = NULL;
@@ -4,10 +4,11 @@
 
 #include <systemd/sd-event.h>
 #include <stddef.h>
-static sd_event *event = NULL;
+extern sd_event *event;
 
 int event_loop_init(void);
 int event_loop_run(void);
+void event_loop_reap_orphans(void);
 void event_loop_shutdown(void);
 
 #endif
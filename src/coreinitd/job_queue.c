@@ -0,0 +1,254 @@
+// job_queue.c — per-unit job slots drained in batches from a defer source
+//
+// Sockets, timers, the dependency scheduler and control requests all ask for
+// state changes through here instead of calling service_manager directly. A
+// unit has at most one pending job, so a burst of triggers between two loop
+// iterations turns into a single transition.
+#include "job_queue.h"
+#include "log.h"
+#include "service_manager.h"
+#include "event_loop.h"
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+typedef struct {
+    JobDoneFn fn;
+    void *userdata;
+    JobType type;       // what this waiter asked for, after merging too
+} JobWaiter;
+
+typedef struct {
+    Unit *unit;
+    JobType type;
+    JobWaiter *waiters;
+    size_t n_waiters;
+} Job;
+
+static Job **jobs = NULL;           // indexed by Unit.id, NULL: nothing pending
+static Job **running = NULL;        // start/restart jobs waiting for READY=1, same indexing
+static Job **stopping = NULL;       // stop jobs waiting for the processes to exit, same indexing
+static size_t jobs_cap = 0;
+static size_t *queue = NULL;        // unit ids in arrival order
+static size_t queue_len = 0, queue_cap = 0;
+static sd_event_source *run_source = NULL;
+static size_t merged_total = 0;
+static int shutting_down = 0;
+
+static const char *const job_type_names[] = {
+    [JOB_START] = "start",
+    [JOB_STOP] = "stop",
+    [JOB_RESTART] = "restart",
+};
+
+static void job_finish(Job *j, int result) {
+    for (size_t i = 0; i < j->n_waiters; i++)
+        j->waiters[i].fn(j->unit, j->waiters[i].type, result, j->waiters[i].userdata);
+    free(j->waiters);
+    free(j);
+}
+
+// > 0: started but not ready yet, the job waits in running[]
+static int job_run(Job *j) {
+    ServiceState state = service_manager_state(j->unit);
+    if (j->type == JOB_RESTART)
+        return service_manager_restart(j->unit);
+    if (j->type == JOB_START) {
+        if (state == SERVICE_STARTING)
+            return 1;
+        if (state == SERVICE_ACTIVE)
+            return 0;
+        // Not before the old process is gone
+        if (state == SERVICE_STOPPING)
+            return service_manager_restart(j->unit);
+        return service_manager_start(j->unit);
+    }
+    // Completes once the processes are gone, see service_manager_stop()
+    return service_manager_stop(j->unit);
+}
+
+static int add_waiter(Job *j, JobType type, JobDoneFn done, void *userdata) {
+    if (!done) return 0;
+    JobWaiter *w = realloc(j->waiters, (j->n_waiters + 1) * sizeof(*w));
+    if (!w) return -ENOMEM;
+    j->waiters = w;
+    j->waiters[j->n_waiters++] = (JobWaiter){ done, userdata, type };
+    return 0;
+}
+
+// Move src's waiters onto dst and free src
+static void job_merge(Job *dst, Job *src) {
+    for (size_t i = 0; i < src->n_waiters; i++)
+        if (add_waiter(dst, src->waiters[i].type, src->waiters[i].fn, src->waiters[i].userdata) < 0)
+            src->waiters[i].fn(src->unit, src->waiters[i].type, -ENOMEM, src->waiters[i].userdata);
+    free(src->waiters);
+    free(src);
+}
+
+static int on_run(sd_event_source *s, void *userdata) {
+    (void)s;
+    (void)userdata;
+
+    // Jobs queued by callbacks below wait for the next iteration
+    size_t *batch = queue;
+    size_t n = queue_len;
+    queue = NULL;
+    queue_len = queue_cap = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        Job *j = jobs[batch[i]];
+        jobs[batch[i]] = NULL;
+        if (!j)
+            continue;
+        int r = job_run(j);
+        // A start during a stop is its own job: it completes at READY=1, the stop at the exit
+        Job **slot = j->type == JOB_STOP ? &stopping[batch[i]] : &running[batch[i]];
+        if (r > 0 && !*slot)
+            *slot = j;
+        else if (r > 0)
+            job_merge(*slot, j);
+        else
+            job_finish(j, r);
+    }
+    free(batch);
+    return 0;
+}
+
+int job_enqueue(Unit *unit, JobType type, JobDoneFn done, void *userdata) {
+    if (shutting_down && type != JOB_STOP)
+        return -ESHUTDOWN;
+    if (unit->id >= jobs_cap) {
+        size_t cap = jobs_cap ? jobs_cap : 64;
+        while (cap <= unit->id) cap *= 2;
+        Job **t = realloc(jobs, cap * sizeof(*t));
+        if (!t) return -ENOMEM;
+        memset(t + jobs_cap, 0, (cap - jobs_cap) * sizeof(*t));
+        jobs = t;
+        t = realloc(running, cap * sizeof(*t));
+        if (!t) return -ENOMEM;
+        memset(t + jobs_cap, 0, (cap - jobs_cap) * sizeof(*t));
+        running = t;
+        t = realloc(stopping, cap * sizeof(*t));
+        if (!t) return -ENOMEM;
+        memset(t + jobs_cap, 0, (cap - jobs_cap) * sizeof(*t));
+        stopping = t;
+        jobs_cap = cap;
+    }
+
+    Job *old = jobs[unit->id];
+    if (old && (old->type == type || (old->type != JOB_STOP && type != JOB_STOP))) {
+        // A restart covers a start, not the other way round
+        if (type == JOB_RESTART)
+            old->type = JOB_RESTART;
+        merged_total++;
+        return add_waiter(old, type, done, userdata);
+    }
+    // Already starting: wait for the same READY=1. A stop in progress is in
+    // stopping[], so a start then is queued and runs once the old processes are gone
+    if (!old && type == JOB_START && running[unit->id]) {
+        merged_total++;
+        return add_waiter(running[unit->id], type, done, userdata);
+    }
+    if (!old && queue_len == queue_cap) {
+        size_t cap = queue_cap ? queue_cap * 2 : 64;
+        size_t *q = realloc(queue, cap * sizeof(*q));
+        if (!q) return -ENOMEM;
+        queue = q;
+        queue_cap = cap;
+    }
+
+    Job *j = calloc(1, sizeof(*j));
+    if (!j || add_waiter(j, type, done, userdata) < 0) {
+        free(j);
+        return -ENOMEM;
+    }
+    j->unit = unit;
+    j->type = type;
+    jobs[unit->id] = j;
+
+    if (old) {
+        // Keeps its place in the queue; only the latest request is run
+        log_debug("[job_queue] %s: %s job replaced by %s",
+                  unit->name, job_type_names[old->type], job_type_names[type]);
+        job_finish(old, -ECANCELED);
+    } else {
+        queue[queue_len++] = unit->id;
+    }
+    if (type != JOB_STOP)
+        trace_event(unit, TRACE_JOB, 0);
+
+    if (!run_source) {
+        int r = sd_event_add_defer(event, &run_source, on_run, NULL);
+        if (r < 0) {
+            log_error("[job_queue] Failed to add dispatch source: %s", strerror(-r));
+            return r;
+        }
+    }
+    sd_event_source_set_enabled(run_source, SD_EVENT_ONESHOT);
+    return 0;
+}
+
+int job_pending(const Unit *unit) {
+    return unit->id < jobs_cap && jobs[unit->id] != NULL;
+}
+
+void job_queue_unit_ready(Unit *unit, int result) {
+    if (unit->id >= jobs_cap || !running[unit->id])
+        return;
+    Job *j = running[unit->id];
+    running[unit->id] = NULL;
+    job_finish(j, result);
+}
+
+void job_queue_unit_stopped(Unit *unit, int result) {
+    if (unit->id >= jobs_cap || !stopping[unit->id])
+        return;
+    Job *j = stopping[unit->id];
+    stopping[unit->id] = NULL;
+    job_finish(j, result);
+}
+
+void job_queue_shutdown(void) {
+    shutting_down = 1;
+    // The slot is cleared before the waiters run: they may queue a stop
+    for (size_t i = 0; i < queue_len; i++) {
+        Job *j = jobs[queue[i]];
+        if (!j || j->type == JOB_STOP)
+            continue;
+        jobs[queue[i]] = NULL;
+        job_finish(j, -ECANCELED);
+    }
+}
+
+void job_queue_free(void) {
+    for (size_t i = 0; i < queue_len; i++)
+        if (jobs[queue[i]]) {
+            job_finish(jobs[queue[i]], -ECANCELED);
+            jobs[queue[i]] = NULL;
+        }
+    for (size_t i = 0; i < jobs_cap; i++) {
+        if (running[i]) {
+            Job *j = running[i];
+            running[i] = NULL;
+            job_finish(j, -ECANCELED);
+        }
+        if (stopping[i]) {
+            Job *j = stopping[i];
+            stopping[i] = NULL;
+            job_finish(j, -ECANCELED);
+        }
+    }
+    if (merged_total)
+        log_debug("[job_queue] %zu duplicate jobs merged", merged_total);
+    run_source = sd_event_source_unref(run_source);
+    free(jobs);
+    free(running);
+    free(stopping);
+    free(queue);
+    jobs = running = stopping = NULL;
+    queue = NULL;
+    jobs_cap = queue_len = queue_cap = 0;
+    shutting_down = 0;
+}
@@ -0,0 +1,35 @@
+// job_queue.h — coalesced start/stop requests between triggers and service_manager
+#ifndef COREINITD_JOB_QUEUE_H
+#define COREINITD_JOB_QUEUE_H
+
+#include "unit_loader.h"
+
+typedef enum {
+    JOB_START,
+    JOB_STOP,
+    JOB_RESTART     // stop if running, then start; completes like a start
+} JobType;
+
+// result: 0 once the unit is in the requested state (a Type=notify start
+// completes at READY=1), < 0 if the transition failed, -ECANCELED if a later
+// job replaced it
+typedef void (*JobDoneFn)(Unit *unit, JobType type, int result, void *userdata);
+
+// Queue a job for unit, run with every other queued job in one batch per
+// event loop iteration. A pending job of the same type absorbs the request,
+// as does a pending restart for a start (a pending start becomes a restart);
+// otherwise the pending job is replaced by it. done may be NULL.
+int job_enqueue(Unit *unit, JobType type, JobDoneFn done, void *userdata);
+// Whether unit has a job waiting for the next batch
+int job_pending(const Unit *unit);
+// service_manager: a start that returned "in progress" finished with result
+void job_queue_unit_ready(Unit *unit, int result);
+// service_manager: a stop that returned "in progress" finished with result
+void job_queue_unit_stopped(Unit *unit, int result);
+
+// Shutdown: pending start and restart jobs are cancelled and new ones
+// refused with -ESHUTDOWN; stop jobs still run
+void job_queue_shutdown(void);
+void job_queue_free(void);
+
+#endif
@@ -0,0 +1,260 @@
+// log.c — asynchronous daemon log
+//
+// The event loop must never wait on a slow console. log_emit() formats into
+// a slot of a preallocated ring (a bounded multi-producer queue with
+// per-slot sequence numbers, so any thread may log) and returns; a writer
+// thread drains the ring with writev() and is the only one that ever blocks
+// on the output.
+#define _GNU_SOURCE
+#include "log.h"
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#define LOG_RING_SLOTS 1024     // power of two
+#define LOG_LINE_MAX 248        // longer messages are truncated
+#define LOG_WRITE_BATCH 64      // lines per writev()
+
+typedef struct {
+    atomic_size_t seq;          // == position: free for that producer; position + 1: filled
+    unsigned short len;
+    char text[LOG_LINE_MAX];    // newline-terminated
+} LogSlot;
+
+LogLevel log_max_level = LOG_LEVEL_INFO;
+
+static LogSlot ring[LOG_RING_SLOTS];
+static atomic_size_t ring_head;         // next position to fill
+static size_t ring_tail;                // next position to write, writer only
+static atomic_ulong dropped;
+
+static atomic_int running;
+static atomic_int writer_waiting;
+static int stopping;                    // under wake_lock
+static pthread_t writer;
+static pthread_mutex_t wake_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake_cond = PTHREAD_COND_INITIALIZER;
+static int out_fd = STDERR_FILENO;
+
+static const char *const level_names[] = {
+    [LOG_LEVEL_ERROR] = "error", [LOG_LEVEL_WARNING] = "warning", [LOG_LEVEL_NOTICE] = "notice",
+    [LOG_LEVEL_INFO] = "info", [LOG_LEVEL_DEBUG] = "debug",
+};
+
+int log_level_from_string(const char *s) {
+    for (int i = 0; i <= LOG_LEVEL_DEBUG; i++)
+        if (strcasecmp(s, level_names[i]) == 0 || (s[0] == '0' + i && s[1] == '\0'))
+            return i;
+    return -1;
+}
+
+static void write_all(const char *p, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(out_fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return;
+        p += n;
+        len -= (size_t)n;
+    }
+}
+
+static void emit_sync(const char *fmt, va_list ap) {
+    char line[LOG_LINE_MAX];
+    int n = vsnprintf(line, sizeof(line) - 1, fmt, ap);
+    if (n < 0) return;
+    if ((size_t)n > sizeof(line) - 2) n = (int)sizeof(line) - 2;
+    line[n++] = '\n';
+    write_all(line, (size_t)n);
+}
+
+void log_emit(LogLevel level, const char *fmt, ...) {
+    if (level > log_max_level)
+        return;
+    va_list ap;
+    va_start(ap, fmt);
+    if (!atomic_load_explicit(&running, memory_order_acquire)) {
+        emit_sync(fmt, ap);
+        va_end(ap);
+        return;
+    }
+
+    // Claim a slot, or give up at once if the ring is full
+    size_t pos = atomic_load_explicit(&ring_head, memory_order_relaxed);
+    LogSlot *slot;
+    for (;;) {
+        slot = &ring[pos & (LOG_RING_SLOTS - 1)];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        if (seq == pos) {
+            if (atomic_compare_exchange_weak_explicit(&ring_head, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
+                break;
+        } else if (seq < pos) {
+            atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+            va_end(ap);
+            return;
+        } else {
+            pos = atomic_load_explicit(&ring_head, memory_order_relaxed);
+        }
+    }
+
+    int n = vsnprintf(slot->text, LOG_LINE_MAX - 1, fmt, ap);
+    va_end(ap);
+    if (n < 0) n = 0;
+    if (n > LOG_LINE_MAX - 2) n = LOG_LINE_MAX - 2;
+    slot->text[n++] = '\n';
+    slot->len = (unsigned short)n;
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+
+    // Pairs with the fence after the writer sets writer_waiting: either it
+    // sees this slot, or we see it waiting
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&writer_waiting, memory_order_relaxed)) {
+        pthread_mutex_lock(&wake_lock);
+        pthread_cond_signal(&wake_cond);
+        pthread_mutex_unlock(&wake_lock);
+    }
+}
+
+void log_lines(LogLevel level, const char *text) {
+    while (*text) {
+        size_t len = strcspn(text, "\n");
+        log_emit(level, "%.*s", (int)len, text);
+        text += len + (text[len] == '\n');
+    }
+}
+
+// Filled slots from ring_tail on, at most max; does not release them
+static size_t ring_ready(size_t max) {
+    size_t n = 0;
+    while (n < max) {
+        const LogSlot *slot = &ring[(ring_tail + n) & (LOG_RING_SLOTS - 1)];
+        if (atomic_load_explicit(&slot->seq, memory_order_acquire) != ring_tail + n + 1)
+            break;
+        n++;
+    }
+    return n;
+}
+
+static void write_batch(size_t n) {
+    struct iovec iov[LOG_WRITE_BATCH + 1];
+    char note[64];
+    size_t k = 0;
+    unsigned long lost = atomic_exchange_explicit(&dropped, 0, memory_order_relaxed);
+    if (lost) {
+        int len = snprintf(note, sizeof(note), "[log] %lu messages dropped\n", lost);
+        iov[k++] = (struct iovec){ note, (size_t)len };
+    }
+    for (size_t i = 0; i < n; i++) {
+        LogSlot *slot = &ring[(ring_tail + i) & (LOG_RING_SLOTS - 1)];
+        iov[k++] = (struct iovec){ slot->text, slot->len };
+    }
+
+    // Short writes are rare (a pipe or tty); finish them line by line
+    ssize_t w;
+    do w = writev(out_fd, iov, (int)k);
+    while (w < 0 && errno == EINTR);
+    for (size_t i = 0; i < k && w >= 0; i++) {
+        if ((size_t)w >= iov[i].iov_len) {
+            w -= (ssize_t)iov[i].iov_len;
+            continue;
+        }
+        write_all((const char *)iov[i].iov_base + w, iov[i].iov_len - (size_t)w);
+        w = 0;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        LogSlot *slot = &ring[ring_tail & (LOG_RING_SLOTS - 1)];
+        atomic_store_explicit(&slot->seq, ring_tail + LOG_RING_SLOTS, memory_order_release);
+        ring_tail++;
+    }
+}
+
+static void *writer_main(void *arg) {
+    (void)arg;
+    for (;;) {
+        size_t n = ring_ready(LOG_WRITE_BATCH);
+        if (n > 0 || atomic_load_explicit(&dropped, memory_order_relaxed)) {
+            write_batch(n);
+            continue;
+        }
+
+        pthread_mutex_lock(&wake_lock);
+        atomic_store_explicit(&writer_waiting, 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        while (!stopping && ring_ready(1) == 0)
+            pthread_cond_wait(&wake_cond, &wake_lock);
+        atomic_store(&writer_waiting, 0);
+        int stop = stopping && ring_ready(1) == 0;
+        pthread_mutex_unlock(&wake_lock);
+        if (stop)
+            return NULL;
+    }
+}
+
+int log_start(void) {
+    if (atomic_load(&running))
+        return 0;
+
+    const char *level = getenv("COREINITD_LOG_LEVEL");
+    if (level && *level) {
+        int l = log_level_from_string(level);
+        if (l >= 0)
+            log_max_level = (LogLevel)l;
+        else
+            log_emit(LOG_LEVEL_WARNING, "[log] Unknown COREINITD_LOG_LEVEL=%s, using info", level);
+    }
+    const char *target = getenv("COREINITD_LOG_TARGET");
+    if (target && *target) {
+        int fd = open(target, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0640);
+        if (fd >= 0)
+            out_fd = fd;
+        else
+            log_emit(LOG_LEVEL_ERROR, "[log] Cannot open %s: %s, logging to stderr", target, strerror(errno));
+    }
+
+    for (size_t i = 0; i < LOG_RING_SLOTS; i++)
+        atomic_init(&ring[i].seq, i);
+    atomic_store(&ring_head, 0);
+    ring_tail = 0;
+    stopping = 0;
+
+    // Only the event loop thread may block signals for sd-event; the writer takes none
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int r = pthread_create(&writer, NULL, writer_main, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (r != 0) {
+        log_emit(LOG_LEVEL_ERROR, "[log] Cannot start writer thread: %s, logging synchronously", strerror(r));
+        return -r;
+    }
+    atomic_store_explicit(&running, 1, memory_order_release);
+
+    static int registered = 0;
+    if (!registered++)
+        atexit(log_stop);
+    return 0;
+}
+
+void log_stop(void) {
+    if (!atomic_exchange(&running, 0))
+        return;
+    pthread_mutex_lock(&wake_lock);
+    stopping = 1;
+    pthread_cond_signal(&wake_cond);
+    pthread_mutex_unlock(&wake_lock);
+    pthread_join(writer, NULL);
+    if (out_fd != STDERR_FILENO) {
+        close(out_fd);
+        out_fd = STDERR_FILENO;
+    }
+}
@@ -0,0 +1,49 @@
+// log.h — leveled daemon log, formatted into a ring and written by a thread
+#ifndef COREINITD_LOG_H
+#define COREINITD_LOG_H
+
+typedef enum {
+    LOG_LEVEL_ERROR,
+    LOG_LEVEL_WARNING,
+    LOG_LEVEL_NOTICE,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_DEBUG,
+} LogLevel;
+
+// Calls above this level are compiled out entirely, arguments included
+#ifndef LOG_LEVEL_COMPILED
+#define LOG_LEVEL_COMPILED LOG_LEVEL_DEBUG
+#endif
+
+// Runtime threshold: $COREINITD_LOG_LEVEL, default info
+extern LogLevel log_max_level;
+
+// A disabled level costs one compare; the arguments are not evaluated
+#define log_at(level, ...) do { \
+        if ((level) <= LOG_LEVEL_COMPILED && (level) <= log_max_level) \
+            log_emit((level), __VA_ARGS__); \
+    } while (0)
+#define log_error(...)   log_at(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define log_warning(...) log_at(LOG_LEVEL_WARNING, __VA_ARGS__)
+#define log_notice(...)  log_at(LOG_LEVEL_NOTICE, __VA_ARGS__)
+#define log_info(...)    log_at(LOG_LEVEL_INFO, __VA_ARGS__)
+#define log_debug(...)   log_at(LOG_LEVEL_DEBUG, __VA_ARGS__)
+
+// One line, without the trailing newline. Never blocks once log_start() has
+// run: the message is formatted into a free ring slot, or dropped (and
+// counted) when the writer has fallen that far behind. Before log_start()
+// and after log_stop() it is written to stderr directly.
+void log_emit(LogLevel level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+// Multi-line text, one message per line
+void log_lines(LogLevel level, const char *text);
+
+// Parse "error", "warning", "notice", "info", "debug" or 0-4; -1 if invalid
+int log_level_from_string(const char *s);
+
+// Start the writer thread. Output goes to $COREINITD_LOG_TARGET when set
+// (a file, appended to), else stderr. log_stop() drains the ring; it also
+// runs at exit.
+int log_start(void);
+void log_stop(void);
+
+#endif
@@ -1,4 +1,4 @@
-// main.c — coreinitd unified daemon with event loop + timerd spawning
+// main.c — coreinitd unified daemon with event loop + timer units
 // 					  systemd executor + socket activation
 // 2025(C) genr8eofl - @ gentoo libera IRC
 #include <systemd/sd-event.h>
@@ -8,118 +8,132 @@
 #include <stdio.h>
 #include <string.h>
 #include <sys/wait.h>
-#include <dirent.h>
-
-#define UNIT_DIR "./etc/units"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/stat.h>
 
 #include "unit_loader.h"
-#define MAX_UNITS 64
-static Unit loaded_units[MAX_UNITS];
-static size_t unit_count = 0;
+#include "unit_registry.h"
+#include "unit_cache.h"
+#include "unit_scan.h"
 
 #include "service_manager.h"
 #include "socket_activation.h"
+#include "accept_pool.h"
 #include "event_loop.h"
-
-// ───────────────────
-// Timer unit launcher
-// ───────────────────
-void spawn_timerd_for(const char *filename) {
-    char path[256];
-    snprintf(path, sizeof(path), "%s/%s", UNIT_DIR, filename);
-
-    pid_t pid = fork();
-    if (pid == 0) {
-        // child
-        execl("./build/helpers/timerd", "timerd", path, NULL);
-        perror("execl failed for timerd");
-        _exit(1);
-    } else if (pid < 0) {
-        perror("fork failed for timerd");
-    } else {
-        fprintf(stderr, "[coreinitd] Started timerd for %s (PID %d)\n", filename, pid);
-    }
-}
+#include "scheduler.h"
+#include "timerd.h"
+#include "job_queue.h"
+#include "trace.h"
+#include "notify.h"
+#include "control.h"
+#include "reload.h"
+#include "service_log.h"
+#include "cgroup.h"
+#include "shutdown.h"
+#include "log.h"
+#include "spawn.h"
+#include "util.h"
 
 void load_all_units(void) {
-    DIR *d = opendir(UNIT_DIR);
-    if (!d) {
-        perror("opendir failed");
+    UnitSearchPath sp;
+    if (unit_search_path_init(&sp) < 0) {
+        log_error("[coreinitd] Out of memory building the unit search path");
         return;
     }
+    uint64_t t0 = now_usec();
 
-    struct dirent *ent;
-    while ((ent = readdir(d))) {
-        if (!(strstr(ent->d_name, ".service") ||
-            strstr(ent->d_name, ".socket") ||
-            strstr(ent->d_name, ".timer"))) continue;
-
-        if (unit_count >= MAX_UNITS) {
-            fprintf(stderr, "[coreinitd] Unit limit reached\n");
-            break;
-        }
-
-        char path[512];
-        snprintf(path, sizeof(path), "%s/%s", UNIT_DIR, ent->d_name);
-        const char *type_str = "unknown";
-
-        if (load_unit(path, &loaded_units[unit_count]) == 0) {
-            switch (loaded_units[unit_count].type) {
-                case UNIT_SERVICE: type_str = "service"; break;
-                case UNIT_SOCKET: type_str = "socket"; break;
-                case UNIT_TIMER: type_str = "timer"; break;
-                default: break;
-            }
-            fprintf(stderr, "[coreinitd] Loaded %s unit: %s → %s\n",
-                type_str, ent->d_name, loaded_units[unit_count].exec_start);
-            unit_count++;
-        } else {
-            fprintf(stderr, "[coreinitd] Failed to load %s\n", ent->d_name);
-        }
-    }
-
-    closedir(d);
-}
-
-void spawn_all_timer_units(void) {
-    DIR *d = opendir(UNIT_DIR);
-    if (!d) {
-        perror("opendir failed");
-        return;
+    int r = unit_cache_load(UNIT_CACHE_PATH, (const char *const *)sp.dirs, sp.n_dirs);
+    if (r >= 0) {
+        log_info("[coreinitd] Loaded %d units from %s in %.3f ms (warm)",
+                 r, UNIT_CACHE_PATH, (now_usec() - t0) / 1000.0);
+    } else {
+        if (r != -ENOENT)
+            log_warning("[coreinitd] Unit cache not usable (%s), parsing unit files", strerror(-r));
+
+        size_t failed = 0, parsed = 0;
+        UnitCacheWriter *w = unit_cache_writer_new();
+        if (w)
+            parsed = unit_scan_load(&sp, w, &failed);
+        else
+            failed++;
+        log_info("[coreinitd] Parsed %zu unit files in %.3f ms (cold)",
+                 parsed, (now_usec() - t0) / 1000.0);
+
+        // A file that failed to load is not in the cache, so never cache a partial load
+        if (w && failed == 0 && (r = unit_cache_writer_commit(w, UNIT_CACHE_PATH)) < 0)
+            log_error("[coreinitd] Failed to write %s: %s", UNIT_CACHE_PATH, strerror(-r));
+        unit_cache_writer_free(w);
     }
-
-    struct dirent *ent;
-    while ((ent = readdir(d))) {
-        if (strstr(ent->d_name, ".timer"))
-            spawn_timerd_for(ent->d_name);
+    unit_search_path_free(&sp);
+    unit_registry_log_memory();
+
+    for (size_t i = 0; i < unit_registry_count(); i++) {
+        const Unit *u = unit_registry_get(i);
+        const char *type_str = "unknown", *what = "";
+        switch (u->type) {
+            case UNIT_SERVICE: type_str = "service"; what = u->exec_start; break;
+            case UNIT_SOCKET: type_str = "socket"; what = u->listen_stream; break;
+            case UNIT_TIMER: type_str = "timer"; what = u->timer_unit; break;
+            default: break;
+        }
+        log_debug("[coreinitd] Loaded %s unit: %s → %s",
+            type_str, u->name, what);
     }
-
-    closedir(d);
 }
 
 // ─────────────────
 // Main Entry Point
 // ─────────────────
-int main(void) {
-    fprintf(stderr, "[coreinitd-main] Starting...\n");
-//TODO: [coreinitd-event] SIGCHLD already has a handler!
-//    if (event_loop_init() < 0)
-//        return 1;
-
+int main(int argc, char *argv[]) {
+    if (argc > 2 && strcmp(argv[1], ACCEPT_WORKER_ARG) == 0)
+        return accept_pool_worker(argv + 2);
+
+    log_start();                // writer thread for everything below
+    log_info("[coreinitd-main] Starting...");
+    if (event_loop_init() < 0)
+        return 1;
+    int r = spawn_raise_fd_limit();     // log pipes, cgroup dirs and pidfds per unit
+    if (r < 0)
+        log_warning("[coreinitd-main] Cannot raise the open file limit: %s", strerror(-r));
+
+    trace_start(event);         // SIGUSR1: dump the activation timeline
     load_all_units();           // Parses and loads .service files
-    //Starts all valid services
-    for (size_t i = 0; i < unit_count; i++) {
-        if (loaded_units[i].type == UNIT_SERVICE) {
-            service_manager_start(&loaded_units[i]);
-        }
-    }
-
-    spawn_all_timer_units();    // Spawns timerd for .timer files
-
-    socket_activation_start(event, loaded_units, unit_count);	// socket_activation.c
+    if (notify_start(event) < 0)    // NOTIFY_SOCKET for Type=notify services
+        log_warning("[coreinitd-main] No notify socket, Type=notify services will not become ready");
+    cgroup_start();                 // a cgroup per service, if cgroup v2 is there
+    if (service_log_start(event) < 0)   // per-service stdout/stderr capture
+        log_warning("[coreinitd-main] Service output goes to our stderr");
+    // Listeners exist before any service runs, so clients can connect from the start
+    socket_activation_start(event);	// socket_activation.c
+    // Starts services in dependency order once the event loop runs
+    if (scheduler_start(event) < 0)
+        log_error("[coreinitd-main] Dependency scheduler failed to start");
+
+    if (timerd_start(event) < 0)    // Arms .timer units on the same loop
+        log_error("[coreinitd-main] Failed to schedule timer units");
+    if (control_start(event) < 0)   // coreinitctl
+        log_warning("[coreinitd-main] No control socket, coreinitctl will not work");
+    if (reload_start(event) < 0)    // inotify + SIGHUP unit reload
+        log_warning("[coreinitd-main] Unit reload unavailable");
+    if (shutdown_start(event) < 0)  // SIGTERM/SIGINT: stop units, then exit
+        log_warning("[coreinitd-main] Units will not be stopped on exit");
 
     int ret = event_loop_run();
+    shutdown_stop();
+    reload_stop();
+    timerd_stop();
+    trace_stop();
+    notify_stop();
+    job_queue_free();
+    control_stop();
+    scheduler_stop();
     socket_activation_stop();
+    service_log_stop();
+    cgroup_stop();
     event_loop_shutdown();
+    unit_registry_free();
+    log_stop();
     return ret;
 }
@@ -0,0 +1,231 @@
+// notify.c — NOTIFY_SOCKET receiver: READY=1, STATUS=, MAINPID=, WATCHDOG=
+//
+// One SOCK_DGRAM socket for every service, drained with recvmmsg() in
+// batches. The kernel stamps each datagram with the sender's credentials
+// (SO_PASSCRED), which is what NotifyAccess= is checked against; the
+// message's contents never name the unit.
+#define _GNU_SOURCE
+#include "notify.h"
+#include "log.h"
+#include "service_manager.h"
+#include "util.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+
+#define NOTIFY_BATCH 16             // datagrams per recvmmsg()
+#define NOTIFY_BUFFER_MAX 4096      // longer messages are dropped, like systemd
+#define NOTIFY_FD_MAX 16            // FDSTORE= is not supported; received fds are closed
+#define NOTIFY_PARENT_DEPTH 8       // NotifyAccess=all: how far up to look for the main process
+
+static int notify_fd = -1;
+static sd_event_source *notify_source = NULL;
+static char notify_path[PATH_MAX];
+static char notify_env[sizeof("NOTIFY_SOCKET=") + PATH_MAX];
+
+static char buffers[NOTIFY_BATCH][NOTIFY_BUFFER_MAX + 1];
+static union {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(sizeof(struct ucred)) + CMSG_SPACE(sizeof(int) * NOTIFY_FD_MAX)];
+} controls[NOTIFY_BATCH];
+
+const char *notify_socket_env(void) {
+    return notify_fd >= 0 ? notify_env : NULL;
+}
+
+// PPid from /proc/<pid>/stat, 0 if it cannot be read
+static pid_t parent_pid(pid_t pid) {
+    char path[32], buf[512];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 0;
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) return 0;
+    buf[n] = '\0';
+
+    // comm may contain anything, including ") ": skip to the last ')'
+    const char *p = strrchr(buf, ')');
+    int ppid;
+    if (!p || sscanf(p + 1, " %*c %d", &ppid) != 1)
+        return 0;
+    return (pid_t)ppid;
+}
+
+// The supervised main process that sent this, or whose descendant did
+static ServiceEntry *find_sender(pid_t pid, int *ret_main) {
+    ServiceEntry *e = service_manager_lookup(pid);
+    *ret_main = e != NULL;
+    for (int depth = 0; !e && depth < NOTIFY_PARENT_DEPTH; depth++) {
+        pid = parent_pid(pid);
+        if (pid <= 1) break;
+        e = service_manager_lookup(pid);
+    }
+    return e && !e->instance ? e : NULL;
+}
+
+static int access_allowed(const ServiceEntry *e, int from_main) {
+    switch (e->unit->notify_access) {
+        case NOTIFY_ACCESS_MAIN:
+        case NOTIFY_ACCESS_EXEC:
+            return from_main;
+        case NOTIFY_ACCESS_ALL:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static void handle_message(pid_t sender, char *msg) {
+    int from_main;
+    ServiceEntry *e = find_sender(sender, &from_main);
+    if (!e) {
+        log_warning("[notify] Message from PID %d, which belongs to no service, ignoring", sender);
+        return;
+    }
+    if (!access_allowed(e, from_main)) {
+        log_warning("[notify] %s: message from PID %d rejected by NotifyAccess=", e->unit->name, sender);
+        return;
+    }
+
+    // systemd applies MAINPID= before READY=1 regardless of their order
+    int ready = 0, watchdog = 0, watchdog_trigger = 0;
+    pid_t main_pid = 0;
+    const char *status = NULL;
+    char *save = NULL;
+    for (char *line = strtok_r(msg, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+        if (strcmp(line, "READY=1") == 0)
+            ready = 1;
+        else if (strncmp(line, "STATUS=", 7) == 0)
+            status = line + 7;
+        else if (strncmp(line, "MAINPID=", 8) == 0)
+            main_pid = (pid_t)strtol(line + 8, NULL, 10);
+        else if (strcmp(line, "WATCHDOG=1") == 0)
+            watchdog = 1;
+        else if (strcmp(line, "WATCHDOG=trigger") == 0)
+            watchdog_trigger = 1;
+    }
+
+    if (main_pid > 0 && service_manager_set_main_pid(e, main_pid) < 0)
+        log_warning("[notify] %s: ignoring MAINPID=%d", e->unit->name, main_pid);
+    if (status)
+        service_manager_set_status(e, status);
+    if (watchdog || watchdog_trigger)
+        service_manager_watchdog(e, watchdog_trigger);
+    if (ready)
+        service_manager_ready(e);
+}
+
+static int on_notify(sd_event_source *s, int fd, uint32_t revents, void *userdata) {
+    (void)s;
+    (void)revents;
+    (void)userdata;
+
+    struct mmsghdr msgs[NOTIFY_BATCH];
+    struct iovec iov[NOTIFY_BATCH];
+    memset(msgs, 0, sizeof(msgs));
+    for (int i = 0; i < NOTIFY_BATCH; i++) {
+        iov[i] = (struct iovec){ buffers[i], NOTIFY_BUFFER_MAX };
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_control = controls[i].buf;
+        msgs[i].msg_hdr.msg_controllen = sizeof(controls[i].buf);
+    }
+
+    // Level-triggered: anything left over wakes us again on the next iteration
+    int n = recvmmsg(fd, msgs, NOTIFY_BATCH, MSG_DONTWAIT | MSG_CMSG_CLOEXEC, NULL);
+    if (n < 0) {
+        if (errno != EAGAIN && errno != EINTR)
+            log_error("[notify] recvmmsg failed: %s", strerror(errno));
+        return 0;
+    }
+
+    for (int i = 0; i < n; i++) {
+        struct msghdr *h = &msgs[i].msg_hdr;
+        const struct ucred *cred = NULL;
+        for (struct cmsghdr *c = CMSG_FIRSTHDR(h); c; c = CMSG_NXTHDR(h, c)) {
+            if (c->cmsg_level != SOL_SOCKET) continue;
+            if (c->cmsg_type == SCM_CREDENTIALS && c->cmsg_len == CMSG_LEN(sizeof(struct ucred))) {
+                cred = (const struct ucred *)CMSG_DATA(c);
+            } else if (c->cmsg_type == SCM_RIGHTS) {
+                const int *fds = (const int *)CMSG_DATA(c);
+                for (size_t k = 0; k < (c->cmsg_len - CMSG_LEN(0)) / sizeof(int); k++)
+                    close(fds[k]);
+            }
+        }
+
+        if (h->msg_flags & (MSG_TRUNC | MSG_CTRUNC)) {
+            log_warning("[notify] Dropping oversized message");
+            continue;
+        }
+        if (!cred || cred->pid <= 0) {
+            log_warning("[notify] Dropping message without sender credentials");
+            continue;
+        }
+        buffers[i][msgs[i].msg_len] = '\0';
+        handle_message(cred->pid, buffers[i]);
+    }
+    return 0;
+}
+
+int notify_start(sd_event *event) {
+    // NOTIFY_SOCKET must be absolute (or abstract) for sd_notify() to use it
+    char *path = notify_path;
+    if (NOTIFY_SOCKET_PATH[0] == '/') {
+        snprintf(path, sizeof(notify_path), "%s", NOTIFY_SOCKET_PATH);
+    } else {
+        char cwd[PATH_MAX];
+        if (!getcwd(cwd, sizeof(cwd)))
+            return -errno;
+        int n = snprintf(path, sizeof(notify_path), "%s/%s", cwd,
+                         strncmp(NOTIFY_SOCKET_PATH, "./", 2) == 0 ? NOTIFY_SOCKET_PATH + 2 : NOTIFY_SOCKET_PATH);
+        if (n < 0 || (size_t)n >= sizeof(notify_path))
+            return -ENAMETOOLONG;
+    }
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        log_error("[notify] Socket path %s too long", path);
+        return -ENAMETOOLONG;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd < 0)
+        return -errno;
+    int one = 1;
+    mkdir_parents(path);
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        setsockopt(fd, SOL_SOCKET, SO_PASSCRED, &one, sizeof(one)) < 0) {
+        int r = -errno;
+        log_error("[notify] Cannot listen on %s: %s", path, strerror(errno));
+        close(fd);
+        return r;
+    }
+
+    int r = sd_event_add_io(event, &notify_source, fd, EPOLLIN, on_notify, NULL);
+    if (r < 0) {
+        log_error("[notify] Failed to watch %s: %s", path, strerror(-r));
+        close(fd);
+        return r;
+    }
+    sd_event_source_set_io_fd_own(notify_source, 1);
+    notify_fd = fd;
+    snprintf(notify_env, sizeof(notify_env), "NOTIFY_SOCKET=%s", path);
+    log_info("[notify] Listening on %s", path);
+    return 0;
+}
+
+void notify_stop(void) {
+    if (notify_fd >= 0)
+        unlink(notify_path);
+    notify_source = sd_event_source_unref(notify_source);   // closes notify_fd
+    notify_fd = -1;
+}
@@ -0,0 +1,18 @@
+// notify.h — NOTIFY_SOCKET receiver for sd_notify() messages from services
+#ifndef COREINITD_NOTIFY_H
+#define COREINITD_NOTIFY_H
+
+#include <systemd/sd-event.h>
+
+#ifndef NOTIFY_SOCKET_PATH
+#define NOTIFY_SOCKET_PATH "./run/coreinitd/notify"
+#endif
+
+// Bind the datagram socket and watch it; services learn it via NOTIFY_SOCKET=
+int notify_start(sd_event *event);
+void notify_stop(void);
+
+// "NOTIFY_SOCKET=<absolute path>" for a child's environment, NULL if not listening
+const char *notify_socket_env(void);
+
+#endif
@@ -0,0 +1,388 @@
+// reload.c — incremental unit reload: stamps, diff, swap in place
+//
+// Every loaded unit has a stamp (device, inode, size, mtime) of its file.
+// inotify names the files that changed, so an edit costs a few fstatat()
+// calls and one parse no matter how many units exist; SIGHUP re-stats every
+// unit file but still parses only those whose stamp moved. A re-parsed unit
+// identical to the loaded one is dropped. A changed one is copied over the
+// registered Unit, so every pointer to it stays valid, and only the
+// subsystem owning the changed part hears about it: running services keep
+// their PIDs, sockets and timers unless their own definition changed.
+#define _GNU_SOURCE
+#include "reload.h"
+#include "log.h"
+#include "unit_loader.h"
+#include "unit_registry.h"
+#include "unit_scan.h"
+#include "service_manager.h"
+#include "socket_activation.h"
+#include "timerd.h"
+#include "job_queue.h"
+#include "cgroup.h"
+#include "util.h"
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+
+#define RELOAD_DEBOUNCE_USEC (100 * USEC_PER_MSEC)  // editors save in several steps
+#define RELOAD_WATCH_MASK (IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+                           IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+typedef struct {
+    uint64_t dev, ino, size;
+    int64_t mtime_sec, mtime_nsec;
+} FileStamp;
+
+static UnitSearchPath search_path;
+static FileStamp *stamps = NULL;        // indexed by Unit.id
+static size_t stamps_cap = 0;
+
+static sd_event *reload_event = NULL;
+static sd_event_source *inotify_source = NULL;
+static sd_event_source *sighup_source = NULL;
+static sd_event_source *debounce_source = NULL;
+
+static char **pending = NULL;           // file names inotify reported since the last pass
+static size_t n_pending = 0, pending_cap = 0;
+static int pending_all = 0;             // a watch was lost or the queue overflowed
+
+static FileStamp stamp_of(const struct stat *st) {
+    return (FileStamp){ st->st_dev, st->st_ino, (uint64_t)st->st_size,
+                        st->st_mtim.tv_sec, st->st_mtim.tv_nsec };
+}
+
+static int stamp_set(size_t id, const struct stat *st) {
+    if (id >= stamps_cap) {
+        size_t cap = stamps_cap ? stamps_cap : 64;
+        while (cap <= id) cap *= 2;
+        FileStamp *t = realloc(stamps, cap * sizeof(*t));
+        if (!t) return -ENOMEM;
+        memset(t + stamps_cap, 0, (cap - stamps_cap) * sizeof(*t));
+        stamps = t;
+        stamps_cap = cap;
+    }
+    stamps[id] = stamp_of(st);
+    return 0;
+}
+
+static int stamp_same(size_t id, const struct stat *st) {
+    FileStamp s = stamp_of(st);
+    return id < stamps_cap && memcmp(&stamps[id], &s, sizeof(s)) == 0;
+}
+
+// Tell the owning subsystem; only a hard change touches anything running
+static void unit_changed(Unit *u, UnitDiff diff) {
+    // New limits apply to what is running right away
+    if (diff != UNIT_DIFF_NONE && u->type == UNIT_SERVICE && !u->not_found)
+        cgroup_apply(u);
+    if (diff != UNIT_DIFF_HARD)
+        return;
+    switch (u->type) {
+        case UNIT_SERVICE: {
+            socket_activation_service_changed(u);
+            timerd_service_changed(u);
+            ServiceState state = service_manager_state(u);
+            if (state != SERVICE_STARTING && state != SERVICE_ACTIVE)
+                break;
+            if (u->not_found) {
+                log_warning("[reload] %s keeps running until it is stopped", u->name);
+            } else {
+                log_info("[reload] %s definition changed, restarting", u->name);
+                job_enqueue(u, JOB_RESTART, NULL, NULL);
+            }
+            break;
+        }
+        case UNIT_SOCKET:
+            socket_activation_reload(u);
+            break;
+        case UNIT_TIMER:
+            timerd_reload(u);
+            break;
+        default:
+            break;
+    }
+}
+
+// Re-resolve one unit name against the search path; 1 if anything changed
+static int reload_name(const char *file, const int *dir_fds) {
+    struct stat st;
+    size_t dir;
+    for (dir = 0; dir < search_path.n_dirs; dir++)
+        if (dir_fds[dir] >= 0 && fstatat(dir_fds[dir], file, &st, 0) == 0 && S_ISREG(st.st_mode))
+            break;
+    Unit *old = unit_registry_find(file);
+
+    if (dir == search_path.n_dirs) {
+        if (!old || old->not_found)
+            return 0;
+        log_info("[reload] %s removed", file);
+        old->not_found = 1;
+        unit_changed(old, UNIT_DIFF_HARD);
+        return 1;
+    }
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", search_path.dirs[dir], file);
+    if (old && !old->not_found && stamp_same(old->id, &st) && strcmp(old->path, path) == 0)
+        return 0;
+
+    Unit nu;
+    if (load_unit_at(dir_fds[dir], file, path, &nu, NULL, NULL) < 0) {
+        log_error("[reload] Failed to load %s, keeping the loaded definition", path);
+        unit_free(&nu);
+        return 0;
+    }
+
+    if (!old) {
+        Unit *u;
+        int r = unit_registry_add(&nu, &u);
+        if (r < 0) {
+            log_error("[reload] Failed to register %s: %s", file, strerror(-r));
+            unit_free(&nu);
+            return 0;
+        }
+        stamp_set(u->id, &st);
+        log_info("[reload] %s added", file);
+        unit_changed(u, UNIT_DIFF_HARD);
+        return 1;
+    }
+
+    UnitDiff diff = old->not_found ? UNIT_DIFF_HARD : unit_diff(old, &nu);
+    stamp_set(old->id, &st);
+    if (diff == UNIT_DIFF_NONE) {
+        unit_free(&nu);
+        return 0;
+    }
+
+    Unit prev = *old;
+    nu.id = prev.id;
+    *old = nu;
+    log_info("[reload] %s %s", file, prev.not_found ? "restored" : "changed");
+    unit_changed(old, diff);
+    // Only now: warm pools borrowed the old ExecStart= argv until they were rebuilt
+    unit_free(&prev);
+    return 1;
+}
+
+static int *open_dirs(void) {
+    int *fds = malloc((search_path.n_dirs ? search_path.n_dirs : 1) * sizeof(*fds));
+    if (!fds) return NULL;
+    for (size_t i = 0; i < search_path.n_dirs; i++)
+        fds[i] = open(search_path.dirs[i], O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    return fds;
+}
+
+static void close_dirs(int *fds) {
+    for (size_t i = 0; i < search_path.n_dirs; i++)
+        if (fds[i] >= 0) close(fds[i]);
+    free(fds);
+}
+
+static int reload_everything(const int *dir_fds) {
+    int changed = 0;
+    // Loaded units first: edits and removals
+    for (size_t id = 0; id < unit_registry_count(); id++)
+        changed += reload_name(unit_registry_get(id)->name, dir_fds);
+
+    // Then names nobody has loaded yet
+    for (size_t i = 0; i < search_path.n_dirs; i++) {
+        if (dir_fds[i] < 0) continue;
+        int fd = dup(dir_fds[i]);
+        DIR *d = fd >= 0 ? fdopendir(fd) : NULL;
+        if (!d) {
+            if (fd >= 0) close(fd);
+            continue;
+        }
+        struct dirent *ent;
+        while ((ent = readdir(d)))
+            if (unit_scan_is_unit_file(ent->d_name) && !unit_registry_find(ent->d_name))
+                changed += reload_name(ent->d_name, dir_fds);
+        closedir(d);
+    }
+    return changed;
+}
+
+int reload_all(void) {
+    int *dir_fds = open_dirs();
+    if (!dir_fds)
+        return -ENOMEM;
+    uint64_t t0 = now_usec();
+    int changed = reload_everything(dir_fds);
+    close_dirs(dir_fds);
+    log_notice("[reload] Checked %zu units, %d changed, in %.3f ms",
+               unit_registry_count(), changed, (now_usec() - t0) / 1000.0);
+    if (changed)
+        unit_registry_log_memory();
+    return changed;
+}
+
+static void pending_clear(void) {
+    for (size_t i = 0; i < n_pending; i++)
+        free(pending[i]);
+    n_pending = 0;
+    pending_all = 0;
+}
+
+static int on_debounce(sd_event_source *s, uint64_t usec, void *userdata) {
+    (void)s;
+    (void)usec;
+    (void)userdata;
+
+    if (pending_all) {
+        pending_clear();
+        reload_all();
+        return 0;
+    }
+    int *dir_fds = open_dirs();
+    if (!dir_fds)
+        return 0;
+    uint64_t t0 = now_usec();
+    int changed = 0;
+    for (size_t i = 0; i < n_pending; i++)
+        changed += reload_name(pending[i], dir_fds);
+    close_dirs(dir_fds);
+    if (changed) {
+        log_notice("[reload] %zu files touched, %d units changed, in %.3f ms",
+                   n_pending, changed, (now_usec() - t0) / 1000.0);
+        unit_registry_log_memory();
+    }
+    pending_clear();
+    return 0;
+}
+
+static void pending_add(const char *name) {
+    for (size_t i = 0; i < n_pending; i++)
+        if (strcmp(pending[i], name) == 0)
+            return;
+    if (n_pending == pending_cap) {
+        size_t cap = pending_cap ? pending_cap * 2 : 16;
+        char **t = realloc(pending, cap * sizeof(*t));
+        if (!t) {
+            pending_all = 1;
+            return;
+        }
+        pending = t;
+        pending_cap = cap;
+    }
+    if (!(pending[n_pending] = strdup(name)))
+        pending_all = 1;
+    else
+        n_pending++;
+}
+
+static int on_inotify(sd_event_source *s, int fd, uint32_t revents, void *userdata) {
+    (void)s;
+    (void)revents;
+    (void)userdata;
+
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t n = read(fd, buf, sizeof(buf));
+    if (n <= 0)
+        return 0;
+
+    int any = 0;
+    for (char *p = buf; p < buf + n; ) {
+        const struct inotify_event *ev = (const struct inotify_event *)p;
+        p += sizeof(*ev) + ev->len;
+        if (ev->mask & (IN_Q_OVERFLOW | IN_DELETE_SELF | IN_MOVE_SELF)) {
+            pending_all = any = 1;
+        } else if (ev->len && unit_scan_is_unit_file(ev->name)) {
+            pending_add(ev->name);
+            any = 1;
+        }
+    }
+    if (!any)
+        return 0;
+
+    // Restart the quiet period on every event so one save is one reload
+    if (!debounce_source) {
+        int r = sd_event_add_time_relative(reload_event, &debounce_source, CLOCK_MONOTONIC,
+                                           RELOAD_DEBOUNCE_USEC, RELOAD_DEBOUNCE_USEC / 10, on_debounce, NULL);
+        if (r < 0)
+            log_error("[reload] Failed to schedule reload: %s", strerror(-r));
+        return 0;
+    }
+    sd_event_source_set_time_relative(debounce_source, RELOAD_DEBOUNCE_USEC);
+    sd_event_source_set_enabled(debounce_source, SD_EVENT_ONESHOT);
+    return 0;
+}
+
+static int on_sighup(sd_event_source *s, const struct signalfd_siginfo *si, void *userdata) {
+    (void)s;
+    (void)si;
+    (void)userdata;
+    log_notice("[reload] SIGHUP, re-checking all unit files");
+    pending_clear();
+    reload_all();
+    return 0;
+}
+
+int reload_start(sd_event *event) {
+    reload_event = event;
+    int r = unit_search_path_init(&search_path);
+    if (r < 0)
+        return r;
+
+    // Stamps for what load_all_units() just loaded
+    for (size_t id = 0; id < unit_registry_count(); id++) {
+        struct stat st;
+        if (stat(unit_registry_get(id)->path, &st) == 0)
+            stamp_set(id, &st);
+    }
+
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGHUP);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0)
+        return -errno;
+    r = sd_event_add_signal(event, &sighup_source, SIGHUP, on_sighup, NULL);
+    if (r < 0) {
+        log_error("[reload] Failed to add SIGHUP handler: %s", strerror(-r));
+        return r;
+    }
+
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) {
+        log_warning("[reload] No inotify (%s), reloading on SIGHUP only", strerror(errno));
+        return 0;
+    }
+    size_t watched = 0;
+    for (size_t i = 0; i < search_path.n_dirs; i++) {
+        if (inotify_add_watch(fd, search_path.dirs[i], RELOAD_WATCH_MASK) >= 0)
+            watched++;
+        else if (errno != ENOENT)
+            log_error("[reload] Cannot watch %s: %s", search_path.dirs[i], strerror(errno));
+    }
+    r = sd_event_add_io(event, &inotify_source, fd, EPOLLIN, on_inotify, NULL);
+    if (r < 0) {
+        log_error("[reload] Failed to watch inotify fd: %s", strerror(-r));
+        close(fd);
+        return 0;
+    }
+    sd_event_source_set_io_fd_own(inotify_source, 1);
+    // Directories created later are only seen on SIGHUP
+    log_info("[reload] Watching %zu of %zu unit directories", watched, search_path.n_dirs);
+    return 0;
+}
+
+void reload_stop(void) {
+    inotify_source = sd_event_source_unref(inotify_source);
+    sighup_source = sd_event_source_unref(sighup_source);
+    debounce_source = sd_event_source_unref(debounce_source);
+    pending_clear();
+    free(pending);
+    free(stamps);
+    pending = NULL;
+    stamps = NULL;
+    pending_cap = stamps_cap = 0;
+    unit_search_path_free(&search_path);
+    reload_event = NULL;
+}
@@ -0,0 +1,15 @@
+// reload.h — pick up edited, added and removed unit files without restarting
+#ifndef COREINITD_RELOAD_H
+#define COREINITD_RELOAD_H
+
+#include <systemd/sd-event.h>
+
+// Watch the unit search path with inotify; SIGHUP forces a full re-check
+int reload_start(sd_event *event);
+void reload_stop(void);
+
+// Re-stat every unit file now and apply whatever changed.
+// Returns the number of units changed, added or removed.
+int reload_all(void);
+
+#endif
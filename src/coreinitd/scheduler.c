@@ -0,0 +1,310 @@
+// scheduler.c — build the unit dependency DAG and start units in parallel waves
+//
+// Ordering (After=/Before=) decides *when* a unit may start; requirement
+// (Requires=) decides *whether* it may start once its turn comes. Wants=
+// only records the relationship, it never blocks or fails a unit.
+#include "scheduler.h"
+#include "log.h"
+#include "service_manager.h"
+#include "job_queue.h"
+#include "trace.h"
+#include "socket_activation.h"
+#include "timerd.h"
+#include "unit_registry.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+
+typedef enum {
+    NODE_WAITING,
+    NODE_QUEUED,
+    NODE_RUNNING,
+    NODE_DONE,
+    NODE_FAILED
+} NodeState;
+
+typedef struct {
+    size_t *v;
+    size_t n, cap;
+} IndexList;
+
+typedef struct {
+    Unit *unit;
+    NodeState state;
+    size_t pending;         // ordering predecessors not finished yet
+    IndexList successors;   // units ordered after this one
+    IndexList requires;     // units this one Requires=
+} SchedNode;
+
+static SchedNode *nodes = NULL;
+static size_t node_count = 0;
+static size_t finished_count = 0;
+
+// FIFO of nodes whose ordering is satisfied; every node enters it at most once
+static size_t *ready = NULL;
+static size_t ready_head = 0, ready_tail = 0;
+
+static sd_event_source *dispatch_source = NULL;
+static uint64_t boot_start_usec = 0;
+
+static int list_push(IndexList *l, size_t idx) {
+    if (l->n == l->cap) {
+        size_t cap = l->cap ? l->cap * 2 : 4;
+        size_t *v = realloc(l->v, cap * sizeof(*v));
+        if (!v) return -ENOMEM;
+        l->v = v;
+        l->cap = cap;
+    }
+    l->v[l->n++] = idx;
+    return 0;
+}
+
+// Nodes are indexed by Unit.id
+static int find_node(const char *name, size_t *out) {
+    Unit *u = unit_registry_find(name);
+    if (!u || u->id >= node_count)
+        return -ENOENT;
+    *out = u->id;
+    return 0;
+}
+
+static int add_ordering(size_t first, size_t then) {
+    int r = list_push(&nodes[first].successors, then);
+    if (r < 0) return r;
+    nodes[then].pending++;
+    return 0;
+}
+
+// Walk a space-separated list of unit names, calling fn for each resolved node
+static int for_each_dep(size_t self, const char *list, const char *key,
+                        int (*fn)(size_t self, size_t dep)) {
+    char name[UNIT_NAME_MAX + 1];
+    while (unit_list_next(&list, name)) {
+        size_t dep;
+        if (find_node(name, &dep) < 0) {
+            log_warning("[scheduler] %s: %s=%s not loaded, ignoring",
+                        nodes[self].unit->name, key, name);
+            continue;
+        }
+        int r = fn(self, dep);
+        if (r < 0) return r;
+    }
+    return 0;
+}
+
+static int dep_after(size_t self, size_t dep)    { return add_ordering(dep, self); }
+static int dep_before(size_t self, size_t dep)   { return add_ordering(self, dep); }
+static int dep_requires(size_t self, size_t dep) { return list_push(&nodes[self].requires, dep); }
+static int dep_wants(size_t self, size_t dep)    { (void)self; (void)dep; return 0; }
+
+static void enqueue(size_t idx) {
+    nodes[idx].state = NODE_QUEUED;
+    ready[ready_tail++] = idx;
+    if (dispatch_source)
+        sd_event_source_set_enabled(dispatch_source, SD_EVENT_ONESHOT);
+}
+
+static void node_finish(size_t idx, int success) {
+    SchedNode *n = &nodes[idx];
+    if (n->state == NODE_DONE || n->state == NODE_FAILED)
+        return;
+
+    n->state = success ? NODE_DONE : NODE_FAILED;
+    finished_count++;
+
+    for (size_t i = 0; i < n->successors.n; i++) {
+        SchedNode *s = &nodes[n->successors.v[i]];
+        if (s->pending > 0 && --s->pending == 0 && s->state == NODE_WAITING)
+            enqueue(n->successors.v[i]);
+    }
+
+    if (finished_count == node_count) {
+        uint64_t now = now_usec();
+        size_t failed = 0;
+        for (size_t i = 0; i < node_count; i++)
+            if (nodes[i].state == NODE_FAILED) failed++;
+        log_notice("[scheduler] Boot transaction complete: %zu units, %zu failed, %" PRIu64 " ms",
+                   node_count, failed, now > boot_start_usec ? (now - boot_start_usec) / 1000 : 0);
+
+        int r = trace_write_chrome(TRACE_PATH);
+        if (r < 0)
+            log_error("[scheduler] Failed to write %s: %s", TRACE_PATH, strerror(-r));
+        trace_log_report(trace_critical_chain);
+    }
+}
+
+static void on_start_done(Unit *unit, JobType type, int result, void *userdata) {
+    (void)unit;
+    (void)type;
+    // > 0 means the service is still starting and will report back later
+    if (result <= 0)
+        node_finish((size_t)(uintptr_t)userdata, result == 0);
+}
+
+static void node_launch(size_t idx) {
+    SchedNode *n = &nodes[idx];
+
+    for (size_t i = 0; i < n->requires.n; i++) {
+        SchedNode *req = &nodes[n->requires.v[i]];
+        if (req->state == NODE_FAILED) {
+            log_error("[scheduler] Dependency failed for %s (requires %s)",
+                      n->unit->name, req->unit->name);
+            node_finish(idx, 0);
+            return;
+        }
+    }
+
+    n->state = NODE_RUNNING;
+    if (n->unit->type != UNIT_SERVICE || socket_activation_triggers(n->unit) || timerd_triggers(n->unit)) {
+        // Sockets and timers are armed by their own subsystems, and
+        // the services they trigger start when they fire
+        node_finish(idx, 1);
+        return;
+    }
+
+    if (job_enqueue(n->unit, JOB_START, on_start_done, (void *)(uintptr_t)idx) < 0)
+        node_finish(idx, 0);
+}
+
+static int on_dispatch(sd_event_source *s, void *userdata) {
+    (void)s;
+    (void)userdata;
+
+    // Only launch the current wave; units it releases start next iteration
+    size_t end = ready_tail;
+    while (ready_head < end) {
+        size_t idx = ready[ready_head++];
+        if (nodes[idx].state == NODE_QUEUED)
+            node_launch(idx);
+    }
+
+    return 0;
+}
+
+// Kahn's algorithm: anything not drained from the front and the back is on a cycle
+static void break_cycles(void) {
+    size_t *indeg = calloc(node_count, sizeof(*indeg));
+    size_t *outdeg = calloc(node_count, sizeof(*outdeg));
+    size_t *queue = calloc(node_count, sizeof(*queue));
+    char *removed = calloc(node_count, 1);
+    if (!indeg || !outdeg || !queue || !removed)
+        goto out;
+
+    size_t head = 0, tail = 0;
+    for (size_t i = 0; i < node_count; i++) {
+        indeg[i] = nodes[i].pending;
+        outdeg[i] = nodes[i].successors.n;
+        if (indeg[i] == 0) queue[tail++] = i;
+    }
+    while (head < tail) {
+        size_t i = queue[head++];
+        removed[i] = 1;
+        for (size_t k = 0; k < nodes[i].successors.n; k++)
+            if (--indeg[nodes[i].successors.v[k]] == 0)
+                queue[tail++] = nodes[i].successors.v[k];
+    }
+    if (tail == node_count)
+        goto out;
+
+    // Peel nodes that merely sit downstream of a cycle
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (size_t i = 0; i < node_count; i++) {
+            if (removed[i] || outdeg[i] != 0) continue;
+            removed[i] = 1;
+            changed = 1;
+            for (size_t j = 0; j < node_count; j++) {
+                if (removed[j]) continue;
+                for (size_t k = 0; k < nodes[j].successors.n; k++)
+                    if (nodes[j].successors.v[k] == i) outdeg[j]--;
+            }
+        }
+    }
+
+    log_error("[scheduler] Ordering cycle detected, not starting:");
+    for (size_t i = 0; i < node_count; i++)
+        if (!removed[i]) log_error("[scheduler]   %s", nodes[i].unit->name);
+
+    // Take every cycle member out of the waiting set before releasing any,
+    // so failing one does not enqueue the next
+    for (size_t i = 0; i < node_count; i++)
+        if (!removed[i]) nodes[i].state = NODE_RUNNING;
+    for (size_t i = 0; i < node_count; i++)
+        if (!removed[i]) node_finish(i, 0);
+
+out:
+    free(indeg);
+    free(outdeg);
+    free(queue);
+    free(removed);
+}
+
+int scheduler_start(sd_event *event) {
+    size_t unit_count = unit_registry_count();
+
+    if (!event) {
+        log_error("[scheduler] No event loop");
+        return -EINVAL;
+    }
+    if (unit_count == 0)
+        return 0;
+
+    nodes = calloc(unit_count, sizeof(*nodes));
+    ready = calloc(unit_count, sizeof(*ready));
+    if (!nodes || !ready) {
+        scheduler_stop();
+        return -ENOMEM;
+    }
+    node_count = unit_count;
+    for (size_t i = 0; i < unit_count; i++)
+        nodes[i].unit = unit_registry_get(i);
+
+    for (size_t i = 0; i < unit_count; i++) {
+        const Unit *u = nodes[i].unit;
+        int r;
+        if ((r = for_each_dep(i, u->after, "After", dep_after)) < 0 ||
+            (r = for_each_dep(i, u->before, "Before", dep_before)) < 0 ||
+            (r = for_each_dep(i, u->requires, "Requires", dep_requires)) < 0 ||
+            (r = for_each_dep(i, u->wants, "Wants", dep_wants)) < 0) {
+            scheduler_stop();
+            return r;
+        }
+    }
+
+    int r = sd_event_add_defer(event, &dispatch_source, on_dispatch, NULL);
+    if (r < 0) {
+        log_error("[scheduler] Failed to add dispatch source: %s", strerror(-r));
+        scheduler_stop();
+        return r;
+    }
+    sd_event_source_set_enabled(dispatch_source, SD_EVENT_OFF);
+    boot_start_usec = now_usec();
+
+    break_cycles();
+    for (size_t i = 0; i < node_count; i++)
+        if (nodes[i].state == NODE_WAITING && nodes[i].pending == 0)
+            enqueue(i);
+
+    return 0;
+}
+
+void scheduler_stop(void) {
+    if (dispatch_source) {
+        sd_event_source_unref(dispatch_source);
+        dispatch_source = NULL;
+    }
+    for (size_t i = 0; i < node_count; i++) {
+        free(nodes[i].successors.v);
+        free(nodes[i].requires.v);
+    }
+    free(nodes);
+    free(ready);
+    nodes = NULL;
+    ready = NULL;
+    node_count = finished_count = 0;
+    ready_head = ready_tail = 0;
+}
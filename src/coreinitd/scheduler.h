@@ -0,0 +1,16 @@
+// scheduler.h — dependency-ordered parallel boot of loaded units
+#ifndef COREINITD_SCHEDULER_H
+#define COREINITD_SCHEDULER_H
+
+#include <systemd/sd-event.h>
+#include <stddef.h>
+#include "unit_loader.h"
+
+// Build the Requires=/Wants=/After=/Before= graph over the registry and start
+// every unit whose ordering dependencies are satisfied, in waves, from
+// a defer source on the event loop.
+int scheduler_start(sd_event *event);
+
+void scheduler_stop(void);
+
+#endif
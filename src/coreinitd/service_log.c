@@ -0,0 +1,294 @@
+// service_log.c — per-service output pipes, log files and in-memory tails
+//
+// Every service (and its Accept=yes instances) writes into one pipe owned by
+// the daemon. Output never passes through a userspace buffer on its way to
+// disk: tee() duplicates the pipe pages into a scratch pipe, splice() moves
+// the originals into <unit>.log, and only the last LOG_RING_SIZE bytes of
+// each chunk are read back out of the scratch pipe into the unit's ring
+// buffer for "coreinitctl status". The daemon keeps the write end open, so
+// the pipe outlives restarts and never reports EOF.
+#define _GNU_SOURCE
+#include "service_log.h"
+#include "log.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#define LOG_CHUNK (64 * 1024)           // bytes moved per wakeup, so one service cannot hog the loop
+#define LOG_RING_SIZE 8192              // recent output kept per service
+#define LOG_MAX_SIZE (8 * 1024 * 1024)  // rotate <unit>.log to <unit>.log.1 beyond this
+#define LOG_PRIORITY 10                 // after notify, control and SIGCHLD
+
+typedef struct {
+    const Unit *unit;
+    int read_fd, write_fd;
+    int file_fd;                // -1: output is discarded, the tail is still kept
+    loff_t file_size;           // splice() refuses O_APPEND, so we track the offset
+    sd_event_source *source;
+
+    // LogRateLimitIntervalSec=/LogRateLimitBurst=, in bytes
+    uint64_t window_start;
+    uint64_t window_bytes;
+    uint64_t suppressed;
+
+    uint64_t ring_head;         // bytes ever put into ring
+    char ring[LOG_RING_SIZE];
+} ServiceLog;
+
+static sd_event *log_event = NULL;
+static int log_dir_fd = -1;
+static int devnull_fd = -1;
+static int scratch[2] = { -1, -1 };     // empty between wakeups
+
+// Indexed by Unit.id, allocated once a service first runs
+static ServiceLog **logs = NULL;
+static size_t logs_cap = 0;
+
+static void ring_put(ServiceLog *l, const char *p, size_t n) {
+    for (size_t i = 0; i < n; i++)
+        l->ring[(l->ring_head + i) % LOG_RING_SIZE] = p[i];
+    l->ring_head += n;
+}
+
+// Consume exactly n bytes of a pipe without looking at them
+static void discard(int fd, size_t n) {
+    while (n > 0) {
+        ssize_t r = splice(fd, NULL, devnull_fd, NULL, n, SPLICE_F_NONBLOCK);
+        if (r <= 0) return;
+        n -= (size_t)r;
+    }
+}
+
+static void open_file(ServiceLog *l, int truncate) {
+    char name[UNIT_NAME_MAX + 8];
+    snprintf(name, sizeof(name), "%s.log", l->unit->name);
+    l->file_fd = log_dir_fd < 0 ? -1 : openat(log_dir_fd, name, O_WRONLY | O_CREAT | O_CLOEXEC |
+                                                           (truncate ? O_TRUNC : 0), 0640);
+    struct stat st;
+    l->file_size = l->file_fd >= 0 && fstat(l->file_fd, &st) == 0 ? st.st_size : 0;
+    if (l->file_fd < 0 && log_dir_fd >= 0)
+        log_error("[service_log] Cannot open %s/%s: %s, output is only kept in memory",
+                  SERVICE_LOG_DIR, name, strerror(errno));
+}
+
+// One previous generation is kept; if it cannot be made, the log starts over
+static void rotate(ServiceLog *l) {
+    char name[UNIT_NAME_MAX + 8], old[sizeof(name) + 2];
+    snprintf(name, sizeof(name), "%s.log", l->unit->name);
+    snprintf(old, sizeof(old), "%s.1", name);
+    close(l->file_fd);
+    if (renameat(log_dir_fd, name, log_dir_fd, old) < 0)
+        log_error("[service_log] Cannot rotate %s: %s", name, strerror(errno));
+    open_file(l, 1);
+}
+
+// Moves n bytes, already tee()d, from the service pipe into the file
+static void write_out(ServiceLog *l, size_t n) {
+    while (n > 0 && l->file_fd >= 0) {
+        ssize_t r = splice(l->read_fd, NULL, l->file_fd, &l->file_size, n, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (r <= 0) {
+            // ENOSPC and friends: drop the rest of this chunk, try again with the next
+            log_error("[service_log] %s: cannot write log: %s", l->unit->name,
+                      r < 0 ? strerror(errno) : "short write");
+            break;
+        }
+        n -= (size_t)r;
+    }
+    discard(l->read_fd, n);
+    if (l->file_fd >= 0 && l->file_size >= LOG_MAX_SIZE)
+        rotate(l);
+}
+
+// The scratch pipe holds a copy of what was just written; keep its tail
+static void keep_tail(ServiceLog *l, size_t n) {
+    if (n > LOG_RING_SIZE) {
+        discard(scratch[0], n - LOG_RING_SIZE);
+        n = LOG_RING_SIZE;
+    }
+    while (n > 0) {
+        size_t pos = l->ring_head % LOG_RING_SIZE;
+        size_t first = n < LOG_RING_SIZE - pos ? n : LOG_RING_SIZE - pos;
+        struct iovec iov[2] = { { l->ring + pos, first }, { l->ring, n - first } };
+        ssize_t r = readv(scratch[0], iov, 2);
+        if (r <= 0) {
+            discard(scratch[0], n);
+            return;
+        }
+        l->ring_head += (size_t)r;
+        n -= (size_t)r;
+    }
+}
+
+static void note_suppressed(ServiceLog *l) {
+    char line[96];
+    int len = snprintf(line, sizeof(line), "[coreinitd] %llu bytes of output suppressed by LogRateLimitBurst=\n",
+                       (unsigned long long)l->suppressed);
+    if (l->file_fd >= 0 && pwrite(l->file_fd, line, (size_t)len, l->file_size) == len)
+        l->file_size += len;
+    ring_put(l, line, (size_t)len);
+    l->suppressed = 0;
+}
+
+static int on_output(sd_event_source *s, int fd, uint32_t revents, void *userdata) {
+    (void)s;
+    (void)revents;
+    ServiceLog *l = userdata;
+    const Unit *u = l->unit;
+    int limited = u->log_rate_limit_interval_usec && u->log_rate_limit_burst;
+
+    size_t budget = LOG_CHUNK;
+    if (limited) {
+        uint64_t now = 0;
+        sd_event_now(log_event, CLOCK_MONOTONIC, &now);
+        if (now - l->window_start >= u->log_rate_limit_interval_usec) {
+            if (l->suppressed)
+                note_suppressed(l);
+            l->window_start = now;
+            l->window_bytes = 0;
+        }
+        if (l->window_bytes >= u->log_rate_limit_burst) {
+            // Keep draining so the service does not block on a full pipe
+            ssize_t r = splice(fd, NULL, devnull_fd, NULL, LOG_CHUNK, SPLICE_F_NONBLOCK);
+            if (r > 0 && l->suppressed == 0)
+                log_warning("[service_log] %s: more than %llu bytes of output in %.0f s, dropping the rest",
+                            u->name, (unsigned long long)u->log_rate_limit_burst,
+                            u->log_rate_limit_interval_usec / (double)USEC_PER_SEC);
+            if (r > 0)
+                l->suppressed += (uint64_t)r;
+            return 0;
+        }
+        if (budget > u->log_rate_limit_burst - l->window_bytes)
+            budget = (size_t)(u->log_rate_limit_burst - l->window_bytes);
+    }
+
+    ssize_t n = tee(fd, scratch[1], budget, SPLICE_F_NONBLOCK);
+    if (n < 0 && errno != EAGAIN) {
+        // Never leave it readable: sd-event would call us again right away
+        log_error("[service_log] %s: tee: %s", u->name, strerror(errno));
+        discard(fd, LOG_CHUNK);
+    }
+    if (n <= 0)
+        return 0;
+    write_out(l, (size_t)n);
+    keep_tail(l, (size_t)n);
+    l->window_bytes += (uint64_t)n;
+    return 0;
+}
+
+static ServiceLog *log_new(const Unit *unit) {
+    ServiceLog *l = calloc(1, sizeof(*l));
+    if (!l) return NULL;
+    l->unit = unit;
+    l->file_fd = -1;
+
+    int p[2];
+    if (pipe2(p, O_CLOEXEC) < 0) {
+        free(l);
+        return NULL;
+    }
+    l->read_fd = p[0];
+    l->write_fd = p[1];
+    fcntl(l->read_fd, F_SETFL, O_NONBLOCK);
+
+    if (sd_event_add_io(log_event, &l->source, l->read_fd, EPOLLIN, on_output, l) < 0) {
+        close(p[0]);
+        close(p[1]);
+        free(l);
+        return NULL;
+    }
+    sd_event_source_set_priority(l->source, LOG_PRIORITY);
+    open_file(l, 0);
+    return l;
+}
+
+int service_log_fd(const Unit *unit) {
+    if (!log_event)
+        return -1;
+    if (unit->id >= logs_cap) {
+        size_t cap = logs_cap ? logs_cap : 64;
+        while (cap <= unit->id) cap *= 2;
+        ServiceLog **t = realloc(logs, cap * sizeof(*t));
+        if (!t) return -1;
+        memset(t + logs_cap, 0, (cap - logs_cap) * sizeof(*t));
+        logs = t;
+        logs_cap = cap;
+    }
+    if (!logs[unit->id] && !(logs[unit->id] = log_new(unit))) {
+        log_error("[service_log] Cannot capture output of %s: %s", unit->name, strerror(errno));
+        return -1;
+    }
+    return logs[unit->id]->write_fd;
+}
+
+size_t service_log_tail(const Unit *unit, char *buf, size_t size, unsigned max_lines) {
+    const ServiceLog *l = unit->id < logs_cap ? logs[unit->id] : NULL;
+    if (!l || l->ring_head == 0 || max_lines == 0)
+        return 0;
+
+    // Walk back from the end; a trailing partial line counts as a line
+    size_t avail = l->ring_head < LOG_RING_SIZE ? (size_t)l->ring_head : LOG_RING_SIZE;
+    size_t len = 0;
+    unsigned lines = 0;
+    while (len < avail && len < size) {
+        char c = l->ring[(l->ring_head - 1 - len) % LOG_RING_SIZE];
+        if (c == '\n' && len > 0 && ++lines == max_lines)
+            break;
+        len++;
+    }
+    // Ran out of ring, not of lines: the oldest line was cut by the wrap
+    size_t skip = 0;
+    if (len == avail && l->ring_head > LOG_RING_SIZE)
+        while (skip < len && l->ring[(l->ring_head - len + skip++) % LOG_RING_SIZE] != '\n')
+            ;
+    for (size_t i = skip; i < len; i++)
+        buf[i - skip] = l->ring[(l->ring_head - len + i) % LOG_RING_SIZE];
+    return len - skip;
+}
+
+int service_log_start(sd_event *event) {
+    mkdir_parents(SERVICE_LOG_DIR "/");
+    log_dir_fd = open(SERVICE_LOG_DIR, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (log_dir_fd < 0)
+        log_error("[service_log] Cannot open %s: %s, service output is only kept in memory",
+                  SERVICE_LOG_DIR, strerror(errno));
+    devnull_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (devnull_fd < 0 || pipe2(scratch, O_CLOEXEC | O_NONBLOCK) < 0) {
+        log_error("[service_log] Cannot set up output capture: %s", strerror(errno));
+        service_log_stop();
+        return -1;
+    }
+    log_event = event;
+    return 0;
+}
+
+void service_log_stop(void) {
+    for (size_t i = 0; i < logs_cap; i++) {
+        ServiceLog *l = logs[i];
+        if (!l) continue;
+        sd_event_source_disable_unref(l->source);
+        close(l->read_fd);
+        close(l->write_fd);
+        if (l->file_fd >= 0)
+            close(l->file_fd);
+        free(l);
+    }
+    free(logs);
+    logs = NULL;
+    logs_cap = 0;
+    for (int i = 0; i < 2; i++)
+        if (scratch[i] >= 0)
+            close(scratch[i]);
+    scratch[0] = scratch[1] = -1;
+    if (devnull_fd >= 0)
+        close(devnull_fd);
+    if (log_dir_fd >= 0)
+        close(log_dir_fd);
+    devnull_fd = log_dir_fd = -1;
+    log_event = NULL;
+}
@@ -0,0 +1,24 @@
+// service_log.h — capture each service's stdout/stderr into its own log file
+#ifndef COREINITD_SERVICE_LOG_H
+#define COREINITD_SERVICE_LOG_H
+
+#include <stddef.h>
+#include <systemd/sd-event.h>
+#include "unit_loader.h"
+
+#ifndef SERVICE_LOG_DIR
+#define SERVICE_LOG_DIR "./var/log/coreinitd"
+#endif
+
+int service_log_start(sd_event *event);
+void service_log_stop(void);
+
+// Write end of unit's output pipe, created on first use; the child gets it as
+// stdout/stderr. -1 if capture is unavailable: the child inherits ours.
+int service_log_fd(const Unit *unit);
+
+// The last max_lines complete lines of output still held in memory, copied to
+// buf (not NUL-terminated). Returns the number of bytes copied.
+size_t service_log_tail(const Unit *unit, char *buf, size_t size, unsigned max_lines);
+
+#endif
@@ -1,67 +1,671 @@
 #include "service_manager.h"
+#include "log.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <stdint.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include "spawn.h"
+#include "unit_registry.h"
+#include "event_loop.h"
+#include "socket_activation.h"
+#include "util.h"
+#include "trace.h"
+#include "notify.h"
+#include "job_queue.h"
+#include "service_log.h"
+#include "cgroup.h"
 
-#define MAX_SERVICES 64
-static ServiceEntry service_table[MAX_SERVICES];
-static size_t service_count = 0;
+#define SERVICE_LISTEN_FDS_MAX 16
+
+// One entry per service unit, indexed by Unit.id; entries never move
+static ServiceEntry **service_table = NULL;
+static size_t service_cap = 0;
+
+// PID -> entry, open addressing with backward-shift deletion (no tombstones)
+static ServiceEntry **pid_index = NULL;
+static size_t pid_index_size = 0, pid_index_used = 0;
+
+static size_t pid_slot(pid_t pid) {
+    return ((uint32_t)pid * 2654435761u) & (pid_index_size - 1);
+}
+
+static int pid_index_insert(ServiceEntry *e) {
+    if ((pid_index_used + 1) * 2 > pid_index_size) {
+        ServiceEntry **old = pid_index;
+        size_t old_size = pid_index_size;
+        size_t size = old_size ? old_size * 2 : 128;
+        ServiceEntry **t = calloc(size, sizeof(*t));
+        if (!t) return -ENOMEM;
+        pid_index = t;
+        pid_index_size = size;
+        for (size_t i = 0; i < old_size; i++) {
+            if (!old[i]) continue;
+            size_t j = pid_slot(old[i]->pid);
+            while (pid_index[j]) j = (j + 1) & (size - 1);
+            pid_index[j] = old[i];
+        }
+        free(old);
+    }
+
+    size_t i = pid_slot(e->pid);
+    while (pid_index[i]) i = (i + 1) & (pid_index_size - 1);
+    pid_index[i] = e;
+    pid_index_used++;
+    return 0;
+}
+
+static void pid_index_remove(pid_t pid) {
+    if (pid_index_size == 0) return;
+    size_t mask = pid_index_size - 1;
+    size_t i = pid_slot(pid);
+    while (pid_index[i] && pid_index[i]->pid != pid)
+        i = (i + 1) & mask;
+    if (!pid_index[i]) return;
+
+    pid_index[i] = NULL;
+    pid_index_used--;
+    // Pull later members of the probe run back over the hole
+    for (size_t j = (i + 1) & mask; pid_index[j]; j = (j + 1) & mask) {
+        size_t home = pid_slot(pid_index[j]->pid);
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            pid_index[i] = pid_index[j];
+            pid_index[j] = NULL;
+            i = j;
+        }
+    }
+}
+
+ServiceEntry *service_manager_lookup(pid_t pid) {
+    if (pid_index_size == 0) return NULL;
+    size_t mask = pid_index_size - 1;
+    for (size_t i = pid_slot(pid); pid_index[i]; i = (i + 1) & mask)
+        if (pid_index[i]->pid == pid)
+            return pid_index[i];
+    return NULL;
+}
+
+static ServiceEntry *service_entry(Unit *unit) {
+    if (unit->id >= service_cap) {
+        size_t cap = service_cap ? service_cap : 64;
+        while (cap <= unit->id) cap *= 2;
+        ServiceEntry **t = realloc(service_table, cap * sizeof(*t));
+        if (!t) return NULL;
+        memset(t + service_cap, 0, (cap - service_cap) * sizeof(*t));
+        service_table = t;
+        service_cap = cap;
+    }
+    if (!service_table[unit->id]) {
+        ServiceEntry *e = calloc(1, sizeof(*e));
+        if (!e) return NULL;
+        e->unit = unit;
+        e->state = SERVICE_INACTIVE;
+        service_table[unit->id] = e;
+    }
+    return service_table[unit->id];
+}
+
+static int on_child_exit(sd_event_source *s, const siginfo_t *si, void *userdata) {
+    ServiceEntry *entry = userdata;
+    if (si->si_pid != entry->pid) {
+        // The process we spawned, after MAINPID= handed over to another one
+        sd_event_source_unref(s);
+        return 0;
+    }
+    service_manager_reap(entry->pid, si);
+    return 0;
+}
+
+static const char *entry_name(const ServiceEntry *e) {
+    return e->instance ? e->name : e->unit->name;
+}
+
+// Each process gets its own child source; without pidfd support sd-event
+// falls back to waitid() on the PID
+static int watch_child(ServiceEntry *entry, pid_t pid, int pidfd) {
+    int r;
+    if (pidfd >= 0) {
+        r = sd_event_add_child_pidfd(event, &entry->child_source, pidfd, WEXITED, on_child_exit, entry);
+        if (r >= 0)
+            sd_event_source_set_child_pidfd_own(entry->child_source, 1);
+        else
+            close(pidfd);
+    } else {
+        r = sd_event_add_child(event, &entry->child_source, pid, WEXITED, on_child_exit, entry);
+    }
+    return r;
+}
+
+static const ServiceSpawner real_spawner = {
+    .spawn = spawn_command_fds,
+    .kill = kill,
+    .watch = watch_child,
+};
+static const ServiceSpawner *spawner = &real_spawner;
+
+void service_manager_set_spawner(const ServiceSpawner *s) {
+    spawner = s ? s : &real_spawner;
+}
+
+static int supervise(ServiceEntry *entry, pid_t pid, int pidfd) {
+    entry->pid = pid;
+    if (pid_index_insert(entry) < 0)
+        log_error("[service_manager] Out of memory indexing PID %d", pid);
+
+    int r = spawner->watch(entry, pid, pidfd);
+    if (r < 0) {
+        // Leave it to the orphan reaper rather than leak a zombie
+        log_error("[service_manager] Cannot supervise %s (PID %d): %s", entry_name(entry), pid, strerror(-r));
+        pid_index_remove(pid);
+    }
+    return r;
+}
+
+// The main process is still around (supervised and not yet reaped)
+static int main_running(ServiceEntry *e) {
+    return e->pid > 0 && service_manager_lookup(e->pid) == e;
+}
+
+static void cancel_restart(ServiceEntry *e) {
+    e->restart_source = clock_timer_free(e->restart_source);
+}
+
+static void cancel_timers(ServiceEntry *e) {
+    e->timeout_source = clock_timer_free(e->timeout_source);
+    e->watchdog_source = clock_timer_free(e->watchdog_source);
+}
+
+static void on_start_timeout(ClockTimer *s, uint64_t usec, void *userdata) {
+    (void)s;
+    (void)usec;
+    ServiceEntry *e = userdata;
+    // Still STARTING when it exits, so it is reaped as failed
+    log_warning("[service_manager] %s: no READY=1 within %.3f s, terminating",
+                e->unit->name, e->unit->timeout_start_usec / (double)USEC_PER_SEC);
+    spawner->kill(e->pid, SIGTERM);
+}
+
+static void on_watchdog(ClockTimer *s, uint64_t usec, void *userdata) {
+    (void)s;
+    (void)usec;
+    ServiceEntry *e = userdata;
+    log_warning("[service_manager] %s: watchdog timeout (PID %d), aborting", e->unit->name, e->pid);
+    spawner->kill(e->pid, SIGABRT);
+}
+
+// Every live instance of unit; there is no per-unit list, stopping is rare
+static void signal_instances(const Unit *unit, int sig) {
+    for (size_t i = 0; i < pid_index_size; i++) {
+        ServiceEntry *e = pid_index[i];
+        if (e && e->instance && e->unit == unit)
+            spawner->kill(e->pid, sig);
+    }
+}
+
+// Without a cgroup, only processes we know of can be reached
+static void kill_all(ServiceEntry *e) {
+    cgroup_kill(e->unit);
+    if (main_running(e))
+        spawner->kill(e->pid, SIGKILL);
+    signal_instances(e->unit, SIGKILL);
+}
+
+static void on_stop_timeout(ClockTimer *s, uint64_t usec, void *userdata) {
+    (void)s;
+    (void)usec;
+    ServiceEntry *e = userdata;
+    log_warning("[service_manager] %s: still running %.3f s after %s, killing",
+                e->unit->name, e->unit->timeout_stop_usec / (double)USEC_PER_SEC, strsignal(e->unit->kill_signal));
+    kill_all(e);
+}
+
+// Relative one-shot timer owned by the entry
+static void arm_timer(ServiceEntry *e, ClockTimer **src, uint64_t usec, ClockTimerFn fn) {
+    int r = -ENOMEM;
+    if ((*src || (*src = clock_timer_new(SD_EVENT_PRIORITY_NORMAL, fn, e))) &&
+        (r = clock_timer_set(*src, clock_now() + usec, usec / 20)) >= 0)
+        return;
+    log_error("[service_manager] %s: cannot arm timer: %s", e->unit->name, strerror(-r));
+}
+
+static void on_restart(ClockTimer *s, uint64_t usec, void *userdata) {
+    (void)s;
+    (void)usec;
+    ServiceEntry *e = userdata;
+    cancel_restart(e);
+    e->state = SERVICE_INACTIVE;
+    service_manager_start(e->unit);
+}
+
+// Fixed window: the first start opens it, at most start_limit_burst fit in
+static int start_limit_hit(ServiceEntry *e, uint64_t now) {
+    const Unit *u = e->unit;
+    if (u->start_limit_interval_usec == 0 || u->start_limit_burst == 0)
+        return 0;
+    if (e->start_count == 0 || now - e->start_window >= u->start_limit_interval_usec) {
+        e->start_window = now;
+        e->start_count = 0;
+    }
+    if (e->start_count >= u->start_limit_burst)
+        return 1;
+    e->start_count++;
+    return 0;
+}
 
 int service_manager_start(Unit *unit) {
     if (unit->type != UNIT_SERVICE || strlen(unit->exec_start) == 0) {
-        fprintf(stderr, "[service_manager] Not a valid service unit\n");
+        log_error("[service_manager] Not a valid service unit");
+        return -1;
+    }
+    if (unit->not_found) {
+        log_warning("[service_manager] %s: unit file was removed, not starting", unit->name);
         return -1;
     }
 
-    if (service_count >= MAX_SERVICES) {
-        fprintf(stderr, "[service_manager] Service table full\n");
+    ServiceEntry *entry = service_entry(unit);
+    if (!entry) {
+        log_error("[service_manager] Out of memory tracking %s", unit->name);
         return -1;
     }
 
-    pid_t pid = fork();
-    if (pid == 0) {
-        // child
-        execl("/bin/sh", "sh", "-c", unit->exec_start, NULL);
-        perror("exec failed");
-        _exit(1);
+    if (entry->state == SERVICE_STARTING || entry->state == SERVICE_ACTIVE) {
+        log_warning("[service_manager] %s already running (PID %d)", unit->name, entry->pid);
+        return 0;
     }
+    // An explicit start (socket, timer) overtakes a pending automatic restart
+    cancel_restart(entry);
 
-    if (pid < 0) {
-        perror("fork failed");
+    uint64_t now = clock_now();
+    if (start_limit_hit(entry, now)) {
+        log_warning("[service_manager] %s: start request repeated too quickly (%u in %.3f s), refusing to start",
+                    unit->name, unit->start_limit_burst, unit->start_limit_interval_usec / (double)USEC_PER_SEC);
+        entry->state = SERVICE_FAILED;
         return -1;
     }
 
-    service_table[service_count++] = (ServiceEntry){
-        .unit = unit,
-        .pid = pid,
-        .state = SERVICE_STARTING
-    };
+    // Socket-activated: hand over the listeners, connections stay queued in them
+    int fds[SERVICE_LISTEN_FDS_MAX];
+    char names[512];
+    SpawnFds sfds = { .fds = fds, .names = names, .stdio_fd = -1, .output_fd = service_log_fd(unit),
+                      .cgroup_fd = cgroup_unit_fd(unit), .placement = unit->placement };
+    sfds.n_fds = socket_activation_collect_fds(unit, fds, SERVICE_LISTEN_FDS_MAX, names, sizeof(names));
+
+    const char *env[3];
+    char watchdog_env[48];
+    size_t n_env = 0;
+    if (unit->notify_access != NOTIFY_ACCESS_NONE && notify_socket_env())
+        env[n_env++] = notify_socket_env();
+    if (unit->watchdog_usec) {
+        snprintf(watchdog_env, sizeof(watchdog_env), "WATCHDOG_USEC=%llu", (unsigned long long)unit->watchdog_usec);
+        env[n_env++] = watchdog_env;
+    }
+    env[n_env] = NULL;
+    if (n_env)
+        sfds.env = env;
+
+    pid_t pid;
+    int pidfd = -1;
+    trace_event(unit, TRACE_FORK, 0);
+    int r = spawner->spawn(&unit->exec, &sfds, &pid, &pidfd);
+    if (r < 0) {
+        trace_event(unit, TRACE_EXIT, 0);
+        log_error("[service_manager] Failed to spawn %s (%s): %s",
+                  unit->name, unit->exec.argv ? unit->exec.argv[0] : unit->exec_start, strerror(-r));
+        entry->state = SERVICE_FAILED;
+        return -1;
+    }
+    if (sfds.n_fds)
+        socket_activation_service_started(unit);
+
+    // exec already succeeded (spawn_command waits for it), so it is running;
+    // Type=notify is only started once it says so
+    int notify = unit->service_type == SERVICE_TYPE_NOTIFY;
+    entry->state = notify ? SERVICE_STARTING : SERVICE_ACTIVE;
+    entry->active_since = now;
+    entry->status_text[0] = '\0';
+    trace_event(unit, TRACE_EXEC, pid);
+    if (!notify)
+        trace_event(unit, TRACE_READY, pid);
+    supervise(entry, pid, pidfd);
+    if (notify && unit->timeout_start_usec)
+        arm_timer(entry, &entry->timeout_source, unit->timeout_start_usec, on_start_timeout);
+    if (unit->watchdog_usec)
+        arm_timer(entry, &entry->watchdog_source, unit->watchdog_usec, on_watchdog);
+
+    log_info("[service_manager] Started %s (PID %d%s%s%s)", unit->name, pid,
+             unit->exec.use_shell ? ", via /bin/sh" : "", sfds.n_fds ? ", socket-activated" : "",
+             notify ? ", waiting for READY=1" : "");
+    return notify;
+}
+
+void service_manager_ready(ServiceEntry *e) {
+    if (e->state != SERVICE_STARTING)
+        return;
+    e->state = SERVICE_ACTIVE;
+    e->timeout_source = clock_timer_free(e->timeout_source);
+    trace_event(e->unit, TRACE_READY, e->pid);
+    log_info("[service_manager] %s is ready (PID %d)", e->unit->name, e->pid);
+    job_queue_unit_ready(e->unit, 0);
+}
+
+void service_manager_set_status(ServiceEntry *e, const char *status) {
+    snprintf(e->status_text, sizeof(e->status_text), "%s", status);
+}
+
+static int on_foreign_main_exit(sd_event_source *s, int fd, uint32_t revents, void *userdata) {
+    (void)s;
+    (void)fd;
+    (void)revents;
+    ServiceEntry *e = userdata;
+
+    // Not our child, so usually there is no exit status to collect
+    siginfo_t si;
+    memset(&si, 0, sizeof(si));
+    if (waitid(P_PID, e->pid, &si, WEXITED | WNOHANG) < 0 || si.si_pid == 0) {
+        si.si_pid = e->pid;
+        si.si_code = CLD_EXITED;
+        si.si_status = 0;
+    }
+    service_manager_reap(e->pid, &si);
+    return 0;
+}
+
+int service_manager_set_main_pid(ServiceEntry *e, pid_t pid) {
+    if (pid == e->pid)
+        return 0;
+    if (e->instance || pid == getpid())
+        return -1;
 
-    fprintf(stderr, "[service_manager] Started %s (PID %d)\n", unit->name, pid);
+    int pidfd = (int)syscall(SYS_pidfd_open, pid, 0);
+    if (pidfd < 0)
+        return -1;
+    sd_event_source *src = NULL;
+    if (sd_event_add_io(event, &src, pidfd, EPOLLIN, on_foreign_main_exit, e) < 0) {
+        close(pidfd);
+        return -1;
+    }
+    sd_event_source_set_io_fd_own(src, 1);
+
+    // A spawned child keeps its own source until it exits (see on_child_exit)
+    if (e->foreign_main)
+        sd_event_source_unref(e->child_source);
+    pid_index_remove(e->pid);
+    log_info("[service_manager] Main PID of %s is now %d (was %d)", e->unit->name, pid, e->pid);
+    e->pid = pid;
+    e->child_source = src;
+    e->foreign_main = 1;
+    if (pid_index_insert(e) < 0)
+        log_error("[service_manager] Out of memory indexing PID %d", pid);
     return 0;
 }
 
-void service_manager_reap(pid_t pid) {
-    for (size_t i = 0; i < service_count; i++) {
-        if (service_table[i].pid == pid) {
-            fprintf(stderr, "[service_manager] Reaped %s (PID %d)\n", service_table[i].unit->name, pid);
-            service_table[i].state = SERVICE_ACTIVE;  // or SERVICE_FAILED if needed
-            return;
-        }
+void service_manager_watchdog(ServiceEntry *e, int trigger) {
+    if (trigger) {
+        on_watchdog(NULL, 0, e);
+        return;
+    }
+    if (e->unit->watchdog_usec && (e->state == SERVICE_STARTING || e->state == SERVICE_ACTIVE))
+        arm_timer(e, &e->watchdog_source, e->unit->watchdog_usec, on_watchdog);
+}
+
+int service_manager_stop(Unit *unit) {
+    if (unit->type != UNIT_SERVICE)
+        return 0;
+    ServiceEntry *entry = service_entry(unit);
+    if (!entry)
+        return -1;
+
+    cancel_restart(entry);
+    if (entry->state == SERVICE_STARTING || entry->start_after_stop)
+        job_queue_unit_ready(unit, -ECANCELED);
+    entry->start_after_stop = 0;
+    if (entry->state == SERVICE_AUTO_RESTART) {
+        entry->state = SERVICE_INACTIVE;
+        return 0;
+    }
+    // Already on its way: wait for the same exit
+    if (entry->state == SERVICE_STOPPING)
+        return 1;
+    int main = entry->state == SERVICE_STARTING || entry->state == SERVICE_ACTIVE;
+    if (!main && entry->instances == 0)
+        return 0;
+
+    cancel_timers(entry);
+    if (main && spawner->kill(entry->pid, unit->kill_signal) < 0 && errno != ESRCH) {
+        log_error("[service_manager] Failed to stop %s (PID %d): %s", unit->name, entry->pid, strerror(errno));
+        return -1;
+    }
+    signal_instances(unit, unit->kill_signal);
+    entry->state = SERVICE_STOPPING;
+    if (unit->timeout_stop_usec)
+        arm_timer(entry, &entry->timeout_source, unit->timeout_stop_usec, on_stop_timeout);
+    if (main)
+        log_info("[service_manager] Stopping %s (PID %d)", unit->name, entry->pid);
+    else
+        log_info("[service_manager] Stopping %s (%u instances)", unit->name, entry->instances);
+    return 1;
+}
+
+void service_manager_kill(Unit *unit) {
+    ServiceEntry *e = unit->id < service_cap ? service_table[unit->id] : NULL;
+    if (e && e->state == SERVICE_STOPPING)
+        kill_all(e);
+}
+
+int service_manager_restart(Unit *unit) {
+    ServiceEntry *entry = service_entry(unit);
+    if (!entry)
+        return -1;
+    if (entry->state != SERVICE_STARTING && entry->state != SERVICE_ACTIVE && entry->state != SERVICE_STOPPING)
+        return service_manager_start(unit);
+
+    if (entry->state != SERVICE_STOPPING && service_manager_stop(unit) < 0)
+        return -1;
+    entry->start_after_stop = 1;
+    return 1;
+}
+
+ServiceState service_manager_state(const Unit *unit) {
+    if (unit->id >= service_cap || !service_table[unit->id])
+        return SERVICE_INACTIVE;
+    return service_table[unit->id]->state;
+}
+
+const ServiceEntry *service_manager_entry(const Unit *unit) {
+    return unit->id < service_cap ? service_table[unit->id] : NULL;
+}
+
+static ServiceEntry *instance_new(Unit *unit, ServiceExitFn on_exit, void *userdata) {
+    static unsigned instance_nr = 0;
+    ServiceEntry *e = calloc(1, sizeof(*e));
+    if (!e) return NULL;
+
+    const char *at = strchr(unit->name, '@');
+    const char *dot = strrchr(unit->name, '.');
+    int base = (int)((at ? at : dot ? dot : unit->name + strlen(unit->name)) - unit->name);
+    snprintf(e->name, sizeof(e->name), "%.*s@%u%s", base, unit->name, ++instance_nr, dot ? dot : "");
+
+    e->unit = unit;
+    e->instance = 1;
+    e->state = SERVICE_ACTIVE;
+    e->on_exit = on_exit;
+    e->userdata = userdata;
+    return e;
+}
+
+// Counted on the unit's own entry, so a stop knows what it waits for
+static void instance_supervised(ServiceEntry *e) {
+    ServiceEntry *owner = service_entry(e->unit);
+    if (owner)
+        owner->instances++;
+}
+
+static ServiceEntry *spawn_instance(Unit *unit, SpawnFds *fds, ServiceExitFn on_exit, void *userdata) {
+    ServiceEntry *e = instance_new(unit, on_exit, userdata);
+    if (!e) return NULL;
+
+    fds->output_fd = service_log_fd(unit);
+    fds->cgroup_fd = cgroup_unit_fd(unit);
+    fds->placement = unit->placement;
+    pid_t pid;
+    int pidfd = -1;
+    int r = spawner->spawn(&unit->exec, fds, &pid, &pidfd);
+    if (r < 0) {
+        log_error("[service_manager] Failed to spawn %s: %s", e->name, strerror(-r));
+        free(e);
+        return NULL;
+    }
+
+    if (supervise(e, pid, pidfd) < 0) {
+        free(e);
+        return NULL;
+    }
+    instance_supervised(e);
+    log_debug("[service_manager] Started %s (PID %d)", e->name, pid);
+    return e;
+}
+
+ServiceEntry *service_manager_start_instance(Unit *unit, int conn_fd, ServiceExitFn on_exit, void *userdata) {
+    SpawnFds fds = { .fds = &conn_fd, .n_fds = 1, .names = "connection", .stdio_fd = conn_fd };
+    return spawn_instance(unit, &fds, on_exit, userdata);
+}
+
+ServiceEntry *service_manager_start_instance_fds(Unit *unit, const int *fds, size_t n_fds, const char *names,
+                                                 ServiceExitFn on_exit, void *userdata) {
+    SpawnFds sfds = { .fds = fds, .n_fds = n_fds, .names = names, .stdio_fd = -1 };
+    return spawn_instance(unit, &sfds, on_exit, userdata);
+}
+
+void service_manager_forget_instances(const void *userdata) {
+    for (size_t i = 0; i < pid_index_size; i++) {
+        ServiceEntry *e = pid_index[i];
+        if (e && e->instance && e->userdata == userdata)
+            e->on_exit = NULL;
     }
 }
 
-void service_manager_status(void) {
-    for (size_t i = 0; i < service_count; i++) {
-        const char *state = "unknown";
-        switch (service_table[i].state) {
-            case SERVICE_INACTIVE: state = "inactive"; break;
-            case SERVICE_STARTING: state = "starting"; break;
-            case SERVICE_ACTIVE: state = "active"; break;
-            case SERVICE_FAILED: state = "failed"; break;
+ServiceEntry *service_manager_adopt_instance(Unit *unit, pid_t pid, int pidfd, ServiceExitFn on_exit, void *userdata) {
+    ServiceEntry *e = instance_new(unit, on_exit, userdata);
+    if (!e) {
+        if (pidfd >= 0) close(pidfd);
+        return NULL;
+    }
+    if (supervise(e, pid, pidfd) < 0) {
+        free(e);
+        return NULL;
+    }
+    instance_supervised(e);
+    return e;
+}
+
+// SIGHUP/SIGINT/SIGTERM/SIGPIPE are how services are normally told to go away
+static int exit_clean(const siginfo_t *si) {
+    if (si->si_code == CLD_EXITED)
+        return si->si_status == 0;
+    return si->si_status == SIGHUP || si->si_status == SIGINT ||
+           si->si_status == SIGTERM || si->si_status == SIGPIPE;
+}
+
+// RestartSec= doubles with every consecutive restart, up to RestartMaxDelaySec=.
+// The timer runs at idle priority so a crash-looping unit yields to other
+// event sources, and StartLimitBurst= eventually stops it altogether.
+static void schedule_restart(ServiceEntry *e) {
+    const Unit *u = e->unit;
+    if (u->restart == RESTART_NO || (u->restart == RESTART_ON_FAILURE && e->state != SERVICE_FAILED))
+        return;
+
+    // A run that outlasted the rate-limit window counts as healthy
+    uint64_t now = clock_now();
+    uint64_t healthy = u->start_limit_interval_usec ? u->start_limit_interval_usec : 10 * USEC_PER_SEC;
+    if (now - e->active_since >= healthy)
+        e->restarts = 0;
+
+    uint64_t delay = u->restart_usec;
+    for (unsigned i = 0; i < e->restarts && delay < u->restart_max_delay_usec; i++)
+        delay = delay > UINT64_MAX / 2 ? UINT64_MAX : delay * 2;
+    if (delay > u->restart_max_delay_usec)
+        delay = u->restart_max_delay_usec;
+
+    int r = -ENOMEM;
+    if (!(e->restart_source = clock_timer_new(SD_EVENT_PRIORITY_IDLE, on_restart, e)) ||
+        (r = clock_timer_set(e->restart_source, now + delay, delay / 10)) < 0) {
+        log_error("[service_manager] Cannot schedule restart of %s: %s", u->name, strerror(-r));
+        cancel_restart(e);
+        return;
+    }
+    e->restarts++;
+    e->state = SERVICE_AUTO_RESTART;
+    log_info("[service_manager] Restarting %s in %.3f s (restart %u)",
+             u->name, delay / (double)USEC_PER_SEC, e->restarts);
+}
+
+// Main process and instances are all gone: complete the stop job, or start
+// again for a restart
+static void stop_finished(ServiceEntry *e) {
+    cancel_timers(e);
+    job_queue_unit_stopped(e->unit, 0);
+    if (e->start_after_stop) {
+        e->start_after_stop = 0;
+        int r = service_manager_start(e->unit);
+        if (r <= 0)
+            job_queue_unit_ready(e->unit, r);
+    }
+}
+
+void service_manager_reap(pid_t pid, const siginfo_t *si) {
+    ServiceEntry *e = service_manager_lookup(pid);
+    if (!e)
+        return;
+
+    pid_index_remove(pid);
+    int stopped = e->state == SERVICE_STOPPING;
+    // Exiting before READY=1 is a failed start, whatever the status
+    int was_starting = e->state == SERVICE_STARTING;
+    e->exit_code = si->si_code;
+    e->exit_status = si->si_status;
+    e->state = stopped ? SERVICE_INACTIVE :
+               (was_starting || !exit_clean(si)) ? SERVICE_FAILED : SERVICE_INACTIVE;
+    // A stop also waits for the unit's instances
+    if (stopped && e->instances > 0)
+        e->state = SERVICE_STOPPING;
+    else
+        cancel_timers(e);
+
+    if (si->si_code == CLD_EXITED)
+        log_info("[service_manager] %s (PID %d) exited with status %d", entry_name(e), pid, si->si_status);
+    else
+        log_info("[service_manager] %s (PID %d) killed by signal %s", entry_name(e), pid, strsignal(si->si_status));
+
+    // Safe from inside the source's own callback: sd-event defers the free
+    e->child_source = sd_event_source_unref(e->child_source);
+    e->foreign_main = 0;
+    if (e->instance) {
+        if (e->on_exit)
+            e->on_exit(e, e->userdata);
+        ServiceEntry *owner = e->unit->id < service_cap ? service_table[e->unit->id] : NULL;
+        free(e);
+        if (owner && owner->instances > 0 && --owner->instances == 0 &&
+            owner->state == SERVICE_STOPPING && !main_running(owner)) {
+            owner->state = SERVICE_INACTIVE;
+            socket_activation_service_exited(owner->unit);
+            stop_finished(owner);
         }
-        printf("%s\tPID %d\t%s\n", service_table[i].unit->name, service_table[i].pid, state);
+    } else {
+        // Whatever the main process left behind goes with it
+        cgroup_kill(e->unit);
+        trace_event(e->unit, TRACE_EXIT, pid);
+        if (was_starting)
+            job_queue_unit_ready(e->unit, -1);
+        socket_activation_service_exited(e->unit);
+        if (stopped && e->state == SERVICE_INACTIVE)
+            stop_finished(e);
+        else if (!stopped)
+            schedule_restart(e);
     }
+    event_loop_reap_orphans();
 }
@@ -2,23 +2,106 @@
 #define COREINITD_SERVICE_MANAGER_H
 
 #include <sys/types.h>
+#include <signal.h>
+#include <systemd/sd-event.h>
 #include "unit_loader.h"
+#include "spawn.h"
+#include "clock.h"
 
 typedef enum {
     SERVICE_INACTIVE,
-    SERVICE_STARTING,
+    SERVICE_STARTING,	// Type=notify: running, READY=1 not yet received
     SERVICE_ACTIVE,
+    SERVICE_AUTO_RESTART,	// exited, RestartSec= timer pending
+    SERVICE_STOPPING,	// KillSignal= sent, waiting for the main process and instances to exit
     SERVICE_FAILED
 } ServiceState;
 
-typedef struct {
+typedef struct ServiceEntry ServiceEntry;
+typedef void (*ServiceExitFn)(ServiceEntry *e, void *userdata);
+
+struct ServiceEntry {
     Unit *unit;
     pid_t pid;
     ServiceState state;
-} ServiceEntry;
 
+    sd_event_source *child_source;	// pidfd-backed, one per running process
+    int foreign_main;	// MAINPID= moved us to a process we did not spawn (io source on its pidfd)
+    int exit_code;		// CLD_EXITED / CLD_KILLED / CLD_DUMPED of the last run
+    int exit_status;	// exit status or signal number
+
+    // Restart=/StartLimit*= bookkeeping, per-unit entries only
+    ClockTimer *restart_source;	// pending RestartSec= timer
+    int start_after_stop;	// restart job: start again once the stopping process is gone
+    unsigned restarts;		// consecutive automatic restarts, drives the backoff
+    uint64_t active_since;	// CLOCK_MONOTONIC time of the last start
+    uint64_t start_window;	// begin of the current StartLimitIntervalSec= window
+    unsigned start_count;	// starts within that window
+    unsigned instances;		// live Accept=yes instances and pool workers of the unit
+
+    // sd_notify() state
+    ClockTimer *timeout_source;	// TimeoutStartSec= while STARTING, TimeoutStopSec= while STOPPING
+    ClockTimer *watchdog_source;	// WatchdogSec=, re-armed by WATCHDOG=1
+    char status_text[128];	// last STATUS=
+
+    // Accept=yes instances only: not in the per-unit table, freed on exit
+    int instance;
+    char name[UNIT_NAME_MAX + 12];	// foo@<n>.service
+    ServiceExitFn on_exit;
+    void *userdata;
+};
+
+// How service processes are started, signalled and watched. The default runs
+// real ones; the simulation harness hands out made-up PIDs and decides itself
+// when they exit.
+typedef struct {
+    int (*spawn)(const ExecCommand *cmd, const SpawnFds *fds, pid_t *ret_pid, int *ret_pidfd);
+    int (*kill)(pid_t pid, int sig);
+    // Arrange for service_manager_reap() once pid exits; takes over pidfd (-1: none)
+    int (*watch)(ServiceEntry *e, pid_t pid, int pidfd);
+} ServiceSpawner;
+
+// NULL: back to real processes
+void service_manager_set_spawner(const ServiceSpawner *spawner);
+
+// Refused (-1) once StartLimitBurst= starts happened within StartLimitIntervalSec=.
+// Type=notify services return 1: the start job completes once READY=1 arrives
+// or the service fails, see job_queue_unit_ready()
 int service_manager_start(Unit *unit);
-void service_manager_reap(pid_t pid);
-void service_manager_status(void);
+// Send KillSignal= to the main process and every instance (and cancel any
+// pending restart); no restart follows. Returns 1 while they are stopping:
+// the stop job completes once all are gone (see job_queue_unit_stopped()),
+// SIGKILLed after TimeoutStopSec=. 0 if nothing was running.
+int service_manager_stop(Unit *unit);
+// SIGKILL whatever is left of a stopping unit now, without waiting for TimeoutStopSec=
+void service_manager_kill(Unit *unit);
+// Stop, then start as soon as the main process has exited; a service that is
+// not running is simply started. Returns like service_manager_start(), 1 while
+// the restart is in progress (see job_queue_unit_ready())
+int service_manager_restart(Unit *unit);
+ServiceState service_manager_state(const Unit *unit);
+// NULL if unit was never started
+const ServiceEntry *service_manager_entry(const Unit *unit);
+// Run one instance of unit on an accepted connection (stdin, stdout, fd 3).
+// on_exit runs once it is gone, right before the entry is freed.
+ServiceEntry *service_manager_start_instance(Unit *unit, int conn_fd, ServiceExitFn on_exit, void *userdata);
+// Same with fds as LISTEN_FDS (fd 3+) and names as LISTEN_FDNAMES, e.g. one
+// shard of a Shards= socket's listeners
+ServiceEntry *service_manager_start_instance_fds(Unit *unit, const int *fds, size_t n_fds, const char *names,
+                                                 ServiceExitFn on_exit, void *userdata);
+// userdata is being freed: instances started with it keep running, unreported
+void service_manager_forget_instances(const void *userdata);
+// Supervise an already forked process (a pre-forked worker) as an instance of unit
+ServiceEntry *service_manager_adopt_instance(Unit *unit, pid_t pid, int pidfd, ServiceExitFn on_exit, void *userdata);
+void service_manager_reap(pid_t pid, const siginfo_t *si);
+
+// sd_notify() messages, already checked against NotifyAccess= by notify.c
+void service_manager_ready(ServiceEntry *e);
+void service_manager_set_status(ServiceEntry *e, const char *status);
+int service_manager_set_main_pid(ServiceEntry *e, pid_t pid);
+// WATCHDOG=1 re-arms WatchdogSec=, WATCHDOG=trigger (trigger != 0) fires it now
+void service_manager_watchdog(ServiceEntry *e, int trigger);
+// O(1) PID -> entry for supervised processes, NULL for anything else
+ServiceEntry *service_manager_lookup(pid_t pid);
 
 #endif
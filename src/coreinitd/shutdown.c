@@ -0,0 +1,294 @@
+// shutdown.c — stop every unit in reverse dependency order
+//
+// The boot graph backwards: a unit ordered After= another stops before it.
+// Each unit gets its stop job as soon as everything ordered after it is
+// down, so independent units stop in parallel and shutdown takes as long as
+// the slowest chain, not the sum. KillSignal= and the SIGKILL after
+// TimeoutStopSec= are the service manager's, on sd-event timers; nothing
+// here waits.
+#include "shutdown.h"
+#include "log.h"
+#include "job_queue.h"
+#include "reload.h"
+#include "service_manager.h"
+#include "socket_activation.h"
+#include "unit_registry.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <signal.h>
+
+typedef enum {
+    STOP_WAITING,
+    STOP_RUNNING,
+    STOP_DONE
+} StopState;
+
+typedef struct {
+    size_t *v;
+    size_t n, cap;
+} IndexList;
+
+typedef struct {
+    Unit *unit;
+    StopState state;
+    size_t pending;         // units to stop before this one, still up
+    IndexList next;         // units that wait for this one
+    uint64_t stop_start;    // when its stop job was queued, 0 if nothing ran
+    uint64_t stop_usec;
+} StopNode;
+
+// Indexed by Unit.id
+static StopNode *nodes = NULL;
+static size_t node_count = 0, done_count = 0;
+
+// Released nodes; every node enters it once
+static size_t *ready = NULL;
+static size_t ready_head = 0, ready_tail = 0;
+
+static sd_event *shutdown_event = NULL;
+static sd_event_source *signal_sources[2] = { NULL, NULL };
+static uint64_t shutdown_start_usec = 0;    // 0: not shutting down
+static int completed = 0;
+
+static int list_push(IndexList *l, size_t idx) {
+    if (l->n == l->cap) {
+        size_t cap = l->cap ? l->cap * 2 : 4;
+        size_t *v = realloc(l->v, cap * sizeof(*v));
+        if (!v) return -ENOMEM;
+        l->v = v;
+        l->cap = cap;
+    }
+    l->v[l->n++] = idx;
+    return 0;
+}
+
+// first must be down before then is stopped
+static int add_order(size_t first, size_t then) {
+    int r = list_push(&nodes[first].next, then);
+    if (r < 0) return r;
+    nodes[then].pending++;
+    return 0;
+}
+
+// u After=dep: u stops first. u Before=dep: dep stops first.
+static int add_deps(size_t self, const char *list, int after) {
+    char name[UNIT_NAME_MAX + 1];
+    while (unit_list_next(&list, name)) {
+        Unit *dep = unit_registry_find(name);
+        if (!dep || dep->id >= node_count || dep->id == self)
+            continue;
+        int r = after ? add_order(self, dep->id) : add_order(dep->id, self);
+        if (r < 0) return r;
+    }
+    return 0;
+}
+
+// Kahn's algorithm; whatever is not drained sits on or behind an ordering
+// cycle and is stopped without order rather than never
+static void break_cycles(void) {
+    size_t *indeg = calloc(node_count, sizeof(*indeg));
+    size_t *queue = calloc(node_count, sizeof(*queue));
+    if (!indeg || !queue) {
+        for (size_t i = 0; i < node_count; i++)
+            nodes[i].pending = 0;
+        goto out;
+    }
+
+    size_t head = 0, tail = 0;
+    for (size_t i = 0; i < node_count; i++)
+        if ((indeg[i] = nodes[i].pending) == 0)
+            queue[tail++] = i;
+    while (head < tail) {
+        const StopNode *n = &nodes[queue[head++]];
+        for (size_t k = 0; k < n->next.n; k++)
+            if (--indeg[n->next.v[k]] == 0)
+                queue[tail++] = n->next.v[k];
+    }
+    if (tail == node_count)
+        goto out;
+
+    log_warning("[shutdown] Ordering cycle, stopping these without order:");
+    for (size_t i = 0; i < node_count; i++)
+        if (indeg[i] > 0) {
+            log_warning("[shutdown]   %s", nodes[i].unit->name);
+            nodes[i].pending = 0;
+        }
+
+out:
+    free(indeg);
+    free(queue);
+}
+
+static int needs_stop(const Unit *u) {
+    const ServiceEntry *e = u->type == UNIT_SERVICE ? service_manager_entry(u) : NULL;
+    return e && (e->instances > 0 || (e->state != SERVICE_INACTIVE && e->state != SERVICE_FAILED));
+}
+
+static void complete(void) {
+    if (completed)
+        return;
+    completed = 1;
+
+    uint64_t now = now_usec();
+    size_t stopped = 0;
+    const StopNode *slowest = NULL;
+    for (size_t i = 0; i < node_count; i++) {
+        if (!nodes[i].stop_start) continue;
+        stopped++;
+        if (!slowest || nodes[i].stop_usec > slowest->stop_usec)
+            slowest = &nodes[i];
+    }
+    if (slowest)
+        log_notice("[shutdown] Stopped %zu units in %" PRIu64 " ms, slowest %s (%" PRIu64 " ms)",
+                   stopped, (now - shutdown_start_usec) / 1000, slowest->unit->name, slowest->stop_usec / 1000);
+    else
+        log_notice("[shutdown] Nothing was running, %" PRIu64 " ms", (now - shutdown_start_usec) / 1000);
+    sd_event_exit(shutdown_event, 0);
+}
+
+static void node_done(size_t idx) {
+    StopNode *n = &nodes[idx];
+    n->state = STOP_DONE;
+    if (n->stop_start)
+        n->stop_usec = now_usec() - n->stop_start;
+    done_count++;
+    for (size_t i = 0; i < n->next.n; i++) {
+        StopNode *s = &nodes[n->next.v[i]];
+        if (s->pending > 0 && --s->pending == 0 && s->state == STOP_WAITING) {
+            s->state = STOP_RUNNING;
+            ready[ready_tail++] = n->next.v[i];
+        }
+    }
+}
+
+static void drain(void);
+
+static void on_stop_done(Unit *unit, JobType type, int result, void *userdata) {
+    (void)type;
+    if (result < 0)
+        log_warning("[shutdown] %s did not stop cleanly", unit->name);
+    node_done((size_t)(uintptr_t)userdata);
+    drain();
+}
+
+// Queue stop jobs for everything released; units with nothing running are
+// done on the spot, which may release more
+static void drain(void) {
+    while (ready_head < ready_tail) {
+        size_t idx = ready[ready_head++];
+        StopNode *n = &nodes[idx];
+        if (needs_stop(n->unit)) {
+            n->stop_start = now_usec();
+            if (job_enqueue(n->unit, JOB_STOP, on_stop_done, (void *)(uintptr_t)idx) == 0)
+                continue;
+            log_error("[shutdown] Cannot queue stop of %s", n->unit->name);
+            n->stop_start = 0;
+        }
+        node_done(idx);
+    }
+    if (done_count == node_count)
+        complete();
+}
+
+static void shutdown_begin(void) {
+    shutdown_start_usec = now_usec();
+
+    // Nothing may start from here on: no reloads, no activations, no start jobs
+    reload_stop();
+    job_queue_shutdown();
+    socket_activation_pause();
+
+    size_t count = unit_registry_count();
+    nodes = calloc(count ? count : 1, sizeof(*nodes));
+    ready = calloc(count ? count : 1, sizeof(*ready));
+    if (!nodes || !ready) {
+        log_error("[shutdown] Out of memory, exiting without stopping units");
+        sd_event_exit(shutdown_event, 0);
+        return;
+    }
+    node_count = count;
+    for (size_t i = 0; i < count; i++)
+        nodes[i].unit = unit_registry_get(i);
+    for (size_t i = 0; i < count; i++) {
+        const Unit *u = nodes[i].unit;
+        if (add_deps(i, u->after, 1) < 0 || add_deps(i, u->before, 0) < 0) {
+            log_error("[shutdown] Out of memory ordering units, stopping all at once");
+            for (size_t k = 0; k < count; k++)
+                nodes[k].pending = 0;
+            break;
+        }
+    }
+    break_cycles();
+
+    size_t running = 0;
+    for (size_t i = 0; i < count; i++)
+        running += needs_stop(nodes[i].unit);
+    log_notice("[shutdown] Stopping %zu running units", running);
+
+    for (size_t i = 0; i < count; i++)
+        if (nodes[i].pending == 0) {
+            nodes[i].state = STOP_RUNNING;
+            ready[ready_tail++] = i;
+        }
+    drain();
+}
+
+static int on_signal(sd_event_source *s, const struct signalfd_siginfo *si, void *userdata) {
+    (void)s;
+    (void)userdata;
+    if (!shutdown_start_usec) {
+        log_notice("[shutdown] %s, shutting down", strsignal((int)si->ssi_signo));
+        shutdown_begin();
+        return 0;
+    }
+
+    log_notice("[shutdown] %s again, killing what is still stopping", strsignal((int)si->ssi_signo));
+    for (size_t i = 0; i < node_count; i++)
+        if (nodes[i].state == STOP_RUNNING)
+            service_manager_kill(nodes[i].unit);
+    return 0;
+}
+
+int shutdown_start(sd_event *event) {
+    static const int signals[] = { SIGTERM, SIGINT };
+    sigset_t mask;
+    sigemptyset(&mask);
+    for (size_t i = 0; i < 2; i++)
+        sigaddset(&mask, signals[i]);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0) {
+        log_error("[shutdown] Cannot block SIGTERM/SIGINT: %s", strerror(errno));
+        return -errno;
+    }
+
+    shutdown_event = event;
+    for (size_t i = 0; i < 2; i++) {
+        int r = sd_event_add_signal(event, &signal_sources[i], signals[i], on_signal, NULL);
+        if (r < 0) {
+            log_error("[shutdown] Cannot handle %s: %s", strsignal(signals[i]), strerror(-r));
+            shutdown_stop();
+            sigprocmask(SIG_UNBLOCK, &mask, NULL);
+            return r;
+        }
+    }
+    return 0;
+}
+
+void shutdown_stop(void) {
+    for (size_t i = 0; i < 2; i++)
+        signal_sources[i] = sd_event_source_unref(signal_sources[i]);
+    for (size_t i = 0; i < node_count; i++)
+        free(nodes[i].next.v);
+    free(nodes);
+    free(ready);
+    nodes = NULL;
+    ready = NULL;
+    node_count = done_count = 0;
+    ready_head = ready_tail = 0;
+    shutdown_start_usec = 0;
+    completed = 0;
+    shutdown_event = NULL;
+}
@@ -0,0 +1,13 @@
+// shutdown.h — ordered, parallel stop of every unit on SIGTERM/SIGINT
+#ifndef COREINITD_SHUTDOWN_H
+#define COREINITD_SHUTDOWN_H
+
+#include <systemd/sd-event.h>
+
+// Handle SIGTERM and SIGINT: stop all units in reverse dependency order,
+// independent ones in parallel, then leave the event loop. A second signal
+// SIGKILLs whatever is still stopping instead of waiting for TimeoutStopSec=.
+int shutdown_start(sd_event *event);
+void shutdown_stop(void);
+
+#endif
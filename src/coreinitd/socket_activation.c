@@ -1,154 +1,596 @@
+// socket_activation.c — socket units: bind every Listen*= address, watch, activate
+//
+// A socket unit owns one fd per ListenStream=/ListenDatagram=/
+// ListenSequentialPacket= address (Unix, IPv4 or IPv6). With Shards=N each IP
+// address is bound N times with SO_REUSEPORT, so the kernel spreads incoming
+// connections over N listeners; every shard is activated on its own and runs
+// its own instance of the service, which accepts on its own core.
 #define _GNU_SOURCE
 #include <sys/socket.h>
 #include <sys/un.h>
-#include <fcntl.h>
+#include <netinet/in.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <stdlib.h>
+#include <limits.h>
 #include <systemd/sd-event.h>
 #include "unit_loader.h"
+#include "log.h"
+#include "clock.h"
+#include "util.h"
+#include "unit_registry.h"
 #include "service_manager.h"
+#include "job_queue.h"
+#include "trace.h"
 #include "socket_activation.h"
+#include "accept_pool.h"
 
+#define ACCEPT_BATCH 64     // connections taken per wakeup before yielding to the loop
+#define SHARDS_MAX 256
+#define SHARD_FDS_MAX 16    // listeners one shard's instance is handed
+
+// systemd's TriggerLimitIntervalSec=/TriggerLimitBurst= defaults: a service
+// that exits without accepting would otherwise be restarted in a tight loop
+#define TRIGGER_LIMIT_USEC  (2 * 1000000ULL)
+#define TRIGGER_LIMIT_BURST 20
+
+typedef struct SocketActivation SocketActivation;
+
+typedef struct {
+    SocketActivation *sa;
+    unsigned index;
+    int running;                // its instance holds the shard's listeners
+} SocketShard;
+
+// One bound fd, the sd-event userdata of its source
 typedef struct {
+    SocketActivation *sa;
     int fd;
-    Unit *unit;
+    int type;                   // SOCK_STREAM, SOCK_DGRAM or SOCK_SEQPACKET
+    unsigned shard;
+    char *path;                 // Unix socket file, unlinked on reload; the unit may be swapped by then
     sd_event_source *event_source;
-} SocketActivation;
+} Listener;
 
-#define MAX_SOCKETS 32
-static SocketActivation sockets[MAX_SOCKETS];
-static size_t socket_count = 0;
+struct SocketActivation {
+    Unit *unit;
+    Listener *listeners;        // allocated once: sources point into it
+    size_t n_listeners;
+    Unit *service;              // Accept=no: gets the listeners, Accept=yes/Shards=: instantiated
+    uint64_t trigger_window;    // Accept=no: start of the current rate limit window
+    unsigned triggers;
 
-static Unit *find_matching_service(const Unit *socket_unit, Unit *units, size_t count) {
-    char base[128];
-    strncpy(base, socket_unit->name, sizeof(base));
-    char *ext = strstr(base, ".socket");
-    if (ext) *ext = '\0';
+    // Accept=yes
+    unsigned n_connections;     // live instances
+    AcceptPool *pool;
 
-    for (size_t i = 0; i < count; i++) {
-        if (units[i].type != UNIT_SERVICE)
-            continue;
+    // Shards=, Accept=no only; NULL when not sharded
+    SocketShard *shards;
+    unsigned n_shards;
+};
 
-        if (strncmp(units[i].name, base, strlen(base)) == 0)
-            return &units[i];
+// Each entry is individually allocated: its listeners point back to it
+static SocketActivation **sockets = NULL;
+static size_t socket_count = 0, socket_cap = 0;
+static sd_event *socket_event = NULL;
+static int paused = 0;          // shutting down: nothing is watched any more
+
+// Accept=yes and Shards= prefer a foo@.service template, like systemd
+static Unit *find_matching_service(const Unit *socket_unit) {
+    Unit *service = NULL;
+    if (socket_unit->accept || socket_unit->shards > 1)
+        service = unit_registry_find_sibling(socket_unit, "@.service");
+    if (!service)
+        service = unit_registry_find_sibling(socket_unit, ".service");
+    return service && service->type == UNIT_SERVICE && !service->not_found ? service : NULL;
+}
+
+int socket_activation_triggers(const Unit *service) {
+    if (strstr(service->name, "@."))
+        return 1;   // a template only ever runs as an instance
+    Unit *socket = unit_registry_find_sibling(service, ".socket");
+    if (socket && socket->type == UNIT_SOCKET && socket->accept)
+        return 1;
+    for (size_t i = 0; i < socket_count; i++)
+        if (sockets[i]->service == service)
+            return 1;
+    return 0;
+}
+
+// Listeners of shard (all of them when not sharded) into fds, names as
+// LISTEN_FDNAMES; systemd's default FileDescriptorName= is the socket unit's name
+static size_t collect_listeners(const SocketActivation *sa, unsigned shard, int *fds, size_t max,
+                                char *names, size_t names_size, size_t *names_len) {
+    size_t n = 0;
+    for (size_t i = 0; i < sa->n_listeners && n < max; i++) {
+        if (sa->listeners[i].shard != shard)
+            continue;
+        int w = snprintf(names + *names_len, names_size - *names_len, "%s%s", *names_len ? ":" : "", sa->unit->name);
+        if (w < 0 || (size_t)w >= names_size - *names_len)
+            break;
+        *names_len += (size_t)w;
+        fds[n++] = sa->listeners[i].fd;
     }
-    return NULL;
+    return n;
 }
 
-static int make_socket_nonblocking(int fd) {
-    int flags = fcntl(fd, F_GETFL, 0);
-    if (flags == -1) return -1;
-    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+size_t socket_activation_collect_fds(const Unit *service, int *fds, size_t max, char *names, size_t names_size) {
+    size_t n = 0, len = 0;
+    if (names_size) names[0] = '\0';
+    for (size_t i = 0; i < socket_count && n < max; i++) {
+        SocketActivation *sa = sockets[i];
+        if (sa->service != service || sa->unit->accept || sa->shards)
+            continue;
+        n += collect_listeners(sa, 0, fds + n, max - n, names, names_size, &len);
+    }
+    return n;
 }
 
-static Unit *all_units = NULL;
-static size_t unit_total = 0;
+// shard < 0: every listener
+static void watch_listeners(SocketActivation *sa, int shard, int on) {
+    for (size_t i = 0; i < sa->n_listeners; i++)
+        if (shard < 0 || sa->listeners[i].shard == (unsigned)shard)
+            sd_event_source_set_enabled(sa->listeners[i].event_source, on && !paused ? SD_EVENT_ON : SD_EVENT_OFF);
+}
 
-static int on_socket_event(sd_event_source *s, int fd, uint32_t revents, void *userdata) {
-    SocketActivation *sa = userdata;
+// Shards whose instance is not running listen for their next activation
+static void watch_idle_shards(SocketActivation *sa) {
+    for (unsigned k = 0; k < sa->n_shards; k++)
+        watch_listeners(sa, (int)k, !sa->shards[k].running);
+}
 
-    if (revents & (EPOLLIN | EPOLLPRI)) {
-		//socket-to-service activation
-		Unit *service = find_matching_service(sa->unit, all_units, unit_total);
-		if (service) {
-		    printf("[socket_activation] Activating service %s for socket %s\n", service->name, sa->unit->name);
-		    service_manager_start(service);
-		} else {
-		    printf("[socket_activation] No matching service for socket %s\n", sa->unit->name);
-		}
-
-        struct sockaddr_un client_addr;
-        socklen_t addrlen = sizeof(client_addr);
-        int client_fd = accept(fd, (struct sockaddr*)&client_addr, &addrlen);
-        if (client_fd == -1) {
-            if (errno != EAGAIN && errno != EWOULDBLOCK)
-                perror("accept");
-            return 0;
+// While the service owns the listeners, connections wait in the kernel backlog for it
+static void set_watching(const Unit *service, int on) {
+    for (size_t i = 0; i < socket_count; i++) {
+        SocketActivation *sa = sockets[i];
+        if (sa->service != service || sa->unit->accept)
+            continue;
+        if (sa->shards) {
+            // A stopped template: shards that triggered meanwhile get their turn
+            if (on)
+                watch_idle_shards(sa);
+        } else {
+            watch_listeners(sa, -1, on);
         }
+    }
+}
 
-        printf("[socket_activation] Accepted connection on %s\n", sa->unit->name);
+void socket_activation_service_started(const Unit *service) {
+    set_watching(service, 0);
+}
 
-        close(client_fd);         // TODO: pass client_fd to service
-    }
+void socket_activation_service_exited(const Unit *service) {
+    set_watching(service, 1);
+}
 
-    return 0;
+static void on_instance_exit(ServiceEntry *e, void *userdata) {
+    (void)e;
+    SocketActivation *sa = userdata;
+    if (sa->n_connections > 0)
+        sa->n_connections--;
 }
 
-int socket_activation_start(sd_event *event, Unit *units, size_t unit_count) {
-	all_units = units;
-	unit_total = unit_count;
+static void on_shard_exit(ServiceEntry *e, void *userdata) {
+    (void)e;
+    SocketShard *shard = userdata;
+    shard->running = 0;
+    // A stop in progress re-arms every shard once it is through
+    if (service_manager_state(shard->sa->service) != SERVICE_STOPPING)
+        watch_listeners(shard->sa, (int)shard->index, 1);
+}
 
-    for (size_t i = 0; i < unit_count; i++) {
-        Unit *u = &units[i];
-        if (u->type != UNIT_SOCKET) continue;
-        if (socket_count >= MAX_SOCKETS) {
-            fprintf(stderr, "Too many socket units loaded, max %d\n", MAX_SOCKETS);
-            break;
+// One instance per connection, from the warm pool when it has one
+static void accept_connections(Listener *l) {
+    SocketActivation *sa = l->sa;
+    for (int i = 0; i < ACCEPT_BATCH; i++) {
+        int conn = accept4(l->fd, NULL, NULL, SOCK_CLOEXEC);
+        if (conn < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                log_error("[socket_activation] %s: accept failed: %s", sa->unit->name, strerror(errno));
+            return;
         }
 
-        if (strlen(u->listen_stream) == 0) {
-            fprintf(stderr, "[socket_activation] Socket unit %s has no ListenStream, skipping\n", u->name);
+        // A stop waits for every instance; do not add to them
+        if (service_manager_state(sa->service) == SERVICE_STOPPING) {
+            close(conn);
             continue;
         }
+        if (sa->unit->max_connections && sa->n_connections >= sa->unit->max_connections) {
+            log_warning("[socket_activation] %s: MaxConnections=%u reached, refusing connection",
+                        sa->unit->name, sa->unit->max_connections);
+            close(conn);
+            continue;
+        }
+
+        ServiceEntry *e = NULL;
+        if (!sa->pool || accept_pool_dispatch(sa->pool, conn, on_instance_exit, sa, &e) < 0)
+            e = service_manager_start_instance(sa->service, conn, on_instance_exit, sa);
+        close(conn);    // the instance holds its own copy
+        if (e)
+            sa->n_connections++;
+    }
+}
+
+// Shards=: the shard's instance gets its own copy of every address
+static void activate_shard(SocketActivation *sa, SocketShard *shard) {
+    watch_listeners(sa, (int)shard->index, 0);
+    if (service_manager_state(sa->service) == SERVICE_STOPPING)
+        return;     // see set_watching()
+
+    int fds[SHARD_FDS_MAX];
+    char names[512];
+    size_t len = 0;
+    size_t n = collect_listeners(sa, shard->index, fds, SHARD_FDS_MAX, names, sizeof(names), &len);
+    log_debug("[socket_activation] Activating shard %u of %s for socket %s", shard->index, sa->service->name, sa->unit->name);
+    if (!service_manager_start_instance_fds(sa->service, fds, n, names, on_shard_exit, shard)) {
+        log_error("[socket_activation] %s: cannot start shard %u, no longer listening on it", sa->unit->name, shard->index);
+        return;
+    }
+    shard->running = 1;
+}
 
-        // Remove existing socket file, if any
-        unlink(u->listen_stream);
+static SocketActivation *find_socket(const char *name) {
+    for (size_t i = 0; i < socket_count; i++)
+        if (strcmp(sockets[i]->unit->name, name) == 0)
+            return sockets[i];
+    return NULL;
+}
 
-        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
-        if (fd < 0) {
-            perror("socket");
+// Socket= in a service claims the listed sockets, overriding the name match
+static void bind_socket_services(void) {
+    for (size_t i = 0; i < unit_registry_count(); i++) {
+        Unit *u = unit_registry_get(i);
+        if (u->type != UNIT_SERVICE || !u->socket_unit[0] || u->not_found)
             continue;
+
+        char name[UNIT_NAME_MAX + 1];
+        for (const char *list = u->socket_unit; unit_list_next(&list, name); ) {
+            SocketActivation *sa = find_socket(name);
+            if (!sa)
+                log_warning("[socket_activation] %s: Socket=%s not listening, ignoring", u->name, name);
+            else if (!sa->unit->accept && !sa->shards)
+                sa->service = u;
         }
+    }
+}
 
-        struct sockaddr_un addr;
-        memset(&addr, 0, sizeof(addr));
-        addr.sun_family = AF_UNIX;
-        strncpy(addr.sun_path, u->listen_stream, sizeof(addr.sun_path) - 1);
+static void on_activation_done(Unit *service, JobType type, int result, void *userdata) {
+    (void)service;
+    (void)type;
+    SocketActivation *sa = userdata;
+    if (result == -ECANCELED) {
+        watch_listeners(sa, -1, 1);
+    } else if (result < 0) {
+        // Leaving the socket armed would retry forever on the same connection
+        log_error("[socket_activation] %s: activation failed, no longer listening", sa->unit->name);
+    }
+}
 
-        if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
-            perror("bind");
-            close(fd);
-            continue;
+static int on_socket_event(sd_event_source *s, int fd, uint32_t revents, void *userdata) {
+    (void)s;
+    (void)fd;
+    Listener *l = userdata;
+    SocketActivation *sa = l->sa;
+
+    if (sa->unit->accept) {
+        if (revents & (EPOLLIN | EPOLLPRI))
+            accept_connections(l);
+        return 0;
+    }
+
+    // Accept=no: never touch the connection or datagram, the service takes
+    // it from the listener it inherits; service_manager_start() passes it the fds
+    if (revents & (EPOLLIN | EPOLLPRI | EPOLLERR | EPOLLHUP)) {
+        uint64_t now = clock_now();
+        if (now - sa->trigger_window > TRIGGER_LIMIT_USEC) {
+            sa->trigger_window = now;
+            sa->triggers = 0;
+        }
+        if (++sa->triggers > TRIGGER_LIMIT_BURST * (sa->shards ? sa->n_shards : 1)) {
+            log_warning("[socket_activation] %s: trigger limit hit, no longer listening", sa->unit->name);
+            watch_listeners(sa, -1, 0);
+            return 0;
         }
 
-        if (listen(fd, SOMAXCONN) < 0) {
-            perror("listen");
-            close(fd);
-            continue;
+        if (sa->shards) {
+            activate_shard(sa, &sa->shards[l->shard]);
+            return 0;
         }
 
-        if (make_socket_nonblocking(fd) < 0) {
-            perror("fcntl");
-            close(fd);
-            continue;
+        // Stop watching right away: however many connections arrive before
+        // the job runs, they all end up in one start of the service
+        log_debug("[socket_activation] Activating service %s for socket %s", sa->service->name, sa->unit->name);
+        watch_listeners(sa, -1, 0);
+        if (job_enqueue(sa->service, JOB_START, on_activation_done, sa) < 0)
+            log_warning("[socket_activation] %s: cannot queue activation, no longer listening", sa->unit->name);
+    }
+
+    return 0;
+}
+
+// Bound and, except for datagrams, listening; -errno. Only Accept=yes
+// listeners are non-blocking: we accept4() on those ourselves, while the others
+// go to the service as LISTEN_FDS, blocking like systemd hands them over
+static int open_listener(const Unit *u, struct sockaddr_storage *addr, socklen_t len, int type) {
+    int flags = SOCK_CLOEXEC | (u->accept ? SOCK_NONBLOCK : 0);
+    int fd = socket(addr->ss_family, type | flags, 0);
+    struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)addr;
+    if (fd < 0 && errno == EAFNOSUPPORT && addr->ss_family == AF_INET6 &&
+        memcmp(&in6->sin6_addr, &in6addr_any, sizeof(in6addr_any)) == 0) {
+        // A bare port on a kernel without IPv6: IPv4 only
+        struct sockaddr_in in = { .sin_family = AF_INET, .sin_port = in6->sin6_port,
+                                  .sin_addr.s_addr = htonl(INADDR_ANY) };
+        memset(addr, 0, sizeof(*addr));
+        memcpy(addr, &in, sizeof(in));
+        len = sizeof(in);
+        fd = socket(AF_INET, type | flags, 0);
+    }
+    if (fd < 0)
+        return -errno;
+
+    int one = 1, ip = addr->ss_family != AF_UNIX;
+    if (!ip && ((struct sockaddr_un *)addr)->sun_path[0])
+        unlink(((struct sockaddr_un *)addr)->sun_path);   // left over from a previous run
+    if ((ip && setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0) ||
+        (ip && (u->reuse_port || u->shards > 1) && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0) ||
+        bind(fd, (struct sockaddr *)addr, len) < 0 ||
+        (type != SOCK_DGRAM && listen(fd, u->backlog > INT_MAX ? INT_MAX : (int)u->backlog) < 0)) {
+        int r = -errno;
+        close(fd);
+        return r;
+    }
+    return fd;
+}
+
+static void socket_close(SocketActivation *sa) {
+    // Instances may outlive the socket; they no longer report back to it
+    service_manager_forget_instances(sa);
+    for (unsigned k = 0; k < sa->n_shards; k++)
+        service_manager_forget_instances(&sa->shards[k]);
+    accept_pool_free(sa->pool);
+    for (size_t i = 0; i < sa->n_listeners; i++) {
+        Listener *l = &sa->listeners[i];
+        if (l->event_source)
+            sd_event_source_unref(l->event_source);
+        if (l->fd >= 0)
+            close(l->fd);
+        free(l->path);
+    }
+    free(sa->listeners);
+    free(sa->shards);
+    free(sa);
+}
+
+static const struct {
+    const char *key;
+    int type;
+} listen_keys[] = {
+    { "ListenStream",           SOCK_STREAM },
+    { "ListenDatagram",         SOCK_DGRAM },
+    { "ListenSequentialPacket", SOCK_SEQPACKET },
+};
+#define N_LISTEN_KEYS (sizeof(listen_keys) / sizeof(listen_keys[0]))
+
+static const char *listen_list(const Unit *u, int type) {
+    return type == SOCK_STREAM ? u->listen_stream : type == SOCK_DGRAM ? u->listen_datagram : u->listen_seqpacket;
+}
+
+// Bind every Listen*= address, once per shard for IP ones: how many fds, or
+// -errno. Unix sockets cannot share an address, so only shard 0 gets those.
+static int bind_listeners(SocketActivation *sa) {
+    const Unit *u = sa->unit;
+    size_t n_addrs = 0;
+    char addr[UNIT_NAME_MAX + 1];
+    for (size_t k = 0; k < N_LISTEN_KEYS; k++)
+        for (const char *list = listen_list(u, listen_keys[k].type); unit_list_next(&list, addr); )
+            n_addrs++;
+    if (!n_addrs)
+        return 0;
+    if (!(sa->listeners = calloc(n_addrs * sa->n_shards, sizeof(*sa->listeners))))
+        return -ENOMEM;
+
+    for (size_t k = 0; k < N_LISTEN_KEYS; k++) {
+        int type = listen_keys[k].type;
+        for (const char *list = listen_list(u, type); unit_list_next(&list, addr); ) {
+            struct sockaddr_storage ss;
+            socklen_t len;
+            if (parse_socket_address(addr, &ss, &len) < 0) {
+                log_warning("[socket_activation] %s: invalid %s=%s, ignoring", u->name, listen_keys[k].key, addr);
+                continue;
+            }
+            if (u->accept && type == SOCK_DGRAM) {
+                log_warning("[socket_activation] %s: Accept=yes cannot take %s=%s, ignoring", u->name, listen_keys[k].key, addr);
+                continue;
+            }
+
+            unsigned shards = ss.ss_family == AF_UNIX ? 1 : sa->n_shards;
+            for (unsigned shard = 0; shard < shards; shard++) {
+                int fd = open_listener(u, &ss, len, type);
+                if (fd < 0) {
+                    log_error("[socket_activation] %s: cannot listen on %s=%s: %s", u->name, listen_keys[k].key, addr, strerror(-fd));
+                    return fd;
+                }
+                Listener *l = &sa->listeners[sa->n_listeners++];
+                l->sa = sa;
+                l->fd = fd;
+                l->type = type;
+                l->shard = shard;
+                if (ss.ss_family == AF_UNIX && addr[0] != '@' && !(l->path = strdup(addr)))
+                    return -ENOMEM;
+            }
+            log_info("[socket_activation] Listening on %s=%s (%s%s)", listen_keys[k].key, addr, u->name,
+                     shards > 1 ? ", sharded" : "");
         }
+    }
+    return (int)sa->n_listeners;
+}
+
+// Bind, listen and watch one socket unit; 0 if it was skipped
+static int socket_listen(Unit *u) {
+    if (socket_count == socket_cap) {
+        size_t cap = socket_cap ? socket_cap * 2 : 16;
+        SocketActivation **v = realloc(sockets, cap * sizeof(*v));
+        if (!v)
+            return -ENOMEM;
+        sockets = v;
+        socket_cap = cap;
+    }
+    SocketActivation *sa = calloc(1, sizeof(*sa));
+    if (!sa)
+        return -ENOMEM;
+    sa->unit = u;
+    sa->n_shards = 1;
+    if (u->shards > 1 && u->accept) {
+        log_warning("[socket_activation] %s: Shards= only applies to Accept=no, ignoring", u->name);
+    } else if (u->shards > 1) {
+        sa->n_shards = u->shards > SHARDS_MAX ? SHARDS_MAX : u->shards;
+        if (!(sa->shards = calloc(sa->n_shards, sizeof(*sa->shards)))) {
+            free(sa);
+            return -ENOMEM;
+        }
+        for (unsigned k = 0; k < sa->n_shards; k++)
+            sa->shards[k] = (SocketShard){ .sa = sa, .index = k };
+    }
+
+    int r = bind_listeners(sa);
+    if (r <= 0) {
+        if (r == 0)
+            log_warning("[socket_activation] Socket unit %s has nothing to listen on, skipping", u->name);
+        socket_close(sa);
+        return r == -ENOMEM ? r : 0;
+    }
 
-        int r = sd_event_add_io(event, &sockets[socket_count].event_source,
-                                fd, EPOLLIN, on_socket_event, &sockets[socket_count]);
+    sa->service = find_matching_service(u);
+    if ((u->accept || sa->shards) && (!sa->service || !sa->service->exec.argv)) {
+        log_warning("[socket_activation] %s: %s without a service to run, skipping", u->name,
+                    u->accept ? "Accept=yes" : "Shards=");
+        socket_close(sa);
+        return 0;
+    }
+
+    for (size_t i = 0; i < sa->n_listeners; i++) {
+        Listener *l = &sa->listeners[i];
+        r = sd_event_add_io(socket_event, &l->event_source, l->fd, EPOLLIN, on_socket_event, l);
         if (r < 0) {
-            fprintf(stderr, "Failed to add socket event source: %s\n", strerror(-r));
-            close(fd);
-            continue;
+            log_error("[socket_activation] Failed to add socket event source: %s", strerror(-r));
+            socket_close(sa);
+            return 0;
         }
+    }
+
+    if (u->accept && u->accept_pool_min > 0 &&
+        !(sa->pool = accept_pool_new(socket_event, sa->service, u->accept_pool_min, u->accept_pool_max)))
+        log_warning("[socket_activation] %s: running without a warm pool", u->name);
 
-        sockets[socket_count].fd = fd;
-        sockets[socket_count].unit = u;
+    trace_event(u, TRACE_READY, 0);
+    sockets[socket_count++] = sa;
+    return 0;
+}
 
-        printf("[socket_activation] Listening on unix socket %s (%s)\n", u->listen_stream, u->name);
-        socket_count++;
+// Accept=no listeners stay quiet while their service holds them
+static void update_watch(SocketActivation *sa) {
+    if (!sa->service) {
+        log_warning("[socket_activation] No matching service for socket %s, not watching", sa->unit->name);
+        watch_listeners(sa, -1, 0);
+    } else if (sa->shards) {
+        watch_idle_shards(sa);
+    } else if (!sa->unit->accept) {
+        ServiceState state = service_manager_state(sa->service);
+        watch_listeners(sa, -1, state != SERVICE_STARTING && state != SERVICE_ACTIVE && state != SERVICE_STOPPING);
+    } else {
+        watch_listeners(sa, -1, 1);
+    }
+}
+
+int socket_activation_start(sd_event *event) {
+    socket_event = event;
+    for (size_t i = 0; i < unit_registry_count(); i++) {
+        Unit *u = unit_registry_get(i);
+        if (u->type == UNIT_SOCKET && socket_listen(u) < 0)
+            break;
     }
 
+    bind_socket_services();
+
+    for (size_t i = 0; i < socket_count; i++)
+        if (!sockets[i]->service)
+            update_watch(sockets[i]);
     return 0;
 }
 
-void socket_activation_stop(void) {
+int socket_activation_reload(Unit *socket_unit) {
+    SocketActivation *sa = find_socket(socket_unit->name);
+    if (sa) {
+        for (size_t i = 0; i < socket_count; i++)
+            if (sockets[i] == sa) {
+                sockets[i] = sockets[--socket_count];
+                break;
+            }
+        for (size_t i = 0; i < sa->n_listeners; i++)
+            if (sa->listeners[i].path)
+                unlink(sa->listeners[i].path);
+        socket_close(sa);
+    }
+    if (!socket_event || socket_unit->not_found || socket_unit->type != UNIT_SOCKET)
+        return 0;
+
+    int r = socket_listen(socket_unit);
+    if (r < 0 || !(sa = find_socket(socket_unit->name)))
+        return r;
+    bind_socket_services();
+    update_watch(sa);
+    return 0;
+}
+
+void socket_activation_service_changed(Unit *service) {
+    if (!socket_event)
+        return;
+    // Accept=yes and Shards= sockets are only set up once they have something to run
+    for (size_t i = 0; i < unit_registry_count(); i++) {
+        Unit *u = unit_registry_get(i);
+        if (u->type == UNIT_SOCKET && (u->accept || u->shards > 1) && !u->not_found && !find_socket(u->name) &&
+            find_matching_service(u) == service)
+            socket_listen(u);
+    }
+
     for (size_t i = 0; i < socket_count; i++) {
-        if (sockets[i].event_source)
-            sd_event_source_unref(sockets[i].event_source);
-        if (sockets[i].fd >= 0)
-            close(sockets[i].fd);
+        SocketActivation *sa = sockets[i];
+        if (sa->service && sa->service != service)
+            continue;
+        sa->service = find_matching_service(sa->unit);
+        // The pool's workers were built from the old ExecStart=
+        if (sa->pool) {
+            accept_pool_free(sa->pool);
+            sa->pool = NULL;
+        }
+        if (sa->unit->accept && sa->service && sa->unit->accept_pool_min > 0)
+            sa->pool = accept_pool_new(socket_event, sa->service, sa->unit->accept_pool_min, sa->unit->accept_pool_max);
     }
-    socket_count = 0;
+    bind_socket_services();
+    for (size_t i = 0; i < socket_count; i++)
+        if (sockets[i]->service == service || !sockets[i]->service)
+            update_watch(sockets[i]);
+}
+
+void socket_activation_pause(void) {
+    paused = 1;
+    for (size_t i = 0; i < socket_count; i++) {
+        watch_listeners(sockets[i], -1, 0);
+        accept_pool_free(sockets[i]->pool);
+        sockets[i]->pool = NULL;
+    }
+}
+
+void socket_activation_stop(void) {
+    for (size_t i = 0; i < socket_count; i++)
+        socket_close(sockets[i]);
+    free(sockets);
+    sockets = NULL;
+    socket_count = socket_cap = 0;
+    socket_event = NULL;
+    paused = 0;
 }
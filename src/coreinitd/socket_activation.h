@@ -1,7 +1,30 @@
 #ifndef COREINITD_SOCKET_ACTIVATION_H
 #define COREINITD_SOCKET_ACTIVATION_H
 
-int socket_activation_start(sd_event *event, Unit *units, size_t unit_count);
+#include <systemd/sd-event.h>
+#include "unit_loader.h"
+
+int socket_activation_start(sd_event *event);
+// Services only started by their socket (Accept=yes instances, foo@.service
+// templates); the boot scheduler leaves them alone
+int socket_activation_triggers(const Unit *service);
+
+// Accept=no listeners belonging to service, for LISTEN_FDS; names gets the
+// colon-separated LISTEN_FDNAMES. Returns how many fds were stored.
+size_t socket_activation_collect_fds(const Unit *service, int *fds, size_t max, char *names, size_t names_size);
+// The service holds its listeners: stop watching them until it exits
+void socket_activation_service_started(const Unit *service);
+void socket_activation_service_exited(const Unit *service);
+// Shutdown: stop watching every listener and let the warm pools go; the
+// sockets stay open, so clients queue until we exit
+void socket_activation_pause(void);
 void socket_activation_stop(void);
 
+// Reload: close socket_unit's listener and set it up again from its current
+// definition (nothing is re-created if it is not_found now)
+int socket_activation_reload(Unit *socket_unit);
+// Reload: service was added, changed or removed; re-resolve which sockets
+// activate it and rebuild their warm pools
+void socket_activation_service_changed(Unit *service);
+
 #endif
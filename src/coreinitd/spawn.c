@@ -0,0 +1,818 @@
+// spawn.c — ExecStart= tokenizer and clone(CLONE_VM|CLONE_VFORK) based spawner
+#define _GNU_SOURCE
+#include "spawn.h"
+#include "util.h"
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <linux/mempolicy.h>
+
+#ifndef CLONE_PIDFD
+#define CLONE_PIDFD 0x00001000
+#endif
+#ifndef CLONE_INTO_CGROUP
+#define CLONE_INTO_CGROUP 0x200000000ULL
+#endif
+
+// <linux/ioprio.h>, which older headers lack
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_WHO_PROCESS 1
+
+#define DEFAULT_PATH "/usr/local/sbin:/usr/local/bin:/usr/sbin:/usr/bin:/sbin:/bin"
+#define SPAWN_STACK_SIZE (64 * 1024)
+
+extern char **environ;
+
+// ─────────────────
+// Growable helpers
+// ─────────────────
+typedef struct {
+    char *s;
+    size_t len, cap;
+} StrBuf;
+
+typedef struct {
+    char **v;
+    size_t n, cap;
+} StrVec;
+
+static int buf_putc(StrBuf *b, char c) {
+    if (b->len + 1 >= b->cap) {
+        size_t cap = b->cap ? b->cap * 2 : 64;
+        char *s = realloc(b->s, cap);
+        if (!s) return -ENOMEM;
+        b->s = s;
+        b->cap = cap;
+    }
+    b->s[b->len++] = c;
+    b->s[b->len] = '\0';
+    return 0;
+}
+
+static int buf_puts(StrBuf *b, const char *s) {
+    for (; *s; s++)
+        if (buf_putc(b, *s) < 0) return -ENOMEM;
+    return 0;
+}
+
+static int vec_push(StrVec *v, char *s) {
+    if (v->n + 1 >= v->cap) {
+        size_t cap = v->cap ? v->cap * 2 : 8;
+        char **nv = realloc(v->v, cap * sizeof(*nv));
+        if (!nv) return -ENOMEM;
+        v->v = nv;
+        v->cap = cap;
+    }
+    v->v[v->n++] = s;
+    v->v[v->n] = NULL;
+    return 0;
+}
+
+static void vec_free(StrVec *v) {
+    for (size_t i = 0; i < v->n; i++)
+        free(v->v[i]);
+    free(v->v);
+    v->v = NULL;
+    v->n = v->cap = 0;
+}
+
+// ──────────────
+// Tokenizer
+// ──────────────
+static int is_var_char(char c, int first) {
+    return c == '_' || isalpha((unsigned char)c) || (!first && isdigit((unsigned char)c));
+}
+
+// Unit Environment= first, then the daemon's own environment
+static const char *lookup_var(const StrVec *unit_env, const char *name, size_t len) {
+    for (size_t i = unit_env ? unit_env->n : 0; i-- > 0; ) {
+        const char *kv = unit_env->v[i];
+        if (strncmp(kv, name, len) == 0 && kv[len] == '=')
+            return kv + len + 1;
+    }
+    char key[128];
+    if (len >= sizeof(key)) return NULL;
+    memcpy(key, name, len);
+    key[len] = '\0';
+    return getenv(key);
+}
+
+// Parse "$NAME" or "${NAME}" at p; returns chars consumed, 0 if not a reference
+static size_t parse_var_ref(const char *p, const char **name, size_t *len) {
+    if (p[0] != '$') return 0;
+    if (p[1] == '{') {
+        const char *end = strchr(p + 2, '}');
+        if (!end || end == p + 2) return 0;
+        *name = p + 2;
+        *len = (size_t)(end - (p + 2));
+        return *len + 3;
+    }
+    if (!is_var_char(p[1], 1)) return 0;
+    size_t n = 1;
+    while (is_var_char(p[1 + n], 0)) n++;
+    *name = p + 1;
+    *len = n;
+    return n + 1;
+}
+
+static int unescape(char c, char *out) {
+    switch (c) {
+        case 'n':  *out = '\n'; return 0;
+        case 't':  *out = '\t'; return 0;
+        case 'r':  *out = '\r'; return 0;
+        case '\\': case '"': case '\'': case '$': case ' ':
+            *out = c; return 0;
+        default:   return -EINVAL;
+    }
+}
+
+// Split cmdline into words. expand=0 is used for Environment= itself.
+static int tokenize(const char *p, const StrVec *unit_env, int expand, StrVec *out) {
+    while (*p) {
+        while (isspace((unsigned char)*p)) p++;
+        if (!*p) break;
+
+        // A bare $VAR word splits its value on whitespace, like systemd
+        const char *name;
+        size_t len, used;
+        if (expand && p[1] != '{' && (used = parse_var_ref(p, &name, &len)) &&
+            (p[used] == '\0' || isspace((unsigned char)p[used]))) {
+            const char *val = lookup_var(unit_env, name, len);
+            if (val) {
+                char *copy = strdup(val), *save = NULL;
+                if (!copy) return -ENOMEM;
+                for (char *w = strtok_r(copy, " \t\n", &save); w; w = strtok_r(NULL, " \t\n", &save)) {
+                    char *dup = strdup(w);
+                    if (!dup || vec_push(out, dup) < 0) { free(dup); free(copy); return -ENOMEM; }
+                }
+                free(copy);
+            }
+            p += used;
+            continue;
+        }
+
+        StrBuf word = {0};
+        char quote = 0;
+        int r = 0;
+        while (r == 0 && *p && (quote || !isspace((unsigned char)*p))) {
+            char c = *p;
+            if (quote == '\'') {
+                if (c == '\'') quote = 0;
+                else r = buf_putc(&word, c);
+                p++;
+            } else if (c == '\'' && !quote) {
+                quote = '\'';
+                p++;
+            } else if (c == '"') {
+                quote = quote ? 0 : '"';
+                p++;
+            } else if (c == '\\') {
+                char e;
+                if (!p[1] || unescape(p[1], &e) < 0) { r = -EINVAL; break; }
+                r = buf_putc(&word, e);
+                p += 2;
+            } else if (expand && (used = parse_var_ref(p, &name, &len))) {
+                const char *val = lookup_var(unit_env, name, len);
+                if (val) r = buf_puts(&word, val);
+                p += used;
+            } else {
+                r = buf_putc(&word, c);
+                p++;
+            }
+        }
+        if (r == 0 && quote) r = -EINVAL;
+        if (r == 0 && !word.s && !(word.s = strdup(""))) r = -ENOMEM;   // "" or ''
+        if (r == 0) r = vec_push(out, word.s);
+        if (r < 0) {
+            free(word.s);
+            return r;
+        }
+    }
+    return 0;
+}
+
+// True when cmdline uses syntax only a shell can evaluate
+static int needs_shell(const char *p) {
+    static const char *const builtins[] = {
+        "cd", "exec", "export", "set", "source", ".", "if", "for", "while", "case", "test", "[", NULL
+    };
+    size_t first_len = strcspn(p + strspn(p, " \t"), " \t");
+    const char *first = p + strspn(p, " \t");
+    for (size_t i = 0; builtins[i]; i++)
+        if (strlen(builtins[i]) == first_len && strncmp(first, builtins[i], first_len) == 0)
+            return 1;
+
+    // Leading VAR=value assignment
+    const char *eq = memchr(first, '=', first_len);
+    if (eq && eq != first && !memchr(first, '/', (size_t)(eq - first)))
+        return 1;
+
+    char quote = 0;
+    int word_start = 1;
+    for (; *p; p++) {
+        char c = *p;
+        if (quote) {
+            if (c == quote) quote = 0;
+            else if (quote == '"' && (c == '`' || (c == '$' && p[1] == '('))) return 1;
+            else if (c == '\\' && quote == '"' && p[1]) p++;
+            continue;
+        }
+        if (c == '\\' && p[1]) { p++; word_start = 0; continue; }
+        if (c == '\'' || c == '"') { quote = c; word_start = 0; continue; }
+        if (strchr("|&;<>()`*?[]!", c)) return 1;
+        if (c == '$' && p[1] == '(') return 1;
+        if (word_start && (c == '~' || c == '#')) return 1;
+        word_start = isspace((unsigned char)c);
+    }
+    return 0;
+}
+
+static char *resolve_executable(const char *name) {
+    if (strchr(name, '/'))
+        return strdup(name);
+
+    const char *path = getenv("PATH");
+    if (!path || !*path) path = DEFAULT_PATH;
+
+    char candidate[4096];
+    for (const char *dir = path; *dir; ) {
+        size_t len = strcspn(dir, ":");
+        if (len > 0 && len + strlen(name) + 2 <= sizeof(candidate)) {
+            memcpy(candidate, dir, len);
+            candidate[len] = '/';
+            strcpy(candidate + len + 1, name);
+            if (access(candidate, X_OK) == 0)
+                return strdup(candidate);
+        }
+        dir += len;
+        if (*dir == ':') dir++;
+    }
+    // Let the spawn report ENOENT with the original name
+    return strdup(name);
+}
+
+static int build_envp(StrVec *envp, const StrVec *unit_env) {
+    for (char **e = environ; e && *e; e++) {
+        size_t klen = strcspn(*e, "=");
+        int overridden = 0;
+        for (size_t i = 0; i < unit_env->n && !overridden; i++)
+            overridden = strncmp(unit_env->v[i], *e, klen) == 0 && unit_env->v[i][klen] == '=';
+        if (overridden) continue;
+        char *dup = strdup(*e);
+        if (!dup || vec_push(envp, dup) < 0) { free(dup); return -ENOMEM; }
+    }
+    for (size_t i = 0; i < unit_env->n; i++) {
+        if (!strchr(unit_env->v[i], '=')) continue;
+        char *dup = strdup(unit_env->v[i]);
+        if (!dup || vec_push(envp, dup) < 0) { free(dup); return -ENOMEM; }
+    }
+    return 0;
+}
+
+int exec_command_parse(ExecCommand *cmd, const char *cmdline, const char *environment) {
+    StrVec unit_env = {0}, argv = {0}, envp = {0};
+    int r;
+
+    memset(cmd, 0, sizeof(*cmd));
+    if (environment && (r = tokenize(environment, NULL, 0, &unit_env)) < 0)
+        goto fail;
+
+    if (needs_shell(cmdline)) {
+        const char *sh_argv[] = { "/bin/sh", "-c", cmdline };
+        for (size_t i = 0; i < 3; i++) {
+            char *dup = strdup(sh_argv[i]);
+            if (!dup || vec_push(&argv, dup) < 0) {
+                free(dup);
+                r = -ENOMEM;
+                goto fail;
+            }
+        }
+        cmd->use_shell = 1;
+    } else {
+        if ((r = tokenize(cmdline, &unit_env, 1, &argv)) < 0)
+            goto fail;
+        if (argv.n == 0) {
+            r = -EINVAL;
+            goto fail;
+        }
+        char *exe = resolve_executable(argv.v[0]);
+        if (!exe) {
+            r = -ENOMEM;
+            goto fail;
+        }
+        free(argv.v[0]);
+        argv.v[0] = exe;
+    }
+
+    // Without Environment= the child simply inherits environ; no per-unit copy
+    if (unit_env.n > 0) {
+        if ((r = build_envp(&envp, &unit_env)) < 0)
+            goto fail;
+        if (!envp.v && (r = vec_push(&envp, NULL)) < 0)
+            goto fail;
+    }
+
+    vec_free(&unit_env);
+    cmd->argv = argv.v;
+    cmd->envp = envp.v;
+    return 0;
+
+fail:
+    vec_free(&unit_env);
+    vec_free(&argv);
+    vec_free(&envp);
+    cmd->use_shell = 0;
+    return r;
+}
+
+static void strv_free(char **v) {
+    for (char **p = v; p && *p; p++)
+        free(*p);
+    free(v);
+}
+
+void exec_command_free(ExecCommand *cmd) {
+    strv_free(cmd->argv);
+    strv_free(cmd->envp);
+    memset(cmd, 0, sizeof(*cmd));
+}
+
+// ──────────────
+// Placement
+// ──────────────
+const char *const spawn_numa_policies[5] = { "default", "preferred", "bind", "interleave", "local" };
+const char *const spawn_sched_policies[6] = {
+    [SCHED_OTHER] = "other", [SCHED_FIFO] = "fifo", [SCHED_RR] = "rr", [SCHED_BATCH] = "batch", [SCHED_IDLE] = "idle",
+};
+const char *const spawn_io_classes[4] = { "none", "realtime", "best-effort", "idle" };
+
+void spawn_placement_init(SpawnPlacement *p) {
+    memset(p, 0, sizeof(*p));
+    p->numa_policy = p->sched_policy = p->io_class = -1;
+    p->io_priority = 4;
+}
+
+// In the child, before execve(): plain syscalls only
+static int apply_placement(const SpawnPlacement *p) {
+    if (p->has_cpus && syscall(SYS_sched_setaffinity, 0, sizeof(p->cpus), p->cpus) < 0)
+        return errno;
+    if (p->numa_policy >= 0) {
+        int empty = p->numa_policy == MPOL_DEFAULT || p->numa_policy == MPOL_LOCAL;
+        if (syscall(SYS_set_mempolicy, p->numa_policy, empty ? NULL : p->numa_nodes,
+                    empty ? 0 : SPAWN_NUMA_NODES_MAX + 1) < 0)
+            return errno;
+    }
+    struct sched_param sp = { .sched_priority = p->sched_priority };
+    if (p->sched_policy >= 0 && sched_setscheduler(0, p->sched_policy, &sp) < 0)
+        return errno;
+    if (p->has_nice && setpriority(PRIO_PROCESS, 0, p->nice) < 0)
+        return errno;
+    if (p->io_class >= 0 &&
+        syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, (p->io_class << IOPRIO_CLASS_SHIFT) | p->io_priority) < 0)
+        return errno;
+    return 0;
+}
+
+// The first mapping's policy in numa_maps, e.g. "bind:0-1"; it is the
+// process policy unless a mapping has one of its own (mbind())
+static void numa_policy_of(pid_t pid, SpawnPlacement *ret) {
+    char path[64], line[256];
+    snprintf(path, sizeof(path), "/proc/%d/numa_maps", (int)pid);
+    FILE *f = fopen(path, "re");
+    if (!f)
+        return;     // no CONFIG_NUMA
+    char *policy = fgets(line, sizeof(line), f) ? strchr(line, ' ') : NULL;
+    fclose(f);
+    if (!policy)
+        return;
+    policy++;
+    policy[strcspn(policy, " \n")] = '\0';
+    char *nodes = strchr(policy, ':');
+    if (nodes)
+        *nodes++ = '\0';
+    if (strcmp(policy, "prefer") == 0 || strcmp(policy, "preferred") == 0)
+        policy = "preferred";
+    for (int i = 0; i < 5; i++)
+        if (strcmp(policy, spawn_numa_policies[i]) == 0) {
+            ret->numa_policy = i;
+            if (nodes)
+                parse_cpu_list(nodes, ret->numa_nodes, SPAWN_NUMA_NODES_MAX);
+        }
+}
+
+int spawn_placement_of(pid_t pid, SpawnPlacement *ret) {
+    spawn_placement_init(ret);
+    if (syscall(SYS_sched_getaffinity, pid, sizeof(ret->cpus), ret->cpus) < 0)
+        return -errno;
+    ret->has_cpus = 1;
+    struct sched_param sp;
+    int policy = sched_getscheduler(pid);
+    if (policy < 0 || sched_getparam(pid, &sp) < 0)
+        return -errno;
+    ret->sched_policy = policy & ~SCHED_RESET_ON_FORK;
+    ret->sched_priority = sp.sched_priority;
+    errno = 0;
+    ret->nice = getpriority(PRIO_PROCESS, (id_t)pid);
+    if (errno)
+        return -errno;
+    ret->has_nice = 1;
+    long io = syscall(SYS_ioprio_get, IOPRIO_WHO_PROCESS, pid);
+    if (io < 0)
+        return -errno;
+    ret->io_class = (int)(io >> IOPRIO_CLASS_SHIFT) & 3;
+    ret->io_priority = (int)(io & 7);
+    numa_policy_of(pid, ret);
+    return 0;
+}
+
+size_t spawn_placement_format(const SpawnPlacement *p, char sep, char *buf, size_t size) {
+    char list[SPAWN_MASK_TEXT_MAX];
+    size_t len = 0;
+    if (size) buf[0] = '\0';
+#define PUT(...) do { \
+        int w_ = snprintf(buf + len, size - len, __VA_ARGS__); \
+        if (w_ < 0 || (size_t)w_ >= size - len) return len; \
+        len += (size_t)w_; \
+    } while (0)
+    if (p->has_cpus) {
+        format_cpu_list(p->cpus, SPAWN_CPUS_MAX, list, sizeof(list));
+        PUT("CPUAffinity=%s%c", list, sep);
+    }
+    if (p->numa_policy >= 0) {
+        format_cpu_list(p->numa_nodes, SPAWN_NUMA_NODES_MAX, list, sizeof(list));
+        PUT("NUMAPolicy=%s%c", spawn_numa_policies[p->numa_policy], sep);
+        if (list[0])
+            PUT("NUMAMask=%s%c", list, sep);
+    }
+    if (p->sched_policy >= 0) {
+        const char *name = p->sched_policy < 6 ? spawn_sched_policies[p->sched_policy] : NULL;
+        PUT("CPUSchedulingPolicy=%s%c", name ? name : "?", sep);
+        if (p->sched_policy == SCHED_FIFO || p->sched_policy == SCHED_RR)
+            PUT("CPUSchedulingPriority=%d%c", p->sched_priority, sep);
+    }
+    if (p->has_nice)
+        PUT("Nice=%d%c", p->nice, sep);
+    if (p->io_class >= 0) {
+        PUT("IOSchedulingClass=%s%c", spawn_io_classes[p->io_class], sep);
+        if (p->io_class != 0)
+            PUT("IOSchedulingPriority=%d%c", p->io_priority, sep);
+    }
+#undef PUT
+    return len;
+}
+
+// ──────────────
+// Spawner
+// ──────────────
+typedef struct {
+    const ExecCommand *cmd;
+    const SpawnFds *fds;
+    char **envp;            // with LISTEN_* added, NULL: use cmd->envp/environ as is
+    char *pid_digits;       // inside envp's LISTEN_PID=, filled in by the child
+    int *lifted;            // scratch for moving fds, n_fds entries
+    char listen_fds[32];
+    char listen_pid[32];
+    char *listen_fdnames;
+    int join_cgroup;        // clone3() could not place the child: it writes cgroup.procs itself
+    volatile int error;     // written by the child, which shares our memory
+} SpawnContext;
+
+// Set by us for this child, whatever the unit or daemon environment says
+static int is_overridden(const char *e, const char *const *extra) {
+    if (strncmp(e, "LISTEN_FDS=", 11) == 0 || strncmp(e, "LISTEN_PID=", 11) == 0 ||
+        strncmp(e, "LISTEN_FDNAMES=", 15) == 0)
+        return 1;
+    size_t len = strcspn(e, "=");
+    for (; extra && *extra; extra++)
+        if (strncmp(e, *extra, len + 1) == 0)
+            return 1;
+    return 0;
+}
+
+// Everything that allocates happens here, in the parent, before clone()
+static int spawn_context_init(SpawnContext *ctx, const ExecCommand *cmd, const SpawnFds *fds) {
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->cmd = cmd;
+    ctx->fds = fds;
+    if (!fds || (fds->n_fds == 0 && fds->stdio_fd < 0 && fds->output_fd < 0 && !fds->env))
+        return 0;
+
+    char **base = cmd->envp ? cmd->envp : environ;
+    size_t n = 0, n_extra = 0;
+    while (base && base[n]) n++;
+    while (fds->env && fds->env[n_extra]) n_extra++;
+
+    ctx->envp = malloc((n + n_extra + 4) * sizeof(char *));
+    ctx->lifted = malloc((fds->n_fds + 1) * sizeof(int));
+    if (fds->names && asprintf(&ctx->listen_fdnames, "LISTEN_FDNAMES=%s", fds->names) < 0)
+        ctx->listen_fdnames = NULL;
+    if (!ctx->envp || !ctx->lifted || (fds->names && !ctx->listen_fdnames))
+        return -ENOMEM;
+
+    size_t k = 0;
+    for (size_t i = 0; i < n; i++)
+        if (!is_overridden(base[i], fds->env))
+            ctx->envp[k++] = base[i];
+    for (size_t i = 0; i < n_extra; i++)
+        ctx->envp[k++] = (char *)fds->env[i];
+    if (fds->n_fds > 0) {
+        snprintf(ctx->listen_fds, sizeof(ctx->listen_fds), "LISTEN_FDS=%zu", fds->n_fds);
+        strcpy(ctx->listen_pid, "LISTEN_PID=");
+        ctx->pid_digits = ctx->listen_pid + strlen(ctx->listen_pid);
+        ctx->envp[k++] = ctx->listen_fds;
+        ctx->envp[k++] = ctx->listen_pid;
+        if (ctx->listen_fdnames)
+            ctx->envp[k++] = ctx->listen_fdnames;
+    }
+    ctx->envp[k] = NULL;
+    return 0;
+}
+
+static void spawn_context_done(SpawnContext *ctx) {
+    free(ctx->envp);
+    free(ctx->lifted);
+    free(ctx->listen_fdnames);
+}
+
+// Signals ignored when we were started (nohup, a shell's background job)
+// would stay ignored across execve() and make KillSignal= useless
+static sigset_t inherited_ignored;
+
+static void find_ignored_signals(void) {
+    static int done = 0;
+    if (done++) return;
+    sigemptyset(&inherited_ignored);
+    for (int sig = 1; sig < NSIG; sig++) {
+        struct sigaction sa;
+        if (sigaction(sig, NULL, &sa) == 0 && sa.sa_handler == SIG_IGN)
+            sigaddset(&inherited_ignored, sig);
+    }
+}
+
+// The fd limit we were started with, handed back to services: select()
+// users break above 1024. rlim_cur == 0: never raised, nothing to restore.
+static struct rlimit inherited_nofile;
+
+int spawn_raise_fd_limit(void) {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) < 0)
+        return -errno;
+
+    // As root we may go past the hard limit, up to the kernel's fs.nr_open
+    rlim_t max = rl.rlim_max;
+    FILE *f = fopen("/proc/sys/fs/nr_open", "re");
+    unsigned long nr_open;
+    if (f) {
+        if (fscanf(f, "%lu", &nr_open) == 1 && nr_open > max)
+            max = nr_open;
+        fclose(f);
+    }
+    if (rl.rlim_cur >= max)
+        return 0;
+    struct rlimit raised = { max, max };
+    if (setrlimit(RLIMIT_NOFILE, &raised) < 0) {
+        raised.rlim_cur = raised.rlim_max = rl.rlim_max;
+        if (rl.rlim_cur >= rl.rlim_max)
+            return 0;
+        if (setrlimit(RLIMIT_NOFILE, &raised) < 0)
+            return -errno;
+    }
+    inherited_nofile = rl;
+    return 0;
+}
+
+// Async-signal-safe: move fds into place, then execve(). Returns errno.
+static int exec_in_child(SpawnContext *ctx) {
+    if (inherited_nofile.rlim_cur && setrlimit(RLIMIT_NOFILE, &inherited_nofile) < 0)
+        return errno;
+    sigset_t none;
+    sigemptyset(&none);
+    struct sigaction dfl = { .sa_handler = SIG_DFL };
+    for (int sig = 1; sig < NSIG; sig++)
+        if (sigismember(&inherited_ignored, sig) == 1)
+            sigaction(sig, &dfl, NULL);
+    sigprocmask(SIG_SETMASK, &none, NULL);
+
+    const SpawnFds *fds = ctx->fds;
+    // Before anything else runs, as clone3() would have done: nothing of the
+    // service ever executes outside its cgroup
+    if (ctx->join_cgroup) {
+        int fd = openat(fds->cgroup_fd, "cgroup.procs", O_WRONLY | O_CLOEXEC);
+        if (fd < 0 || write(fd, "0", 1) != 1)
+            return errno;
+        close(fd);
+    }
+    int r;
+    if (fds && fds->placement && (r = apply_placement(fds->placement)) != 0)
+        return r;
+    if (ctx->envp) {
+        // Lift every source above the target range first so dup2() cannot clobber one
+        int min = 3 + (int)fds->n_fds;
+        for (size_t i = 0; i < fds->n_fds; i++)
+            if ((ctx->lifted[i] = fcntl(fds->fds[i], F_DUPFD_CLOEXEC, min)) < 0)
+                return errno;
+        int out = -1;
+        if (fds->output_fd >= 0 && (out = fcntl(fds->output_fd, F_DUPFD_CLOEXEC, min)) < 0)
+            return errno;
+        if (fds->stdio_fd >= 0) {
+            int s = fcntl(fds->stdio_fd, F_DUPFD_CLOEXEC, min);
+            if (s < 0 || dup2(s, STDIN_FILENO) < 0 || dup2(s, STDOUT_FILENO) < 0)
+                return errno;
+        }
+        if (out >= 0 && ((fds->stdio_fd < 0 && dup2(out, STDOUT_FILENO) < 0) || dup2(out, STDERR_FILENO) < 0))
+            return errno;
+        for (size_t i = 0; i < fds->n_fds; i++)
+            if (dup2(ctx->lifted[i], 3 + (int)i) < 0)    // dup2() clears FD_CLOEXEC
+                return errno;
+
+        if (ctx->pid_digits) {
+            char digits[16];
+            int len = 0;
+            for (unsigned pid = (unsigned)getpid(); pid; pid /= 10)
+                digits[len++] = (char)('0' + pid % 10);
+            for (int i = 0; i < len; i++)
+                ctx->pid_digits[i] = digits[len - 1 - i];
+            ctx->pid_digits[len] = '\0';
+        }
+    }
+
+    char **envp = ctx->envp ? ctx->envp : ctx->cmd->envp ? ctx->cmd->envp : environ;
+    execve(ctx->cmd->argv[0], ctx->cmd->argv, envp);
+    return errno;
+}
+
+static char *spawn_stack = NULL;
+
+// Runs on spawn_stack in the parent's address space until execve() succeeds:
+// only async-signal-safe calls, no allocation.
+static int spawn_child(void *arg) {
+    SpawnContext *ctx = arg;
+    ctx->error = exec_in_child(ctx);
+    _exit(127);
+}
+
+#if defined(SYS_clone3) && (defined(__x86_64__) || defined(__aarch64__))
+// struct clone_args up to .cgroup (CLONE_ARGS_SIZE_VER2), for older headers
+struct spawn_clone_args {
+    uint64_t flags, pidfd, child_tid, parent_tid, exit_signal;
+    uint64_t stack, stack_size, tls, set_tid, set_tid_size, cgroup;
+};
+
+// glibc has no clone3() wrapper that takes a function, and with CLONE_VM the
+// child must not return through the parent's stack frame: it leaves the
+// syscall on spawn_stack and calls fn(arg) straight from here.
+static long clone3_call(struct spawn_clone_args *args, int (*fn)(void *), void *arg) {
+#if defined(__x86_64__)
+    register long rax __asm__("rax") = SYS_clone3;
+    register void *r12 __asm__("r12") = (void *)fn;
+    register void *r13 __asm__("r13") = arg;
+    __asm__ volatile("syscall\n\t"
+                     "test %%rax, %%rax\n\t"
+                     "jnz 1f\n\t"
+                     "xor %%ebp, %%ebp\n\t"
+                     "mov %%r13, %%rdi\n\t"
+                     "call *%%r12\n\t"
+                     "mov %%eax, %%edi\n\t"
+                     "mov $60, %%eax\n\t"     // SYS_exit
+                     "syscall\n"
+                     "1:"
+                     : "+r"(rax)
+                     : "D"(args), "S"(sizeof(*args)), "r"(r12), "r"(r13)
+                     : "rcx", "r11", "memory");
+    return rax;
+#else
+    register long x0 __asm__("x0") = (long)args;
+    register long x1 __asm__("x1") = sizeof(*args);
+    register long x8 __asm__("x8") = SYS_clone3;
+    register void *x19 __asm__("x19") = (void *)fn;
+    register void *x20 __asm__("x20") = arg;
+    __asm__ volatile("svc #0\n\t"
+                     "cbnz x0, 1f\n\t"
+                     "mov x0, x20\n\t"
+                     "blr x19\n\t"
+                     "mov x8, #93\n\t"         // SYS_exit
+                     "svc #0\n"
+                     "1:"
+                     : "+r"(x0)
+                     : "r"(x1), "r"(x8), "r"(x19), "r"(x20)
+                     : "x30", "memory");
+    return x0;
+#endif
+}
+
+// 0 once the kernel turned CLONE_INTO_CGROUP down (< 5.7, or clone3() missing)
+static int clone3_works = 1;
+
+static pid_t clone_into_cgroup(SpawnContext *ctx, int cgroup_fd, int *ret_pidfd) {
+    if (!clone3_works)
+        return -ENOSYS;
+    struct spawn_clone_args args = {
+        .flags = CLONE_VM | CLONE_VFORK | CLONE_INTO_CGROUP | (ret_pidfd ? CLONE_PIDFD : 0),
+        .pidfd = (uint64_t)(uintptr_t)ret_pidfd,
+        .exit_signal = SIGCHLD,
+        .stack = (uint64_t)(uintptr_t)spawn_stack,
+        .stack_size = SPAWN_STACK_SIZE,
+        .cgroup = (uint64_t)cgroup_fd,
+    };
+    long r = clone3_call(&args, spawn_child, ctx);
+    if (r == -ENOSYS || r == -E2BIG || r == -EINVAL)
+        clone3_works = 0;
+    return (pid_t)r;
+}
+#else
+static pid_t clone_into_cgroup(SpawnContext *ctx, int cgroup_fd, int *ret_pidfd) {
+    (void)ctx;
+    (void)cgroup_fd;
+    (void)ret_pidfd;
+    return -ENOSYS;
+}
+#endif
+
+int spawn_command(const ExecCommand *cmd, pid_t *ret_pid, int *ret_pidfd) {
+    return spawn_command_fds(cmd, NULL, ret_pid, ret_pidfd);
+}
+
+int spawn_exec(const ExecCommand *cmd, const SpawnFds *fds) {
+    if (!cmd->argv || !cmd->argv[0])
+        return -EINVAL;
+
+    find_ignored_signals();
+    SpawnContext ctx;
+    int r = spawn_context_init(&ctx, cmd, fds);
+    if (r == 0)
+        r = -exec_in_child(&ctx);
+    spawn_context_done(&ctx);
+    return r;
+}
+
+int spawn_command_fds(const ExecCommand *cmd, const SpawnFds *fds, pid_t *ret_pid, int *ret_pidfd) {
+    if (!cmd->argv || !cmd->argv[0])
+        return -EINVAL;
+
+    if (!spawn_stack) {
+        void *stack = mmap(NULL, SPAWN_STACK_SIZE, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+        if (stack == MAP_FAILED)
+            return -errno;
+        spawn_stack = stack;
+    }
+
+    find_ignored_signals();
+    SpawnContext ctx;
+    int r = spawn_context_init(&ctx, cmd, fds);
+    if (r < 0) {
+        spawn_context_done(&ctx);
+        return r;
+    }
+    int flags = CLONE_VM | CLONE_VFORK | SIGCHLD;
+    int pidfd = -1;
+    pid_t pid = -1;
+
+    // The parent is suspended until the child exec's or exits, so one stack suffices
+    if (fds && fds->cgroup_fd >= 0) {
+        pid = clone_into_cgroup(&ctx, fds->cgroup_fd, ret_pidfd ? &pidfd : NULL);
+        if (pid == -ENOSYS || pid == -E2BIG || pid == -EINVAL)
+            ctx.join_cgroup = 1;
+        else if (pid < 0) {
+            spawn_context_done(&ctx);
+            return pid;
+        }
+    }
+    if (pid < 0) {
+        pid = clone(spawn_child, spawn_stack + SPAWN_STACK_SIZE,
+                    flags | (ret_pidfd ? CLONE_PIDFD : 0), &ctx, &pidfd);
+        if (pid < 0 && ret_pidfd && errno == EINVAL) {
+            // Kernel without CLONE_PIDFD (< 5.2)
+            pidfd = -1;
+            pid = clone(spawn_child, spawn_stack + SPAWN_STACK_SIZE, flags, &ctx, NULL);
+        }
+        if (pid < 0) {
+            r = -errno;
+            spawn_context_done(&ctx);
+            return r;
+        }
+    }
+    spawn_context_done(&ctx);
+
+    if (ctx.error) {
+        waitpid(pid, NULL, 0);
+        if (pidfd >= 0) close(pidfd);
+        return -ctx.error;
+    }
+
+    *ret_pid = pid;
+    if (ret_pidfd)
+        *ret_pidfd = pidfd;
+    return 0;
+}
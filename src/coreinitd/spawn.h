@@ -0,0 +1,83 @@
+// spawn.h — pre-tokenized ExecStart= commands and shell-free process spawning
+#ifndef COREINITD_SPAWN_H
+#define COREINITD_SPAWN_H
+
+#include <sys/types.h>
+
+typedef struct {
+    char **argv;     // NULL-terminated, argv[0] resolved to an absolute path
+    char **envp;     // daemon environment + Environment=, NULL: inherit environ
+    int use_shell;   // argv is { "/bin/sh", "-c", <cmdline> }
+} ExecCommand;
+
+// Tokenize cmdline with systemd-style quoting and $VAR/${VAR} expansion.
+// environment holds the unit's Environment= words ("K=V" "K2=V2"), may be NULL.
+int exec_command_parse(ExecCommand *cmd, const char *cmdline, const char *environment);
+void exec_command_free(ExecCommand *cmd);
+
+#define SPAWN_CPUS_MAX 1024        // as glibc's CPU_SETSIZE
+#define SPAWN_NUMA_NODES_MAX 1024
+#define SPAWN_MASK_WORDS(bits) ((bits) / (8 * sizeof(unsigned long)))
+#define SPAWN_MASK_TEXT_MAX 2048   // "0,2,4,...,1022" is the longest list
+#define SPAWN_PLACEMENT_TEXT_MAX (2 * SPAWN_MASK_TEXT_MAX + 256)
+
+// Where the child runs, set right before execve(); anything left at its
+// "inherit" value stays as the daemon's own
+typedef struct {
+    int has_cpus;
+    unsigned long cpus[SPAWN_MASK_WORDS(SPAWN_CPUS_MAX)];               // CPUAffinity=
+    int numa_policy;         // NUMAPolicy=, MPOL_*; -1: inherit
+    unsigned long numa_nodes[SPAWN_MASK_WORDS(SPAWN_NUMA_NODES_MAX)];   // NUMAMask=
+    int sched_policy;        // CPUSchedulingPolicy=, SCHED_*; -1: inherit
+    int sched_priority;      // CPUSchedulingPriority=, fifo/rr only
+    int has_nice;
+    int nice;                // Nice=
+    int io_class;            // IOSchedulingClass=, IOPRIO_CLASS_*; -1: inherit
+    int io_priority;         // IOSchedulingPriority= 0-7
+} SpawnPlacement;
+
+// Indexed by the kernel's value, NULL where it has none
+extern const char *const spawn_numa_policies[5];
+extern const char *const spawn_sched_policies[6];
+extern const char *const spawn_io_classes[4];
+
+// Nothing set: everything inherited
+void spawn_placement_init(SpawnPlacement *p);
+// What a running process actually got; NUMA policy as far as /proc tells.
+// -errno (-ESRCH once it is gone).
+int spawn_placement_of(pid_t pid, SpawnPlacement *ret);
+// "Key=value" for every setting that is not inherited, each followed by
+// sep; truncated to size, which SPAWN_PLACEMENT_TEXT_MAX always fits.
+// Returns the length.
+size_t spawn_placement_format(const SpawnPlacement *p, char sep, char *buf, size_t size);
+
+// Descriptors handed to the child sd_listen_fds()-style
+typedef struct {
+    const int *fds;          // become fd 3, 4, ... in the child
+    size_t n_fds;
+    const char *names;       // LISTEN_FDNAMES value (colon-separated), may be NULL
+    int stdio_fd;            // >= 0: also dup'd onto stdin and stdout
+    int output_fd;           // >= 0: dup'd onto stderr, and stdout unless stdio_fd is set
+    int cgroup_fd;           // >= 0: cgroup v2 directory the child starts in
+    const char *const *env;  // extra "K=V" (NOTIFY_SOCKET=, ...), NULL-terminated, may be NULL
+    const SpawnPlacement *placement;    // NULL: the daemon's own
+} SpawnFds;
+
+// Start cmd without duplicating the daemon's address space (CLONE_VM|CLONE_VFORK).
+// With a cgroup_fd, clone3(CLONE_INTO_CGROUP) creates the child inside the
+// cgroup; kernels without it (< 5.7) have the child join it before execve().
+// Returns once the child has exec'd; exec failures are reported as -errno.
+// ret_pidfd may be NULL; otherwise it receives a pidfd or -1 if unsupported.
+int spawn_command(const ExecCommand *cmd, pid_t *ret_pid, int *ret_pidfd);
+// Same, passing fds with LISTEN_FDS/LISTEN_PID/LISTEN_FDNAMES set; fds may be NULL
+int spawn_command_fds(const ExecCommand *cmd, const SpawnFds *fds, pid_t *ret_pid, int *ret_pidfd);
+// Become cmd in the calling process (e.g. a pre-forked worker); returns -errno on failure.
+// fds->cgroup_fd is ignored: the caller already runs where it should.
+int spawn_exec(const ExecCommand *cmd, const SpawnFds *fds);
+
+// Raise RLIMIT_NOFILE as far as allowed (past the hard limit as root): a few
+// fds per unit add up. Spawned commands still get the limit we were started
+// with. -errno on failure.
+int spawn_raise_fd_limit(void);
+
+#endif
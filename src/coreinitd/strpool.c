@@ -0,0 +1,150 @@
+// strpool.c — interned strings in append-only arena chunks
+//
+// Unit names, paths, ExecStart= lines and dependency lists are stored once,
+// however many units carry them: a thousand instances of one template share
+// a single copy of everything but their name. Strings are never freed one
+// by one; a reload that changes a value leaves the old one behind, so the
+// pool grows only with values never seen before.
+#include "strpool.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define CHUNK_SIZE (64 * 1024)      // longer strings get a chunk of their own
+
+typedef struct Chunk {
+    struct Chunk *next;
+    size_t size, used;
+    char data[];
+} Chunk;
+
+typedef struct {
+    const char *s;          // NULL: free slot
+    uint32_t hash;
+    uint32_t len;
+} Slot;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static Chunk *chunks = NULL;        // the head is the one being filled
+static Slot *slots = NULL;          // linear probing, power-of-two size
+static size_t slot_count = 0;
+static StrPoolStats stats;
+
+// Eight bytes per step; unit names mostly differ in their last few
+static uint32_t hash_bytes(const char *s, size_t len) {
+    uint64_t h = 0x9e3779b97f4a7c15ULL ^ len, w;
+    for (; len >= 8; s += 8, len -= 8) {
+        memcpy(&w, s, 8);
+        h = (h ^ w) * 0xff51afd7ed558ccdULL;
+        h ^= h >> 32;
+    }
+    w = 0;
+    memcpy(&w, s, len);
+    h = (h ^ w) * 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 29;
+    return (uint32_t)h;
+}
+
+static Slot *slot_for(uint32_t hash, const char *s, size_t len) {
+    size_t mask = slot_count - 1;
+    for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+        Slot *sl = &slots[i];
+        if (!sl->s || (sl->hash == hash && sl->len == len && memcmp(sl->s, s, len) == 0))
+            return sl;
+    }
+}
+
+static int grow(void) {
+    size_t count = slot_count ? slot_count * 2 : 1024;
+    Slot *old = slots;
+    size_t old_count = slot_count;
+
+    if (!(slots = calloc(count, sizeof(*slots)))) {
+        slots = old;
+        return -1;
+    }
+    slot_count = count;
+    for (size_t i = 0; i < old_count; i++)
+        if (old[i].s)
+            *slot_for(old[i].hash, old[i].s, old[i].len) = old[i];
+    free(old);
+    stats.allocated += (count - old_count) * sizeof(*slots);
+    return 0;
+}
+
+static char *arena_alloc(size_t size) {
+    if (chunks && chunks->size - chunks->used >= size) {
+        char *p = chunks->data + chunks->used;
+        chunks->used += size;
+        return p;
+    }
+    size_t csize = size > CHUNK_SIZE / 4 ? size : CHUNK_SIZE;
+    Chunk *c = malloc(sizeof(*c) + csize);
+    if (!c) return NULL;
+    c->size = csize;
+    c->used = size;
+    // A dedicated chunk goes behind the head, which still has room
+    if (csize == size && chunks) {
+        c->next = chunks->next;
+        chunks->next = c;
+    } else {
+        c->next = chunks;
+        chunks = c;
+    }
+    stats.allocated += sizeof(*c) + csize;
+    return c->data;
+}
+
+const char *strpool_intern_n(const char *s, size_t len) {
+    if (len == 0)
+        return "";
+    if (len > UINT32_MAX)
+        return NULL;
+    uint32_t hash = hash_bytes(s, len);
+
+    pthread_mutex_lock(&lock);
+    const char *r = NULL;
+    if ((stats.strings + 1) * 4 > slot_count * 3 && grow() < 0)
+        goto out;
+    Slot *sl = slot_for(hash, s, len);
+    if (!sl->s) {
+        char *p = arena_alloc(len + 1);
+        if (!p)
+            goto out;
+        memcpy(p, s, len);
+        p[len] = '\0';
+        *sl = (Slot){ p, hash, (uint32_t)len };
+        stats.strings++;
+        stats.used += len + 1;
+    }
+    stats.requested += len + 1;
+    r = sl->s;
+out:
+    pthread_mutex_unlock(&lock);
+    return r;
+}
+
+const char *strpool_intern(const char *s) {
+    return strpool_intern_n(s, strlen(s));
+}
+
+void strpool_stats(StrPoolStats *ret) {
+    pthread_mutex_lock(&lock);
+    *ret = stats;
+    pthread_mutex_unlock(&lock);
+}
+
+void strpool_free(void) {
+    pthread_mutex_lock(&lock);
+    while (chunks) {
+        Chunk *next = chunks->next;
+        free(chunks);
+        chunks = next;
+    }
+    free(slots);
+    slots = NULL;
+    slot_count = 0;
+    memset(&stats, 0, sizeof(stats));
+    pthread_mutex_unlock(&lock);
+}
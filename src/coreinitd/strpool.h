@@ -0,0 +1,23 @@
+// strpool.h — interned, immutable strings shared by every loaded unit
+#ifndef COREINITD_STRPOOL_H
+#define COREINITD_STRPOOL_H
+
+#include <stddef.h>
+
+typedef struct {
+    size_t strings;     // distinct strings held
+    size_t used;        // their bytes, NULs included
+    size_t allocated;   // arena chunks plus the hash index
+    size_t requested;   // bytes all interning calls asked for; minus used = saved by sharing
+} StrPoolStats;
+
+// The pooled copy of s: equal strings get the same pointer, valid until
+// strpool_free(). "" is a static string and costs nothing. Thread-safe, so
+// the parallel unit scan can use it. NULL if out of memory.
+const char *strpool_intern(const char *s);
+const char *strpool_intern_n(const char *s, size_t len);
+
+void strpool_stats(StrPoolStats *ret);
+void strpool_free(void);
+
+#endif
@@ -1,111 +1,152 @@
-//#include "timerd.h"
-#include "unit_loader.h"
-#include "service_manager.h"
-#include <systemd/sd-event.h>
+// timerd.c — .timer units scheduled on coreinitd's own event loop
+//
+// One clock timer (an sd-event time source) per timer. AccuracySec= is passed
+// through as the source's accuracy, so sd-event can fire timers whose windows
+// overlap in a single wakeup; RandomizedDelaySec= spreads elapse times across
+// a window.
+#include "timerd.h"
+#include "clock.h"
+#include "log.h"
+#include "unit_registry.h"
+#include "job_queue.h"
+#include "trace.h"
+#include "util.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
 
-#define USEC_PER_SEC 1000000
+typedef struct {
+    Unit *timer;
+    Unit *target;
+    ClockTimer *source;
+} Timer;
+
+// Each entry is individually allocated: it is the sd-event userdata
+static Timer **timers = NULL;
+static size_t timer_count = 0;
+static sd_event *timer_event = NULL;
+
+static uint64_t elapse_after(uint64_t now, uint64_t span, const Unit *timer) {
+    uint64_t t = now + span;
+    if (timer->randomized_delay_usec)
+        t += clock_random(timer->randomized_delay_usec);
+    return t;
+}
 
-static Unit *all_units = NULL;
-static size_t unit_total = 0;
+// Unit= if given, else foo.timer -> foo.service
+static Unit *find_target(const Unit *timer) {
+    Unit *u = timer->timer_unit[0] ? unit_registry_find(timer->timer_unit)
+                                   : unit_registry_find_sibling(timer, ".service");
+    return u && u->type == UNIT_SERVICE && !u->not_found ? u : NULL;
+}
 
-static int parse_sec_to_int(const char *str, int *out) {
-    if (!str || !out) return -1;
+int timerd_triggers(const Unit *service) {
+    for (size_t i = 0; i < timer_count; i++)
+        if (timers[i]->target == service)
+            return 1;
+    return 0;
+}
 
-    errno = 0;
-    char *end = NULL;
-    long val = strtol(str, &end, 10);
+static void on_timer_event(ClockTimer *s, uint64_t usec, void *userdata) {
+    Timer *t = userdata;
 
-    if (errno != 0 || end == str || *end != '\0' || val < 0 || val > 86400) {
-        // Arbitrary upper limit of 24 hours for sanity
-        fprintf(stderr, "[timerd] Invalid time string: '%s'\n", str);
-        return -1;
-    }
+    log_debug("[timerd] Triggering %s from %s", t->target->name, t->timer->name);
+    job_enqueue(t->target, JOB_START, NULL, NULL);
 
-    *out = (int)val;
-    return 0;
+    // OnUnitActiveSec= repeats, measured from this elapse
+    if (t->timer->on_active_usec)
+        clock_timer_set(s, elapse_after(usec, t->timer->on_active_usec, t->timer), t->timer->accuracy_usec);
 }
 
-static int get_interval_seconds(const char *str, int *out) {
-    if (!str || str[0] == '\0') {
-        *out = 0;
+static int timer_arm(Unit *u) {
+    if (!u->on_boot_usec && !u->on_active_usec) {
+        log_warning("[timerd] Skipping %s (no OnBootSec or OnUnitActiveSec)", u->name);
         return 0;
     }
-    return parse_sec_to_int(str, out);
-}
-
-static int on_timer_event(sd_event_source *s, uint64_t usec, void *userdata) {
-    Unit *timer_unit = userdata;
-
-    // Find associated service basename
-    char base[128];
-    strncpy(base, timer_unit->name, sizeof(base));
-    char *ext = strstr(base, ".timer");
-    if (ext) *ext = '\0';
-
-    // Trigger the service start
-    for (size_t i = 0; i < unit_total; i++) {
-        if (all_units[i].type == UNIT_SERVICE &&
-            strncmp(all_units[i].name, base, strlen(base)) == 0) {
-            printf("[timerd] Triggering %s from %s\n", all_units[i].name, timer_unit->name);
-            service_manager_start(&all_units[i]);
-            break;
-        }
+    Unit *target = find_target(u);
+    if (!target) {
+        log_warning("[timerd] Skipping %s: unit %s not loaded", u->name,
+                    u->timer_unit[0] ? u->timer_unit : "to trigger");
+        return 0;
     }
 
-    // Now check if OnUnitActiveSec is set, and if so, reschedule timer
-    int active_sec = 0;
-    if (get_interval_seconds(timer_unit->on_active_sec, &active_sec) == 0 && active_sec > 0) {
-        uint64_t next_time;
-        sd_event_now(sd_event_source_get_event(s), CLOCK_MONOTONIC, &next_time);
-        next_time += (uint64_t)active_sec * USEC_PER_SEC;
-        sd_event_source_set_time(s, next_time);
-        return 0; // keep the timer active
+    Timer **v = realloc(timers, (timer_count + 1) * sizeof(*v));
+    if (!v) return -ENOMEM;
+    timers = v;
+    Timer *t = calloc(1, sizeof(*t));
+    if (!t) return -ENOMEM;
+    t->timer = u;
+    t->target = target;
+
+    uint64_t now = clock_now();
+    uint64_t first = elapse_after(now, u->on_boot_usec ? u->on_boot_usec : u->on_active_usec, u);
+
+    int r = -ENOMEM;
+    if (!(t->source = clock_timer_new(SD_EVENT_PRIORITY_NORMAL, on_timer_event, t)) ||
+        (r = clock_timer_set(t->source, first, u->accuracy_usec)) < 0) {
+        log_error("[timerd] Failed to schedule timer %s: %s", u->name, strerror(-r));
+        clock_timer_free(t->source);
+        free(t);
+        return 0;
     }
+    timers[timer_count++] = t;
+    trace_event(u, TRACE_READY, 0);
 
-    // No repeating interval, disable timer
-    return 1; // stop the timer event source
+    log_info("[timerd] Scheduled %s → %s in %.3f s (accuracy %.3f s)", u->name, target->name,
+             (first - now) / (double)USEC_PER_SEC, u->accuracy_usec / (double)USEC_PER_SEC);
+    return 0;
 }
 
-int timerd_start(sd_event *event, Unit *units, size_t count) {
-    all_units = units;
-    unit_total = count;
-
-    for (size_t i = 0; i < count; i++) {
-        Unit *u = &units[i];
-        if (u->type != UNIT_TIMER) continue;
-
-        int boot_sec = 0, active_sec = 0;
-        int has_boot = (parse_sec_to_int(u->on_boot_sec, &boot_sec) == 0 && boot_sec > 0);
-        int has_active = (parse_sec_to_int(u->on_active_sec, &active_sec) == 0 && active_sec > 0);
-
-        if (!has_boot && !has_active) {
-            fprintf(stderr, "[timerd] Skipping %s (no OnBootSec or OnUnitActiveSec)\n", u->name);
-            continue;
+int timerd_start(sd_event *event) {
+    timer_event = event;
+    for (size_t i = 0; i < unit_registry_count(); i++) {
+        Unit *u = unit_registry_get(i);
+        if (u->type == UNIT_TIMER) {
+            int r = timer_arm(u);
+            if (r < 0) return r;
         }
+    }
+    return 0;
+}
 
-        uint64_t now;
-        sd_event_now(event, CLOCK_MONOTONIC, &now);
-
-        uint64_t trigger_time = now;
-        if (has_boot)
-            trigger_time += (uint64_t)boot_sec * USEC_PER_SEC;
-        else
-            trigger_time += (uint64_t)active_sec * USEC_PER_SEC;
-
-        sd_event_source *source;
-        int r = sd_event_add_time(event, &source, CLOCK_MONOTONIC, trigger_time,
-                                  0, on_timer_event, u);
-        if (r < 0) {
-            fprintf(stderr, "[timerd] Failed to schedule timer %s: %s\n", u->name, strerror(-r));
-            continue;
+int timerd_reload(Unit *timer) {
+    for (size_t i = 0; i < timer_count; i++)
+        if (timers[i]->timer == timer) {
+            clock_timer_free(timers[i]->source);
+            free(timers[i]);
+            timers[i] = timers[--timer_count];
+            break;
         }
+    if (!timer_event || timer->not_found || timer->type != UNIT_TIMER)
+        return 0;
+    return timer_arm(timer);
+}
 
-        printf("[timerd] Scheduled %s to trigger in %" PRIu64 " usec\n", u->name, trigger_time - now);
+void timerd_service_changed(Unit *service) {
+    if (!timer_event)
+        return;
+    for (size_t i = 0; i < unit_registry_count(); i++) {
+        Unit *u = unit_registry_get(i);
+        if (u->type != UNIT_TIMER || u->not_found)
+            continue;
+        Timer *t = NULL;
+        for (size_t k = 0; k < timer_count && !t; k++)
+            if (timers[k]->timer == u)
+                t = timers[k];
+        // Disarm timers whose service went away, arm those that can run now
+        if (t ? t->target == service && service->not_found : find_target(u) == service)
+            timerd_reload(u);
     }
+}
 
-    return 0;
+void timerd_stop(void) {
+    for (size_t i = 0; i < timer_count; i++) {
+        clock_timer_free(timers[i]->source);
+        free(timers[i]);
+    }
+    free(timers);
+    timers = NULL;
+    timer_count = 0;
+    timer_event = NULL;
 }
@@ -0,0 +1,20 @@
+// timerd.h — .timer units scheduled on coreinitd's own event loop
+#ifndef COREINITD_TIMERD_H
+#define COREINITD_TIMERD_H
+
+#include <systemd/sd-event.h>
+#include "unit_loader.h"
+
+// Arm OnBootSec=/OnUnitActiveSec= for every loaded timer unit
+int timerd_start(sd_event *event);
+void timerd_stop(void);
+// Drop timer's schedule and arm it afresh from its current definition
+// (reload: changed, added, or gone if not_found)
+int timerd_reload(Unit *timer);
+// Reload: service was added or removed, re-resolve the timers that start it
+void timerd_service_changed(Unit *service);
+
+// Services started by a timer are left out of the boot transaction
+int timerd_triggers(const Unit *service);
+
+#endif
@@ -0,0 +1,314 @@
+// trace.c — fixed-size event ring, Chrome Trace export and boot analysis
+//
+// Recording is a clock read and a store; everything else (spans, blame,
+// critical chain) is reconstructed from the ring when a report is asked for.
+#include "trace.h"
+#include "log.h"
+#include "unit_registry.h"
+#include "util.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+
+typedef struct {
+    uint64_t usec;      // CLOCK_MONOTONIC
+    uint32_t unit;      // Unit.id
+    uint16_t phase;
+    int32_t pid;
+} TraceEvent;
+
+static TraceEvent ring[TRACE_RING_SIZE];
+static uint64_t ring_total = 0;     // events ever recorded; ring index is this mod size
+static sd_event_source *sigusr1_source = NULL;
+
+static const char *const phase_names[_TRACE_PHASE_MAX] = {
+    [TRACE_LOAD] = "load",
+    [TRACE_JOB] = "job",
+    [TRACE_FORK] = "fork",
+    [TRACE_EXEC] = "exec",
+    [TRACE_READY] = "ready",
+    [TRACE_EXIT] = "exit",
+};
+
+void trace_event(const Unit *u, TracePhase phase, pid_t pid) {
+    TraceEvent *e = &ring[ring_total++ & (TRACE_RING_SIZE - 1)];
+    e->usec = now_usec();
+    e->unit = (uint32_t)u->id;
+    e->phase = (uint16_t)phase;
+    e->pid = pid;
+}
+
+static uint64_t ring_first(void) {
+    return ring_total > TRACE_RING_SIZE ? ring_total - TRACE_RING_SIZE : 0;
+}
+
+static const TraceEvent *ring_at(uint64_t i) {
+    return &ring[i & (TRACE_RING_SIZE - 1)];
+}
+
+// ─────────────────
+// Chrome Trace JSON
+// ─────────────────
+static void json_string(FILE *f, const char *s) {
+    fputc('"', f);
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\')
+            fprintf(f, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(f, "\\u%04x", c);
+        else
+            fputc(c, f);
+    }
+    fputc('"', f);
+}
+
+static void json_span(FILE *f, int *first, uint32_t tid, const char *name, uint64_t from, uint64_t to) {
+    fprintf(f, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%llu,\"dur\":%llu}",
+            *first ? "" : ",", name, tid, (unsigned long long)from, (unsigned long long)(to - from));
+    *first = 0;
+}
+
+int trace_write_chrome(const char *path) {
+    size_t n_units = unit_registry_count();
+    // Open spans per unit: activating (job/fork -> ready), running (ready -> exit)
+    uint64_t *activating = calloc(n_units ? n_units : 1, sizeof(uint64_t));
+    uint64_t *running = calloc(n_units ? n_units : 1, sizeof(uint64_t));
+    if (!activating || !running) {
+        free(activating);
+        free(running);
+        return -ENOMEM;
+    }
+
+    char tmp[512];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    mkdir_parents(path);
+    FILE *f = fopen(tmp, "we");
+    if (!f) {
+        int r = -errno;
+        free(activating);
+        free(running);
+        return r;
+    }
+
+    int first = 1;
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    for (size_t id = 0; id < n_units; id++) {
+        fprintf(f, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%zu,\"args\":{\"name\":",
+                first ? "" : ",", id);
+        json_string(f, unit_registry_get(id)->name);
+        fprintf(f, "}}");
+        first = 0;
+    }
+
+    for (uint64_t i = ring_first(); i < ring_total; i++) {
+        const TraceEvent *e = ring_at(i);
+        if (e->unit >= n_units) continue;
+
+        fprintf(f, "%s\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%u,\"ts\":%llu,\"args\":{\"pid\":%d}}",
+                first ? "" : ",", phase_names[e->phase], e->unit, (unsigned long long)e->usec, e->pid);
+        first = 0;
+
+        switch ((TracePhase)e->phase) {
+            case TRACE_JOB:
+            case TRACE_FORK:
+                if (!activating[e->unit])
+                    activating[e->unit] = e->usec;
+                break;
+            case TRACE_READY:
+                if (activating[e->unit])
+                    json_span(f, &first, e->unit, "activating", activating[e->unit], e->usec);
+                activating[e->unit] = 0;
+                running[e->unit] = e->usec;
+                break;
+            case TRACE_EXIT:
+                if (activating[e->unit])
+                    json_span(f, &first, e->unit, "activating", activating[e->unit], e->usec);
+                if (running[e->unit])
+                    json_span(f, &first, e->unit, "running", running[e->unit], e->usec);
+                activating[e->unit] = running[e->unit] = 0;
+                break;
+            default:
+                break;
+        }
+    }
+
+    // Still running: the span ends now
+    uint64_t now = now_usec();
+    for (size_t id = 0; id < n_units; id++)
+        if (running[id])
+            json_span(f, &first, (uint32_t)id, "running", running[id], now);
+    fprintf(f, "\n]}\n");
+
+    free(activating);
+    free(running);
+    if (fclose(f) != 0 || rename(tmp, path) < 0) {
+        int r = -errno;
+        unlink(tmp);
+        return r;
+    }
+    return 0;
+}
+
+// ──────────────────────────
+// blame / critical-chain
+// ──────────────────────────
+typedef struct {
+    uint64_t fork;      // first activation only: that is what boot waits on
+    uint64_t ready;
+} UnitTimes;
+
+// NULL if there is nothing to report; *ret_t0 is the oldest event still in the ring
+static UnitTimes *collect_times(size_t n_units, uint64_t *ret_t0) {
+    if (ring_total == 0 || n_units == 0)
+        return NULL;
+    UnitTimes *t = calloc(n_units, sizeof(*t));
+    if (!t)
+        return NULL;
+
+    *ret_t0 = ring_at(ring_first())->usec;
+    for (uint64_t i = ring_first(); i < ring_total; i++) {
+        const TraceEvent *e = ring_at(i);
+        if (e->unit >= n_units) continue;
+        if (e->phase == TRACE_FORK && !t[e->unit].fork)
+            t[e->unit].fork = e->usec;
+        else if (e->phase == TRACE_READY && !t[e->unit].ready)
+            t[e->unit].ready = e->usec;
+    }
+    return t;
+}
+
+static uint64_t activation_usec(const UnitTimes *t) {
+    return t->fork && t->ready > t->fork ? t->ready - t->fork : 0;
+}
+
+static const UnitTimes *blame_times;
+
+static int blame_cmp(const void *a, const void *b) {
+    uint64_t x = activation_usec(&blame_times[*(const size_t *)a]);
+    uint64_t y = activation_usec(&blame_times[*(const size_t *)b]);
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+void trace_blame(FILE *f) {
+    size_t n_units = unit_registry_count();
+    uint64_t t0;
+    UnitTimes *t = collect_times(n_units, &t0);
+    size_t *order = t ? malloc(n_units * sizeof(*order)) : NULL;
+    if (!order) {
+        free(t);
+        return;
+    }
+
+    size_t n = 0;
+    for (size_t id = 0; id < n_units; id++)
+        if (t[id].fork && t[id].ready)
+            order[n++] = id;
+    blame_times = t;
+    qsort(order, n, sizeof(*order), blame_cmp);
+
+    fprintf(f, "[trace] blame (fork to ready):\n");
+    for (size_t i = 0; i < n; i++)
+        fprintf(f, "[trace] %10.3fms %s\n", activation_usec(&t[order[i]]) / 1000.0,
+                unit_registry_get(order[i])->name);
+    free(order);
+    free(t);
+}
+
+// Among the units self is ordered after, the one that became ready last,
+// but no later than self started
+static size_t latest_predecessor(size_t self, const UnitTimes *t, size_t n_units) {
+    const Unit *u = unit_registry_get(self);
+    uint64_t limit = t[self].fork ? t[self].fork : t[self].ready;
+    size_t best = SIZE_MAX;
+
+    char name[UNIT_NAME_MAX + 1];
+    for (const char *list = u->after; unit_list_next(&list, name); ) {
+        Unit *dep = unit_registry_find(name);
+        if (!dep || !t[dep->id].ready || t[dep->id].ready > limit) continue;
+        if (best == SIZE_MAX || t[dep->id].ready > t[best].ready)
+            best = dep->id;
+    }
+
+    // Before= on the other side orders it the same way
+    for (size_t id = 0; id < n_units; id++) {
+        const Unit *o = unit_registry_get(id);
+        if (!o->before[0] || !t[id].ready || t[id].ready > limit) continue;
+        for (const char *list = o->before; unit_list_next(&list, name); )
+            if (strcmp(name, u->name) == 0) {
+                if (best == SIZE_MAX || t[id].ready > t[best].ready)
+                    best = id;
+                break;
+            }
+    }
+    return best;
+}
+
+void trace_critical_chain(FILE *f) {
+    size_t n_units = unit_registry_count();
+    uint64_t t0;
+    UnitTimes *t = collect_times(n_units, &t0);
+    if (!t) return;
+
+    size_t last = SIZE_MAX;
+    for (size_t id = 0; id < n_units; id++)
+        if (t[id].ready && (last == SIZE_MAX || t[id].ready > t[last].ready))
+            last = id;
+
+    fprintf(f, "[trace] critical chain (@ready since first event, +fork to ready):\n");
+    // Predecessors are strictly earlier, so the walk ends; the bound is a backstop
+    for (size_t depth = 0; last != SIZE_MAX && depth < n_units; depth++) {
+        fprintf(f, "[trace] %*s%s @%.3fs", (int)depth * 2, "", unit_registry_get(last)->name,
+                (t[last].ready - t0) / (double)USEC_PER_SEC);
+        if (activation_usec(&t[last]))
+            fprintf(f, " +%.3fms", activation_usec(&t[last]) / 1000.0);
+        fputc('\n', f);
+        last = latest_predecessor(last, t, n_units);
+    }
+    free(t);
+}
+
+void trace_log_report(void (*report)(FILE *f)) {
+    char *text = NULL;
+    size_t len = 0;
+    FILE *f = open_memstream(&text, &len);
+    if (!f) return;
+    report(f);
+    if (fclose(f) == 0)
+        log_lines(LOG_LEVEL_INFO, text);
+    free(text);
+}
+
+static int on_sigusr1(sd_event_source *s, const struct signalfd_siginfo *si, void *userdata) {
+    (void)s;
+    (void)si;
+    (void)userdata;
+    int r = trace_write_chrome(TRACE_PATH);
+    if (r < 0)
+        log_error("[trace] Failed to write %s: %s", TRACE_PATH, strerror(-r));
+    else
+        log_info("[trace] Wrote %s", TRACE_PATH);
+    trace_log_report(trace_blame);
+    trace_log_report(trace_critical_chain);
+    return 0;
+}
+
+int trace_start(sd_event *event) {
+    // sd-event signal sources need the signal blocked; spawn.c unblocks for children
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR1);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0)
+        return -errno;
+
+    int r = sd_event_add_signal(event, &sigusr1_source, SIGUSR1, on_sigusr1, NULL);
+    if (r < 0)
+        log_error("[trace] Failed to add SIGUSR1 handler: %s", strerror(-r));
+    return r;
+}
+
+void trace_stop(void) {
+    sigusr1_source = sd_event_source_unref(sigusr1_source);
+}
@@ -0,0 +1,43 @@
+// trace.h — per-unit boot and activation timeline kept in a fixed-size ring
+#ifndef COREINITD_TRACE_H
+#define COREINITD_TRACE_H
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <systemd/sd-event.h>
+#include "unit_loader.h"
+
+#ifndef TRACE_PATH
+#define TRACE_PATH "./var/log/coreinitd/boot-trace.json"
+#endif
+
+#define TRACE_RING_SIZE 8192    // power of two; the oldest events are overwritten
+
+typedef enum {
+    TRACE_LOAD,         // unit registered
+    TRACE_JOB,          // start job queued
+    TRACE_FORK,         // spawn begins
+    TRACE_EXEC,         // exec succeeded
+    TRACE_READY,        // started (Type=simple: right after exec), socket listening, timer armed
+    TRACE_EXIT,         // main process gone, or the start failed
+    _TRACE_PHASE_MAX
+} TracePhase;
+
+// Cheap enough for every transition: one clock read and a store into the ring
+void trace_event(const Unit *u, TracePhase phase, pid_t pid);
+
+// Chrome Trace Event JSON (chrome://tracing, Perfetto): one track per unit
+int trace_write_chrome(const char *path);
+// Units by time from fork to ready, slowest first
+void trace_blame(FILE *f);
+// Walk back from the last unit to become ready through the After=/Before=
+// predecessor that became ready last, like systemd-analyze critical-chain
+void trace_critical_chain(FILE *f);
+// Run one of the above into the daemon log, a message per line
+void trace_log_report(void (*report)(FILE *f));
+
+// SIGUSR1 writes TRACE_PATH and prints blame and critical chain
+int trace_start(sd_event *event);
+void trace_stop(void);
+
+#endif
@@ -0,0 +1,371 @@
+// unit_cache.c — compiled unit database: fixed-layout records + interned strings
+//
+// A cached unit is the list of (key id, value) pairs the text parser saw,
+// replayed through unit_set_key(). Loading it costs one mmap and one
+// fstatat() per unit instead of opendir/fopen/fgets/strcasecmp per line.
+#define _GNU_SOURCE
+#include "unit_cache.h"
+#include "unit_loader.h"
+#include "unit_registry.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define CACHE_MAGIC   "CIDUNIT\0"
+#define CACHE_VERSION 1
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t key_abi;       // unit_key_abi() of the writer
+    uint32_t n_dirs, n_units, n_props, strtab_size;
+    uint64_t dirs_off, units_off, props_off, strtab_off;
+} CacheHeader;
+
+typedef struct {
+    uint64_t dev, ino;
+    int64_t mtime_sec, mtime_nsec;
+    uint32_t path;          // strtab offset
+    uint32_t pad;
+} CacheDir;
+
+typedef struct {
+    uint64_t ino, size;
+    int64_t mtime_sec, mtime_nsec;
+    uint32_t file;          // strtab offset, relative to its directory
+    uint32_t dir;
+    uint32_t first_prop, n_props;
+} CacheUnit;
+
+typedef struct {
+    uint32_t key;           // UnitKey
+    uint32_t value;         // strtab offset
+} CacheProp;
+
+struct UnitCacheWriter {
+    CacheDir *dirs;
+    size_t n_dirs, cap_dirs;
+    CacheUnit *units;
+    size_t n_units, cap_units;
+    CacheProp *props;
+    size_t n_props, cap_props;
+
+    char *strtab;
+    size_t strtab_len, strtab_cap;
+    uint32_t *intern;       // open addressing over strtab offsets, 0 = empty
+    size_t intern_size, intern_used;
+
+    int error;              // sticky, reported by commit
+};
+
+static int grow(void **v, size_t *cap, size_t n, size_t elem) {
+    if (n < *cap) return 0;
+    size_t c = *cap ? *cap * 2 : 64;
+    void *nv = realloc(*v, c * elem);
+    if (!nv) return -ENOMEM;
+    *v = nv;
+    *cap = c;
+    return 0;
+}
+
+static uint32_t hash_str(const char *s) {
+    uint32_t h = 2166136261u;
+    for (; *s; s++)
+        h = (h ^ (unsigned char)*s) * 16777619u;
+    return h;
+}
+
+static int intern_rehash(UnitCacheWriter *w) {
+    size_t size = w->intern_size ? w->intern_size * 2 : 256;
+    uint32_t *t = calloc(size, sizeof(*t));
+    if (!t) return -ENOMEM;
+    for (size_t i = 0; i < w->intern_size; i++) {
+        uint32_t off = w->intern[i];
+        if (!off) continue;
+        size_t j = hash_str(w->strtab + off) & (size - 1);
+        while (t[j]) j = (j + 1) & (size - 1);
+        t[j] = off;
+    }
+    free(w->intern);
+    w->intern = t;
+    w->intern_size = size;
+    return 0;
+}
+
+// Offset 0 is the empty string; equal strings share one copy
+static uint32_t intern(UnitCacheWriter *w, const char *s) {
+    if (!*s || w->error) return 0;
+    if ((w->intern_used + 1) * 2 > w->intern_size && (w->error = intern_rehash(w)) < 0)
+        return 0;
+
+    size_t mask = w->intern_size - 1;
+    size_t i = hash_str(s) & mask;
+    for (; w->intern[i]; i = (i + 1) & mask)
+        if (strcmp(w->strtab + w->intern[i], s) == 0)
+            return w->intern[i];
+
+    size_t len = strlen(s) + 1;
+    while (w->strtab_len + len > w->strtab_cap) {
+        size_t cap = w->strtab_cap ? w->strtab_cap * 2 : 4096;
+        char *t = realloc(w->strtab, cap);
+        if (!t) {
+            w->error = -ENOMEM;
+            return 0;
+        }
+        w->strtab = t;
+        w->strtab_cap = cap;
+    }
+    uint32_t off = (uint32_t)w->strtab_len;
+    memcpy(w->strtab + off, s, len);
+    w->strtab_len += len;
+    w->intern[i] = off;
+    w->intern_used++;
+    return off;
+}
+
+UnitCacheWriter *unit_cache_writer_new(void) {
+    UnitCacheWriter *w = calloc(1, sizeof(*w));
+    if (!w) return NULL;
+    w->strtab = calloc(1, 4096);
+    if (!w->strtab) {
+        free(w);
+        return NULL;
+    }
+    w->strtab_cap = 4096;
+    w->strtab_len = 1;      // offset 0: ""
+    return w;
+}
+
+int unit_cache_writer_add_dir(UnitCacheWriter *w, const char *path, const struct stat *st) {
+    if (!w->error)
+        w->error = grow((void **)&w->dirs, &w->cap_dirs, w->n_dirs, sizeof(*w->dirs));
+    if (w->error) return w->error;
+
+    // ino 0 marks an absent directory
+    w->dirs[w->n_dirs++] = st ? (CacheDir){
+        .dev = st->st_dev, .ino = st->st_ino,
+        .mtime_sec = st->st_mtim.tv_sec, .mtime_nsec = st->st_mtim.tv_nsec,
+        .path = intern(w, path),
+    } : (CacheDir){ .path = intern(w, path) };
+    return w->error;
+}
+
+int unit_cache_writer_add_unit(UnitCacheWriter *w, size_t dir_index, const char *file, const struct stat *st) {
+    if (!w->error)
+        w->error = grow((void **)&w->units, &w->cap_units, w->n_units, sizeof(*w->units));
+    if (w->error) return w->error;
+
+    w->units[w->n_units++] = (CacheUnit){
+        .ino = st->st_ino, .size = (uint64_t)st->st_size,
+        .mtime_sec = st->st_mtim.tv_sec, .mtime_nsec = st->st_mtim.tv_nsec,
+        .file = intern(w, file),
+        .dir = (uint32_t)dir_index,
+        .first_prop = (uint32_t)w->n_props,
+    };
+    return w->error;
+}
+
+void unit_cache_writer_record(void *userdata, int key, const char *val) {
+    UnitCacheWriter *w = userdata;
+    if (w->n_units == 0 || w->error) return;
+    if ((w->error = grow((void **)&w->props, &w->cap_props, w->n_props, sizeof(*w->props))) < 0)
+        return;
+
+    w->props[w->n_props++] = (CacheProp){ .key = (uint32_t)key, .value = intern(w, val) };
+    w->units[w->n_units - 1].n_props++;
+}
+
+static int write_all(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -errno;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+int unit_cache_writer_commit(UnitCacheWriter *w, const char *cache_path) {
+    if (w->error) return w->error;
+
+    CacheHeader h = {
+        .version = CACHE_VERSION,
+        .key_abi = unit_key_abi(),
+        .n_dirs = (uint32_t)w->n_dirs,
+        .n_units = (uint32_t)w->n_units,
+        .n_props = (uint32_t)w->n_props,
+        .strtab_size = (uint32_t)w->strtab_len,
+    };
+    memcpy(h.magic, CACHE_MAGIC, sizeof(h.magic));
+    h.dirs_off = sizeof(h);
+    h.units_off = h.dirs_off + w->n_dirs * sizeof(CacheDir);
+    h.props_off = h.units_off + w->n_units * sizeof(CacheUnit);
+    h.strtab_off = h.props_off + w->n_props * sizeof(CacheProp);
+
+    char tmp[512];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", cache_path);
+    mkdir_parents(cache_path);
+
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return -errno;
+
+    int r;
+    if ((r = write_all(fd, &h, sizeof(h))) < 0 ||
+        (r = write_all(fd, w->dirs, w->n_dirs * sizeof(CacheDir))) < 0 ||
+        (r = write_all(fd, w->units, w->n_units * sizeof(CacheUnit))) < 0 ||
+        (r = write_all(fd, w->props, w->n_props * sizeof(CacheProp))) < 0 ||
+        (r = write_all(fd, w->strtab, w->strtab_len)) < 0) {
+        close(fd);
+        unlink(tmp);
+        return r;
+    }
+    close(fd);
+
+    // Readers see either the old cache or the complete new one
+    if (rename(tmp, cache_path) < 0) {
+        r = -errno;
+        unlink(tmp);
+        return r;
+    }
+    return 0;
+}
+
+void unit_cache_writer_free(UnitCacheWriter *w) {
+    if (!w) return;
+    free(w->dirs);
+    free(w->units);
+    free(w->props);
+    free(w->strtab);
+    free(w->intern);
+    free(w);
+}
+
+// ─────────────
+// Cache reader
+// ─────────────
+static int same_stat(const struct stat *st, uint64_t ino, int64_t sec, int64_t nsec) {
+    return (uint64_t)st->st_ino == ino && st->st_mtim.tv_sec == sec && st->st_mtim.tv_nsec == nsec;
+}
+
+static int check_layout(const CacheHeader *h, size_t size) {
+    if (size < sizeof(*h) || memcmp(h->magic, CACHE_MAGIC, sizeof(h->magic)) != 0 ||
+        h->version != CACHE_VERSION || h->key_abi != unit_key_abi())
+        return -ESTALE;
+    if (h->dirs_off != sizeof(*h) ||
+        h->units_off != h->dirs_off + (uint64_t)h->n_dirs * sizeof(CacheDir) ||
+        h->props_off != h->units_off + (uint64_t)h->n_units * sizeof(CacheUnit) ||
+        h->strtab_off != h->props_off + (uint64_t)h->n_props * sizeof(CacheProp) ||
+        h->strtab_off + h->strtab_size != size ||
+        h->strtab_size == 0 || ((const char *)h)[size - 1] != '\0')
+        return -EBADMSG;
+    return 0;
+}
+
+int unit_cache_load(const char *cache_path, const char *const *dirs, size_t n_dirs) {
+    int fd = open(cache_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -errno;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        close(fd);
+        return -EBADMSG;
+    }
+    size_t size = (size_t)st.st_size;
+    void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -errno;
+
+    const CacheHeader *h = map;
+    const CacheDir *cdirs = NULL;
+    const CacheUnit *cunits = NULL;
+    const CacheProp *cprops = NULL;
+    const char *strtab = NULL;
+    int *dir_fds = NULL;
+    size_t n_open = 0;
+    int r = check_layout(h, size);
+    if (r < 0) goto out;
+
+    cdirs = (const CacheDir *)((const char *)map + h->dirs_off);
+    cunits = (const CacheUnit *)((const char *)map + h->units_off);
+    cprops = (const CacheProp *)((const char *)map + h->props_off);
+    strtab = (const char *)map + h->strtab_off;
+
+    // Same search path, and no unit file added, removed or renamed
+    r = -ESTALE;
+    if (h->n_dirs != n_dirs) goto out;
+    dir_fds = calloc(n_dirs ? n_dirs : 1, sizeof(*dir_fds));
+    if (!dir_fds) { r = -ENOMEM; goto out; }
+    for (; n_open < n_dirs; n_open++) {
+        if (cdirs[n_open].path >= h->strtab_size || strcmp(strtab + cdirs[n_open].path, dirs[n_open]) != 0)
+            goto out;
+        int dfd = open(dirs[n_open], O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        dir_fds[n_open] = dfd;
+        if (dfd < 0 && errno == ENOENT && cdirs[n_open].ino == 0)
+            continue;   // still absent
+        if (dfd < 0) goto out;
+        if (fstat(dfd, &st) < 0 || (uint64_t)st.st_dev != cdirs[n_open].dev ||
+            !same_stat(&st, cdirs[n_open].ino, cdirs[n_open].mtime_sec, cdirs[n_open].mtime_nsec)) {
+            n_open++;
+            goto out;
+        }
+    }
+
+    // No unit file edited in place
+    for (uint32_t i = 0; i < h->n_units; i++) {
+        const CacheUnit *cu = &cunits[i];
+        if (cu->dir >= n_dirs || cu->file >= h->strtab_size ||
+            (uint64_t)cu->first_prop + cu->n_props > h->n_props) {
+            r = -EBADMSG;
+            goto out;
+        }
+        if (fstatat(dir_fds[cu->dir], strtab + cu->file, &st, 0) < 0 ||
+            (uint64_t)st.st_size != cu->size ||
+            !same_stat(&st, cu->ino, cu->mtime_sec, cu->mtime_nsec))
+            goto out;
+    }
+    for (uint32_t i = 0; i < h->n_props; i++) {
+        if (cprops[i].value >= h->strtab_size) {
+            r = -EBADMSG;
+            goto out;
+        }
+    }
+
+    // Valid: replay every unit through the same setters the parser uses
+    for (uint32_t i = 0; i < h->n_units; i++) {
+        const CacheUnit *cu = &cunits[i];
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", dirs[cu->dir], strtab + cu->file);
+
+        Unit unit;
+        unit_begin(&unit, path);
+        for (uint32_t p = cu->first_prop; p < cu->first_prop + cu->n_props; p++)
+            unit_set_key(&unit, (int)cprops[p].key, strtab + cprops[p].value);
+        if (unit_finish(&unit) < 0 || (r = unit_registry_add(&unit, NULL)) < 0) {
+            unit_free(&unit);
+            unit_registry_free();
+            r = -EBADMSG;
+            goto out;
+        }
+    }
+    r = (int)h->n_units;
+
+out:
+    for (size_t i = 0; i < n_open; i++)
+        if (dir_fds[i] >= 0)
+            close(dir_fds[i]);
+    free(dir_fds);
+    munmap(map, size);
+    return r;
+}
@@ -0,0 +1,32 @@
+// unit_cache.h — compiled, mmap'able unit database to skip text parsing at boot
+#ifndef COREINITD_UNIT_CACHE_H
+#define COREINITD_UNIT_CACHE_H
+
+#include <stddef.h>
+#include <sys/stat.h>
+
+#ifndef UNIT_CACHE_PATH
+#define UNIT_CACHE_PATH "./var/cache/coreinitd/units.cache"
+#endif
+
+// Load every cached unit into the registry. The cache is only used if it was
+// built from exactly these directories and no directory or unit file changed
+// (inode, size, mtime). Returns the number of units loaded, or a negative
+// errno (-ENOENT, -ESTALE, ...) telling the caller to parse the text files.
+int unit_cache_load(const char *cache_path, const char *const *dirs, size_t n_dirs);
+
+// Collects what the text parser saw, then writes it out atomically
+typedef struct UnitCacheWriter UnitCacheWriter;
+
+UnitCacheWriter *unit_cache_writer_new(void);
+// st NULL: the directory does not exist, the cache goes stale once it does
+int unit_cache_writer_add_dir(UnitCacheWriter *w, const char *path, const struct stat *st);
+// Subsequent unit_cache_writer_record() calls belong to this unit
+int unit_cache_writer_add_unit(UnitCacheWriter *w, size_t dir_index, const char *file, const struct stat *st);
+// Matches UnitKeyRecorder, for load_unit_at()
+void unit_cache_writer_record(void *w, int key, const char *val);
+// Only commit after a load without failures: unloadable files are not recorded
+int unit_cache_writer_commit(UnitCacheWriter *w, const char *cache_path);
+void unit_cache_writer_free(UnitCacheWriter *w);
+
+#endif
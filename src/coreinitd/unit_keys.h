@@ -0,0 +1,41 @@
+// unit_keys.h — unit file sections, key ids and the key hash function
+#ifndef COREINITD_UNIT_KEYS_H
+#define COREINITD_UNIT_KEYS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum {
+    UNIT_SECTION_NONE,      // assignments before the first [Section]
+    UNIT_SECTION_UNIT,
+    UNIT_SECTION_SERVICE,
+    UNIT_SECTION_SOCKET,
+    UNIT_SECTION_TIMER,
+    UNIT_SECTION_INSTALL,
+    UNIT_SECTION_UNKNOWN,
+    _UNIT_SECTION_MAX
+} UnitSection;
+
+// Stable ids of the keys in unit_keys.def, also used by the unit cache
+typedef enum {
+#define UNIT_KEY(id, section, name) UNIT_KEY_##id,
+#include "unit_keys.def"
+#undef UNIT_KEY
+    _UNIT_KEY_MAX
+} UnitKey;
+
+static inline unsigned char unit_key_lower(char c) {
+    return (unsigned char)(c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c);
+}
+
+// Case-insensitive; looks at the section, length and three characters only,
+// unit_keys_gen picks a seed that makes it collision-free for the key table
+static inline uint32_t unit_key_hash(uint32_t seed, UnitSection section, const char *key, size_t len) {
+    uint32_t h = seed ^ ((uint32_t)section * 0x9e3779b1u) ^ (uint32_t)len;
+    h = (h ^ unit_key_lower(key[0])) * 16777619u;
+    h = (h ^ unit_key_lower(key[len / 2])) * 16777619u;
+    h = (h ^ unit_key_lower(key[len - 1])) * 16777619u;
+    return h ^ (h >> 15);
+}
+
+#endif
@@ -0,0 +1,65 @@
+// unit_keys_gen.c — build-time generator of the unit key perfect hash table
+//
+// Finds a seed for unit_key_hash() under which every (section, key) pair of
+// unit_keys.def lands in its own slot, and writes unit_keys_hash.h.
+#include "unit_keys.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const struct {
+    UnitSection section;
+    const char *name;
+} keys[_UNIT_KEY_MAX] = {
+#define UNIT_KEY(id, sect, str) [UNIT_KEY_##id] = { UNIT_SECTION_##sect, str },
+#include "unit_keys.def"
+#undef UNIT_KEY
+};
+
+static int try_seed(uint32_t seed, size_t size, int *slots) {
+    for (size_t i = 0; i < size; i++)
+        slots[i] = -1;
+    for (int k = 0; k < _UNIT_KEY_MAX; k++) {
+        size_t slot = unit_key_hash(seed, keys[k].section, keys[k].name, strlen(keys[k].name)) & (size - 1);
+        if (slots[slot] >= 0)
+            return 0;
+        slots[slot] = k;
+    }
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s output.h\n", argv[0]);
+        return 1;
+    }
+
+    // Smallest power of two that is at least twice the key count, grown on failure
+    size_t size = 8;
+    while (size < 2 * _UNIT_KEY_MAX) size *= 2;
+
+    for (;; size *= 2) {
+        int *slots = malloc(size * sizeof(*slots));
+        if (!slots) return 1;
+
+        for (uint32_t seed = 1; seed < 1u << 20; seed++) {
+            if (!try_seed(seed, size, slots)) continue;
+
+            FILE *f = fopen(argv[1], "w");
+            if (!f) {
+                perror(argv[1]);
+                return 1;
+            }
+            fprintf(f, "// Generated by unit_keys_gen from unit_keys.def — do not edit\n");
+            fprintf(f, "#define UNIT_KEY_HASH_SEED 0x%08xu\n", seed);
+            fprintf(f, "#define UNIT_KEY_HASH_SIZE %zu\n", size);
+            fprintf(f, "static const int16_t unit_key_slots[UNIT_KEY_HASH_SIZE] = {");
+            for (size_t i = 0; i < size; i++)
+                fprintf(f, "%s%d,", i % 16 ? " " : "\n    ", slots[i]);
+            fprintf(f, "\n};\n");
+            free(slots);
+            return fclose(f) == 0 ? 0 : 1;
+        }
+        free(slots);
+    }
+}
@@ -1,7 +1,18 @@
 #include "unit_loader.h"
+#include "log.h"
+#include "unit_parser.h"
+#include "unit_keys_hash.h"
+#include "strpool.h"
+#include "util.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sched.h>
+#include <linux/mempolicy.h>
+#include <errno.h>
 
 static UnitType infer_unit_type(const char *filename) {
     if (strstr(filename, ".service")) return UNIT_SERVICE;
@@ -10,58 +21,527 @@ static UnitType infer_unit_type(const char *filename) {
     return UNIT_UNKNOWN;
 }
 
-int load_unit(const char *path, Unit *out) {
-    memset(out, 0, sizeof(Unit));
+// Out of memory keeps the previous value
+static void set_string(const Unit *u, const char **field, const char *val) {
+    const char *s = strpool_intern(val);
+    if (s)
+        *field = s;
+    else
+        log_error("[unit_loader] %s: out of memory, ignoring '%s'", u->path, val);
+}
+
+// Dependency keys may repeat and hold several names; accumulate them
+static void append_unit_list(const Unit *u, const char **list, const char *val) {
+    const char *cur = *list ? *list : "";
+    if (!*cur) {
+        set_string(u, list, val);
+        return;
+    }
+    char stack[512];
+    size_t len = strlen(cur), vlen = strlen(val);
+    char *buf = len + vlen + 2 <= sizeof(stack) ? stack : malloc(len + vlen + 2);
+    if (!buf) {
+        log_error("[unit_loader] %s: out of memory, ignoring '%s'", u->path, val);
+        return;
+    }
+    memcpy(buf, cur, len);
+    buf[len] = ' ';
+    memcpy(buf + len + 1, val, vlen + 1);
+    set_string(u, list, buf);
+    if (buf != stack)
+        free(buf);
+}
+
+int unit_list_next(const char **list, char name[UNIT_NAME_MAX + 1]) {
+    const char *p = *list;
+    for (;;) {
+        p += strspn(p, " \t");
+        size_t len = strcspn(p, " \t");
+        if (len == 0) {
+            *list = p;
+            return 0;
+        }
+        if (len <= UNIT_NAME_MAX) {
+            memcpy(name, p, len);
+            name[len] = '\0';
+            *list = p + len;
+            return 1;
+        }
+        p += len;
+    }
+}
+
+// Invalid values leave the default in place
+static void parse_unsigned(const Unit *u, const char *val, unsigned *out) {
+    char *end;
+    errno = 0;
+    unsigned long v = strtoul(val, &end, 10);
+    if (end == val || *end || errno || v > UINT32_MAX) {
+        log_warning("[unit_loader] %s: invalid number '%s', ignoring", u->path, val);
+        return;
+    }
+    *out = (unsigned)v;
+}
+
+// Bytes with an optional K/M/G suffix (base 1024, as systemd)
+static void parse_bytes(const Unit *u, const char *val, uint64_t *out) {
+    char *end;
+    errno = 0;
+    unsigned long long v = strtoull(val, &end, 10);
+    unsigned shift = 0;
+    switch (*end) {
+        case 'K': case 'k': shift = 10; end++; break;
+        case 'M': case 'm': shift = 20; end++; break;
+        case 'G': case 'g': shift = 30; end++; break;
+    }
+    if (end == val || *end || errno || v > (UINT64_MAX >> shift)) {
+        log_warning("[unit_loader] %s: invalid size '%s', ignoring", u->path, val);
+        return;
+    }
+    *out = (uint64_t)v << shift;
+}
+
+// CPUWeight=, IOWeight=
+static void parse_weight(const Unit *u, const char *val, unsigned *out) {
+    char *end;
+    unsigned long v = strtoul(val, &end, 10);
+    if (end == val || *end || v < 1 || v > 10000) {
+        log_warning("[unit_loader] %s: invalid weight '%s' (1-10000), ignoring", u->path, val);
+        return;
+    }
+    *out = (unsigned)v;
+}
+
+// Nice= and friends; invalid values leave the default in place (-1)
+static int parse_int_range(const Unit *u, const char *key, const char *val, int min, int max, int *out) {
+    char *end;
+    long v = strtol(val, &end, 10);
+    if (end == val || *end || v < min || v > max) {
+        log_warning("[unit_loader] %s: invalid %s=%s (%d to %d), ignoring", u->path, key, val, min, max);
+        return -1;
+    }
+    *out = (int)v;
+    return 0;
+}
+
+// CPUAffinity=, NUMAMask=: lines add up, an empty one starts over, an invalid one is ignored (-1)
+static int parse_mask(const Unit *u, const char *key, const char *val, unsigned long *mask, size_t nbits) {
+    unsigned long m[SPAWN_MASK_WORDS(SPAWN_CPUS_MAX > SPAWN_NUMA_NODES_MAX ? SPAWN_CPUS_MAX : SPAWN_NUMA_NODES_MAX)] = { 0 };
+    if (!*val) {
+        memset(mask, 0, SPAWN_MASK_WORDS(nbits) * sizeof(*mask));
+        return 0;
+    }
+    if (parse_cpu_list(val, m, nbits) < 0) {
+        log_warning("[unit_loader] %s: invalid %s=%s, ignoring", u->path, key, val);
+        return -1;
+    }
+    for (size_t i = 0; i < SPAWN_MASK_WORDS(nbits); i++)
+        mask[i] |= m[i];
+    return 0;
+}
+
+static int mask_empty(const unsigned long *mask, size_t words) {
+    for (size_t i = 0; i < words; i++)
+        if (mask[i])
+            return 0;
+    return 1;
+}
+
+// The placement settings share one allocation, made by the first of them
+static SpawnPlacement *placement(Unit *u) {
+    if (!u->placement && (u->placement = malloc(sizeof(*u->placement))))
+        spawn_placement_init(u->placement);
+    if (!u->placement)
+        log_error("[unit_loader] %s: out of memory, ignoring placement", u->path);
+    return u->placement;
+}
+
+// Case-insensitive index into names[], -1 (after a warning) if none matches
+static int parse_enum(const Unit *u, const char *key, const char *val,
+                      const char *const *names, int n_names) {
+    for (int i = 0; i < n_names; i++)
+        if (names[i] && strcasecmp(val, names[i]) == 0)
+            return i;
+    log_warning("[unit_loader] %s: unsupported %s=%s, ignoring", u->path, key, val);
+    return -1;
+}
+
+static const char *const service_types[] = {
+    [SERVICE_TYPE_SIMPLE] = "simple", [SERVICE_TYPE_EXEC] = "exec", [SERVICE_TYPE_NOTIFY] = "notify",
+};
+static const char *const notify_accesses[] = {
+    [NOTIFY_ACCESS_NONE] = "none", [NOTIFY_ACCESS_MAIN] = "main",
+    [NOTIFY_ACCESS_EXEC] = "exec", [NOTIFY_ACCESS_ALL] = "all",
+};
+static const char *const restart_policies[] = {
+    [RESTART_NO] = "no", [RESTART_ON_FAILURE] = "on-failure", [RESTART_ALWAYS] = "always",
+};
+#define ELEMENTSOF(x) ((int)(sizeof(x) / sizeof((x)[0])))
+
+static void parse_usec(const Unit *u, const char *val, uint64_t *out) {
+    if (parse_timespan(val, out) < 0)
+        log_warning("[unit_loader] %s: invalid time span '%s', ignoring", u->path, val);
+}
+
+// Indexed by UnitKey; the order is part of the unit cache format
+static const struct {
+    UnitSection section;
+    const char *name;
+} unit_keys[_UNIT_KEY_MAX] = {
+#define UNIT_KEY(id, sect, str) [UNIT_KEY_##id] = { UNIT_SECTION_##sect, str },
+#include "unit_keys.def"
+#undef UNIT_KEY
+};
+
+// One probe of the table generated by unit_keys_gen, then a single compare
+int unit_key_lookup(UnitSection section, const char *key, size_t len) {
+    if (len == 0) return -1;
+    int id = unit_key_slots[unit_key_hash(UNIT_KEY_HASH_SEED, section, key, len) & (UNIT_KEY_HASH_SIZE - 1)];
+    if (id < 0 || unit_keys[id].section != section ||
+        strncasecmp(unit_keys[id].name, key, len) != 0 || unit_keys[id].name[len] != '\0')
+        return -1;
+    return id;
+}
 
-    FILE *f = fopen(path, "r");
-    if (!f) return -1;
+uint32_t unit_key_abi(void) {
+    uint32_t h = 2166136261u;   // FNV-1a over the key table
+    for (int i = 0; i < _UNIT_KEY_MAX; i++) {
+        for (const char *p = unit_keys[i].name; *p; p++)
+            h = (h ^ (unsigned char)*p) * 16777619u;
+        h = (h ^ (uint32_t)unit_keys[i].section) * 16777619u;
+    }
+    return h;
+}
 
+void unit_begin(Unit *out, const char *path) {
+    memset(out, 0, sizeof(Unit));
     out->type = infer_unit_type(path);
-    strncpy(out->name, path, sizeof(out->name) - 1);
-
-    char line[512];
-    while (fgets(line, sizeof(line), f)) {
-        // Remove newline
-        line[strcspn(line, "\r\n")] = 0;
-
-        // Skip section headers
-        if (line[0] == '[') continue;
-
-        char *eq = strchr(line, '=');
-        if (!eq) continue;
-
-        *eq = 0;
-        char *key = line;
-        char *val = eq + 1;
-
-        // Strip whitespace (basic)
-        while (*key == ' ') key++;
-        while (*val == ' ') val++;
-
-        if (strcasecmp(key, "Description") == 0)
-            strncpy(out->description, val, sizeof(out->description) - 1);
-        else if (strcasecmp(key, "ExecStart") == 0)
-            strncpy(out->exec_start, val, sizeof(out->exec_start) - 1);
-        else if (strcasecmp(key, "NotifyAccess") == 0)
-            strncpy(out->notify_access, val, sizeof(out->notify_access) - 1);
-        else if (out->type == UNIT_SERVICE && strcasecmp(key, "Socket") == 0) {
-            strncpy(out->socket_unit, val, sizeof(out->socket_unit) - 1);
-            out->socket_unit[sizeof(out->socket_unit) - 1] = '\0';
-        } else if (out->type == UNIT_SOCKET && strcasecmp(key, "ListenStream") == 0) {
-            strncpy(out->listen_stream, val, sizeof(out->listen_stream) - 1);
-            out->listen_stream[sizeof(out->listen_stream) - 1] = '\0';
-        } else if (strcasecmp(key, "Accept") == 0)
-            out->accept = (strcasecmp(val, "yes") == 0);
-        else if (strcasecmp(key, "OnBootSec") == 0)
-            strncpy(out->on_boot_sec, val, sizeof(out->on_boot_sec) - 1);
-        else if (strcasecmp(key, "OnUnitActiveSec") == 0)
-            strncpy(out->on_active_sec, val, sizeof(out->on_active_sec) - 1);
-        else if (strcasecmp(key, "Unit") == 0)
-            strncpy(out->timer_unit, val, sizeof(out->timer_unit) - 1);
-        else if (strcasecmp(key, "Sandbox") == 0)
-            out->sandbox = (strcasecmp(val, "true") == 0);
-    }
-
-    fclose(f);
+    const char *base = strrchr(path, '/');
+    size_t dir_len = base ? (size_t)(base + 1 - path) : 0;
+    // The name is the tail of the pooled path, so it costs nothing extra
+    out->path = strpool_intern(path);
+    out->name = out->path ? out->path + dir_len : "";
+    if (!out->path || strlen(out->name) > UNIT_NAME_MAX) {
+        // unit_finish() refuses an empty name
+        out->path = out->path ? out->path : "";
+        out->name = "";
+    }
+    out->description = out->requires = out->wants = out->after = out->before = "";
+    out->start_limit_interval_usec = 10 * USEC_PER_SEC;   // systemd's defaults
+    out->start_limit_burst = 5;
+
+    switch (out->type) {
+        case UNIT_SERVICE:
+            out->exec_start = out->environment = out->socket_unit = "";
+            out->restart_usec = 100 * USEC_PER_MSEC;
+            out->restart_max_delay_usec = 5 * 60 * USEC_PER_SEC;
+            out->timeout_start_usec = 90 * USEC_PER_SEC;
+            out->timeout_stop_usec = 90 * USEC_PER_SEC;
+            out->kill_signal = SIGTERM;
+            out->log_rate_limit_interval_usec = 30 * USEC_PER_SEC;
+            out->log_rate_limit_burst = 4 * 1024 * 1024;
+            break;
+        case UNIT_SOCKET:
+            out->listen_stream = out->listen_datagram = out->listen_seqpacket = "";
+            out->backlog = SOMAXCONN;
+            out->shards = 1;
+            out->max_connections = 64;
+            break;
+        case UNIT_TIMER:
+            out->timer_unit = "";
+            out->accuracy_usec = 60 * USEC_PER_SEC;
+            break;
+        default:
+            break;
+    }
+}
+
+int unit_set_key(Unit *out, int key, const char *val) {
+    if (key < 0 || key >= _UNIT_KEY_MAX)
+        return 0;
+
+    // The union only holds the settings of out->type
+    static const UnitSection type_section[] = {
+        [UNIT_SERVICE] = UNIT_SECTION_SERVICE, [UNIT_SOCKET] = UNIT_SECTION_SOCKET,
+        [UNIT_TIMER] = UNIT_SECTION_TIMER, [UNIT_UNKNOWN] = UNIT_SECTION_UNIT,
+    };
+    if (unit_keys[key].section != UNIT_SECTION_UNIT && unit_keys[key].section != type_section[out->type]) {
+        log_warning("[unit_loader] %s: %s= does not apply to this unit type, ignoring", out->path, unit_keys[key].name);
+        return 0;
+    }
+
+    int e;
+    switch ((UnitKey)key) {
+        case UNIT_KEY_DESCRIPTION:
+            set_string(out, &out->description, val); break;
+        case UNIT_KEY_REQUIRES:
+            append_unit_list(out, &out->requires, val); break;
+        case UNIT_KEY_WANTS:
+            append_unit_list(out, &out->wants, val); break;
+        case UNIT_KEY_AFTER:
+            append_unit_list(out, &out->after, val); break;
+        case UNIT_KEY_BEFORE:
+            append_unit_list(out, &out->before, val); break;
+        case UNIT_KEY_EXEC_START:
+            set_string(out, &out->exec_start, val); break;
+        case UNIT_KEY_ENVIRONMENT:
+            append_unit_list(out, &out->environment, val); break;
+        case UNIT_KEY_TYPE:
+            if ((e = parse_enum(out, "Type", val, service_types, ELEMENTSOF(service_types))) >= 0)
+                out->service_type = (ServiceType)e;
+            break;
+        case UNIT_KEY_NOTIFY_ACCESS:
+            if ((e = parse_enum(out, "NotifyAccess", val, notify_accesses, ELEMENTSOF(notify_accesses))) >= 0)
+                out->notify_access = (NotifyAccess)e;
+            break;
+        case UNIT_KEY_TIMEOUT_START_SEC:
+            parse_usec(out, val, &out->timeout_start_usec); break;
+        case UNIT_KEY_TIMEOUT_STOP_SEC:
+            parse_usec(out, val, &out->timeout_stop_usec);
+            if (out->timeout_stop_usec == USEC_INFINITY)
+                out->timeout_stop_usec = 0;
+            break;
+        case UNIT_KEY_KILL_SIGNAL: {
+            int sig = parse_signal(val);
+            if (sig > 0)
+                out->kill_signal = sig;
+            else
+                log_warning("[unit_loader] %s: unknown signal '%s', ignoring", out->path, val);
+            break;
+        }
+        case UNIT_KEY_WATCHDOG_SEC:
+            parse_usec(out, val, &out->watchdog_usec); break;
+        case UNIT_KEY_SOCKET:
+            append_unit_list(out, &out->socket_unit, val); break;
+        case UNIT_KEY_LISTEN_STREAM:
+            append_unit_list(out, &out->listen_stream, val); break;
+        case UNIT_KEY_LISTEN_DATAGRAM:
+            append_unit_list(out, &out->listen_datagram, val); break;
+        case UNIT_KEY_LISTEN_SEQUENTIAL_PACKET:
+            append_unit_list(out, &out->listen_seqpacket, val); break;
+        case UNIT_KEY_BACKLOG:
+            parse_unsigned(out, val, &out->backlog); break;
+        case UNIT_KEY_REUSE_PORT:
+            out->reuse_port = (strcasecmp(val, "yes") == 0 || strcasecmp(val, "true") == 0); break;
+        case UNIT_KEY_SHARDS:
+            parse_unsigned(out, val, &out->shards);
+            if (out->shards == 0)
+                out->shards = 1;
+            break;
+        case UNIT_KEY_ACCEPT:
+            out->accept = (strcasecmp(val, "yes") == 0); break;
+        case UNIT_KEY_MAX_CONNECTIONS:
+            parse_unsigned(out, val, &out->max_connections); break;
+        case UNIT_KEY_ACCEPT_POOL_MIN:
+            parse_unsigned(out, val, &out->accept_pool_min); break;
+        case UNIT_KEY_ACCEPT_POOL_MAX:
+            parse_unsigned(out, val, &out->accept_pool_max); break;
+        case UNIT_KEY_ON_BOOT_SEC:
+            parse_usec(out, val, &out->on_boot_usec); break;
+        case UNIT_KEY_ON_UNIT_ACTIVE_SEC:
+            parse_usec(out, val, &out->on_active_usec); break;
+        case UNIT_KEY_ACCURACY_SEC:
+            parse_usec(out, val, &out->accuracy_usec); break;
+        case UNIT_KEY_RANDOMIZED_DELAY_SEC:
+            parse_usec(out, val, &out->randomized_delay_usec); break;
+        case UNIT_KEY_UNIT:
+            set_string(out, &out->timer_unit, val); break;
+        case UNIT_KEY_START_LIMIT_INTERVAL_SEC:
+            parse_usec(out, val, &out->start_limit_interval_usec); break;
+        case UNIT_KEY_START_LIMIT_BURST:
+            parse_unsigned(out, val, &out->start_limit_burst); break;
+        case UNIT_KEY_RESTART:
+            if ((e = parse_enum(out, "Restart", val, restart_policies, ELEMENTSOF(restart_policies))) >= 0)
+                out->restart = (RestartPolicy)e;
+            break;
+        case UNIT_KEY_RESTART_SEC:
+            parse_usec(out, val, &out->restart_usec); break;
+        case UNIT_KEY_RESTART_MAX_DELAY_SEC:
+            parse_usec(out, val, &out->restart_max_delay_usec); break;
+        case UNIT_KEY_LOG_RATE_LIMIT_INTERVAL_SEC:
+            parse_usec(out, val, &out->log_rate_limit_interval_usec); break;
+        case UNIT_KEY_LOG_RATE_LIMIT_BURST:
+            parse_bytes(out, val, &out->log_rate_limit_burst); break;
+        case UNIT_KEY_CPU_WEIGHT:
+            parse_weight(out, val, &out->cpu_weight); break;
+        case UNIT_KEY_IO_WEIGHT:
+            parse_weight(out, val, &out->io_weight); break;
+        case UNIT_KEY_MEMORY_MAX:
+            if (strcasecmp(val, "infinity") == 0)
+                out->memory_max = UINT64_MAX;
+            else
+                parse_bytes(out, val, &out->memory_max);
+            break;
+        case UNIT_KEY_TASKS_MAX: {
+            unsigned n = 0;
+            if (strcasecmp(val, "infinity") == 0) {
+                out->tasks_max = UINT64_MAX;
+                break;
+            }
+            parse_unsigned(out, val, &n);
+            if (n)
+                out->tasks_max = n;
+            break;
+        }
+        case UNIT_KEY_CPU_AFFINITY:
+            // An invalid line keeps what earlier lines set, like any other key
+            if (placement(out) && parse_mask(out, "CPUAffinity", val, out->placement->cpus, SPAWN_CPUS_MAX) == 0)
+                out->placement->has_cpus = *val != '\0';
+            break;
+        case UNIT_KEY_NUMA_POLICY:
+            if (placement(out) && (e = parse_enum(out, "NUMAPolicy", val, spawn_numa_policies, ELEMENTSOF(spawn_numa_policies))) >= 0)
+                out->placement->numa_policy = e;
+            break;
+        case UNIT_KEY_NUMA_MASK:
+            if (placement(out))
+                parse_mask(out, "NUMAMask", val, out->placement->numa_nodes, SPAWN_NUMA_NODES_MAX);
+            break;
+        case UNIT_KEY_CPU_SCHEDULING_POLICY:
+            if (placement(out) && (e = parse_enum(out, "CPUSchedulingPolicy", val, spawn_sched_policies, ELEMENTSOF(spawn_sched_policies))) >= 0)
+                out->placement->sched_policy = e;
+            break;
+        case UNIT_KEY_CPU_SCHEDULING_PRIORITY:
+            if (placement(out))
+                parse_int_range(out, "CPUSchedulingPriority", val, 0, 99, &out->placement->sched_priority);
+            break;
+        case UNIT_KEY_NICE:
+            if (placement(out) && parse_int_range(out, "Nice", val, -20, 19, &out->placement->nice) == 0)
+                out->placement->has_nice = 1;
+            break;
+        case UNIT_KEY_IO_SCHEDULING_CLASS:
+            if (placement(out) && (e = parse_enum(out, "IOSchedulingClass", val, spawn_io_classes, ELEMENTSOF(spawn_io_classes))) >= 0)
+                out->placement->io_class = e;
+            break;
+        case UNIT_KEY_IO_SCHEDULING_PRIORITY:
+            if (placement(out))
+                parse_int_range(out, "IOSchedulingPriority", val, 0, 7, &out->placement->io_priority);
+            break;
+        case UNIT_KEY_SANDBOX:
+            out->sandbox = (strcasecmp(val, "true") == 0); break;
+        case _UNIT_KEY_MAX:
+            break;
+    }
+    return 0;
+}
+
+int unit_finish(Unit *out) {
+    if (!out->name[0]) {
+        log_error("[unit_loader] %s: unit name too long or out of memory", out->path);
+        return -1;
+    }
+    if (out->type != UNIT_SERVICE)
+        return 0;
+
+    SpawnPlacement *p = out->placement;
+    if (p && (p->sched_policy == SCHED_FIFO || p->sched_policy == SCHED_RR))
+        p->sched_priority = p->sched_priority ? p->sched_priority : 1;
+    else if (p)
+        p->sched_priority = 0;  // the kernel only takes 0 for the others
+    if (p && p->io_class == 0)
+        p->io_priority = 0;     // likewise for class none: any level is EINVAL
+    if (p && (p->numa_policy == MPOL_BIND || p->numa_policy == MPOL_INTERLEAVE) &&
+        mask_empty(p->numa_nodes, SPAWN_MASK_WORDS(SPAWN_NUMA_NODES_MAX))) {
+        log_warning("[unit_loader] %s: NUMAPolicy=%s needs a NUMAMask=, ignoring", out->path, spawn_numa_policies[p->numa_policy]);
+        p->numa_policy = -1;
+    }
+
+    if (out->notify_access == NOTIFY_ACCESS_DEFAULT)
+        out->notify_access = out->service_type == SERVICE_TYPE_NOTIFY ? NOTIFY_ACCESS_MAIN : NOTIFY_ACCESS_NONE;
+
+    // Environment= may follow ExecStart=, so tokenize only once every key is set
+    if (out->exec_start[0] != '\0') {
+        int r = exec_command_parse(&out->exec, out->exec_start, out->environment);
+        if (r < 0) {
+            log_error("[unit_loader] %s: invalid ExecStart=%s: %s", out->path, out->exec_start, strerror(-r));
+            return -1;
+        }
+    }
     return 0;
 }
+
+typedef struct {
+    Unit *unit;
+    const char *path;
+    UnitKeyRecorder record;
+    void *userdata;
+} LoadContext;
+
+static void on_assignment(void *userdata, UnitSection section, const char *key, const char *val, unsigned line) {
+    LoadContext *ctx = userdata;
+    int id = unit_key_lookup(section, key, strlen(key));
+    if (id < 0) {
+        if (section != UNIT_SECTION_INSTALL)
+            log_warning("[unit_loader] %s:%u: Unknown key %s, ignoring", ctx->path, line, key);
+        return;
+    }
+    unit_set_key(ctx->unit, id, val);
+    if (ctx->record)
+        ctx->record(ctx->userdata, id, val);
+}
+
+int load_unit_at(int dir_fd, const char *file, const char *path, Unit *out,
+                 UnitKeyRecorder record, void *userdata) {
+    LoadContext ctx = { out, path, record, userdata };
+
+    unit_begin(out, path);
+    if (unit_parse_file_at(dir_fd, file, path, on_assignment, &ctx) < 0)
+        return -1;
+    return unit_finish(out);
+}
+
+int load_unit(const char *path, Unit *out) {
+    return load_unit_at(AT_FDCWD, path, path, out, NULL, NULL);
+}
+
+// Interned: equal strings are the same pointer
+#define SAME(f) (a->f == b->f)
+
+// Only used by the next start, like the restart settings
+static int same_placement(const SpawnPlacement *a, const SpawnPlacement *b) {
+    return a == b || (a && b && memcmp(a, b, sizeof(*a)) == 0);
+}
+
+UnitDiff unit_diff(const Unit *a, const Unit *b) {
+    if (!SAME(type))
+        return UNIT_DIFF_HARD;
+    switch (a->type) {
+        case UNIT_SERVICE:
+            if (!(SAME(exec_start) && SAME(environment) && SAME(service_type) && SAME(notify_access) &&
+                  SAME(watchdog_usec) && SAME(sandbox) && SAME(socket_unit)))
+                return UNIT_DIFF_HARD;
+            if (!(SAME(timeout_start_usec) && SAME(timeout_stop_usec) && SAME(kill_signal) &&
+                  SAME(restart) && SAME(restart_usec) && SAME(restart_max_delay_usec) &&
+                  SAME(log_rate_limit_interval_usec) && SAME(log_rate_limit_burst) &&
+                  SAME(cpu_weight) && SAME(io_weight) && SAME(memory_max) && SAME(tasks_max) &&
+                  same_placement(a->placement, b->placement)))
+                return UNIT_DIFF_SOFT;
+            break;
+        case UNIT_SOCKET:
+            if (!(SAME(listen_stream) && SAME(listen_datagram) && SAME(listen_seqpacket) &&
+                  SAME(backlog) && SAME(reuse_port) && SAME(shards) && SAME(accept) && SAME(max_connections) &&
+                  SAME(accept_pool_min) && SAME(accept_pool_max)))
+                return UNIT_DIFF_HARD;
+            break;
+        case UNIT_TIMER:
+            if (!(SAME(on_boot_usec) && SAME(on_active_usec) && SAME(accuracy_usec) &&
+                  SAME(randomized_delay_usec) && SAME(timer_unit)))
+                return UNIT_DIFF_HARD;
+            break;
+        default:
+            break;
+    }
+    if (!(SAME(path) && SAME(description) && SAME(requires) && SAME(wants) &&
+          SAME(after) && SAME(before) && SAME(start_limit_interval_usec) && SAME(start_limit_burst)))
+        return UNIT_DIFF_SOFT;
+    return UNIT_DIFF_NONE;
+}
+
+#undef SAME
+
+void unit_free(Unit *u) {
+    if (u->type == UNIT_SERVICE) {
+        exec_command_free(&u->exec);
+        free(u->placement);
+        u->placement = NULL;
+    }
+}
@@ -1,6 +1,11 @@
 #ifndef COREINITD_UNIT_LOADER_H
 #define COREINITD_UNIT_LOADER_H
 
+#include <stddef.h>
+#include <stdint.h>
+#include "spawn.h"
+#include "unit_keys.h"
+
 typedef enum {
     UNIT_SERVICE,
     UNIT_SOCKET,
@@ -8,29 +13,130 @@ typedef enum {
     UNIT_UNKNOWN
 } UnitType;
 
+typedef enum {
+    SERVICE_TYPE_SIMPLE,    // started once exec'd (exec is the same here: spawning waits for exec)
+    SERVICE_TYPE_EXEC,
+    SERVICE_TYPE_NOTIFY     // started once it sends READY=1
+} ServiceType;
+
+// Who may send sd_notify() messages for a service
+typedef enum {
+    NOTIFY_ACCESS_DEFAULT,  // resolved by unit_finish(): main for Type=notify, else none
+    NOTIFY_ACCESS_NONE,
+    NOTIFY_ACCESS_MAIN,
+    NOTIFY_ACCESS_EXEC,     // main process; there are no control processes yet
+    NOTIFY_ACCESS_ALL       // main process and its descendants
+} NotifyAccess;
+
+typedef enum {
+    RESTART_NO,
+    RESTART_ON_FAILURE,
+    RESTART_ALWAYS
+} RestartPolicy;
+
+#define UNIT_NAME_MAX 255       // a unit name is a file name, no longer than NAME_MAX
+
+// Strings come from strpool.h: never NULL ("" when unset), shared between
+// units, never written to. Type-specific settings overlap in a union; only
+// the ones matching .type are meaningful, unit_set_key() ignores the others.
 typedef struct {
     UnitType type;
-    char name[128];
-    char description[256];
+    int not_found;		// file removed by a reload; the slot stays so ids remain valid
+    size_t id;			// registry index, see unit_registry.h
+    const char *name;		// canonical name: file basename, e.g. "foo.service"
+    const char *path;		// unit file it was loaded from
+    const char *description;
 
-    // For Service units
-    char exec_start[256];
-    char notify_access[32];
-    int sandbox;
+    // Dependencies ([Unit] section, space-separated unit names, see unit_list_next())
+    const char *requires;
+    const char *wants;
+    const char *after;
+    const char *before;
 
-    // For Socket units
-    char listen_stream[64];	// Unix path, TCP port, etc.
-    int accept;		// For Accept=yes|no
+    // Start rate limit: at most start_limit_burst starts per interval
+    uint64_t start_limit_interval_usec;	// 0 = no limit
+    unsigned start_limit_burst;
 
-    // For Timer units
-    char on_boot_sec[32];
-    char on_active_sec[32];
-    char timer_unit[128];
-
-	// Service->Socket Activation (if `.socket` is a reference to another unit)
-    char socket_unit[128];     // Name of .socket unit linked from a .service
+    union {
+        // UNIT_SERVICE
+        struct {
+            const char *exec_start;
+            const char *environment;	// Environment= words, "K=V" "K2=V2"
+            const char *socket_unit;	// Socket= names of .socket units this service takes over
+            ExecCommand exec;	// ExecStart= tokenized once at load time
+            ServiceType service_type;
+            NotifyAccess notify_access;
+            RestartPolicy restart;
+            int kill_signal;		// KillSignal=, what stop sends first
+            int sandbox;
+            // cgroup v2 resource control, 0 = unset (the kernel default)
+            unsigned cpu_weight;		// CPUWeight= 1-10000
+            unsigned io_weight;		// IOWeight= 1-10000
+            uint64_t memory_max;		// MemoryMax= bytes, UINT64_MAX = infinity
+            uint64_t tasks_max;		// TasksMax=, UINT64_MAX = infinity
+            SpawnPlacement *placement;	// CPUAffinity=, NUMAPolicy=, Nice=, ...; NULL = inherit all
+            uint64_t timeout_start_usec;	// Type=notify: READY=1 deadline, 0 = none
+            uint64_t timeout_stop_usec;	// TimeoutStopSec=: SIGKILL after this, 0 = never
+            uint64_t watchdog_usec;		// WatchdogSec=, 0 = off
+            uint64_t restart_usec;		// first RestartSec= delay, doubled per consecutive restart
+            uint64_t restart_max_delay_usec;	// cap for that doubling
+            uint64_t log_rate_limit_interval_usec;	// output beyond log_rate_limit_burst bytes
+            uint64_t log_rate_limit_burst;		// per interval is dropped; either 0 = no limit
+        };
+        // UNIT_SOCKET
+        struct {
+            // Listen*= addresses, space-separated, see parse_socket_address()
+            const char *listen_stream;
+            const char *listen_datagram;
+            const char *listen_seqpacket;	// ListenSequentialPacket=
+            unsigned backlog;		// listen() queue length
+            int reuse_port;		// SO_REUSEPORT on IP listeners
+            unsigned shards;		// Accept=no: bind each IP address this many times, one instance each
+            int accept;		// For Accept=yes|no
+            unsigned max_connections;	// Accept=yes: live instances, 0 = unlimited
+            unsigned accept_pool_min;	// Accept=yes: warm pre-forked instances kept idle
+            unsigned accept_pool_max;	// upper bound the pool may grow to under load
+        };
+        // UNIT_TIMER
+        struct {
+            const char *timer_unit;		// Unit=, defaults to the sibling .service
+            uint64_t on_boot_usec;		// 0 = unset
+            uint64_t on_active_usec;	// OnUnitActiveSec=, 0 = unset
+            uint64_t accuracy_usec;		// AccuracySec=, lets wakeups coalesce
+            uint64_t randomized_delay_usec;
+        };
+    };
 } Unit;
 
+// Copy the next name of a unit list (Requires=, After=, Socket=, ...) to
+// name and advance *list past it; 0 once the list is exhausted. Words
+// longer than UNIT_NAME_MAX cannot name a unit and are skipped.
+int unit_list_next(const char **list, char name[UNIT_NAME_MAX + 1]);
+
+
+// Called for every recognised key=value, in file order
+typedef void (*UnitKeyRecorder)(void *userdata, int key, const char *val);
+
 int load_unit(const char *path, Unit *out);
+// Load file relative to dir_fd (or AT_FDCWD); path is what Unit.path records
+int load_unit_at(int dir_fd, const char *file, const char *path, Unit *out,
+                 UnitKeyRecorder record, void *userdata);
+
+// Building blocks of load_unit(), also used to replay a cached unit
+void unit_begin(Unit *out, const char *path);
+int unit_set_key(Unit *out, int key, const char *val);
+int unit_finish(Unit *out);
+int unit_key_lookup(UnitSection section, const char *key, size_t len);
+uint32_t unit_key_abi(void);		// changes whenever the key table does
+
+// What a reload has to do about a changed definition
+typedef enum {
+    UNIT_DIFF_NONE,
+    UNIT_DIFF_SOFT,     // metadata, dependencies, restart policy: just swap it in
+    UNIT_DIFF_HARD      // the process, listener or schedule itself changed
+} UnitDiff;
+UnitDiff unit_diff(const Unit *old, const Unit *new);
+
+void unit_free(Unit *u);
 
 #endif
@@ -0,0 +1,166 @@
+// unit_parser.c — single-pass, in-place tokenizer for unit files
+//
+// No line length limit and no per-line copies: the file is read once and
+// every key and value is NUL-terminated where it lies. Joining continuation
+// lines only ever moves bytes backwards, so it happens in the same buffer.
+#include "unit_parser.h"
+#include "log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static const char *const section_names[_UNIT_SECTION_MAX] = {
+    [UNIT_SECTION_UNIT]    = "Unit",
+    [UNIT_SECTION_SERVICE] = "Service",
+    [UNIT_SECTION_SOCKET]  = "Socket",
+    [UNIT_SECTION_TIMER]   = "Timer",
+    [UNIT_SECTION_INSTALL] = "Install",
+};
+
+static int is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static UnitSection lookup_section(const char *name, size_t len) {
+    for (int i = UNIT_SECTION_UNIT; i < UNIT_SECTION_UNKNOWN; i++)
+        if (strlen(section_names[i]) == len && memcmp(section_names[i], name, len) == 0)
+            return (UnitSection)i;
+    return UNIT_SECTION_UNKNOWN;
+}
+
+int unit_parse_buffer(char *buf, size_t len, const char *path, UnitParserFn fn, void *userdata) {
+    char *p = buf, *end = buf + len;
+    UnitSection section = UNIT_SECTION_NONE;
+    unsigned line = 0;
+    int diagnostics = 0;
+
+    *end = '\0';
+    while (p < end) {
+        char *eol = memchr(p, '\n', (size_t)(end - p));
+        if (!eol) eol = end;
+        line++;
+
+        char *s = p, *e = eol;
+        while (s < e && is_blank(*s)) s++;
+        while (e > s && is_blank(e[-1])) e--;
+        p = eol < end ? eol + 1 : end;
+
+        if (s == e || *s == '#' || *s == ';')
+            continue;
+
+        if (*s == '[') {
+            if (e[-1] != ']') {
+                log_warning("[unit_parser] %s:%u: Invalid section header", path, line);
+                diagnostics++;
+                section = UNIT_SECTION_UNKNOWN;
+                continue;
+            }
+            section = lookup_section(s + 1, (size_t)(e - s - 2));
+            if (section == UNIT_SECTION_UNKNOWN) {
+                log_warning("[unit_parser] %s:%u: Unknown section %.*s, ignoring its keys",
+                            path, line, (int)(e - s), s);
+                diagnostics++;
+            }
+            continue;
+        }
+
+        // Join "\<newline>" continuations into [s, w); comment lines inside are dropped
+        unsigned start_line = line;
+        char *w = e;
+        while (w > s && w[-1] == '\\' && p < end) {
+            char *ceol = memchr(p, '\n', (size_t)(end - p));
+            if (!ceol) ceol = end;
+            line++;
+
+            char *cs = p, *ce = ceol;
+            while (cs < ce && is_blank(*cs)) cs++;
+            while (ce > cs && is_blank(ce[-1])) ce--;
+            p = ceol < end ? ceol + 1 : end;
+
+            if (cs < ce && (*cs == '#' || *cs == ';'))
+                continue;
+            w--;
+            while (w > s && is_blank(w[-1])) w--;
+            *w++ = ' ';
+            memmove(w, cs, (size_t)(ce - cs));
+            w += ce - cs;
+        }
+        if (w > s && w[-1] == '\\') w--;   // continuation at end of file
+        while (w > s && is_blank(w[-1])) w--;
+        *w = '\0';
+
+        char *eq = memchr(s, '=', (size_t)(w - s));
+        if (!eq) {
+            log_warning("[unit_parser] %s:%u: Missing '=', ignoring line", path, start_line);
+            diagnostics++;
+            continue;
+        }
+        if (section == UNIT_SECTION_NONE) {
+            log_warning("[unit_parser] %s:%u: Assignment outside of any section, ignoring", path, start_line);
+            diagnostics++;
+            continue;
+        }
+
+        char *ke = eq;
+        while (ke > s && is_blank(ke[-1])) ke--;
+        char *v = eq + 1;
+        while (v < w && is_blank(*v)) v++;
+        *ke = '\0';
+
+        if (ke == s) {
+            log_warning("[unit_parser] %s:%u: Empty key, ignoring", path, start_line);
+            diagnostics++;
+            continue;
+        }
+        if (section != UNIT_SECTION_UNKNOWN)
+            fn(userdata, section, s, v, start_line);
+    }
+
+    return diagnostics;
+}
+
+int unit_parse_file_at(int dir_fd, const char *file, const char *path, UnitParserFn fn, void *userdata) {
+    int fd = openat(dir_fd, file, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -errno;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        int r = -errno;
+        close(fd);
+        return r;
+    }
+
+    size_t size = (size_t)st.st_size;
+    char *buf = malloc(size + 1);
+    if (!buf) {
+        close(fd);
+        return -ENOMEM;
+    }
+
+    size_t got = 0;
+    while (got < size) {
+        ssize_t n = read(fd, buf + got, size - got);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            int r = -errno;
+            free(buf);
+            close(fd);
+            return r;
+        }
+        if (n == 0) break;  // truncated under us
+        got += (size_t)n;
+    }
+    close(fd);
+
+    int r = unit_parse_buffer(buf, got, path, fn, userdata);
+    free(buf);
+    return r;
+}
+
+int unit_parse_file(const char *path, UnitParserFn fn, void *userdata) {
+    return unit_parse_file_at(AT_FDCWD, path, path, fn, userdata);
+}
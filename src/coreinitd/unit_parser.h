@@ -0,0 +1,24 @@
+// unit_parser.h — single-pass, in-place tokenizer for unit files
+#ifndef COREINITD_UNIT_PARSER_H
+#define COREINITD_UNIT_PARSER_H
+
+#include <stddef.h>
+#include "unit_keys.h"
+
+// key and value point into the parse buffer, NUL-terminated and trimmed;
+// continuation lines are already joined. line is where the assignment starts.
+typedef void (*UnitParserFn)(void *userdata, UnitSection section, const char *key,
+                             const char *value, unsigned line);
+
+// Tokenize buf[0..len) in place; buf[len] must be writable and is set to NUL.
+// Malformed lines are reported as path:line and skipped. Returns the number
+// of such diagnostics.
+int unit_parse_buffer(char *buf, size_t len, const char *path, UnitParserFn fn, void *userdata);
+
+// Read the whole file with a single read() and parse it. Returns a negative
+// errno if the file cannot be read, otherwise as unit_parse_buffer().
+int unit_parse_file(const char *path, UnitParserFn fn, void *userdata);
+// Same, opening file relative to dir_fd; path is only used in diagnostics
+int unit_parse_file_at(int dir_fd, const char *file, const char *path, UnitParserFn fn, void *userdata);
+
+#endif
@@ -0,0 +1,160 @@
+// unit_registry.c — slab-allocated Unit storage with an open-addressing name index
+#include "unit_registry.h"
+#include "trace.h"
+#include "strpool.h"
+#include "log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+
+// Units live in fixed slabs so handles never move when the registry grows
+#define UNITS_PER_SLAB 64
+
+static Unit **slabs = NULL;
+static size_t slab_count = 0;
+
+static Unit **by_id = NULL;     // id -> Unit*, in load order
+static size_t unit_count = 0, id_cap = 0;
+
+static Unit **buckets = NULL;   // linear probing, power-of-two size
+static size_t bucket_count = 0;
+
+static uint32_t hash_name(const char *s) {
+    uint32_t h = 2166136261u;   // FNV-1a
+    for (; *s; s++) {
+        h ^= (unsigned char)*s;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static Unit **bucket_for(const char *name) {
+    size_t mask = bucket_count - 1;
+    for (size_t i = hash_name(name) & mask; ; i = (i + 1) & mask) {
+        if (!buckets[i] || strcmp(buckets[i]->name, name) == 0)
+            return &buckets[i];
+    }
+}
+
+static int rehash(size_t new_count) {
+    Unit **old = buckets;
+    size_t old_count = bucket_count;
+
+    buckets = calloc(new_count, sizeof(*buckets));
+    if (!buckets) {
+        buckets = old;
+        return -ENOMEM;
+    }
+    bucket_count = new_count;
+    for (size_t i = 0; i < old_count; i++)
+        if (old[i]) *bucket_for(old[i]->name) = old[i];
+    free(old);
+    return 0;
+}
+
+static Unit *alloc_unit(void) {
+    if (unit_count == slab_count * UNITS_PER_SLAB) {
+        Unit **s = realloc(slabs, (slab_count + 1) * sizeof(*s));
+        if (!s) return NULL;
+        slabs = s;
+        slabs[slab_count] = calloc(UNITS_PER_SLAB, sizeof(Unit));
+        if (!slabs[slab_count]) return NULL;
+        slab_count++;
+    }
+    if (unit_count == id_cap) {
+        size_t cap = id_cap ? id_cap * 2 : UNITS_PER_SLAB;
+        Unit **v = realloc(by_id, cap * sizeof(*v));
+        if (!v) return NULL;
+        by_id = v;
+        id_cap = cap;
+    }
+    return &slabs[unit_count / UNITS_PER_SLAB][unit_count % UNITS_PER_SLAB];
+}
+
+int unit_registry_add(const Unit *u, Unit **ret) {
+    // Keep the load factor under 3/4
+    if ((unit_count + 1) * 4 > bucket_count * 3) {
+        int r = rehash(bucket_count ? bucket_count * 2 : 128);
+        if (r < 0) return r;
+    }
+
+    Unit **slot = bucket_for(u->name);
+    if (*slot)
+        return -EEXIST;
+
+    Unit *nu = alloc_unit();
+    if (!nu)
+        return -ENOMEM;
+
+    *nu = *u;
+    nu->id = unit_count;
+    by_id[unit_count++] = nu;
+    *slot = nu;
+    trace_event(nu, TRACE_LOAD, 0);
+
+    if (ret) *ret = nu;
+    return 0;
+}
+
+Unit *unit_registry_find(const char *name) {
+    if (!name || bucket_count == 0)
+        return NULL;
+    return *bucket_for(name);
+}
+
+Unit *unit_registry_find_sibling(const Unit *u, const char *suffix) {
+    char name[UNIT_NAME_MAX + 1];
+    const char *dot = strrchr(u->name, '.');
+    size_t base = dot ? (size_t)(dot - u->name) : strlen(u->name);
+
+    if (base + strlen(suffix) >= sizeof(name))
+        return NULL;
+    memcpy(name, u->name, base);
+    strcpy(name + base, suffix);
+    return unit_registry_find(name);
+}
+
+size_t unit_registry_count(void) {
+    return unit_count;
+}
+
+Unit *unit_registry_get(size_t id) {
+    return id < unit_count ? by_id[id] : NULL;
+}
+
+void unit_registry_log_memory(void) {
+    StrPoolStats sp;
+    strpool_stats(&sp);
+    size_t table = slab_count * UNITS_PER_SLAB * sizeof(Unit) +
+                   id_cap * sizeof(*by_id) + bucket_count * sizeof(*buckets);
+
+    long rss_pages = 0;
+    FILE *f = fopen("/proc/self/statm", "re");
+    if (f) {
+        if (fscanf(f, "%*s %ld", &rss_pages) != 1)
+            rss_pages = 0;
+        fclose(f);
+    }
+    log_info("[unit_registry] %zu units: %zu KiB table (%zu B per unit), %zu KiB strings "
+             "(%zu distinct, %zu KiB saved by sharing), RSS %ld KiB",
+             unit_count, table / 1024, sizeof(Unit), sp.allocated / 1024, sp.strings,
+             (sp.requested - sp.used) / 1024, rss_pages * (sysconf(_SC_PAGESIZE) / 1024));
+}
+
+void unit_registry_free(void) {
+    for (size_t i = 0; i < unit_count; i++)
+        unit_free(by_id[i]);
+    for (size_t i = 0; i < slab_count; i++)
+        free(slabs[i]);
+    free(slabs);
+    free(by_id);
+    free(buckets);
+    slabs = NULL;
+    by_id = NULL;
+    buckets = NULL;
+    slab_count = unit_count = id_cap = bucket_count = 0;
+    strpool_free();
+}
@@ -0,0 +1,25 @@
+// unit_registry.h — owns every loaded Unit; O(1) lookup by canonical unit name
+#ifndef COREINITD_UNIT_REGISTRY_H
+#define COREINITD_UNIT_REGISTRY_H
+
+#include <stddef.h>
+#include "unit_loader.h"
+
+// Move *u into the registry. The returned handle stays valid until
+// unit_registry_free(); -EEXIST if a unit of that name is already loaded.
+int unit_registry_add(const Unit *u, Unit **ret);
+
+Unit *unit_registry_find(const char *name);
+// "foo.socket" + ".service" -> foo.service
+Unit *unit_registry_find_sibling(const Unit *u, const char *suffix);
+
+size_t unit_registry_count(void);
+Unit *unit_registry_get(size_t id);
+
+// Log what the unit table, its index and the string pool take, next to our RSS
+void unit_registry_log_memory(void);
+
+// Also releases the string pool: no Unit may be used afterwards
+void unit_registry_free(void);
+
+#endif
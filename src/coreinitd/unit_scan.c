@@ -0,0 +1,307 @@
+// unit_scan.c — single-pass, parallel load of every unit directory on the search path
+//
+// Directories are listed once, in precedence order, through cached dir fds.
+// Shadowed names are dropped before any file is read, then a small pthread
+// pool parses the survivors with openat()/fstatat(). Registration and cache
+// recording happen afterwards on the calling thread, in listing order, so the
+// result does not depend on which worker finished first.
+#define _GNU_SOURCE
+#include "unit_scan.h"
+#include "log.h"
+#include "unit_loader.h"
+#include "unit_registry.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+
+#define SCAN_MAX_WORKERS 8
+#define SCAN_FILES_PER_WORKER 32   // below this, threads cost more than they save
+
+typedef struct {
+    size_t dir;
+    char *file;
+    int shadowed;
+    int r;                  // load result
+    struct stat st;
+    Unit unit;
+    char *props;            // recorded (key byte, value, NUL) triples for the cache
+    size_t props_len, props_cap;
+} ScanEntry;
+
+typedef struct {
+    const UnitSearchPath *sp;
+    const int *dir_fds;
+    ScanEntry *entries;
+    size_t n_entries;
+    atomic_size_t next;
+} ScanJob;
+
+int unit_search_path_init(UnitSearchPath *sp) {
+    const char *env = getenv("COREINITD_UNIT_PATH");
+    const char *path = env && *env ? env : UNIT_SEARCH_PATH;
+
+    sp->dirs = NULL;
+    sp->n_dirs = 0;
+    for (const char *p = path; *p; ) {
+        size_t len = strcspn(p, ":");
+        if (len > 0) {
+            char **dirs = realloc(sp->dirs, (sp->n_dirs + 1) * sizeof(*dirs));
+            if (!dirs) goto fail;
+            sp->dirs = dirs;
+            if (!(sp->dirs[sp->n_dirs] = strndup(p, len))) goto fail;
+            sp->n_dirs++;
+        }
+        p += len;
+        if (*p == ':') p++;
+    }
+    return 0;
+
+fail:
+    unit_search_path_free(sp);
+    return -ENOMEM;
+}
+
+void unit_search_path_free(UnitSearchPath *sp) {
+    for (size_t i = 0; i < sp->n_dirs; i++)
+        free(sp->dirs[i]);
+    free(sp->dirs);
+    sp->dirs = NULL;
+    sp->n_dirs = 0;
+}
+
+static int has_suffix(const char *s, size_t len, const char *suffix, size_t suffix_len) {
+    return len > suffix_len && memcmp(s + len - suffix_len, suffix, suffix_len) == 0;
+}
+
+int unit_scan_is_unit_file(const char *name) {
+    size_t len = strlen(name);
+    return name[0] != '.' &&
+        (has_suffix(name, len, ".service", 8) ||
+         has_suffix(name, len, ".socket", 7) ||
+         has_suffix(name, len, ".timer", 6));
+}
+
+// Append the unit files of one directory, already open as dir_fd
+static int list_dir(int dir_fd, size_t dir, ScanEntry **entries, size_t *n, size_t *cap) {
+    int fd = dup(dir_fd);
+    if (fd < 0) return -errno;
+    DIR *d = fdopendir(fd);
+    if (!d) {
+        int r = -errno;
+        close(fd);
+        return r;
+    }
+    rewinddir(d);
+
+    struct dirent *ent;
+    while ((ent = readdir(d))) {
+        if (ent->d_type != DT_REG && ent->d_type != DT_LNK && ent->d_type != DT_UNKNOWN)
+            continue;
+        if (!unit_scan_is_unit_file(ent->d_name))
+            continue;
+
+        if (*n == *cap) {
+            size_t c = *cap ? *cap * 2 : 256;
+            ScanEntry *e = realloc(*entries, c * sizeof(*e));
+            if (!e) {
+                closedir(d);
+                return -ENOMEM;
+            }
+            *entries = e;
+            *cap = c;
+        }
+        ScanEntry *e = &(*entries)[*n];
+        memset(e, 0, sizeof(*e));
+        e->dir = dir;
+        if (!(e->file = strdup(ent->d_name))) {
+            closedir(d);
+            return -ENOMEM;
+        }
+        (*n)++;
+    }
+
+    closedir(d);
+    return 0;
+}
+
+static int compare_entries(const void *a, const void *b) {
+    const ScanEntry *x = *(ScanEntry *const *)a, *y = *(ScanEntry *const *)b;
+    int c = strcmp(x->file, y->file);
+    if (c) return c;
+    return x->dir < y->dir ? -1 : x->dir > y->dir;
+}
+
+// Keep the first directory's copy of every name
+static int mark_shadowed(const UnitSearchPath *sp, ScanEntry *entries, size_t n) {
+    if (sp->n_dirs < 2 || n < 2) return 0;
+
+    ScanEntry **sorted = malloc(n * sizeof(*sorted));
+    if (!sorted) return -ENOMEM;
+    for (size_t i = 0; i < n; i++)
+        sorted[i] = &entries[i];
+    qsort(sorted, n, sizeof(*sorted), compare_entries);
+
+    const ScanEntry *winner = sorted[0];
+    for (size_t i = 1; i < n; i++) {
+        if (strcmp(sorted[i]->file, winner->file) != 0) {
+            winner = sorted[i];
+            continue;
+        }
+        sorted[i]->shadowed = 1;
+        log_info("[unit_scan] %s/%s is overridden by %s/%s",
+                 sp->dirs[sorted[i]->dir], sorted[i]->file, sp->dirs[winner->dir], winner->file);
+    }
+
+    free(sorted);
+    return 0;
+}
+
+// UnitKeyRecorder: copy what the parser saw, the cache writer is not thread-safe
+static void record_prop(void *userdata, int key, const char *val) {
+    ScanEntry *e = userdata;
+    size_t len = strlen(val) + 2;
+    if (e->props_len + len > e->props_cap) {
+        size_t c = e->props_cap ? e->props_cap * 2 : 256;
+        while (c < e->props_len + len) c *= 2;
+        char *p = realloc(e->props, c);
+        if (!p) {
+            e->r = -ENOMEM;
+            return;
+        }
+        e->props = p;
+        e->props_cap = c;
+    }
+    e->props[e->props_len] = (char)key;
+    memcpy(e->props + e->props_len + 1, val, len - 1);
+    e->props_len += len;
+}
+
+static void parse_entry(ScanJob *job, ScanEntry *e) {
+    int dir_fd = job->dir_fds[e->dir];
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", job->sp->dirs[e->dir], e->file);
+
+    // stat before reading: an edit racing the parse invalidates the cache
+    if (fstatat(dir_fd, e->file, &e->st, 0) < 0) {
+        e->r = -errno;
+        return;
+    }
+    if (!S_ISREG(e->st.st_mode)) {
+        e->r = -EISDIR;
+        return;
+    }
+    if (load_unit_at(dir_fd, e->file, path, &e->unit, record_prop, e) < 0 && e->r == 0)
+        e->r = -EINVAL;
+}
+
+static void *scan_worker(void *userdata) {
+    ScanJob *job = userdata;
+    size_t i;
+    while ((i = atomic_fetch_add(&job->next, 1)) < job->n_entries)
+        if (!job->entries[i].shadowed)
+            parse_entry(job, &job->entries[i]);
+    return NULL;
+}
+
+static void parse_all(ScanJob *job) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t n_workers = job->n_entries / SCAN_FILES_PER_WORKER;
+    if (cpus > 0 && n_workers > (size_t)cpus) n_workers = (size_t)cpus;
+    if (n_workers > SCAN_MAX_WORKERS) n_workers = SCAN_MAX_WORKERS;
+
+    // The calling thread is a worker too; spawn failures just mean fewer helpers
+    pthread_t threads[SCAN_MAX_WORKERS];
+    size_t started = 0;
+    for (; started + 1 < n_workers; started++)
+        if (pthread_create(&threads[started], NULL, scan_worker, job) != 0)
+            break;
+    scan_worker(job);
+    for (size_t i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+}
+
+size_t unit_scan_load(const UnitSearchPath *sp, UnitCacheWriter *w, size_t *failed) {
+    int *dir_fds = malloc((sp->n_dirs ? sp->n_dirs : 1) * sizeof(*dir_fds));
+    ScanEntry *entries = NULL;
+    size_t n = 0, cap = 0, loaded = 0;
+    if (!dir_fds) {
+        (*failed)++;
+        return 0;
+    }
+
+    for (size_t i = 0; i < sp->n_dirs; i++) {
+        struct stat st;
+        dir_fds[i] = open(sp->dirs[i], O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dir_fds[i] < 0) {
+            if (errno != ENOENT) {
+                log_error("[unit_scan] Failed to open %s: %s", sp->dirs[i], strerror(errno));
+                (*failed)++;
+            }
+            if (w) unit_cache_writer_add_dir(w, sp->dirs[i], NULL);
+            continue;
+        }
+        // stat before listing, so a file created meanwhile makes the cache stale
+        if (fstat(dir_fds[i], &st) < 0 || (w && unit_cache_writer_add_dir(w, sp->dirs[i], &st) < 0))
+            (*failed)++;
+        int r = list_dir(dir_fds[i], i, &entries, &n, &cap);
+        if (r < 0) {
+            log_error("[unit_scan] Failed to list %s: %s", sp->dirs[i], strerror(-r));
+            (*failed)++;
+        }
+    }
+
+    if (mark_shadowed(sp, entries, n) < 0)
+        (*failed)++;
+
+    ScanJob job = { .sp = sp, .dir_fds = dir_fds, .entries = entries, .n_entries = n };
+    atomic_init(&job.next, 0);
+    parse_all(&job);
+
+    for (size_t i = 0; i < n; i++) {
+        ScanEntry *e = &entries[i];
+        if (e->shadowed)
+            goto next;
+        if (e->r < 0) {
+            log_error("[unit_scan] Failed to load %s/%s", sp->dirs[e->dir], e->file);
+            unit_free(&e->unit);
+            (*failed)++;
+            goto next;
+        }
+
+        if (w) {
+            unit_cache_writer_add_unit(w, e->dir, e->file, &e->st);
+            for (size_t off = 0; off < e->props_len; ) {
+                const char *val = e->props + off + 1;
+                unit_cache_writer_record(w, (unsigned char)e->props[off], val);
+                off += strlen(val) + 2;
+            }
+        }
+
+        int r = unit_registry_add(&e->unit, NULL);
+        if (r < 0) {
+            log_error("[unit_scan] Failed to register %s: %s", e->file, strerror(-r));
+            unit_free(&e->unit);
+            (*failed)++;
+            goto next;
+        }
+        loaded++;
+next:
+        free(e->file);
+        free(e->props);
+    }
+
+    for (size_t i = 0; i < sp->n_dirs; i++)
+        if (dir_fds[i] >= 0)
+            close(dir_fds[i]);
+    free(dir_fds);
+    free(entries);
+    return loaded;
+}
@@ -0,0 +1,30 @@
+// unit_scan.h — single-pass, parallel load of every unit directory on the search path
+#ifndef COREINITD_UNIT_SCAN_H
+#define COREINITD_UNIT_SCAN_H
+
+#include <stddef.h>
+#include "unit_cache.h"
+
+// Highest precedence first: a unit file shadows any same-named file after it.
+// Overridden at runtime by $COREINITD_UNIT_PATH (colon-separated).
+#ifndef UNIT_SEARCH_PATH
+#define UNIT_SEARCH_PATH "./etc/units:/etc/coreinitd/units:/run/coreinitd/units:/usr/lib/coreinitd/units"
+#endif
+
+typedef struct {
+    char **dirs;
+    size_t n_dirs;
+} UnitSearchPath;
+
+int unit_search_path_init(UnitSearchPath *sp);
+void unit_search_path_free(UnitSearchPath *sp);
+
+// Parse every .service/.socket/.timer file on the search path into the
+// registry, recording it in w (may be NULL). Missing directories are skipped.
+// Returns the number of units loaded; *failed counts files that could not be.
+size_t unit_scan_load(const UnitSearchPath *sp, UnitCacheWriter *w, size_t *failed);
+
+// foo.service, foo.socket, foo.timer; not hidden files or editor backups
+int unit_scan_is_unit_file(const char *name);
+
+#endif
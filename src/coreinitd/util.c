@@ -0,0 +1,267 @@
+// util.c — small helpers shared across coreinitd modules
+#include "util.h"
+#include <ctype.h>
+#include <errno.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+static const struct {
+    const char *suffix;
+    uint64_t usec;
+} timespan_units[] = {
+    { "usec",    1ULL },
+    { "us",      1ULL },
+    { "µs",      1ULL },
+    { "msec",    USEC_PER_MSEC },
+    { "ms",      USEC_PER_MSEC },
+    { "seconds", USEC_PER_SEC },
+    { "second",  USEC_PER_SEC },
+    { "sec",     USEC_PER_SEC },
+    { "s",       USEC_PER_SEC },
+    { "minutes", 60 * USEC_PER_SEC },
+    { "minute",  60 * USEC_PER_SEC },
+    { "min",     60 * USEC_PER_SEC },
+    { "months",  2629800 * USEC_PER_SEC },
+    { "month",   2629800 * USEC_PER_SEC },
+    { "m",       60 * USEC_PER_SEC },
+    { "M",       2629800 * USEC_PER_SEC },
+    { "hours",   3600 * USEC_PER_SEC },
+    { "hour",    3600 * USEC_PER_SEC },
+    { "hr",      3600 * USEC_PER_SEC },
+    { "h",       3600 * USEC_PER_SEC },
+    { "days",    86400 * USEC_PER_SEC },
+    { "day",     86400 * USEC_PER_SEC },
+    { "d",       86400 * USEC_PER_SEC },
+    { "weeks",   604800 * USEC_PER_SEC },
+    { "week",    604800 * USEC_PER_SEC },
+    { "w",       604800 * USEC_PER_SEC },
+    { "years",   31557600 * USEC_PER_SEC },
+    { "year",    31557600 * USEC_PER_SEC },
+    { "y",       31557600 * USEC_PER_SEC },
+};
+
+uint64_t now_usec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * USEC_PER_SEC + (uint64_t)ts.tv_nsec / 1000;
+}
+
+int parse_timespan(const char *s, uint64_t *ret_usec) {
+    while (isspace((unsigned char)*s)) s++;
+    if (strcmp(s, "infinity") == 0) {
+        *ret_usec = USEC_INFINITY;
+        return 0;
+    }
+    if (*s == '\0')
+        return -EINVAL;
+
+    uint64_t total = 0;
+    while (*s) {
+        // Plain decimal only: no sign, exponent or hex as strtod() would take
+        uint64_t whole = 0, frac = 0, frac_div = 1;
+        int digits = 0;
+        for (; isdigit((unsigned char)*s); s++, digits++) {
+            if (whole > (UINT64_MAX - 9) / 10)
+                return -ERANGE;
+            whole = whole * 10 + (uint64_t)(*s - '0');
+        }
+        if (*s == '.')
+            for (s++; isdigit((unsigned char)*s); s++, digits++)
+                if (frac_div < USEC_PER_SEC) {
+                    frac = frac * 10 + (uint64_t)(*s - '0');
+                    frac_div *= 10;
+                }
+        if (digits == 0 || *s == '.')
+            return -EINVAL;
+        while (isspace((unsigned char)*s)) s++;
+
+        uint64_t mult = USEC_PER_SEC;  // bare number: seconds
+        size_t len = 0;
+        while (s[len] && !isspace((unsigned char)s[len]) && !isdigit((unsigned char)s[len]) && s[len] != '.')
+            len++;
+        if (len > 0) {
+            size_t i;
+            for (i = 0; i < sizeof(timespan_units) / sizeof(timespan_units[0]); i++)
+                if (strlen(timespan_units[i].suffix) == len && memcmp(s, timespan_units[i].suffix, len) == 0)
+                    break;
+            if (i == sizeof(timespan_units) / sizeof(timespan_units[0]))
+                return -EINVAL;
+            mult = timespan_units[i].usec;
+            s += len;
+        }
+
+        // Digits below a microsecond are dropped
+        uint64_t part = frac_div <= mult ? frac * (mult / frac_div) : frac / (frac_div / mult);
+        if (whole > (USEC_INFINITY - total) / mult || part > USEC_INFINITY - total - whole * mult)
+            return -ERANGE;
+        total += whole * mult + part;
+        while (isspace((unsigned char)*s)) s++;
+    }
+
+    *ret_usec = total;
+    return 0;
+}
+
+static const struct {
+    const char *name;
+    int sig;
+} signal_names[] = {
+    { "HUP", SIGHUP }, { "INT", SIGINT }, { "QUIT", SIGQUIT }, { "ABRT", SIGABRT },
+    { "KILL", SIGKILL }, { "USR1", SIGUSR1 }, { "USR2", SIGUSR2 }, { "PIPE", SIGPIPE },
+    { "ALRM", SIGALRM }, { "TERM", SIGTERM }, { "CONT", SIGCONT }, { "STOP", SIGSTOP },
+    { "WINCH", SIGWINCH }, { "PWR", SIGPWR },
+};
+
+int parse_signal(const char *s) {
+    const char *name = strncasecmp(s, "SIG", 3) == 0 ? s + 3 : s;
+    for (size_t i = 0; i < sizeof(signal_names) / sizeof(signal_names[0]); i++)
+        if (strcasecmp(name, signal_names[i].name) == 0)
+            return signal_names[i].sig;
+
+    char *end;
+    long n = strtol(s, &end, 10);
+    if (end == s || *end || n <= 0 || n >= NSIG)
+        return -EINVAL;
+    return (int)n;
+}
+
+static int parse_port(const char *s, uint16_t *ret) {
+    char *end;
+    if (!isdigit((unsigned char)*s))
+        return -EINVAL;
+    unsigned long n = strtoul(s, &end, 10);
+    if (*end || n == 0 || n > 65535)
+        return -EINVAL;
+    *ret = htons((uint16_t)n);
+    return 0;
+}
+
+int parse_socket_address(const char *s, struct sockaddr_storage *ret, socklen_t *ret_len) {
+    memset(ret, 0, sizeof(*ret));
+    uint16_t port;
+
+    if (*s == '@' || strchr(s, '/')) {
+        struct sockaddr_un *un = (struct sockaddr_un *)ret;
+        size_t len = strlen(s);
+        if (len < 2 && *s == '@')
+            return -EINVAL;
+        if (len >= sizeof(un->sun_path))
+            return -EINVAL;
+        un->sun_family = AF_UNIX;
+        memcpy(un->sun_path, s, len);
+        if (*s == '@') {
+            // Abstract: leading NUL, and the length alone ends the name
+            un->sun_path[0] = '\0';
+            *ret_len = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + len);
+        } else {
+            *ret_len = sizeof(*un);
+        }
+        return 0;
+    }
+
+    if (parse_port(s, &port) == 0) {
+        struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)ret;
+        in6->sin6_family = AF_INET6;
+        in6->sin6_addr = in6addr_any;
+        in6->sin6_port = port;
+        *ret_len = sizeof(*in6);
+        return 0;
+    }
+
+    char host[INET6_ADDRSTRLEN];
+    const char *colon;
+    if (*s == '[') {
+        const char *close = strchr(s, ']');
+        if (!close || close[1] != ':' || (size_t)(close - s - 1) >= sizeof(host))
+            return -EINVAL;
+        memcpy(host, s + 1, (size_t)(close - s - 1));
+        host[close - s - 1] = '\0';
+        struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)ret;
+        if (inet_pton(AF_INET6, host, &in6->sin6_addr) != 1 || parse_port(close + 2, &port) < 0)
+            return -EINVAL;
+        in6->sin6_family = AF_INET6;
+        in6->sin6_port = port;
+        *ret_len = sizeof(*in6);
+        return 0;
+    }
+
+    if (!(colon = strrchr(s, ':')) || (size_t)(colon - s) >= sizeof(host))
+        return -EINVAL;
+    memcpy(host, s, (size_t)(colon - s));
+    host[colon - s] = '\0';
+    struct sockaddr_in *in = (struct sockaddr_in *)ret;
+    if (inet_pton(AF_INET, host, &in->sin_addr) != 1 || parse_port(colon + 1, &port) < 0)
+        return -EINVAL;
+    in->sin_family = AF_INET;
+    in->sin_port = port;
+    *ret_len = sizeof(*in);
+    return 0;
+}
+
+#define MASK_BITS (8 * sizeof(unsigned long))
+
+int parse_cpu_list(const char *s, unsigned long *mask, size_t nbits) {
+    for (;;) {
+        s += strspn(s, " \t,");
+        if (!*s)
+            return 0;
+        char *end;
+        if (!isdigit((unsigned char)*s))
+            return -EINVAL;
+        unsigned long lo = strtoul(s, &end, 10), hi = lo;
+        if (*end == '-') {
+            s = end + 1;
+            if (!isdigit((unsigned char)*s))
+                return -EINVAL;
+            hi = strtoul(s, &end, 10);
+        }
+        if (*end && !strchr(" \t,", *end))
+            return -EINVAL;
+        if (hi < lo)
+            return -EINVAL;
+        if (hi >= nbits)
+            return -ERANGE;
+        for (unsigned long i = lo; i <= hi; i++)
+            mask[i / MASK_BITS] |= 1UL << (i % MASK_BITS);
+        s = end;
+    }
+}
+
+void format_cpu_list(const unsigned long *mask, size_t nbits, char *buf, size_t size) {
+    size_t len = 0;
+    if (size) buf[0] = '\0';
+    for (size_t i = 0; i < nbits; i++) {
+        if (!(mask[i / MASK_BITS] & (1UL << (i % MASK_BITS))))
+            continue;
+        size_t j = i;
+        while (j + 1 < nbits && (mask[(j + 1) / MASK_BITS] & (1UL << ((j + 1) % MASK_BITS))))
+            j++;
+        int w = j > i ? snprintf(buf + len, size - len, "%s%zu-%zu", len ? "," : "", i, j)
+                      : snprintf(buf + len, size - len, "%s%zu", len ? "," : "", i);
+        if (w < 0 || (size_t)w >= size - len)
+            return;
+        len += (size_t)w;
+        i = j;
+    }
+}
+
+void mkdir_parents(const char *path) {
+    char buf[512];
+    strncpy(buf, path, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+    for (char *p = buf + 1; *p; p++) {
+        if (*p != '/') continue;
+        *p = '\0';
+        mkdir(buf, 0755);
+        *p = '/';
+    }
+}
@@ -0,0 +1,37 @@
+// util.h — small helpers shared across coreinitd modules
+#ifndef COREINITD_UTIL_H
+#define COREINITD_UTIL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#define USEC_PER_MSEC 1000ULL
+#define USEC_PER_SEC  1000000ULL
+#define USEC_INFINITY UINT64_MAX
+
+// systemd time spans: "10s", "1h 30min", "2.5s", "500ms", "1d"; a bare
+// number is seconds, "infinity" is USEC_INFINITY. -EINVAL/-ERANGE on error.
+int parse_timespan(const char *s, uint64_t *ret_usec);
+// CLOCK_MONOTONIC in usec, read now: sd_event_now() stands still for a whole
+// loop iteration, too coarse for boot and reload timings
+uint64_t now_usec(void);
+
+// "SIGTERM", "TERM" or "15" -> 15; -EINVAL if unknown
+int parse_signal(const char *s);
+
+// Listen*= addresses: "80" (every IPv6 and, dual-stack, IPv4 address),
+// "1.2.3.4:80", "[::1]:80", "@name" (abstract) or a path containing '/'
+// (AF_UNIX). -EINVAL if it is none of those.
+int parse_socket_address(const char *s, struct sockaddr_storage *ret, socklen_t *ret_len);
+
+// CPU or NUMA node lists, "0-3 8,10": numbers and ranges separated by
+// spaces or commas, added to mask (nbits wide). -EINVAL/-ERANGE on error.
+int parse_cpu_list(const char *s, unsigned long *mask, size_t nbits);
+// The reverse, "0-3,8,10"; "" for an empty mask
+void format_cpu_list(const unsigned long *mask, size_t nbits, char *buf, size_t size);
+
+// mkdir -p of every directory leading up to path's last component
+void mkdir_parents(const char *path);
+
+#endif
@@ -0,0 +1,275 @@
+// coreinitctl.c
+// Talks to coreinitd over its control socket: start/stop/restart/status/list/show.
+// All requests for the given units are written at once and the replies
+// collected as they come, so "status a b c ..." is one round trip.
+
+#define _GNU_SOURCE
+#include "../coreinitd/control_protocol.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char *const state_names[] = {
+    [CONTROL_STATE_INACTIVE] = "inactive",
+    [CONTROL_STATE_STARTING] = "starting",
+    [CONTROL_STATE_ACTIVE] = "active",
+    [CONTROL_STATE_AUTO_RESTART] = "auto-restart",
+    [CONTROL_STATE_STOPPING] = "stopping",
+    [CONTROL_STATE_FAILED] = "failed",
+    [CONTROL_STATE_LOADED] = "loaded",
+};
+
+#define WINDOW 256      // requests in flight; bounds what either side has to buffer
+
+static const char *const type_names[] = { "service", "socket", "timer", "unknown" };
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [--no-block] [--placement] COMMAND [UNIT...]\n"
+            "  start UNIT...     start units, wait until they are running (Type=notify: ready)\n"
+            "  stop UNIT...      stop units\n"
+            "  restart UNIT...   stop and start again\n"
+            "  status [UNIT...]  state of the given units, or of all of them;\n"
+            "                    --placement adds each running service's CPU, NUMA and\n"
+            "                    scheduling placement\n"
+            "  list              every loaded unit\n"
+            "  show UNIT...      settings of the loaded unit\n"
+            "  reload            re-read changed unit files\n"
+            "Socket: $COREINITD_CONTROL_SOCKET or %s\n", prog, CONTROL_SOCKET_PATH);
+}
+
+static int control_connect(void) {
+    const char *path = getenv("COREINITD_CONTROL_SOCKET");
+    if (!path || !*path)
+        path = CONTROL_SOCKET_PATH;
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path %s too long\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        fprintf(stderr, "Cannot connect to %s: %s\n", path, strerror(errno));
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int read_all(int fd, void *buf, size_t len) {
+    char *p = buf;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static uint64_t now_usec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+// One line per unit; returns the number of bytes consumed, 0 if malformed
+static size_t print_status(const char *p, size_t len) {
+    ControlUnitStatus st;
+    if (len < sizeof(st))
+        return 0;
+    memcpy(&st, p, sizeof(st));
+    if (len - sizeof(st) < (size_t)st.name_len + st.status_len + st.log_len + st.placement_len)
+        return 0;
+    const char *name = p + sizeof(st);
+    const char *status = name + st.name_len;
+    const char *log = status + st.status_len;
+    const char *placement = log + st.log_len;
+
+    const char *state = st.state < sizeof(state_names) / sizeof(state_names[0]) && state_names[st.state]
+                        ? state_names[st.state] : "?";
+    printf("%-32.*s %-8s %-12s%s%s", (int)st.name_len, name, type_names[st.type < 3 ? st.type : 3], state,
+           st.not_found ? " (unit file removed)" : "", st.job_pending ? " (job queued)" : "");
+    if (st.pid)
+        printf(" PID %d", st.pid);
+    if (st.state == CONTROL_STATE_ACTIVE && st.active_since) {
+        uint64_t now = now_usec();
+        printf(" for %.1fs", now > st.active_since ? (now - st.active_since) / 1e6 : 0.0);
+    }
+    if (st.state == CONTROL_STATE_FAILED && st.exit_code == CLD_EXITED)
+        printf(" (status=%d)", st.exit_status);
+    else if (st.state == CONTROL_STATE_FAILED && st.exit_code)
+        printf(" (signal=%s)", strsignal(st.exit_status));
+    if (st.restarts)
+        printf(" restarts=%u", st.restarts);
+    if (st.status_len)
+        printf(": %.*s", (int)st.status_len, status);
+    putchar('\n');
+    // Effective placement on one line, ahead of the output it may explain
+    if (st.placement_len) {
+        printf("    Placement:");
+        for (const char *l = placement, *end = placement + st.placement_len; l < end;) {
+            const char *nl = memchr(l, '\n', (size_t)(end - l));
+            int n = (int)((nl ? nl : end) - l);
+            printf(" %.*s", n, l);
+            l += n + 1;
+        }
+        putchar('\n');
+    }
+    // Recent output, indented like systemctl's journal excerpt
+    for (const char *l = log, *end = log + st.log_len; l < end;) {
+        const char *nl = memchr(l, '\n', (size_t)(end - l));
+        int n = (int)((nl ? nl : end) - l);
+        printf("    %.*s\n", n, l);
+        l += n + 1;
+    }
+    return sizeof(st) + st.name_len + st.status_len + st.log_len + st.placement_len;
+}
+
+int main(int argc, char *argv[]) {
+    int argi = 1;
+    uint16_t flags = 0;
+    for (; argi < argc && strncmp(argv[argi], "--", 2) == 0; argi++) {
+        if (strcmp(argv[argi], "--no-block") == 0)
+            flags |= CONTROL_NO_BLOCK;
+        else if (strcmp(argv[argi], "--placement") == 0)
+            flags |= CONTROL_PLACEMENT;
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (argi >= argc) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    static const struct { const char *verb; ControlOp op; } verbs[] = {
+        { "start", CONTROL_OP_START }, { "stop", CONTROL_OP_STOP }, { "restart", CONTROL_OP_RESTART },
+        { "status", CONTROL_OP_STATUS }, { "list", CONTROL_OP_LIST }, { "show", CONTROL_OP_SHOW },
+        { "reload", CONTROL_OP_RELOAD },
+    };
+    const char *verb = argv[argi++];
+    ControlOp op = 0;
+    for (size_t i = 0; i < sizeof(verbs) / sizeof(verbs[0]); i++)
+        if (strcmp(verb, verbs[i].verb) == 0)
+            op = verbs[i].op;
+    if (op == CONTROL_OP_STATUS && argi == argc)
+        op = CONTROL_OP_LIST;
+    int no_units = op == CONTROL_OP_LIST || op == CONTROL_OP_RELOAD;
+    if (!op || (!no_units && argi == argc)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // One frame per unit (or a single list/reload frame), written WINDOW at a time
+    size_t n_req = no_units ? 1 : (size_t)(argc - argi);
+    char *req = malloc(n_req * CONTROL_REQUEST_MAX);
+    size_t *req_off = malloc((n_req + 1) * sizeof(*req_off));
+    char **units = calloc(n_req, sizeof(*units));
+    if (!req || !req_off || !units) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    size_t req_len = 0;
+    for (size_t i = 0; i < n_req; i++) {
+        const char *name = no_units ? "" : argv[argi + i];
+        size_t len = strlen(name);
+        if (len > CONTROL_REQUEST_MAX - sizeof(ControlHeader)) {
+            fprintf(stderr, "Unit name too long: %s\n", name);
+            return 1;
+        }
+        ControlHeader h = { .len = (uint32_t)len, .id = (uint32_t)i, .op = (uint16_t)op, .flags = flags };
+        req_off[i] = req_len;
+        memcpy(req + req_len, &h, sizeof(h));
+        memcpy(req + req_len + sizeof(h), name, len);
+        req_len += sizeof(h) + len;
+        units[i] = (char *)name;
+    }
+    req_off[n_req] = req_len;
+
+    int fd = control_connect();
+    if (fd < 0)
+        return 1;
+
+    // status follows systemctl: 3 if any unit is not active
+    int ret = 0;
+    size_t sent = 0;
+    for (size_t done = 0; done < n_req; done++) {
+        if (sent < n_req && sent - done < WINDOW / 2) {
+            size_t upto = done + WINDOW < n_req ? done + WINDOW : n_req;
+            if (write_all(fd, req + req_off[sent], req_off[upto] - req_off[sent]) < 0) {
+                fprintf(stderr, "Failed to send request: %s\n", strerror(errno));
+                return 1;
+            }
+            sent = upto;
+        }
+
+        ControlHeader h;
+        if (read_all(fd, &h, sizeof(h)) < 0) {
+            fprintf(stderr, "Connection closed by coreinitd\n");
+            return 1;
+        }
+        char *payload = malloc(h.len ? h.len : 1);
+        if (!payload || read_all(fd, payload, h.len) < 0) {
+            fprintf(stderr, "Truncated reply\n");
+            return 1;
+        }
+        const char *unit = h.id < n_req ? units[h.id] : "?";
+
+        if (h.result < 0) {
+            if (h.result == -EIO)
+                fprintf(stderr, "Job for %s failed\n", unit);
+            else if (h.result == -ECANCELED)
+                fprintf(stderr, "Job for %s canceled by a later request\n", unit);
+            else
+                fprintf(stderr, "%s: %s\n", unit, strerror(-h.result));
+            ret = ret ? ret : 1;
+        } else if (op == CONTROL_OP_STATUS || op == CONTROL_OP_LIST) {
+            for (size_t off = 0; off < h.len;) {
+                size_t n = print_status(payload + off, h.len - off);
+                if (n == 0) {
+                    fprintf(stderr, "Malformed status reply\n");
+                    return 1;
+                }
+                ControlUnitStatus st;
+                memcpy(&st, payload + off, sizeof(st));
+                if (op == CONTROL_OP_STATUS && st.state != CONTROL_STATE_ACTIVE && !ret)
+                    ret = 3;
+                off += n;
+            }
+        } else if (op == CONTROL_OP_SHOW) {
+            if (n_req > 1)
+                printf("%s# %s\n", done ? "\n" : "", unit);
+            fwrite(payload, 1, h.len, stdout);
+        }
+        free(payload);
+    }
+
+    close(fd);
+    free(req);
+    free(req_off);
+    free(units);
+    return ret;
+}
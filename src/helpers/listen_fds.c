@@ -6,11 +6,13 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <sys/socket.h>
 
 int main(void) {
-    int fd_count = sd_listen_fds(0);
+    char **names = NULL;
+    int fd_count = sd_listen_fds_with_names(0, &names);
     if (fd_count < 0) {
-        perror("sd_listen_fds");
+        fprintf(stderr, "sd_listen_fds: %s\n", strerror(-fd_count));
         return 1;
     }
 
@@ -21,9 +23,12 @@ int main(void) {
 
     for (int i = 0; i < fd_count; ++i) {
         int fd = SD_LISTEN_FDS_START + i;
-        printf("FD %d (index %d)\n", fd, i);
-        // You can enhance this later with sd_is_socket()
+        printf("FD %d (index %d) name=%s %s\n", fd, i, names && names[i] ? names[i] : "?",
+               sd_is_socket(fd, AF_UNSPEC, 0, 1) > 0 ? "listening socket" :
+               sd_is_socket(fd, AF_UNSPEC, 0, 0) > 0 ? "connected socket" : "not a socket");
+        if (names) free(names[i]);
     }
+    free(names);
 
     return 0;
 }
@@ -19,7 +19,7 @@ int main(int argc, char *argv[]) {
         // Still continue for now
     }
 
-    // TODO: enter cgroup, apply seccomp, set uid/gid
+    // TODO: apply seccomp, set uid/gid (coreinitd already spawns us in the unit's cgroup)
 
     // Replace process with target
     execvp(argv[1], &argv[1]);
@@ -0,0 +1,388 @@
+/* End-to-end scale benchmark: the real daemon on a synthetic unit tree
+ *
+ * Usage: bench-scale COREINITD [services] [--json FILE]
+ * Writes <services> services (/bin/true, After= one another as a binary
+ * tree), a tenth as many Accept=yes sockets with /bin/cat instances and a
+ * tenth as many timers into a temporary directory, then runs COREINITD in
+ * it and measures:
+ *   - cold and warm unit load time (the daemon's own log lines)
+ *   - boot: exec to "Boot transaction complete"
+ *   - spawn throughput: every service started again over the control socket
+ *   - spawn + reap throughput: until all of them have exited again
+ *   - activation latency: connect() to the first byte echoed by a new instance
+ *   - daemon RSS after boot and at the end
+ * A summary goes to stdout; --json writes the same numbers for comparing runs.
+ */
+#define _GNU_SOURCE
+#include "../src/coreinitd/control_protocol.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#define LOG_FILE "daemon.log"
+#define WINDOW 256                  // control requests in flight, as coreinitctl
+#define CONNECTIONS 200             // activation latency samples
+#define TIMEOUT_SEC 600
+
+typedef struct {
+    int services, sockets, timers;
+    double load_cold_ms, load_warm_ms, boot_ms;
+    double spawn_per_sec, spawn_reap_per_sec;
+    double latency_us[CONNECTIONS];
+    int n_latency;
+    long rss_boot_kib, rss_end_kib;
+} Results;
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void die(const char *what) {
+    fprintf(stderr, "bench-scale: %s: %s\n", what, strerror(errno));
+    exit(1);
+}
+
+static void write_file(const char *path, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+static void write_file(const char *path, const char *fmt, ...) {
+    FILE *f = fopen(path, "w");
+    if (!f) die(path);
+    va_list ap;
+    va_start(ap, fmt);
+    vfprintf(f, fmt, ap);
+    va_end(ap);
+    fclose(f);
+}
+
+static void write_tree(const Results *r) {
+    char path[256];
+    if (mkdir("etc", 0755) < 0 || mkdir("etc/units", 0755) < 0 || mkdir("run", 0755) < 0)
+        die("mkdir");
+    for (int i = 0; i < r->services; i++) {
+        snprintf(path, sizeof(path), "etc/units/svc%05d.service", i);
+        char after[64] = "";
+        if (i > 0)
+            snprintf(after, sizeof(after), "After=svc%05d.service\n", (i - 1) / 2);
+        write_file(path, "[Unit]\nDescription=Synthetic service %d\n%s"
+                         "[Service]\nExecStart=/bin/true\nEnvironment=BENCH=1\n", i, after);
+    }
+    for (int i = 0; i < r->sockets; i++) {
+        snprintf(path, sizeof(path), "etc/units/echo%05d.socket", i);
+        write_file(path, "[Socket]\nListenStream=./run/echo%05d.sock\nAccept=yes\n", i);
+        snprintf(path, sizeof(path), "etc/units/echo%05d@.service", i);
+        write_file(path, "[Service]\nExecStart=/bin/cat\n");
+    }
+    for (int i = 0; i < r->timers; i++) {
+        snprintf(path, sizeof(path), "etc/units/tick%05d.timer", i);
+        write_file(path, "[Timer]\nOnBootSec=1h\nUnit=svc%05d.service\n", i % r->services);
+    }
+}
+
+static pid_t start_daemon(const char *binary) {
+    unlink(LOG_FILE);
+    pid_t pid = fork();
+    if (pid < 0) die("fork");
+    if (pid == 0) {
+        int null = open("/dev/null", O_RDWR);
+        dup2(null, STDIN_FILENO);
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        setenv("COREINITD_UNIT_PATH", "./etc/units", 1);
+        setenv("COREINITD_LOG_TARGET", LOG_FILE, 1);
+        execl(binary, binary, (char *)NULL);
+        _exit(127);
+    }
+    return pid;
+}
+
+static void stop_daemon(pid_t pid) {
+    kill(pid, SIGTERM);
+    double deadline = now_sec() + TIMEOUT_SEC;
+    while (waitpid(pid, NULL, WNOHANG) == 0) {
+        if (now_sec() > deadline) {
+            kill(pid, SIGKILL);
+            waitpid(pid, NULL, 0);
+            return;
+        }
+        usleep(10000);
+    }
+}
+
+// Wait for a daemon log line containing key; returns the text after it
+static const char *wait_log(pid_t pid, const char *key, char *line, size_t size) {
+    double deadline = now_sec() + TIMEOUT_SEC;
+    long off = 0;
+    while (now_sec() < deadline) {
+        FILE *f = fopen(LOG_FILE, "r");
+        if (f) {
+            fseek(f, off, SEEK_SET);
+            while (fgets(line, (int)size, f)) {
+                if (line[strlen(line) - 1] != '\n')
+                    break;      // the writer is mid-line; read it again next time
+                off = ftell(f);
+                const char *p = strstr(line, key);
+                if (p) {
+                    fclose(f);
+                    return p + strlen(key);
+                }
+            }
+            fclose(f);
+        }
+        if (waitpid(pid, NULL, WNOHANG) == pid) {
+            fprintf(stderr, "bench-scale: coreinitd exited, see %s\n", LOG_FILE);
+            exit(1);
+        }
+        usleep(2000);
+    }
+    fprintf(stderr, "bench-scale: no \"%s\" in %s after %d s\n", key, LOG_FILE, TIMEOUT_SEC);
+    exit(1);
+}
+
+static long rss_kib(pid_t pid) {
+    char path[64], line[256];
+    long kib = -1;
+    snprintf(path, sizeof(path), "/proc/%d/status", pid);
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    while (fgets(line, sizeof(line), f))
+        if (sscanf(line, "VmRSS: %ld kB", &kib) == 1)
+            break;
+    fclose(f);
+    return kib;
+}
+
+static int unix_connect(const char *path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) die("socket");
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int read_all(int fd, void *buf, size_t len) {
+    char *p = buf;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static void send_request(int fd, uint32_t id, uint16_t op, const char *name) {
+    char buf[sizeof(ControlHeader) + 64];
+    ControlHeader h = { .len = name ? (uint32_t)strlen(name) : 0, .id = id, .op = op };
+    memcpy(buf, &h, sizeof(h));
+    if (name) memcpy(buf + sizeof(h), name, h.len);
+    if (write(fd, buf, sizeof(h) + h.len) != (ssize_t)(sizeof(h) + h.len))
+        die("control write");
+}
+
+// Reads one reply; its payload (if any) into a malloc'd *payload
+static ControlHeader read_reply(int fd, char **payload) {
+    ControlHeader h;
+    if (read_all(fd, &h, sizeof(h)) < 0)
+        die("control read");
+    char *p = malloc(h.len ? h.len : 1);
+    if (!p || read_all(fd, p, h.len) < 0)
+        die("control read");
+    if (payload) *payload = p;
+    else free(p);
+    return h;
+}
+
+// Services still starting or running, from one list request
+static int busy_services(int fd) {
+    char *p;
+    send_request(fd, 0, CONTROL_OP_LIST, NULL);
+    ControlHeader h = read_reply(fd, &p);
+    int busy = 0;
+    for (size_t off = 0; off + sizeof(ControlUnitStatus) <= h.len; ) {
+        ControlUnitStatus st;
+        memcpy(&st, p + off, sizeof(st));
+        if (st.type == 0 && (st.state == CONTROL_STATE_STARTING || st.state == CONTROL_STATE_ACTIVE ||
+                             st.state == CONTROL_STATE_STOPPING || st.job_pending))
+            busy++;
+        off += sizeof(st) + st.name_len + st.status_len + st.log_len;
+    }
+    free(p);
+    return busy;
+}
+
+static void wait_idle(int fd) {
+    double deadline = now_sec() + TIMEOUT_SEC;
+    while (busy_services(fd) > 0) {
+        if (now_sec() > deadline) {
+            fprintf(stderr, "bench-scale: services still running after %d s\n", TIMEOUT_SEC);
+            exit(1);
+        }
+        usleep(1000);
+    }
+}
+
+// Start every service again through the control socket, WINDOW at a time
+static void bench_spawn(Results *r) {
+    int fd = unix_connect(CONTROL_SOCKET_PATH);
+    if (fd < 0) die("connect " CONTROL_SOCKET_PATH);
+    wait_idle(fd);
+
+    char name[64];
+    int sent = 0, done = 0, failed = 0;
+    double t0 = now_sec();
+    while (done < r->services) {
+        while (sent < r->services && sent - done < WINDOW) {
+            snprintf(name, sizeof(name), "svc%05d.service", sent);
+            send_request(fd, (uint32_t)++sent, CONTROL_OP_START, name);
+        }
+        if (read_reply(fd, NULL).result < 0)
+            failed++;
+        done++;
+    }
+    double t1 = now_sec();
+    wait_idle(fd);
+    double t2 = now_sec();
+    close(fd);
+
+    if (failed)
+        fprintf(stderr, "bench-scale: %d starts failed\n", failed);
+    r->spawn_per_sec = r->services / (t1 - t0);
+    r->spawn_reap_per_sec = r->services / (t2 - t0);
+}
+
+// connect() to the first echoed byte; every connection is a new /bin/cat
+static void bench_activation(Results *r) {
+    char path[64], c = 'x';
+    for (int i = 0; i < CONNECTIONS; i++) {
+        snprintf(path, sizeof(path), "./run/echo%05d.sock", i % r->sockets);
+        double t0 = now_sec();
+        int fd = unix_connect(path);
+        if (fd < 0) {
+            fprintf(stderr, "bench-scale: connect %s: %s\n", path, strerror(errno));
+            continue;
+        }
+        if (write(fd, &c, 1) == 1 && read(fd, &c, 1) == 1)
+            r->latency_us[r->n_latency++] = (now_sec() - t0) * 1e6;
+        close(fd);
+    }
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static double percentile(const Results *r, double p) {
+    if (r->n_latency == 0) return 0;
+    return r->latency_us[(int)(p * (r->n_latency - 1) + 0.5)];
+}
+
+static void report(const Results *r, FILE *f, int json) {
+    int units = r->services + 2 * r->sockets + r->timers;
+    if (!json) {
+        fprintf(f, "%d units (%d services, %d sockets, %d timers)\n", units, r->services, r->sockets, r->timers);
+        fprintf(f, "load: cold %.1f ms, warm %.1f ms\n", r->load_cold_ms, r->load_warm_ms);
+        fprintf(f, "boot: %.1f ms\n", r->boot_ms);
+        fprintf(f, "spawn: %.1f/sec, spawn + reap: %.1f/sec\n", r->spawn_per_sec, r->spawn_reap_per_sec);
+        fprintf(f, "activation latency: median %.0f us, p99 %.0f us, max %.0f us (%d connections)\n",
+                percentile(r, 0.5), percentile(r, 0.99), percentile(r, 1), r->n_latency);
+        fprintf(f, "rss: %ld KiB after boot, %ld KiB at the end\n", r->rss_boot_kib, r->rss_end_kib);
+        return;
+    }
+    fprintf(f, "{\n  \"benchmark\": \"scale\",\n  \"units\": %d,\n  \"services\": %d,\n"
+               "  \"sockets\": %d,\n  \"timers\": %d,\n", units, r->services, r->sockets, r->timers);
+    fprintf(f, "  \"load_cold_ms\": %.3f,\n  \"load_warm_ms\": %.3f,\n  \"boot_ms\": %.3f,\n",
+            r->load_cold_ms, r->load_warm_ms, r->boot_ms);
+    fprintf(f, "  \"spawn_per_sec\": %.1f,\n  \"spawn_reap_per_sec\": %.1f,\n",
+            r->spawn_per_sec, r->spawn_reap_per_sec);
+    fprintf(f, "  \"activation_latency_us\": { \"median\": %.1f, \"p99\": %.1f, \"max\": %.1f, \"samples\": %d },\n",
+            percentile(r, 0.5), percentile(r, 0.99), percentile(r, 1), r->n_latency);
+    fprintf(f, "  \"rss_kib\": { \"boot\": %ld, \"end\": %ld }\n}\n", r->rss_boot_kib, r->rss_end_kib);
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+    (void)st;
+    (void)flag;
+    (void)ftw;
+    remove(path);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    const char *binary = NULL, *json = NULL;
+    int n = 1000;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+            json = argv[++i];
+        else if (!binary)
+            binary = argv[i];
+        else
+            n = atoi(argv[i]);
+    }
+    if (!binary || n <= 0) {
+        fprintf(stderr, "Usage: %s COREINITD [services] [--json FILE]\n", argv[0]);
+        return 1;
+    }
+
+    char binary_path[4096], json_path[4096] = "";
+    if (!realpath(binary, binary_path)) die(binary);
+    if (json) {
+        if (json[0] == '/') snprintf(json_path, sizeof(json_path), "%s", json);
+        else if (!getcwd(json_path, sizeof(json_path) - 256)) die("getcwd");
+        else snprintf(json_path + strlen(json_path), 256, "/%s", json);
+    }
+
+    Results r = { .services = n, .sockets = n / 10 ? n / 10 : 1, .timers = n / 10 ? n / 10 : 1 };
+    char dir[] = "/tmp/bench-scale.XXXXXX";
+    if (!mkdtemp(dir) || chdir(dir) < 0) die("temporary directory");
+    write_tree(&r);
+
+    char line[512];
+    double t0 = now_sec();
+    pid_t pid = start_daemon(binary_path);
+    r.load_cold_ms = atof(wait_log(pid, "unit files in ", line, sizeof(line)));
+    wait_log(pid, "Boot transaction complete", line, sizeof(line));
+    r.boot_ms = (now_sec() - t0) * 1000;
+    r.rss_boot_kib = rss_kib(pid);
+
+    bench_spawn(&r);
+    bench_activation(&r);
+    r.rss_end_kib = rss_kib(pid);
+    stop_daemon(pid);
+
+    // Second run loads from the cache the first one wrote
+    pid = start_daemon(binary_path);
+    r.load_warm_ms = atof(wait_log(pid, "units.cache in ", line, sizeof(line)));
+    wait_log(pid, "Boot transaction complete", line, sizeof(line));
+    stop_daemon(pid);
+
+    qsort(r.latency_us, (size_t)r.n_latency, sizeof(double), compare_double);
+    report(&r, stdout, 0);
+    if (json) {
+        FILE *f = fopen(json_path, "w");
+        if (!f) die(json_path);
+        report(&r, f, 1);
+        fclose(f);
+    }
+
+    if (chdir("/") == 0)
+        nftw(dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    return 0;
+}
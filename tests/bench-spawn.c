@@ -0,0 +1,74 @@
+/* Spawn throughput: legacy fork()+sh -c versus spawn_command()
+ *
+ * Usage: bench-spawn [iterations] [daemon-rss-MiB]
+ * The RSS ballast makes fork() pay for page tables the way coreinitd does.
+ */
+#include "../src/coreinitd/spawn.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define COMMAND "/bin/true"
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int spawn_legacy(void) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        execl("/bin/sh", "sh", "-c", COMMAND, NULL);
+        _exit(127);
+    }
+    if (pid < 0) return -1;
+    return waitpid(pid, NULL, 0) == pid ? 0 : -1;
+}
+
+static int spawn_fast(const ExecCommand *cmd) {
+    pid_t pid;
+    if (spawn_command(cmd, &pid, NULL) < 0) return -1;
+    return waitpid(pid, NULL, 0) == pid ? 0 : -1;
+}
+
+static void report(const char *label, int n, double secs) {
+    printf("%-26s %6d spawns in %7.3f s  %9.1f spawns/sec\n", label, n, secs, n / secs);
+}
+
+int main(int argc, char *argv[]) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 2000;
+    size_t ballast_mib = argc > 2 ? (size_t)atoi(argv[2]) : 64;
+
+    char *ballast = malloc(ballast_mib << 20);
+    if (ballast)
+        memset(ballast, 0xa5, ballast_mib << 20);
+
+    ExecCommand cmd;
+    if (exec_command_parse(&cmd, COMMAND, NULL) < 0) {
+        fprintf(stderr, "Failed to parse %s\n", COMMAND);
+        return 1;
+    }
+
+    double t0 = now_sec();
+    for (int i = 0; i < iterations; i++)
+        if (spawn_legacy() < 0) { perror("legacy spawn"); return 1; }
+    double legacy = now_sec() - t0;
+
+    t0 = now_sec();
+    for (int i = 0; i < iterations; i++)
+        if (spawn_fast(&cmd) < 0) { perror("spawn_command"); return 1; }
+    double fast = now_sec() - t0;
+
+    printf("daemon RSS ballast: %zu MiB\n", ballast_mib);
+    report("before: fork + sh -c", iterations, legacy);
+    report("after:  spawn_command", iterations, fast);
+    printf("speedup: %.2fx\n", legacy / fast);
+
+    exec_command_free(&cmd);
+    free(ballast);
+    return 0;
+}
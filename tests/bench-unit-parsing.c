@@ -0,0 +1,222 @@
+/* Unit file parsing: legacy fgets()+linear strcasecmp() versus unit_parser.c
+ *
+ * Usage: bench-unit-parsing [units]
+ * Writes a synthetic unit tree to a temporary directory and checks both
+ * loaders agree. Tokenizing is timed on in-memory copies of the files so
+ * the numbers are not drowned by open()/read(); full loads are timed too.
+ */
+#include "../src/coreinitd/unit_loader.h"
+#include "../src/coreinitd/unit_parser.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char *const key_names[_UNIT_KEY_MAX] = {
+#define UNIT_KEY(id, sect, str) [UNIT_KEY_##id] = str,
+#include "../src/coreinitd/unit_keys.def"
+#undef UNIT_KEY
+};
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// The loader as it was before unit_parser.c, minus unit_finish()
+static void parse_legacy(FILE *f, Unit *out) {
+    char line[512];
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\r\n")] = 0;
+        if (line[0] == '[') continue;
+
+        char *eq = strchr(line, '=');
+        if (!eq) continue;
+
+        *eq = 0;
+        char *key = line;
+        char *val = eq + 1;
+        while (*key == ' ') key++;
+        while (*val == ' ') val++;
+
+        for (int i = 0; i < _UNIT_KEY_MAX; i++)
+            if (strcasecmp(key, key_names[i]) == 0) {
+                unit_set_key(out, i, val);
+                break;
+            }
+    }
+
+}
+
+static int load_unit_legacy(const char *path, Unit *out) {
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    unit_begin(out, path);
+    parse_legacy(f, out);
+    fclose(f);
+    return unit_finish(out);
+}
+
+static void on_assignment(void *userdata, UnitSection section, const char *key, const char *val, unsigned line) {
+    (void)line;
+    unit_set_key(userdata, unit_key_lookup(section, key, strlen(key)), val);
+}
+
+#define ROUNDS 5
+
+typedef struct {
+    char *data;
+    size_t len;
+} FileData;
+
+static int read_file(const char *path, FileData *fd) {
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    fd->data = malloc(4096);
+    fd->len = fd->data ? fread(fd->data, 1, 4095, f) : 0;
+    fclose(f);
+    return fd->data ? 0 : -1;
+}
+
+static int write_units(const char *dir, int n) {
+    char path[512];
+    for (int i = 0; i < n; i++) {
+        snprintf(path, sizeof(path), "%s/unit%05d.service", dir, i);
+        FILE *f = fopen(path, "w");
+        if (!f) return -1;
+        fprintf(f, "# synthetic unit %d\n[Unit]\nDescription=Synthetic service number %d\n", i, i);
+        if (i > 0)
+            fprintf(f, "After=unit%05d.service\nWants=unit%05d.service\n", i - 1, i - 1);
+        fprintf(f, "\n[Service]\nExecStart=/bin/true --instance %d --verbose\n"
+                   "Environment=INSTANCE=%d MODE=bench\nNotifyAccess=main\n"
+                   "\n[Install]\nWantedBy=multi-user.target\n", i, i);
+        fclose(f);
+    }
+    return 0;
+}
+
+typedef int (*Loader)(const char *path, Unit *out);
+
+// Best of ROUNDS; units hold the last round's result
+static double run(Loader load, const char *dir, int n, Unit *units) {
+    char path[512];
+    double best = 0;
+    for (int r = 0; r < ROUNDS; r++) {
+        if (r > 0)
+            for (int i = 0; i < n; i++)
+                unit_free(&units[i]);
+        double t0 = now_sec();
+        for (int i = 0; i < n; i++) {
+            snprintf(path, sizeof(path), "%s/unit%05d.service", dir, i);
+            if (load(path, &units[i]) < 0) {
+                fprintf(stderr, "Failed to load %s\n", path);
+                exit(1);
+            }
+        }
+        double t = now_sec() - t0;
+        if (r == 0 || t < best) best = t;
+    }
+    return best;
+}
+
+static double tokenize_legacy(const FileData *files, int n, Unit *units) {
+    double best = 0;
+    for (int r = 0; r < ROUNDS; r++) {
+        double t0 = now_sec();
+        for (int i = 0; i < n; i++) {
+            FILE *f = fmemopen(files[i].data, files[i].len, "r");
+            memset(&units[i], 0, sizeof(Unit));
+            parse_legacy(f, &units[i]);
+            fclose(f);
+        }
+        double t = now_sec() - t0;
+        if (r == 0 || t < best) best = t;
+    }
+    return best;
+}
+
+static double tokenize_fast(const FileData *files, int n, Unit *units) {
+    char buf[4096];
+    double best = 0;
+    for (int r = 0; r < ROUNDS; r++) {
+        double t0 = now_sec();
+        for (int i = 0; i < n; i++) {
+            memcpy(buf, files[i].data, files[i].len);
+            memset(&units[i], 0, sizeof(Unit));
+            unit_parse_buffer(buf, files[i].len, "bench", on_assignment, &units[i]);
+        }
+        double t = now_sec() - t0;
+        if (r == 0 || t < best) best = t;
+    }
+    return best;
+}
+
+static void report(const char *label, int n, double secs) {
+    printf("%-26s %6d units in %7.3f s  %9.1f units/sec\n", label, n, secs, n / secs);
+}
+
+int main(int argc, char *argv[]) {
+    int n = argc > 1 ? atoi(argv[1]) : 5000;
+    if (n <= 0) n = 1;
+
+    char dir[] = "/tmp/bench-unit-parsing.XXXXXX";
+    if (!mkdtemp(dir) || write_units(dir, n) < 0) {
+        perror("Failed to create unit tree");
+        return 1;
+    }
+
+    Unit *legacy = calloc((size_t)n, sizeof(Unit));
+    Unit *fast = calloc((size_t)n, sizeof(Unit));
+    if (!legacy || !fast) return 1;
+
+    FileData *files = calloc((size_t)n, sizeof(FileData));
+    if (!files) return 1;
+    for (int i = 0; i < n; i++) {
+        char path[512];
+        snprintf(path, sizeof(path), "%s/unit%05d.service", dir, i);
+        if (read_file(path, &files[i]) < 0) return 1;
+    }
+    double tok_legacy = tokenize_legacy(files, n, legacy);
+    double tok_fast = tokenize_fast(files, n, fast);
+    for (int i = 0; i < n; i++)
+        free(files[i].data);
+    free(files);
+
+    double t_legacy = run(load_unit_legacy, dir, n, legacy);
+    double t_fast = run(load_unit, dir, n, fast);
+
+    int mismatches = 0;
+    for (int i = 0; i < n; i++) {
+        if (strcmp(legacy[i].description, fast[i].description) ||
+            strcmp(legacy[i].after, fast[i].after) ||
+            strcmp(legacy[i].exec_start, fast[i].exec_start) ||
+            strcmp(legacy[i].environment, fast[i].environment))
+            mismatches++;
+        unit_free(&legacy[i]);
+        unit_free(&fast[i]);
+    }
+
+    report("tokenize: legacy", n, tok_legacy);
+    report("tokenize: unit_parser", n, tok_fast);
+    printf("tokenize speedup: %.2fx\n", tok_legacy / tok_fast);
+    report("load: legacy", n, t_legacy);
+    report("load: load_unit", n, t_fast);
+    printf("load speedup: %.2fx\n", t_legacy / t_fast);
+
+    char path[512];
+    for (int i = 0; i < n; i++) {
+        snprintf(path, sizeof(path), "%s/unit%05d.service", dir, i);
+        unlink(path);
+    }
+    rmdir(dir);
+    free(legacy);
+    free(fast);
+
+    if (mismatches) {
+        fprintf(stderr, "%d units parsed differently\n", mismatches);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,734 @@
+/* Deterministic simulation of the scheduler, timers and supervision
+ *
+ * Usage: test-simulation [services] [hours] [seed]
+ * Runs the daemon's own scheduler, job queue, timerd and service_manager on
+ * a virtual clock with a spawner that forks nothing: made-up PIDs exit when
+ * the simulation says so. A day of timer fires, crashes, restarts and
+ * socket activations replays in seconds. Along the way it checks
+ *   - boot ordering: nothing starts before the unit it is After= is up
+ *   - automatic restarts wait RestartSec= (doubling, capped) and respect
+ *     StartLimitBurst=
+ *   - timers elapse exactly on schedule, within RandomizedDelaySec=
+ *   - every hour, service_manager's states against the simulated processes
+ *   - a start issued while a unit is stopping starts it again once stopped
+ *   - stopping everything leaves no process and no unit running
+ * and reports the CPU time the daemon spends per event. The scenario runs
+ * twice, in child processes; both runs must produce the same event trace.
+ */
+#define _GNU_SOURCE
+#include "../src/coreinitd/clock.h"
+#include "../src/coreinitd/event_loop.h"
+#include "../src/coreinitd/job_queue.h"
+#include "../src/coreinitd/log.h"
+#include "../src/coreinitd/scheduler.h"
+#include "../src/coreinitd/service_manager.h"
+#include "../src/coreinitd/timerd.h"
+#include "../src/coreinitd/unit_parser.h"
+#include "../src/coreinitd/unit_registry.h"
+#include "../src/coreinitd/util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <ftw.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define SIM_START USEC_PER_SEC
+#define HOUR (3600 * USEC_PER_SEC)
+#define PID_BASE 1000
+#define MAX_FAILURES 20             // printed; all are counted
+
+typedef enum { KIND_DAEMON, KIND_JOB, KIND_WEB, KIND_LAZY } SimKind;
+
+// What a unit does in the simulation; indexed by Unit.id
+typedef struct {
+    Unit *unit;
+    SimKind kind;
+    unsigned index;
+    int notify, hangs, stubborn;
+    pid_t main_pid;             // 0 when its main process is not running
+    int started, up;            // spawned once; its start job is done
+    uint64_t failed_at;         // exit that scheduled an automatic restart
+    int prompted;               // an explicit start or restart since then
+    uint64_t starts[16];        // recent spawn times, for StartLimitBurst=
+    unsigned n_starts;
+    uint64_t next_fire, jitter, period;     // KIND_JOB: its timer
+} SimUnit;
+
+typedef struct {
+    Unit *unit;
+    int alive, main;
+} Proc;
+
+typedef enum { EV_EXIT, EV_READY, EV_CONNECT, EV_ACTIVATE, EV_RESTART, EV_TIMER, _EV_MAX } EventType;
+static const char *const event_names[_EV_MAX] = {
+    "exit", "ready", "connect", "activate", "restart", "timer",
+};
+
+typedef struct {
+    uint64_t usec, seq;
+    EventType type;
+    uint32_t arg;               // PID for exit/ready, Unit.id otherwise
+    int code, status;
+} SimEvent;
+
+static SimUnit *units = NULL;
+static size_t n_units = 0;
+static Unit **daemons = NULL;
+static size_t n_daemons = 0;
+static Proc *procs = NULL;
+static size_t n_procs = 0, procs_cap = 0;
+static SimEvent *heap = NULL;
+static size_t heap_count = 0, heap_cap = 0;
+static uint64_t seq = 0, rng = 0, end_usec = 0;
+static uint64_t trace_hash = 0xcbf29ce484222325ULL;     // FNV-1a over every spawn and exit
+static int spawning_instance = 0;
+static unsigned long failures = 0;
+static unsigned long checks[5];     // boot order, restarts, timer elapses, state sweeps, start during stop
+static unsigned long events[_EV_MAX];
+static uint64_t event_nsec[_EV_MAX];
+
+static void fail(const char *fmt, ...) {
+    if (failures++ >= MAX_FAILURES)
+        return;
+    va_list ap;
+    va_start(ap, fmt);
+    fprintf(stderr, "FAIL @%.6f s: ", (clock_now() - SIM_START) / (double)USEC_PER_SEC);
+    vfprintf(stderr, fmt, ap);
+    fputc('\n', stderr);
+    va_end(ap);
+}
+
+static uint64_t random_below(uint64_t n) {
+    rng ^= rng >> 12;
+    rng ^= rng << 25;
+    rng ^= rng >> 27;
+    return n ? (rng * 2685821657736338717ULL) % n : 0;
+}
+
+static void record(char what, uint64_t a, uint64_t b) {
+    uint64_t v[3] = { clock_now(), (uint64_t)what, a ^ (b << 32) };
+    const unsigned char *p = (const unsigned char *)v;
+    for (size_t i = 0; i < sizeof(v); i++)
+        trace_hash = (trace_hash ^ p[i]) * 0x100000001b3ULL;
+}
+
+static uint64_t thread_nsec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+// ──────────────
+// Event queue
+// ──────────────
+static int event_before(const SimEvent *a, const SimEvent *b) {
+    return a->usec != b->usec ? a->usec < b->usec : a->seq < b->seq;
+}
+
+static void push(uint64_t usec, EventType type, uint32_t arg, int code, int status) {
+    if (heap_count == heap_cap) {
+        heap_cap = heap_cap ? heap_cap * 2 : 1024;
+        if (!(heap = realloc(heap, heap_cap * sizeof(*heap)))) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    SimEvent ev = { usec, seq++, type, arg, code, status };
+    size_t i = heap_count++;
+    for (; i > 0 && event_before(&ev, &heap[(i - 1) / 2]); i = (i - 1) / 2)
+        heap[i] = heap[(i - 1) / 2];
+    heap[i] = ev;
+}
+
+static SimEvent pop(void) {
+    SimEvent top = heap[0], last = heap[--heap_count];
+    size_t i = 0;
+    for (;;) {
+        size_t c = 2 * i + 1;
+        if (c >= heap_count) break;
+        if (c + 1 < heap_count && event_before(&heap[c + 1], &heap[c])) c++;
+        if (!event_before(&heap[c], &last)) break;
+        heap[i] = heap[c];
+        i = c;
+    }
+    if (heap_count)
+        heap[i] = last;
+    return top;
+}
+
+// ──────────────
+// Fake spawner
+// ──────────────
+static Proc *proc_of(pid_t pid) {
+    size_t i = (size_t)(pid - PID_BASE);
+    return pid >= PID_BASE && i < n_procs ? &procs[i] : NULL;
+}
+
+static void exit_at(uint64_t usec, pid_t pid, int code, int status) {
+    push(usec, EV_EXIT, (uint32_t)pid, code, status);
+}
+
+static void check_start(SimUnit *su, uint64_t now) {
+    const Unit *u = su->unit;
+    if (!su->started && su->kind == KIND_DAEMON && su->index > 0) {
+        const SimUnit *parent = &units[daemons[(su->index - 1) / 2]->id];
+        if (!parent->up)
+            fail("%s started before %s, which it is After=", u->name, parent->unit->name);
+        checks[0]++;
+    }
+    su->started = 1;
+
+    if (su->failed_at && !su->prompted) {
+        uint64_t delay = now - su->failed_at;
+        if (delay < u->restart_usec || delay > u->restart_max_delay_usec)
+            fail("%s restarted after %.3f s, outside RestartSec=%.3f s..%.3f s", u->name,
+                 delay / (double)USEC_PER_SEC, u->restart_usec / (double)USEC_PER_SEC,
+                 u->restart_max_delay_usec / (double)USEC_PER_SEC);
+        checks[1]++;
+    }
+    su->failed_at = 0;
+    su->prompted = 0;
+
+    // Fixed windows: no more than two bursts fit in any interval
+    unsigned limit = 2 * u->start_limit_burst;
+    if (limit && limit <= 16 && su->n_starts >= limit &&
+        now - su->starts[(su->n_starts - limit) % 16] < u->start_limit_interval_usec)
+        fail("%s started %u times within %.3f s (StartLimitBurst=%u)", u->name, limit + 1,
+             u->start_limit_interval_usec / (double)USEC_PER_SEC, u->start_limit_burst);
+    su->starts[su->n_starts++ % 16] = now;
+
+    if (su->kind == KIND_JOB) {
+        if (now < su->next_fire || now > su->next_fire + su->jitter)
+            fail("%s started at %.6f s, its timer was due at %.6f s", u->name,
+                 (now - SIM_START) / (double)USEC_PER_SEC, (su->next_fire - SIM_START) / (double)USEC_PER_SEC);
+        su->next_fire = now + su->period;
+        checks[2]++;
+    }
+}
+
+static int sim_spawn(const ExecCommand *cmd, const SpawnFds *fds, pid_t *ret_pid, int *ret_pidfd) {
+    (void)fds;
+    // service_manager always spawns &unit->exec
+    Unit *u = (Unit *)((char *)cmd - offsetof(Unit, exec));
+    SimUnit *su = &units[u->id];
+    if (n_procs == procs_cap) {
+        procs_cap = procs_cap ? procs_cap * 2 : 4096;
+        if (!(procs = realloc(procs, procs_cap * sizeof(*procs))))
+            return -ENOMEM;
+    }
+    pid_t pid = PID_BASE + (pid_t)n_procs;
+    procs[n_procs++] = (Proc){ u, 1, !spawning_instance };
+    *ret_pid = pid;
+    if (ret_pidfd)
+        *ret_pidfd = -1;
+
+    uint64_t now = clock_now();
+    record('S', u->id, (uint64_t)pid);
+    if (spawning_instance) {
+        exit_at(now + 5000 + random_below(45000), pid, CLD_EXITED, 0);
+        return 0;
+    }
+    check_start(su, now);
+    su->main_pid = pid;
+    if (!su->notify)
+        su->up = 1;
+
+    switch (su->kind) {
+        case KIND_DAEMON:
+            if (su->hangs)          // never says READY=1: TimeoutStartSec= ends it
+                break;
+            if (su->notify)
+                push(now + 20000 + random_below(80000), EV_READY, (uint32_t)pid, 0, 0);
+            // Crashes every few hours, half of them by signal
+            if (random_below(2))
+                exit_at(now + random_below(6 * HOUR), pid, CLD_EXITED, 1);
+            else
+                exit_at(now + random_below(6 * HOUR), pid, CLD_KILLED, SIGSEGV);
+            break;
+        case KIND_JOB:
+            exit_at(now + 100000 + random_below(1900000), pid, CLD_EXITED, 0);
+            break;
+        case KIND_LAZY:
+            exit_at(now + 30 * USEC_PER_SEC + random_below(30 * USEC_PER_SEC), pid, CLD_EXITED, 0);
+            break;
+        case KIND_WEB:
+            break;                  // the listener itself runs until stopped
+    }
+    return 0;
+}
+
+static int sim_kill(pid_t pid, int sig) {
+    Proc *p = proc_of(pid);
+    if (!p || !p->alive) {
+        errno = ESRCH;
+        return -1;
+    }
+    uint64_t now = clock_now();
+    if (sig == SIGKILL)
+        exit_at(now + 1000, pid, CLD_KILLED, SIGKILL);
+    else if (sig && !(sig == SIGTERM && p->main && units[p->unit->id].stubborn))
+        exit_at(now + 20000, pid, CLD_KILLED, sig);
+    return 0;
+}
+
+static int sim_watch(ServiceEntry *e, pid_t pid, int pidfd) {
+    (void)e;
+    (void)pid;
+    (void)pidfd;
+    return 0;
+}
+
+static const ServiceSpawner sim_spawner = { sim_spawn, sim_kill, sim_watch };
+
+// ──────────────
+// Events
+// ──────────────
+static void on_exit_event(const SimEvent *ev) {
+    pid_t pid = (pid_t)ev->arg;
+    Proc *p = proc_of(pid);
+    p->alive = 0;
+    record('X', (uint64_t)pid, (uint64_t)ev->status);
+    if (!service_manager_lookup(pid))
+        fail("PID %d of %s exited but is not supervised", pid, p->unit->name);
+
+    // Before reaping: a restart job spawns the next main process right inside it
+    SimUnit *su = &units[p->unit->id];
+    if (p->main) {
+        su->main_pid = 0;
+        su->up = 1;
+    }
+
+    siginfo_t si;
+    memset(&si, 0, sizeof(si));
+    si.si_pid = pid;
+    si.si_code = ev->code;
+    si.si_status = ev->status;
+    service_manager_reap(pid, &si);
+    if (service_manager_lookup(pid))
+        fail("PID %d of %s still supervised after exiting", pid, p->unit->name);
+
+    if (p->main && service_manager_state(p->unit) == SERVICE_AUTO_RESTART) {
+        su->failed_at = clock_now();
+        su->prompted = 0;
+    }
+}
+
+static void on_ready_event(const SimEvent *ev) {
+    Proc *p = proc_of((pid_t)ev->arg);
+    ServiceEntry *e = service_manager_lookup((pid_t)ev->arg);
+    if (!p->alive || !e || e->instance)
+        return;
+    record('R', ev->arg, 0);
+    service_manager_ready(e);
+    units[p->unit->id].up = 1;
+}
+
+static void on_instance_exit(ServiceEntry *e, void *userdata) {
+    (void)e;
+    (void)userdata;
+}
+
+static void on_event(const SimEvent *ev) {
+    uint64_t now = ev->usec;
+    SimUnit *su = ev->type >= EV_CONNECT ? &units[ev->arg] : NULL;
+    switch (ev->type) {
+        case EV_EXIT:
+            on_exit_event(ev);
+            break;
+        case EV_READY:
+            on_ready_event(ev);
+            break;
+        case EV_CONNECT:    // an Accept=yes connection: one instance each
+            spawning_instance = 1;
+            service_manager_start_instance(su->unit, -1, on_instance_exit, NULL);
+            spawning_instance = 0;
+            if (now < end_usec)
+                push(now + random_below(20 * USEC_PER_SEC), EV_CONNECT, ev->arg, 0, 0);
+            break;
+        case EV_ACTIVATE:   // Accept=no: traffic on the socket starts the service
+            su->prompted = 1;
+            job_enqueue(su->unit, JOB_START, NULL, NULL);
+            if (now < end_usec)
+                push(now + random_below(10 * 60 * USEC_PER_SEC), EV_ACTIVATE, ev->arg, 0, 0);
+            break;
+        case EV_RESTART: {  // an operator's coreinitctl restart
+            SimUnit *d = &units[daemons[random_below(n_daemons)]->id];
+            d->prompted = 1;
+            job_enqueue(d->unit, JOB_RESTART, NULL, NULL);
+            if (now < end_usec)
+                push(now + 10 * 60 * USEC_PER_SEC, EV_RESTART, ev->arg, 0, 0);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+// What service_manager says against what is really running
+static void check_states(void) {
+    for (size_t i = 0; i < n_units; i++) {
+        SimUnit *su = &units[i];
+        if (!su->unit || su->unit->type != UNIT_SERVICE)
+            continue;
+        ServiceState state = service_manager_state(su->unit);
+        const ServiceEntry *e = service_manager_entry(su->unit);
+        int running = state == SERVICE_STARTING || state == SERVICE_ACTIVE;
+        if (running && (!su->main_pid || e->pid != su->main_pid))
+            fail("%s is %s but its main process is not running", su->unit->name,
+                 state == SERVICE_ACTIVE ? "active" : "starting");
+        if (su->main_pid && !running && state != SERVICE_STOPPING)
+            fail("%s has PID %d running in state %d", su->unit->name, su->main_pid, state);
+    }
+    for (size_t i = 0; i < n_procs; i++)
+        if (procs[i].alive && !service_manager_lookup(PID_BASE + (pid_t)i))
+            fail("PID %d of %s is running unsupervised", PID_BASE + (int)i, procs[i].unit->name);
+    checks[3]++;
+}
+
+static void drain(void) {
+    while (sd_event_run(event, 0) > 0)
+        ;
+}
+
+// Next simulated event or timer, whichever is earlier, until both run dry or limit
+static void run_until(uint64_t limit) {
+    uint64_t next_sweep = clock_now() + HOUR;
+    for (;;) {
+        uint64_t t_timer = clock_next();
+        uint64_t t_event = heap_count ? heap[0].usec : UINT64_MAX;
+        uint64_t t = t_event <= t_timer ? t_event : t_timer;
+        if (t == UINT64_MAX || t > limit)
+            break;
+        if (t >= next_sweep) {
+            check_states();
+            next_sweep += HOUR;
+        }
+
+        uint64_t t0 = thread_nsec();
+        EventType type = EV_TIMER;
+        if (t_event <= t_timer) {
+            SimEvent ev = pop();
+            // Killed, and the exit it was going to make on its own is moot
+            if (ev.type == EV_EXIT && !proc_of((pid_t)ev.arg)->alive)
+                continue;
+            clock_advance(ev.usec);
+            type = ev.type;
+            on_event(&ev);
+        } else {
+            clock_run_next();
+        }
+        drain();
+        event_nsec[type] += thread_nsec() - t0;
+        events[type]++;
+    }
+    clock_advance(limit == UINT64_MAX ? clock_now() : limit);
+}
+
+// ──────────────
+// Start during stop
+// ──────────────
+typedef struct {
+    int stop_result, start_result;      // 1 until the job completes
+    unsigned starts_at_stop;            // spawns when the stop completed
+} StopStart;
+
+static void on_stop_done(Unit *u, JobType type, int result, void *userdata) {
+    (void)type;
+    StopStart *ss = userdata;
+    ss->stop_result = result;
+    ss->starts_at_stop = units[u->id].n_starts;
+}
+
+static void on_start_done(Unit *u, JobType type, int result, void *userdata) {
+    (void)type;
+    StopStart *ss = userdata;
+    ss->start_result = result;
+    if (ss->stop_result != 0)
+        fail("%s: start during stop completed before the stop (stop result %d)", u->name, ss->stop_result);
+    else if (units[u->id].n_starts == ss->starts_at_stop)
+        fail("%s: start during stop completed with %d but nothing was spawned", u->name, result);
+    else if (result == 0 && service_manager_state(u) != SERVICE_ACTIVE)
+        fail("%s: start during stop succeeded but the unit is in state %d", u->name, service_manager_state(u));
+}
+
+// Two active daemons: one gets its start while the stop is in progress, the
+// other while a second stop is still queued behind the first
+static void check_start_during_stop(void) {
+    StopStart ss[2] = { { 1, 1, 0 }, { 1, 1, 0 } };
+    Unit *picked[2];
+    size_t n = 0;
+    for (size_t i = 0; i < n_daemons && n < 2; i++)
+        if (service_manager_state(daemons[i]) == SERVICE_ACTIVE)
+            picked[n++] = daemons[i];
+    if (n < 2)
+        return;
+
+    for (size_t i = 0; i < 2; i++) {
+        units[picked[i]->id].prompted = 1;
+        job_enqueue(picked[i], JOB_STOP, on_stop_done, &ss[i]);
+    }
+    drain();
+    job_enqueue(picked[1], JOB_STOP, NULL, NULL);
+    for (size_t i = 0; i < 2; i++)
+        job_enqueue(picked[i], JOB_START, on_start_done, &ss[i]);
+    drain();
+    run_until(clock_now() + 10 * 60 * USEC_PER_SEC);
+    for (size_t i = 0; i < 2; i++) {
+        if (ss[i].start_result == 1)
+            fail("%s: start during stop never completed (stop result %d, state %d)", picked[i]->name,
+                 ss[i].stop_result, service_manager_state(picked[i]));
+        checks[4]++;
+    }
+}
+
+// ──────────────
+// Unit tree
+// ──────────────
+static void on_assignment(void *userdata, UnitSection section, const char *key, const char *val, unsigned line) {
+    (void)line;
+    unit_set_key(userdata, unit_key_lookup(section, key, strlen(key)), val);
+}
+
+static Unit *add_unit(SimKind kind, unsigned index, const char *fmt, ...) {
+    char name[64], text[1024];
+    static const char *const prefix[] = { "svc", "job", "web", "lazy" };
+    snprintf(name, sizeof(name), "%s%05u.service", prefix[kind], index);
+
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf(text, sizeof(text), fmt, ap);
+    va_end(ap);
+
+    Unit u, *ret;
+    unit_begin(&u, name);
+    unit_parse_buffer(text, (size_t)len, name, on_assignment, &u);
+    if (unit_finish(&u) < 0 || unit_registry_add(&u, &ret) < 0) {
+        fprintf(stderr, "Cannot load %s\n", name);
+        exit(1);
+    }
+    if (ret->id >= n_units) {
+        size_t n = n_units ? n_units : 64;
+        while (n <= ret->id) n *= 2;
+        if (!(units = realloc(units, n * sizeof(*units)))) {
+            perror("realloc");
+            exit(1);
+        }
+        memset(units + n_units, 0, (n - n_units) * sizeof(*units));
+        n_units = n;
+    }
+    units[ret->id] = (SimUnit){ .unit = ret, .kind = kind, .index = index };
+    return ret;
+}
+
+static void add_timer(unsigned index, uint64_t jitter) {
+    static const char *const spans[] = { "10s", "30s", "1min", "5min" };
+    char name[64], text[256];
+    snprintf(name, sizeof(name), "job%05u.timer", index);
+    int len = snprintf(text, sizeof(text), "[Timer]\nOnBootSec=%us\nOnUnitActiveSec=%s\n"
+                       "AccuracySec=1s\nRandomizedDelaySec=%llums\n", index % 60 + 1,
+                       spans[index % 4], (unsigned long long)(jitter / 1000));
+
+    Unit u, *ret;
+    unit_begin(&u, name);
+    unit_parse_buffer(text, (size_t)len, name, on_assignment, &u);
+    if (unit_finish(&u) < 0 || unit_registry_add(&u, &ret) < 0) {
+        fprintf(stderr, "Cannot load %s\n", name);
+        exit(1);
+    }
+}
+
+static void build_tree(unsigned services) {
+    static const uint64_t periods[] = { 10, 30, 60, 300 };
+    if (!(daemons = calloc(services, sizeof(*daemons)))) {
+        perror("calloc");
+        exit(1);
+    }
+    for (unsigned i = 0; i < services; i++) {
+        char after[64] = "";
+        if (i > 0)
+            snprintf(after, sizeof(after), "After=svc%05u.service\n", (i - 1) / 2);
+        int notify = i % 5 == 1, hangs = i % 50 == 11;
+        Unit *u = add_unit(KIND_DAEMON, i,
+                           "[Unit]\n%s[Service]\nExecStart=/bin/true\nType=%s\nTimeoutStartSec=2s\n"
+                           "TimeoutStopSec=5s\nRestart=on-failure\nRestartSec=100ms\nRestartMaxDelaySec=30s\n",
+                           after, notify ? "notify" : "simple");
+        SimUnit *su = &units[u->id];
+        su->notify = notify;
+        su->hangs = hangs;
+        su->stubborn = i % 17 == 3 && !hangs;   // see on_start_timeout: SIGTERM only
+        daemons[n_daemons++] = u;
+    }
+    for (unsigned i = 0; i < services / 4; i++) {
+        Unit *u = add_unit(KIND_JOB, i, "[Service]\nExecStart=/bin/true\n");
+        SimUnit *su = &units[u->id];
+        su->period = periods[i % 4] * USEC_PER_SEC;
+        su->jitter = i % 2 ? USEC_PER_SEC : 0;
+        su->next_fire = SIM_START + (i % 60 + 1) * USEC_PER_SEC;
+        add_timer(i, su->jitter);
+    }
+    for (unsigned i = 0; i < services / 10; i++) {
+        add_unit(KIND_WEB, i, "[Service]\nExecStart=/bin/cat\n");
+        add_unit(KIND_LAZY, i, "[Service]\nExecStart=/bin/true\n");
+    }
+}
+
+// ──────────────
+// Scenario
+// ──────────────
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+    (void)st;
+    (void)flag;
+    (void)ftw;
+    remove(path);
+    return 0;
+}
+
+// Returns the number of failed checks; *ret_hash identifies the event trace
+static unsigned long simulate(unsigned services, double hours, uint64_t seed, int report, uint64_t *ret_hash) {
+    // The boot trace lands in ./var/log/coreinitd: keep it out of the way
+    char dir[] = "/tmp/test-simulation.XXXXXX";
+    if (!mkdtemp(dir) || chdir(dir) < 0) {
+        perror("mkdtemp");
+        exit(1);
+    }
+    const char *level = getenv("COREINITD_LOG_LEVEL");
+    log_max_level = level && log_level_from_string(level) >= 0 ? (LogLevel)log_level_from_string(level)
+                                                                : LOG_LEVEL_ERROR;
+
+    rng = seed * 0x9e3779b97f4a7c15ULL | 1;
+    clock_virtual(SIM_START, seed);
+    service_manager_set_spawner(&sim_spawner);
+    if (sd_event_default(&event) < 0) {
+        fprintf(stderr, "No event loop\n");
+        exit(1);
+    }
+    build_tree(services);
+    end_usec = SIM_START + (uint64_t)(hours * HOUR);
+
+    struct timespec w0, w1;
+    clock_gettime(CLOCK_MONOTONIC, &w0);
+
+    if (scheduler_start(event) < 0 || timerd_start(event) < 0) {
+        fprintf(stderr, "Cannot start the scheduler or timers\n");
+        exit(1);
+    }
+    for (size_t i = 0; i < n_units; i++) {
+        SimUnit *su = &units[i];
+        if (su->unit && su->kind == KIND_WEB)
+            push(SIM_START + random_below(20 * USEC_PER_SEC), EV_CONNECT, (uint32_t)i, 0, 0);
+        else if (su->unit && su->kind == KIND_LAZY)
+            push(SIM_START + random_below(10 * 60 * USEC_PER_SEC), EV_ACTIVATE, (uint32_t)i, 0, 0);
+    }
+    push(SIM_START + 10 * 60 * USEC_PER_SEC, EV_RESTART, 0, 0, 0);
+    drain();
+    run_until(end_usec);
+    check_states();
+    check_start_during_stop();
+    for (size_t i = 0; i < n_daemons; i++)
+        if (!units[daemons[i]->id].started)
+            fail("%s never started", daemons[i]->name);
+
+    // Stop everything, the way shutdown does, and let it settle
+    timerd_stop();
+    for (size_t i = 0; i < unit_registry_count(); i++) {
+        Unit *u = unit_registry_get(i);
+        if (u->type == UNIT_SERVICE)
+            job_enqueue(u, JOB_STOP, NULL, NULL);
+    }
+    drain();
+    run_until(UINT64_MAX);
+    for (size_t i = 0; i < n_procs; i++)
+        if (procs[i].alive)
+            fail("PID %d of %s survived the stop", PID_BASE + (int)i, procs[i].unit->name);
+    for (size_t i = 0; i < unit_registry_count(); i++) {
+        Unit *u = unit_registry_get(i);
+        ServiceState state = u->type == UNIT_SERVICE ? service_manager_state(u) : SERVICE_INACTIVE;
+        if (state != SERVICE_INACTIVE && state != SERVICE_FAILED)
+            fail("%s is still in state %d after stopping", u->name, state);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &w1);
+
+    if (report) {
+        double wall = (w1.tv_sec - w0.tv_sec) + (w1.tv_nsec - w0.tv_nsec) / 1e9;
+        double simulated = (end_usec - SIM_START) / (double)USEC_PER_SEC;
+        unsigned long total = 0;
+        uint64_t total_nsec = 0;
+        for (int i = 0; i < _EV_MAX; i++) {
+            total += events[i];
+            total_nsec += event_nsec[i];
+        }
+        printf("%zu units, %zu processes: %.1f h simulated (and a full stop) in %.3f s (%.0fx)\n",
+               unit_registry_count(), n_procs, simulated / 3600, wall, simulated / wall);
+        printf("daemon CPU per event (includes the sd-event iteration):\n");
+        for (int i = 0; i < _EV_MAX; i++)
+            if (events[i])
+                printf("  %-9s %9lu events %8.2f us/event\n", event_names[i], events[i],
+                       event_nsec[i] / 1000.0 / events[i]);
+        printf("  %-9s %9lu events %8.2f us/event\n", "all", total, total ? total_nsec / 1000.0 / total : 0);
+        printf("checked: %lu boot orderings, %lu automatic restarts, %lu timer elapses, %lu state sweeps, "
+               "%lu starts during a stop\n", checks[0], checks[1], checks[2], checks[3], checks[4]);
+    }
+
+    nftw(dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    *ret_hash = trace_hash;
+    return failures;
+}
+
+int main(int argc, char *argv[]) {
+    unsigned services = argc > 1 ? (unsigned)atoi(argv[1]) : 200;
+    double hours = argc > 2 ? atof(argv[2]) : 24;
+    uint64_t seed = argc > 3 ? strtoull(argv[3], NULL, 0) : 1;
+    if (services < 1 || hours <= 0) {
+        fprintf(stderr, "Usage: %s [services] [hours] [seed]\n", argv[0]);
+        return 2;
+    }
+
+    // Each run in a fresh process: the daemon's modules keep global state
+    uint64_t hashes[2] = { 0, 0 };
+    int ok = 1;
+    for (int run = 0; run < 2; run++) {
+        int fds[2];
+        if (pipe(fds) < 0) {
+            perror("pipe");
+            return 1;
+        }
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            return 1;
+        }
+        if (pid == 0) {
+            close(fds[0]);
+            uint64_t hash;
+            unsigned long failed = simulate(services, hours, seed, run == 0, &hash);
+            if (write(fds[1], &hash, sizeof(hash)) != sizeof(hash))
+                _exit(1);
+            if (failed)
+                fprintf(stderr, "%lu checks failed\n", failed);
+            fflush(stdout);
+            _exit(failed ? 1 : 0);
+        }
+        close(fds[1]);
+        if (read(fds[0], &hashes[run], sizeof(hashes[run])) != sizeof(hashes[run]))
+            ok = 0;
+        close(fds[0]);
+        int status;
+        if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            ok = 0;
+        if (!ok)
+            break;
+    }
+    if (ok && hashes[0] != hashes[1]) {
+        fprintf(stderr, "FAIL: two runs with seed %llu diverged\n", (unsigned long long)seed);
+        ok = 0;
+    }
+    if (ok)
+        printf("deterministic: trace %016llx in both runs\n", (unsigned long long)hashes[0]);
+    return ok ? 0 : 1;
+}
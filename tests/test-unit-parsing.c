@@ -1,5 +1,189 @@
 #include "../src/coreinitd/unit_loader.h"
+#include "../src/coreinitd/unit_parser.h"
+#include "../src/coreinitd/util.h"
 #include <stdio.h>
+#include <stddef.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <string.h>
+
+static void on_assignment(void *userdata, UnitSection section, const char *key, const char *val, unsigned line) {
+    (void)line;
+    unit_set_key(userdata, unit_key_lookup(section, key, strlen(key)), val);
+}
+
+// Continuations, comments, odd whitespace and section-scoped keys
+static int test_parser(void) {
+    char buf[] =
+        "# comment\n"
+        "[Unit]\n"
+        "  description = Split \\\n"
+        "# ignored inside a continuation\n"
+        "    over lines  \r\n"
+        "ExecStart=/bin/false\n"
+        "no equals sign\n"
+        "[Service]\n"
+        "ExecStart=/bin/echo a\tb\n"
+        "ListenStream=1234\n"
+        "\n"
+        "[Socket]\n"
+        "ListenStream=1234\n"
+        "ListenStream=/run/a.sock";
+    char copy[sizeof(buf)];
+    memcpy(copy, buf, sizeof(buf));
+
+    // Settings of another unit type are dropped, so parse it as both
+    Unit svc, sock;
+    unit_begin(&svc, "test.service");
+    unit_begin(&sock, "test.socket");
+    int diagnostics = unit_parse_buffer(buf, strlen(buf), "test", on_assignment, &svc);
+    unit_parse_buffer(copy, strlen(copy), "test", on_assignment, &sock);
+    if (diagnostics != 1 ||
+        strcmp(svc.description, "Split over lines") != 0 ||
+        strcmp(svc.exec_start, "/bin/echo a\tb") != 0 ||
+        strcmp(sock.listen_stream, "1234 /run/a.sock") != 0) {
+        fprintf(stderr, "parser: diagnostics=%d description='%s' exec_start='%s' listen_stream='%s'\n",
+                diagnostics, svc.description, svc.exec_start, sock.listen_stream);
+        return 1;
+    }
+    // Interned: one copy of each distinct string
+    if (svc.description != sock.description) {
+        fprintf(stderr, "parser: equal descriptions not shared\n");
+        return 1;
+    }
+    return 0;
+}
+
+static int test_timespan(void) {
+    static const struct { const char *s; uint64_t usec; } ok[] = {
+        { "5", 5 * USEC_PER_SEC },
+        { "500ms", 500 * USEC_PER_MSEC },
+        { "1min 30s", 90 * USEC_PER_SEC },
+        { "1h30min", 5400 * USEC_PER_SEC },
+        { "2.5s", 2500 * USEC_PER_MSEC },
+        { " 1d ", 86400 * USEC_PER_SEC },
+        { "1.5555555ms", 1555 },
+        { "infinity", USEC_INFINITY },
+    };
+    static const char *bad[] = { "", "s", "5 parsecs", "-1s", "1.2.3s", "1e3s", "0x10" };
+    uint64_t v;
+
+    for (size_t i = 0; i < sizeof(ok) / sizeof(ok[0]); i++)
+        if (parse_timespan(ok[i].s, &v) < 0 || v != ok[i].usec) {
+            fprintf(stderr, "timespan: '%s' parsed wrong\n", ok[i].s);
+            return 1;
+        }
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++)
+        if (parse_timespan(bad[i], &v) >= 0) {
+            fprintf(stderr, "timespan: '%s' accepted\n", bad[i]);
+            return 1;
+        }
+    return 0;
+}
+
+static unsigned port_of(const struct sockaddr_storage *ss) {
+    if (ss->ss_family == AF_INET)
+        return ntohs(((const struct sockaddr_in *)ss)->sin_port);
+    if (ss->ss_family == AF_INET6)
+        return ntohs(((const struct sockaddr_in6 *)ss)->sin6_port);
+    return 0;
+}
+
+static int test_socket_address(void) {
+    static const struct { const char *s; int family; unsigned port; } ok[] = {
+        { "80", AF_INET6, 80 },
+        { "127.0.0.1:8080", AF_INET, 8080 },
+        { "[::1]:443", AF_INET6, 443 },
+        { "/run/foo.sock", AF_UNIX, 0 },
+        { "./run/foo.sock", AF_UNIX, 0 },
+        { "@abstract", AF_UNIX, 0 },
+    };
+    static const char *bad[] = { "", "0", "65536", "foo", "1.2.3:80", "[::1]80", "[::1]:", "127.0.0.1:x", "@" };
+    struct sockaddr_storage ss;
+    socklen_t len;
+
+    for (size_t i = 0; i < sizeof(ok) / sizeof(ok[0]); i++)
+        if (parse_socket_address(ok[i].s, &ss, &len) < 0 || ss.ss_family != ok[i].family || port_of(&ss) != ok[i].port) {
+            fprintf(stderr, "socket address: '%s' parsed wrong\n", ok[i].s);
+            return 1;
+        }
+    // Abstract names start with a NUL and are exactly as long as given
+    parse_socket_address("@abstract", &ss, &len);
+    if (((struct sockaddr_un *)&ss)->sun_path[0] != '\0' || len != offsetof(struct sockaddr_un, sun_path) + 9) {
+        fprintf(stderr, "socket address: abstract name wrong\n");
+        return 1;
+    }
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++)
+        if (parse_socket_address(bad[i], &ss, &len) >= 0) {
+            fprintf(stderr, "socket address: '%s' accepted\n", bad[i]);
+            return 1;
+        }
+    return 0;
+}
+
+// CPUAffinity=/NUMAMask= lists: ranges and commas, out-of-range CPUs refused
+static int test_cpu_list(void) {
+    unsigned long mask[1024 / (8 * sizeof(unsigned long))];
+    char buf[64];
+    static const char *bad[] = { "3-1", "x", "2000", "1-", "0,,x" };
+
+    memset(mask, 0, sizeof(mask));
+    if (parse_cpu_list("0-3 8,10", mask, 1024) < 0 || parse_cpu_list("9", mask, 1024) < 0) {
+        fprintf(stderr, "cpu list: valid list refused\n");
+        return 1;
+    }
+    format_cpu_list(mask, 1024, buf, sizeof(buf));
+    if (strcmp(buf, "0-3,8-10") != 0) {
+        fprintf(stderr, "cpu list: formatted as '%s'\n", buf);
+        return 1;
+    }
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++)
+        if (parse_cpu_list(bad[i], mask, 1024) >= 0) {
+            fprintf(stderr, "cpu list: '%s' accepted\n", bad[i]);
+            return 1;
+        }
+    return 0;
+}
+
+// Placement values the kernel would refuse never get as far as a spawn
+static int test_placement(void) {
+    char buf[] =
+        "[Service]\n"
+        "ExecStart=/bin/true\n"
+        "CPUAffinity=1-2\n"
+        "CPUAffinity=3-1\n"
+        "Nice=99\n";
+    char bad[] =
+        "[Service]\n"
+        "ExecStart=/bin/true\n"
+        "CPUAffinity=x\n";
+    char io_none[] =
+        "[Service]\n"
+        "ExecStart=/bin/true\n"
+        "IOSchedulingClass=none\n"
+        "IOSchedulingPriority=6\n";
+    Unit u, v, w;
+    unit_begin(&u, "placed.service");
+    unit_begin(&v, "bad.service");
+    unit_begin(&w, "io.service");
+    unit_parse_buffer(buf, strlen(buf), "test", on_assignment, &u);
+    unit_parse_buffer(bad, strlen(bad), "test", on_assignment, &v);
+    unit_parse_buffer(io_none, strlen(io_none), "test", on_assignment, &w);
+    if (!u.placement || !u.placement->has_cpus || u.placement->cpus[0] != 0x6 || u.placement->has_nice) {
+        fprintf(stderr, "placement: valid CPUAffinity= lost or invalid Nice= applied\n");
+        return 1;
+    }
+    if (v.placement && v.placement->has_cpus) {
+        fprintf(stderr, "placement: invalid CPUAffinity= applied\n");
+        return 1;
+    }
+    // The kernel refuses class none with any level but 0
+    if (unit_finish(&w) < 0 || !w.placement || w.placement->io_class != 0 || w.placement->io_priority != 0) {
+        fprintf(stderr, "placement: IOSchedulingClass=none kept a priority\n");
+        return 1;
+    }
+    return 0;
+}
 
 int main() {
     Unit u;
@@ -9,7 +193,7 @@ int main() {
     }
 
     printf("Name: %s\nExecStart: %s\nNotify: %s\n",
-        u.name, u.exec_start, u.notify_access);
+        u.name, u.exec_start, u.notify_access == NOTIFY_ACCESS_MAIN ? "main" : "other");
 
-    return 0;
+    return test_parser() || test_timespan() || test_socket_address() || test_cpu_list() || test_placement();
 }
@@ -1,4 +1,7 @@
 #!/bin/bash
-# Stub test script
-gcc -Isrc -o test-loader tests/test-unit-parsing.c src/coreinitd/unit_loader.c
-./test-loader
+# Stub test script; builds into a scratch directory so nothing lands in the tree
+B=$(mktemp -d) || exit 1
+trap 'rm -rf "$B"' EXIT
+gcc -o "$B/unit-keys-gen" src/coreinitd/unit_keys_gen.c && "$B/unit-keys-gen" "$B/unit_keys_hash.h" || exit 1
+gcc -Isrc -I"$B" -o "$B/test-loader" tests/test-unit-parsing.c src/coreinitd/unit_loader.c src/coreinitd/unit_parser.c src/coreinitd/strpool.c src/coreinitd/spawn.c src/coreinitd/util.c src/coreinitd/log.c -pthread || exit 1
+"$B/test-loader"